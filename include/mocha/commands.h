@@ -12,6 +12,10 @@ extern "C" {
 #define IPC_CUSTOM_START_USB_LOGGING      0xFA
 #define IPC_CUSTOM_COPY_ENVIRONMENT_PATH  0xF9
 #define IPC_CUSTOM_GET_MOCHA_API_VERSION  0xF8
+#define IPC_CUSTOM_BATCH                  0xF7
+
+// First mocha API version that may understand IPC_CUSTOM_BATCH.
+#define MOCHA_API_VERSION_BATCH 3
 
 typedef enum LoadRPXTargetEnum {
     LOAD_RPX_TARGET_SD_CARD = 0,
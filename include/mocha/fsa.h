@@ -1,6 +1,7 @@
 #pragma once
 
 #include <coreinit/filesystem.h>
+#include <coreinit/filesystem_fsa.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -61,6 +62,75 @@ FSError FSAEx_Unmount(FSClient *client, const char *mountedTarget, FSAUnmountFla
  */
 FSError FSAEx_UnmountEx(int clientHandle, const char *mountedTarget, FSAUnmountFlags flags);
 
+#define FSAEX_MOUNT_MAX_PATH_LENGTH 0x80
+
+typedef struct FSAExMountInfo {
+    char source[FSAEX_MOUNT_MAX_PATH_LENGTH];
+    char target[FSAEX_MOUNT_MAX_PATH_LENGTH];
+    FSAMountFlags flags;
+    uint32_t refCount; // Number of FSAEx_MountAcquire(Ex) calls that haven't been released yet.
+} FSAExMountInfo;
+
+/**
+ * Mounts a source via FSAEx_MountEx and tracks the mount in a reference counted registry. <br>
+ * If the same source is already mounted to the target with the same flags, only the reference count is increased
+ * and no request is sent. <br>
+ * The registry belongs to the library instance: every module that links libmocha has its own one, so modules only
+ * share the reference count of a mount if they go through the same instance. Mounts done by other modules are unknown.
+ * Sharing a target across modules is NOT handled: if two modules acquire the same target, the first one to release
+ * its last reference unmounts it while the other one may still use it. Such targets need to be coordinated by the
+ * modules themselves.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param source Mount source e.g. /dev/sdcard01
+ * @param target Mount target e.g. /vol/storage_sdcard01
+ * @param flags Mount flags
+ * @param arg_buf Mount argument buffer, only used for the first mount.
+ * @param arg_len Mount argument length
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_ALREADY_EXISTS if a different source or flags are registered for the target <br>
+ *         FS_ERROR_OUT_OF_RESOURCES if the registry is full <br>
+ *         or the error of FSAEx_MountEx.
+ */
+FSError FSAEx_MountAcquire(FSClient *client, const char *source, const char *target, FSAMountFlags flags, void *arg_buf, uint32_t arg_len);
+
+/**
+ * Mounts a source and tracks the mount in a reference counted registry. <br>
+ * See FSAEx_MountAcquire
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_MountAcquireEx(int clientHandle, const char *source, const char *target, FSAMountFlags flags, void *arg_buf, uint32_t arg_len);
+
+/**
+ * Releases a mount that was acquired via FSAEx_MountAcquire(Ex). The target is only unmounted when the last reference is released. <br>
+ * Unmounting a registered target directly via FSAEx_Unmount(Ex) drops it from the registry regardless of the reference count.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param target Mount target that was passed to FSAEx_MountAcquire(Ex).
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_NOT_FOUND if the target is not registered <br>
+ *         or the error of FSAEx_UnmountEx, the reference is kept in that case.
+ */
+FSError FSAEx_MountRelease(FSClient *client, const char *target);
+
+/**
+ * Releases a mount that was acquired via FSAEx_MountAcquire(Ex). <br>
+ * See FSAEx_MountRelease
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_MountReleaseEx(int clientHandle, const char *target);
+
+/**
+ * Lists the mounts of the registry of this library instance without sending any request.
+ *
+ * @param outMounts optional, array where up to maxCount mounts will be stored.
+ * @param maxCount size of outMounts.
+ * @return number of active mounts, which can be larger than maxCount.
+ */
+uint32_t FSAEx_GetActiveMounts(FSAExMountInfo *outMounts, uint32_t maxCount);
+
 /**
  * Opens a device for raw read/write
  * @param client valid FSClient pointer with unlocked permissions
@@ -80,7 +150,9 @@ FSError FSAEx_RawOpen(FSClient *client, char *device_path, int32_t *outHandle);
 FSError FSAEx_RawOpenEx(int clientHandle, char *device_path, int32_t *outHandle);
 
 /**
- * Closes a devices that was previously opened via FSAEx_RawOpen
+ * Closes a devices that was previously opened via FSAEx_RawOpen <br>
+ * Buffered writes and dirty cache blocks of the handle are written back first. If that fails, the handle is not closed
+ * and the error is returned.
  * @param client valid FSClient pointer with unlocked permissions
  * @param device_handle device handle
  * @return
@@ -99,7 +171,7 @@ FSError FSAEx_RawCloseEx(int clientHandle, int32_t device_handle);
  * Read data from a device handle.
  *
  * @param client valid FSClient pointer with unlocked permissions
- * @param data buffer where the result will be stored. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer where the result will be stored. Should be 0x40 aligned (buffer itself and buffer size) to avoid a bounce buffer, see FSAEx_RawSetMaxBounceSize.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be read.
  * @param blocks_offset read offset in sectors.
@@ -112,7 +184,7 @@ FSError FSAEx_RawRead(FSClient *client, void *data, uint32_t size_bytes, uint32_
  * Read data from a raw device handle.
  *
  * @param clientHandle valid /dev/fsa handle with unlocked permissions
- * @param data buffer where the result will be stored. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer where the result will be stored. Should be 0x40 aligned (buffer itself and buffer size) to avoid a bounce buffer, see FSAEx_RawSetMaxBounceSize.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be read.
  * @param blocks_offset read offset in sectors.
@@ -126,7 +198,7 @@ FSError FSAEx_RawReadEx(int clientHandle, void *data, uint32_t size_bytes, uint3
  * Write data to raw device handle
  *
  * @param client valid FSClient pointer with unlocked permissions
- * @param data buffer of data that should be written.. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer of data that should be written. Should be 0x40 aligned (buffer itself and buffer size) to avoid a bounce buffer, see FSAEx_RawSetMaxBounceSize.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be written.
  * @param blocks_offset write offset in sectors.
@@ -139,7 +211,7 @@ FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes,
  * Write data to raw device handle
  *
  * @param clientHandle valid /dev/fsa handle with unlocked permissions
- * @param data buffer of data that should be written.. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer of data that should be written. Should be 0x40 aligned (buffer itself and buffer size) to avoid a bounce buffer, see FSAEx_RawSetMaxBounceSize.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be written.
  * @param blocks_offset write offset in sectors.
@@ -148,6 +220,833 @@ FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes,
  */
 FSError FSAEx_RawWriteEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
 
+typedef struct FSAExRawAsyncResult {
+    FSError result;         // Result of the transfer.
+    int32_t device_handle;  // Device handle of the request.
+    void *data;             // Buffer of the request.
+    uint32_t size_bytes;    // Sector size of the request.
+    uint32_t cnt;           // Number of sectors of the request.
+    uint64_t blocks_offset; // Offset in sectors of the request.
+    void *userContext;      // userContext that was passed when submitting the request.
+} FSAExRawAsyncResult;
+
+/**
+ * Called once an async raw read/write has completed. <br>
+ * The callback is called from the IPC completion context and must not block. The result pointer is only valid during the callback.
+ */
+typedef void (*FSAExRawAsyncCallback)(const FSAExRawAsyncResult *result);
+
+/**
+ * Sets the max. number of async requests that can be in flight for a device handle at once. The default is 4. <br>
+ * Can only be changed while no async request is in flight for this handle.
+ *
+ * @param device_handle valid device handle.
+ * @param depth max. number of in flight requests, needs to be > 0.
+ * @return FS_ERROR_OK on success, FS_ERROR_BUSY if requests are in flight.
+ */
+FSError FSAEx_RawSetQueueDepth(int32_t device_handle, uint32_t depth);
+
+/**
+ * Submits a read from a raw device handle and returns without waiting for the result. <br>
+ * The completion is either reported via the callback or, if callback is NULL, queued for FSAEx_RawPollCompletion.
+ * All completions must have been reported/polled before the device handle is closed.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param data buffer where the result will be stored. Requires 0x40 alignment, needs to stay valid until the request has completed.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @param device_handle valid device handle.
+ * @param callback function that will be called on completion, NULL to queue the completion instead.
+ * @param userContext will be passed to the result.
+ * @return FS_ERROR_OK if the request has been submitted <br>
+ *         FS_ERROR_BUSY if the queue depth of the handle has been reached <br>
+ *         FS_ERROR_INVALID_ALIGNMENT if the buffer is not 0x40 aligned.
+ */
+FSError FSAEx_RawReadAsync(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext);
+
+/**
+ * Submits a read from a raw device handle and returns without waiting for the result. <br>
+ * See FSAEx_RawReadAsync
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawReadAsyncEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext);
+
+/**
+ * Submits a write to a raw device handle and returns without waiting for the result. <br>
+ * The completion is either reported via the callback or, if callback is NULL, queued for FSAEx_RawPollCompletion.
+ * All completions must have been reported/polled before the device handle is closed.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param data buffer of data that should be written. Requires 0x40 alignment, needs to stay valid until the request has completed.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors that should be written.
+ * @param blocks_offset write offset in sectors.
+ * @param device_handle valid device handle.
+ * @param callback function that will be called on completion, NULL to queue the completion instead.
+ * @param userContext will be passed to the result.
+ * @return FS_ERROR_OK if the request has been submitted <br>
+ *         FS_ERROR_BUSY if the queue depth of the handle has been reached <br>
+ *         FS_ERROR_INVALID_ALIGNMENT if the buffer is not 0x40 aligned.
+ */
+FSError FSAEx_RawWriteAsync(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext);
+
+/**
+ * Submits a write to a raw device handle and returns without waiting for the result. <br>
+ * See FSAEx_RawWriteAsync
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawWriteAsyncEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext);
+
+/**
+ * Takes the next completed async request (submitted without callback) of a device handle. <br>
+ * A waiting call still gets its result if the handle is closed meanwhile, FSAEx_RawCloseEx returns after it did.
+ *
+ * @param device_handle valid device handle.
+ * @param outResult pointer where the result will be stored.
+ * @param wait block until a request has completed.
+ * @return FS_ERROR_OK if a result was stored in outResult <br>
+ *         FS_ERROR_BUSY if wait is false and no request has completed yet <br>
+ *         FS_ERROR_NOT_FOUND if no request without callback is in flight or waiting to be polled.
+ */
+FSError FSAEx_RawPollCompletion(int32_t device_handle, FSAExRawAsyncResult *outResult, bool wait);
+
+typedef enum FSAExHashAlgorithm {
+    FSAEX_HASH_CRC32  = 1 << 0,
+    FSAEX_HASH_SHA1   = 1 << 1,
+    FSAEX_HASH_SHA256 = 1 << 2,
+} FSAExHashAlgorithm;
+
+typedef struct FSAExHashDigest {
+    uint32_t crc32;     // CRC32 (IEEE 802.3, as used by zip)
+    uint8_t sha1[20];   // SHA-1
+    uint8_t sha256[32]; // SHA-256
+} FSAExHashDigest;
+
+/**
+ * Called with the digest of every chunk of a hashed transfer. Chunks are passed in order. <br>
+ * This is called from the hasher thread, not the thread that started the transfer.
+ *
+ * @param blocks_offset first sector of the chunk.
+ * @param cnt number of sectors of the chunk.
+ * @param digest digests of the chunk, only the algorithms of FSAExRawHashParams::algorithms are set.
+ * @param userContext FSAExRawHashParams::userContext
+ */
+typedef void (*FSAExRawHashChunkCallback)(uint64_t blocks_offset, uint32_t cnt, const FSAExHashDigest *digest, void *userContext);
+
+typedef struct FSAExRawHashParams {
+    uint32_t algorithms;                     // FSAExHashAlgorithm flags.
+    uint32_t chunkSectors;                   // Sectors per chunk for FSAEx_RawReadHashed/FSAEx_RawWriteHashed. 0 for the default (FSAEx_RawAutotune result or 1 MiB). FSAEx_RawCopy hashes its own chunks.
+    FSAExRawHashChunkCallback chunkCallback; // Optional, per chunk digests are only computed if set.
+    void *userContext;                       // Passed to chunkCallback.
+    FSAExHashDigest *outDigest;              // Optional, receives the digest of the whole range if the transfer succeeded.
+} FSAExRawHashParams;
+
+typedef enum FSAExRawCopyDirection {
+    FSAEX_RAW_COPY_DEVICE_TO_FILE = 0,
+    FSAEX_RAW_COPY_FILE_TO_DEVICE = 1,
+} FSAExRawCopyDirection;
+
+/**
+ * Called by FSAEx_RawCopy to write (device to file) or read (file to device) the next chunk of the file.
+ *
+ * @param buffer data of the chunk (device to file) or buffer where the chunk needs to be stored (file to device).
+ * @param size size of the chunk in bytes.
+ * @param offset offset of the chunk in bytes, relative to FSAExRawCopyParams::firstSector. Chunks are passed in order.
+ * @param userContext FSAExRawCopyParams::userContext
+ * @return number of bytes that have been transferred, anything other than size aborts the copy.
+ */
+typedef int32_t (*FSAExRawCopyFileCallback)(void *buffer, uint32_t size, uint64_t offset, void *userContext);
+
+/**
+ * Called by FSAEx_RawCopy after each completed chunk.
+ * @return false to abort the copy.
+ */
+typedef bool (*FSAExRawCopyProgressCallback)(uint64_t sectorsDone, uint64_t sectorsTotal, void *userContext);
+
+typedef struct FSAExRawCopyParams {
+    FSAExRawCopyDirection direction;
+    int fd;                                        // File descriptor of the file (e.g. from open()), only used if fileCallback is NULL.
+    FSAExRawCopyFileCallback fileCallback;         // Optional, replaces the reads/writes on fd.
+    uint32_t sectorSize;                           // Size of a sector in bytes.
+    uint64_t firstSector;                          // First sector of the device range, maps to offset 0 of the file.
+    uint64_t sectorCount;                          // Number of sectors of the device range.
+    uint64_t resumeSector;                         // First sector that will be copied. Set to firstSector to copy the full range.
+    uint32_t chunkSectors;                         // Number of sectors per transfer. 0 for the default (FSAEx_RawAutotune result or 1 MiB).
+    uint32_t bufferCount;                          // Number of rotating buffers (max. 16). 0 for the default (3).
+    FSAExRawCopyProgressCallback progressCallback; // Optional
+    void *userContext;                             // Passed to the callbacks.
+    const FSAExRawHashParams *hashParams;          // Optional, hashes the copied data while the transfers are in flight. Set to NULL if unused.
+} FSAExRawCopyParams;
+
+/**
+ * Copies a sector range of a raw device into a file or from a file into a raw device. <br>
+ * The device transfers are done asynchronously into a set of rotating 0x40 aligned buffers, so the device I/O
+ * overlaps with the file I/O. The queue depth of the handle (FSAEx_RawSetQueueDepth) should be >= bufferCount. <br>
+ * When resumeSector is not firstSector and fd is used, the file position is moved to the matching offset before copying. <br>
+ * With hashParams every chunk is hashed on a separate core while the next transfers are in flight. The digests only
+ * cover the sectors from resumeSector on.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param params parameters of the copy.
+ * @param outNextSector optional, first sector that has not been copied (yet). Can be used as resumeSector to continue after an error.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_CANCELLED if the progress callback returned false <br>
+ *         FS_ERROR_STORAGE_FULL / FS_ERROR_END_OF_FILE if the file could not be written/read <br>
+ *         FS_ERROR_BUSY if other requests kept every slot of the async queue of the handle busy for a second <br>
+ *         or the error of the failed device transfer.
+ */
+FSError FSAEx_RawCopy(FSClient *client, int device_handle, const FSAExRawCopyParams *params, uint64_t *outNextSector);
+
+/**
+ * Copies a sector range of a raw device into a file or from a file into a raw device. <br>
+ * See FSAEx_RawCopy
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawCopyEx(int clientHandle, int device_handle, const FSAExRawCopyParams *params, uint64_t *outNextSector);
+
+typedef struct FSAExRawExtent {
+    uint64_t blocks_offset; // Read offset in sectors.
+    uint32_t cnt;           // Number of sectors that should be read.
+    void *data;             // Buffer where the sectors will be stored. Doesn't need to be aligned.
+    FSError result;         // Set by FSAEx_RawReadV to the result of the read of this extent.
+} FSAExRawExtent;
+
+/**
+ * Reads many (non-contiguous) extents of a raw device with as few requests as possible. <br>
+ * The extents are sorted by offset and adjacent, overlapping or nearly adjacent extents are merged into a single
+ * request. Merged extents are read into an aligned scratch buffer and copied into place, unless their buffers are
+ * 0x40 aligned and contiguous in which case they are read directly. Extents larger than 512 KiB that can't be read
+ * directly go through the scratch buffer in pieces of at most 512 KiB. Extents with a cnt of 0 don't cause a read.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param size_bytes size of sector.
+ * @param extents array of extents to read. The result of every extent is stored in its result field.
+ * @param extentCount number of extents.
+ * @param device_handle valid device handle.
+ * @return FS_ERROR_OK if all extents have been read, otherwise the first error that occurred.
+ */
+FSError FSAEx_RawReadV(FSClient *client, uint32_t size_bytes, FSAExRawExtent *extents, uint32_t extentCount, int device_handle);
+
+/**
+ * Reads many (non-contiguous) extents of a raw device with as few requests as possible. <br>
+ * See FSAEx_RawReadV
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawReadVEx(int clientHandle, uint32_t size_bytes, FSAExRawExtent *extents, uint32_t extentCount, int device_handle);
+
+typedef enum FSAExRawCachePolicy {
+    FSAEX_RAW_CACHE_WRITE_THROUGH = 0, // Writes go to the device immediately, cached blocks are updated.
+    FSAEX_RAW_CACHE_WRITE_BACK    = 1, // Writes only update the cache, dirty blocks are written on eviction or flush.
+} FSAExRawCachePolicy;
+
+typedef struct FSAExRawCache FSAExRawCache;
+
+typedef struct FSAExRawCacheStats {
+    uint32_t hits;        // Block lookups that were served from the cache.
+    uint32_t misses;      // Block lookups that had to go to the device. Hit rate is hits / (hits + misses).
+    uint32_t evictions;   // Blocks that had to be evicted to make room.
+    uint32_t writebacks;  // Dirty blocks that have been written to the device.
+    uint32_t dirtyBlocks; // Currently dirty blocks.
+} FSAExRawCacheStats;
+
+/**
+ * Creates a LRU block cache in front of a raw device handle. <br>
+ * The cache keeps up to blockCount blocks of blockSectors sectors in 0x40 aligned memory. Writes that bypass the cache
+ * on the same device handle (FSAEx_RawWriteEx, FSAEx_RawWriteAsyncEx, FSAEx_RawCopyEx) invalidate overlapping blocks,
+ * reads that bypass it (FSAEx_RawReadEx, FSAEx_RawReadVEx, FSAEx_RawReadAsyncEx, FSAEx_RawCopyEx and
+ * FSAEx_RawReadParallelEx of the same device) write back overlapping dirty blocks first. Only one cache can exist per
+ * device handle. Closing the device handle flushes the cache, if that fails the handle stays open and the error is
+ * returned. The cache still needs to be destroyed via FSAEx_RawCacheDestroy.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param blockSectors number of sectors per cache block.
+ * @param blockCount max. number of cached blocks.
+ * @param policy write policy of the cache.
+ * @param outCache pointer where the cache will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_ALREADY_EXISTS if the device handle already has a cache.
+ */
+FSError FSAEx_RawCacheCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t blockSectors, uint32_t blockCount, FSAExRawCachePolicy policy, FSAExRawCache **outCache);
+
+/**
+ * Reads sectors through the cache. Reads that are at least half the size of the cache bypass it.
+ *
+ * @param cache cache created via FSAEx_RawCacheCreate
+ * @param data buffer where the result will be stored. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawCacheRead(FSAExRawCache *cache, void *data, uint32_t cnt, uint64_t blocks_offset);
+
+/**
+ * Writes sectors through the cache according to the write policy of the cache.
+ *
+ * @param cache cache created via FSAEx_RawCacheCreate
+ * @param data buffer of data that should be written. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be written.
+ * @param blocks_offset write offset in sectors.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawCacheWrite(FSAExRawCache *cache, const void *data, uint32_t cnt, uint64_t blocks_offset);
+
+/**
+ * Writes all dirty blocks to the device.
+ */
+FSError FSAEx_RawCacheFlush(FSAExRawCache *cache);
+
+/**
+ * Writes all dirty blocks to the device and drops all cached blocks.
+ */
+FSError FSAEx_RawCacheInvalidate(FSAExRawCache *cache);
+
+/**
+ * Returns the hit/miss/eviction counters of a cache.
+ */
+void FSAEx_RawCacheGetStats(FSAExRawCache *cache, FSAExRawCacheStats *outStats);
+
+/**
+ * Flushes and frees a cache.
+ * @return FS_ERROR_OK on success. If writing back the dirty blocks fails, the cache is NOT freed and the error is returned.
+ */
+FSError FSAEx_RawCacheDestroy(FSAExRawCache *cache);
+
+typedef struct FSAExRawWriteBuffer FSAExRawWriteBuffer;
+
+typedef struct FSAExRawWriteBufferStats {
+    uint32_t writes;          // Number of FSAEx_RawWriteBufferWrite calls.
+    uint32_t coalescedWrites; // Writes that were merged into an already buffered run.
+    uint32_t flushes;         // Number of requests that were sent to the device.
+    uint64_t flushedSectors;  // Number of sectors that were written to the device by flushes.
+} FSAExRawWriteBufferStats;
+
+/**
+ * Creates a write buffer for a raw device handle that coalesces small writes. <br>
+ * Adjacent and overlapping writes are gathered into up to 4 aligned runs of at most maxRunSize bytes, each run is
+ * written with a single request once it is full, when it has to make room for a new run, on
+ * FSAEx_RawWriteBufferFlush/FSAEx_RawWriteBufferDestroy or before the device handle is closed. <br>
+ * FSAEx_RawReadEx/FSAEx_RawWriteEx calls on the same device handle write back overlapping buffered data first, so
+ * reads always see the latest data. Only one write buffer can exist per device handle.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param maxRunSize max. size of a buffered run in bytes, 4x this size will be allocated.
+ * @param outWriteBuffer pointer where the write buffer will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_ALREADY_EXISTS if the device handle already has a write buffer.
+ */
+FSError FSAEx_RawWriteBufferCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t maxRunSize, FSAExRawWriteBuffer **outWriteBuffer);
+
+/**
+ * Buffers a write. Writes of at least maxRunSize bytes are written directly.
+ *
+ * @param writeBuffer write buffer created via FSAEx_RawWriteBufferCreate
+ * @param data buffer of data that should be written. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be written.
+ * @param blocks_offset write offset in sectors.
+ * @return FS_ERROR_OK on success, or the error of a flush that was triggered by this write.
+ */
+FSError FSAEx_RawWriteBufferWrite(FSAExRawWriteBuffer *writeBuffer, const void *data, uint32_t cnt, uint64_t blocks_offset);
+
+/**
+ * Reads from the device of a write buffer. Buffered writes that overlap the range are flushed first.
+ *
+ * @param writeBuffer write buffer created via FSAEx_RawWriteBufferCreate
+ * @param data buffer where the result will be stored. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawWriteBufferRead(FSAExRawWriteBuffer *writeBuffer, void *data, uint32_t cnt, uint64_t blocks_offset);
+
+/**
+ * Writes all buffered data to the device.
+ */
+FSError FSAEx_RawWriteBufferFlush(FSAExRawWriteBuffer *writeBuffer);
+
+/**
+ * Returns the counters of a write buffer.
+ */
+void FSAEx_RawWriteBufferGetStats(FSAExRawWriteBuffer *writeBuffer, FSAExRawWriteBufferStats *outStats);
+
+/**
+ * Flushes and frees a write buffer.
+ * @return FS_ERROR_OK on success. If the flush fails, the write buffer is NOT freed and the error is returned.
+ */
+FSError FSAEx_RawWriteBufferDestroy(FSAExRawWriteBuffer *writeBuffer);
+
+/**
+ * Enables adaptive read-ahead for a raw device handle. <br>
+ * Once FSAEx_RawRead(Ex) calls on the handle are sequential, or skip the same number of sectors every time, the
+ * following sectors are prefetched in the background into 0x40 aligned buffers and later reads are served from there
+ * via memcpy. The prefetch window starts at 4x the size of the reads, doubles every time a prefetched window was used
+ * completely (up to maxWindowSize), halves if the reads skipped parts of it and collapses on random access. Writes to
+ * the handle drop overlapping prefetched data. <br>
+ * Prefetches are submitted to the async queue of the handle and count against its queue depth. <br>
+ * Must not be called while other threads are using the device handle.
+ *
+ * @param device_handle valid device handle.
+ * @param maxWindowSize max. size of a prefetch in bytes. Twice this size will be allocated. 0 disables the read-ahead.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawSetReadAhead(int32_t device_handle, uint32_t maxWindowSize);
+
+/**
+ * Finds a good transfer size for a device with a short benchmark. <br>
+ * Reads 4 MiB (starting at sector 0, about 4 MiB * number of probed sizes in total) with transfer sizes from 16 KiB up
+ * to maxTransferSize, doubling each step, and picks the smallest size that reaches 95% of the best throughput. The result
+ * is cached per device path (e.g. "/dev/mlc01"), FSAEx_RawCopy(Ex) and FSAEx_RawReadParallel(Ex) use it as their
+ * default transfer size. <br>
+ * The device handle must have been opened via FSAEx_RawOpen(Ex).
+ *
+ * @param client valid FSClient with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param maxTransferSize max. transfer size in bytes, a buffer of this size will be allocated. 0 = default (4 MiB)
+ * @param outTransferSize where the chosen transfer size in bytes will be stored.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawAutotune(FSClient *client, int32_t device_handle, uint32_t size_bytes, uint32_t maxTransferSize, uint32_t *outTransferSize);
+
+/**
+ * Finds a good transfer size for a device with a short benchmark. <br>
+ * See FSAEx_RawAutotune for details.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param maxTransferSize max. transfer size in bytes, a buffer of this size will be allocated. 0 = default (4 MiB)
+ * @param outTransferSize where the chosen transfer size in bytes will be stored.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawAutotuneEx(int clientHandle, int32_t device_handle, uint32_t size_bytes, uint32_t maxTransferSize, uint32_t *outTransferSize);
+
+/**
+ * Returns the transfer size that was determined by FSAEx_RawAutotune(Ex) for a device path, or 0 if the device hasn't
+ * been tuned yet.
+ */
+uint32_t FSAEx_RawGetTunedTransferSize(const char *device_path);
+
+/**
+ * Reads a large range of sectors using several /dev/fsa clients in parallel. <br>
+ * The range is split into stripes which are read by up to maxWorkers workers (the calling thread and helper threads).
+ * Each helper gets its own client handle, unlocked via Mocha_UnlockFSClientEx, and opens the device on its own, so
+ * the number of helpers is capped by the number of clients mocha is able to unlock. Stripes are handed out by dynamic
+ * self-scheduling: every idle worker claims the next unread stripe from a shared counter, so slow stripes don't hold
+ * up the other workers. Data is read directly into the destination buffer.
+ * <br>
+ * Requires an initialized library (Mocha_InitLibrary), otherwise only the calling thread is used.
+ *
+ * @param client valid FSClient with unlocked permissions
+ * @param device_path path of the device, e.g. "/dev/mlc01". Opened once per worker.
+ * @param data buffer where the result will be stored. Must be 0x40 aligned.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @param maxWorkers max. number of workers including the calling thread. 0 = default (8)
+ * @param stripeSize size of a stripe in bytes. 0 = default (FSAEx_RawAutotune result or 1 MiB). Rounded down to whole sectors, must keep stripes 0x40 aligned.
+ * @return FS_ERROR_OK on success, otherwise the first error that occurred.
+ */
+FSError FSAEx_RawReadParallel(FSClient *client, const char *device_path, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, uint32_t maxWorkers, uint32_t stripeSize);
+
+/**
+ * Reads a large range of sectors using several /dev/fsa clients in parallel. <br>
+ * See FSAEx_RawReadParallel for details.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_path path of the device, e.g. "/dev/mlc01". Opened once per worker.
+ * @param data buffer where the result will be stored. Must be 0x40 aligned.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @param maxWorkers max. number of workers including the calling thread. 0 = default (8)
+ * @param stripeSize size of a stripe in bytes. 0 = default (FSAEx_RawAutotune result or 1 MiB).
+ * @return FS_ERROR_OK on success, otherwise the first error that occurred.
+ */
+FSError FSAEx_RawReadParallelEx(int clientHandle, const char *device_path, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, uint32_t maxWorkers, uint32_t stripeSize);
+
+typedef struct FSAExRawImageWriter FSAExRawImageWriter;
+typedef struct FSAExRawImageReader FSAExRawImageReader;
+
+typedef struct FSAExRawImageStats {
+    uint32_t holeBlocks;       // All-zero blocks, nothing was stored for them.
+    uint32_t compressedBlocks; // Blocks that were stored compressed.
+    uint32_t rawBlocks;        // Blocks that didn't compress and were stored as is.
+    uint64_t storedBytes;      // Size of the stored block data (without header and index).
+} FSAExRawImageStats;
+
+/**
+ * Creates a writer for a sparse, compressed image container (e.g. for device dumps). <br>
+ * The data is split into blocks. All-zero blocks are only recorded as holes in the index, all other blocks are
+ * compressed with a fast LZ codec (or stored as is if they don't compress). An index at the end of the container
+ * allows random reads via FSAEx_RawImageReaderRead. <br>
+ * The container starts at the current position of fd, fd must be seekable and must not be used otherwise until
+ * FSAEx_RawImageWriterFinish.
+ *
+ * @param fd file descriptor (e.g. from open()) the container will be written to.
+ * @param blockSize size of a block in bytes, max. 1 MiB. 0 = default (64 KiB)
+ * @param outWriter where the writer will be stored.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawImageWriterCreate(int fd, uint32_t blockSize, FSAExRawImageWriter **outWriter);
+
+/**
+ * Appends data to the image.
+ * @return FS_ERROR_OK on success. Once a write failed, the writer only returns that error.
+ */
+FSError FSAEx_RawImageWriterWrite(FSAExRawImageWriter *writer, const void *data, uint32_t size);
+
+/**
+ * FSAExRawCopyFileCallback that appends to an image writer, pass the writer as userContext of FSAEx_RawCopy(Ex) to dump
+ * a device directly into a container (FSAEX_RAW_COPY_DEVICE_TO_FILE).
+ */
+int32_t FSAEx_RawImageWriterFileCallback(void *buffer, uint32_t size, uint64_t offset, void *userContext);
+
+/**
+ * Returns how the blocks written so far have been stored.
+ */
+void FSAEx_RawImageWriterGetStats(FSAExRawImageWriter *writer, FSAExRawImageStats *outStats);
+
+/**
+ * Writes the remaining data, the index and the header and frees the writer. The writer must not be used afterwards,
+ * even if an error is returned.
+ * @return FS_ERROR_OK on success.
+ */
+FSError FSAEx_RawImageWriterFinish(FSAExRawImageWriter *writer);
+
+/**
+ * Opens an image container that was written via FSAEx_RawImageWriterCreate. <br>
+ * The container has to start at the current position of fd. Only the index is read on open.
+ *
+ * @param fd file descriptor (e.g. from open()) of the container.
+ * @param outReader where the reader will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_MEDIA_ERROR if the container is invalid.
+ */
+FSError FSAEx_RawImageReaderOpen(int fd, FSAExRawImageReader **outReader);
+
+/**
+ * Returns the size of the image data in bytes.
+ */
+uint64_t FSAEx_RawImageReaderGetSize(FSAExRawImageReader *reader);
+
+/**
+ * Reads image data at an arbitrary offset, holes read as zeros.
+ * @return FS_ERROR_OK on success, FS_ERROR_OUT_OF_RANGE if the range exceeds the image, FS_ERROR_MEDIA_ERROR if the container is corrupt.
+ */
+FSError FSAEx_RawImageReaderRead(FSAExRawImageReader *reader, void *data, uint64_t offset, uint32_t size);
+
+/**
+ * Frees the reader. The file descriptor is not closed.
+ */
+void FSAEx_RawImageReaderClose(FSAExRawImageReader *reader);
+
+/**
+ * Reads sectors of a raw device and hashes them without a second pass over the data. <br>
+ * The range is read in chunks of hashParams->chunkSectors, every chunk is hashed on a separate core while the next
+ * chunk is read.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param data buffer where the sectors will be stored. Doesn't need to be aligned.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param blocks_offset read offset in sectors.
+ * @param device_handle valid device handle.
+ * @param hashParams algorithms and destinations of the digests.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_OUT_OF_RESOURCES if the hasher thread could not be created <br>
+ *         or the error of the failed read.
+ */
+FSError FSAEx_RawReadHashed(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams);
+
+/**
+ * Reads sectors of a raw device and hashes them without a second pass over the data. <br>
+ * See FSAEx_RawReadHashed
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawReadHashedEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams);
+
+/**
+ * Writes sectors to a raw device and hashes the written data. <br>
+ * The range is written in chunks of hashParams->chunkSectors, every chunk is hashed on a separate core while it is written.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param data data that will be written. Doesn't need to be aligned.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param blocks_offset write offset in sectors.
+ * @param device_handle valid device handle.
+ * @param hashParams algorithms and destinations of the digests.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_OUT_OF_RESOURCES if the hasher thread could not be created <br>
+ *         or the error of the failed write.
+ */
+FSError FSAEx_RawWriteHashed(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams);
+
+/**
+ * Writes sectors to a raw device and hashes the written data. <br>
+ * See FSAEx_RawWriteHashed
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawWriteHashedEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams);
+
+/**
+ * Reads sectors of a raw device with a shim buffer that is owned by the caller, so no shim buffer is taken from the pool. <br>
+ * Keeps the write buffer and block cache of the handle coherent like FSAEx_RawReadEx, but neither bounces nor uses the
+ * read-ahead window. Used by the RAII wrapper in mocha/raw_device.hpp, which keeps one shim buffer per device.
+ *
+ * @param shim 0x40 aligned shim buffer, may be reused for any number of calls but not concurrently.
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param data 0x40 aligned buffer where the sectors will be stored.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param blocks_offset read offset in sectors.
+ * @param device_handle valid device handle.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_INVALID_ALIGNMENT if shim or data isn't 0x40 aligned <br>
+ *         or the error of the read.
+ */
+FSError FSAEx_RawReadWithShimEx(FSAShimBuffer *shim, int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+/**
+ * Writes sectors to a raw device with a shim buffer that is owned by the caller. <br>
+ * See FSAEx_RawReadWithShimEx
+ *
+ * @param data 0x40 aligned data that will be written.
+ */
+FSError FSAEx_RawWriteWithShimEx(FSAShimBuffer *shim, int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+typedef struct FSAExRawDevoptabConfig {
+    const char *name;       // Name of the devoptab device without ':', e.g. "rawsd" for "rawsd:".
+    const char *devicePath; // Raw device, e.g. /dev/sdcard01
+    uint32_t sectorSize;    // Size of a sector in bytes.
+    uint64_t sectorCount;   // Size of the device in sectors, reported by stat/fstat and used for SEEK_END. 0 if unknown.
+    uint32_t bufferSize;    // Size of the buffer of every stream in bytes. 0 for the default (FSAEx_RawAutotune result or 1 MiB).
+    bool readOnly;          // Rejects opening the device for writing.
+} FSAExRawDevoptabConfig;
+
+/**
+ * Registers a newlib devoptab device that exposes a raw device as a seekable file, e.g. fopen("rawsd:", "rb"). <br>
+ * Every stream opens its own device handle and has a 0x40 aligned buffer of whole sectors. Byte granular reads, writes
+ * and seeks are served from the buffer, large sector aligned transfers go directly to the device. Partial sector
+ * writes are merged into the buffer and written back on fflush/fsync/fclose or when the buffer moves. <br>
+ * The device gets its own unlocked FSA client, so Mocha_InitLibrary needs to be called before.
+ *
+ * @param config configuration of the device, the strings are copied.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_ALREADY_EXISTS if a device with this name is already registered <br>
+ *         FS_ERROR_OUT_OF_RESOURCES if too many devices are registered <br>
+ *         FS_ERROR_MAX_CLIENTS / FS_ERROR_NOT_INIT if no unlocked client could be created <br>
+ *         FS_ERROR_MAX_MOUNT_POINTS if newlib has no free device slot.
+ */
+FSError FSAEx_RawDevoptabAdd(const FSAExRawDevoptabConfig *config);
+
+/**
+ * Unregisters a device that was registered via FSAEx_RawDevoptabAdd.
+ *
+ * @param name name of the device without ':'
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_BUSY if a stream of the device is still open <br>
+ *         FS_ERROR_NOT_FOUND if no device with this name is registered.
+ */
+FSError FSAEx_RawDevoptabRemove(const char *name);
+
+typedef struct FSAExCancelToken {
+    volatile uint32_t cancelled; // Set to a non-zero value (from any thread) to abort the transfer before the next chunk.
+} FSAExCancelToken;
+
+typedef struct FSAExRawDeadlineParams {
+    int64_t deadline;              // OSTime (OSGetSystemTime) after which no further chunk is started. 0 for no deadline.
+    FSAExCancelToken *cancelToken; // Optional
+    uint32_t chunkSectors;         // Sectors per chunk. 0 for the default (FSAEx_RawAutotune result, at most 128 KiB).
+} FSAExRawDeadlineParams;
+
+/**
+ * Reads sectors of a raw device in chunks and stops before the next chunk once the deadline has passed or the cancel
+ * token has been set. A chunk that is already in flight is never aborted, so the time spent after the deadline is
+ * bounded by the latency of a single chunk (see FSAEx_RawGetLatencyStats).
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param data buffer where the sectors will be stored. Doesn't need to be aligned.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param blocks_offset read offset in sectors.
+ * @param device_handle valid device handle.
+ * @param params deadline, cancel token and chunk size.
+ * @param outSectorsDone optional, number of sectors that have been read from the start of the range.
+ * @return FS_ERROR_OK if all sectors have been read <br>
+ *         FS_ERROR_BUSY if the deadline has passed <br>
+ *         FS_ERROR_CANCELLED if the cancel token has been set <br>
+ *         or the error of the failed read.
+ */
+FSError FSAEx_RawReadDeadline(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone);
+
+/**
+ * Reads sectors of a raw device with a deadline. <br>
+ * See FSAEx_RawReadDeadline
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawReadDeadlineEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone);
+
+/**
+ * Writes sectors to a raw device in chunks with a deadline. <br>
+ * See FSAEx_RawReadDeadline
+ *
+ * @param outSectorsDone optional, number of sectors that have been written from the start of the range.
+ */
+FSError FSAEx_RawWriteDeadline(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone);
+
+/**
+ * Writes sectors to a raw device with a deadline. <br>
+ * See FSAEx_RawReadDeadline
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawWriteDeadlineEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone);
+
+typedef struct FSAExRawLatencyStats {
+    uint32_t samples; // Number of recorded transfers.
+    uint32_t p50Us;   // Latency percentiles in microseconds, accurate to 25%.
+    uint32_t p90Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+} FSAExRawLatencyStats;
+
+/**
+ * Returns the latency percentiles of the synchronous transfers (single request round trips) of a device handle since
+ * it was opened or FSAEx_RawResetLatencyStats was called. Useful to pick deadlines and chunk sizes for
+ * FSAEx_RawReadDeadline/FSAEx_RawWriteDeadline.
+ *
+ * @param device_handle valid device handle.
+ * @param outStats where the percentiles will be stored.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_INVALID_FILEHANDLE if the library has no state for the handle.
+ */
+FSError FSAEx_RawGetLatencyStats(int32_t device_handle, FSAExRawLatencyStats *outStats);
+
+/**
+ * Clears the latency histogram of a device handle.
+ */
+FSError FSAEx_RawResetLatencyStats(int32_t device_handle);
+
+typedef struct FSAExRawScheduler FSAExRawScheduler;
+
+typedef enum FSAExRawPriority {
+    FSAEX_RAW_PRIORITY_HIGH   = 0,
+    FSAEX_RAW_PRIORITY_NORMAL = 1,
+    FSAEX_RAW_PRIORITY_LOW    = 2,
+    FSAEX_RAW_PRIORITY_COUNT  = 3,
+} FSAExRawPriority;
+
+typedef struct FSAExRawSchedulerStats {
+    uint32_t requests;       // Number of requests that were queued.
+    uint32_t dispatches;     // Number of transfers that were sent to the device.
+    uint32_t mergedRequests; // Requests that were served by the transfer of another request.
+    uint32_t queueDepth;     // Requests that are currently waiting to be dispatched.
+    uint32_t maxQueueDepth;  // Highest queueDepth so far.
+} FSAExRawSchedulerStats;
+
+/**
+ * Creates an I/O scheduler for a raw device handle. <br>
+ * Requests of all threads are queued per priority class and dispatched by a single worker thread, each caller only
+ * blocks until its own request is done. Within a class the worker serves requests in ascending sector order starting
+ * at the end of the previous transfer, wrapping around at the end (C-SCAN). Higher classes are preferred, but after 8
+ * transfers in a row one request of the next waiting class is served. <br>
+ * Before a request is dispatched, queued requests of the same direction from any class are merged into it: reads that
+ * touch or overlap it and writes that are adjacent to it, as long as the merged range fits in maxMergeSize bytes. <br>
+ * While the scheduler exists, FSAEx_RawReadEx/FSAEx_RawWriteEx calls on the device handle with the same sector size are
+ * queued with FSAEX_RAW_PRIORITY_NORMAL. Requests of different threads can complete in any order, callers that need
+ * ordering have to wait for the previous request. Only one scheduler can exist per device handle.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param maxMergeSize max. size of a merged transfer in bytes, a buffer of this size will be allocated. Pass 0 to use
+ *                     the size determined by FSAEx_RawAutotune or 1 MiB.
+ * @param outScheduler pointer where the scheduler will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_ALREADY_EXISTS if the device handle already has a scheduler.
+ */
+FSError FSAEx_RawSchedulerCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t maxMergeSize, FSAExRawScheduler **outScheduler);
+
+/**
+ * Queues a read and waits until it has been done.
+ *
+ * @param scheduler scheduler created via FSAEx_RawSchedulerCreate
+ * @param data buffer where the result will be stored. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be read.
+ * @param blocks_offset read offset in sectors.
+ * @param priority priority class of the request.
+ * @return FS_ERROR_OK on success, FS_ERROR_INVALID_PARAM if the device handle of the scheduler has been closed,
+ *         FS_ERROR_BUSY while it is being closed.
+ */
+FSError FSAEx_RawSchedulerRead(FSAExRawScheduler *scheduler, void *data, uint32_t cnt, uint64_t blocks_offset, FSAExRawPriority priority);
+
+/**
+ * Queues a write and waits until it has been done.
+ *
+ * @param scheduler scheduler created via FSAEx_RawSchedulerCreate
+ * @param data buffer of data that should be written. Doesn't need to be aligned.
+ * @param cnt number of sectors that should be written.
+ * @param blocks_offset write offset in sectors.
+ * @param priority priority class of the request.
+ * @return FS_ERROR_OK on success, FS_ERROR_INVALID_PARAM if the device handle of the scheduler has been closed,
+ *         FS_ERROR_BUSY while it is being closed.
+ */
+FSError FSAEx_RawSchedulerWrite(FSAExRawScheduler *scheduler, const void *data, uint32_t cnt, uint64_t blocks_offset, FSAExRawPriority priority);
+
+/**
+ * Returns the counters of a scheduler. The merge ratio is mergedRequests / requests.
+ */
+void FSAEx_RawSchedulerGetStats(FSAExRawScheduler *scheduler, FSAExRawSchedulerStats *outStats);
+
+/**
+ * Waits for all queued requests, stops the worker thread and frees a scheduler. Must be called after the device handle
+ * has been closed as well.
+ */
+void FSAEx_RawSchedulerDestroy(FSAExRawScheduler *scheduler);
+
+/**
+ * Limits the size of the bounce buffer that is used when FSAEx_RawRead(Ex)/FSAEx_RawWrite(Ex) are called with a buffer
+ * that is not 0x40 aligned. <br>
+ * Unaligned reads are done directly into the aligned interior of the given buffer and moved into place, only the
+ * remaining sectors are read through the bounce buffer. Unaligned writes are copied through the bounce buffer in chunks
+ * of at most maxBounceSize bytes. <br>
+ * The default limit is 128 KiB.
+ *
+ * @param device_handle valid device handle.
+ * @param maxBounceSize max size of the bounce buffer in bytes. At least one sector is always bounced at once.
+ *                      0 restores the old behaviour of bouncing the whole transfer at once.
+ * @return FS_ERROR_OK on success, FS_ERROR_OUT_OF_RESOURCES if too many device handles are tracked.
+ */
+FSError FSAEx_RawSetMaxBounceSize(int32_t device_handle, uint32_t maxBounceSize);
+
+typedef struct FSAExShimPoolStats {
+    uint32_t hits;   // Number of FSAShimBuffers that were served from the pool.
+    uint32_t misses; // Number of FSAShimBuffers that had to be allocated.
+} FSAExShimPoolStats;
+
+/**
+ * Returns the hit/miss counters of the FSAShimBuffer pool that is used by all FSAEx_* functions.
+ * In a steady state every call should be a hit, misses mean the library had to allocate a new buffer.
+ *
+ * @param outStats pointer where the counters will be stored.
+ */
+void FSAEx_GetShimPoolStats(FSAExShimPoolStats *outStats);
+
+/**
+ * Resets the hit/miss counters of the FSAShimBuffer pool.
+ */
+void FSAEx_ResetShimPoolStats();
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
\ No newline at end of file
@@ -19,16 +19,55 @@ typedef enum MochaUtilsStatus {
 } MochaUtilsStatus;
 
 /**
- * Initializes the mocha lib. Needs to be called before any other functions can be used
+ * Initializes the mocha lib. Needs to be called before any other functions can be used. <br>
+ * Checks the API version of the loaded mocha and determines which commands it supports, see Mocha_GetCapabilities.
  * @return MOCHA_RESULT_SUCCESS: Library has been successfully initialized <br>
- *         MOCHA_RESULT_UNSUPPORTED_COMMAND: Failed to initialize the library caused by an outdated mocha version.
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: Failed to initialize the library caused by an outdated mocha version. <br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: Failed to open /dev/mcp. <br>
+ *         The library stays uninitialized on error.
  */
 MochaUtilsStatus Mocha_InitLibrary();
 
+/**
+ * Deinitializes the mocha lib and closes the /dev/mcp handle that is shared by all commands.
+ * @return MOCHA_RESULT_SUCCESS
+ */
 MochaUtilsStatus Mocha_DeInitLibrary();
 
+typedef enum MochaCapability {
+    MOCHA_CAPABILITY_ENVIRONMENT_PATH   = 1 << 0,
+    MOCHA_CAPABILITY_RPX_HOOK_COMPLETED = 1 << 1,
+    MOCHA_CAPABILITY_START_MCP_THREAD   = 1 << 2,
+    MOCHA_CAPABILITY_START_USB_LOGGING  = 1 << 3,
+    MOCHA_CAPABILITY_UNLOCK_FS_CLIENT   = 1 << 4,
+    MOCHA_CAPABILITY_LOAD_RPX           = 1 << 5,
+    MOCHA_CAPABILITY_ODM_DISC_KEY       = 1 << 6,
+    MOCHA_CAPABILITY_SEEPROM            = 1 << 7,
+    MOCHA_CAPABILITY_BATCH              = 1 << 8, // Mocha_BatchSubmit sends all commands in a single request
+} MochaCapability;
+
 /**
- * Retrieves the API Version of the running mocha.
+ * Returns the commands that are supported by the loaded mocha version as a combination of MochaCapability bits. <br>
+ * The capabilities are determined once by Mocha_InitLibrary.
+ * @param outCapabilities Where the capabilities will be stored
+ * @return MOCHA_RESULT_SUCCESS: The capabilities have been stored in outCapabilities <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid outCapabilities pointer <br>
+ *         MOCHA_RESULT_LIB_UNINITIALIZED: Library was not initialized. Call Mocha_InitLibrary() before using this function.
+ */
+MochaUtilsStatus Mocha_GetCapabilities(uint32_t *outCapabilities);
+
+/**
+ * Drops all results the library has cached, the next calls will query mocha again. <br>
+ * Affects Mocha_GetEnvironmentPath and the SEEPROM snapshot (see Mocha_SEEPROMGetSnapshot).
+ * @return MOCHA_RESULT_SUCCESS <br>
+ *         MOCHA_RESULT_LIB_UNINITIALIZED: Library was not initialized. Call Mocha_InitLibrary() before using this function.
+ */
+MochaUtilsStatus Mocha_InvalidateCache();
+
+/**
+ * Retrieves the API Version of the running mocha. <br>
+ * Uses the shared /dev/mcp handle of the library. Before Mocha_InitLibrary, or if the loaded mocha rejects the query on
+ * that handle, a read only handle is opened for this call only.
  *
  * @param outVersion pointer to the variable where the version will be stored.
  *
@@ -39,7 +78,8 @@ MochaUtilsStatus Mocha_DeInitLibrary();
 MochaUtilsStatus Mocha_CheckAPIVersion(uint32_t *outVersion);
 
 /***
- * Returns the path of the currently loaded environment
+ * Returns the path of the currently loaded environment. The path is only requested from mocha once, later calls are
+ * served from a cached copy (see Mocha_InvalidateCache).
  * @param environmentPathBuffer: buffer where the result will be stored
  * @param bufferLen: length of the buffer. Required to be >= 0x100
 * @return MOCHA_RESULT_SUCCESS: The environment path has been stored in environmentPathBuffer<br>
@@ -103,14 +143,286 @@ MochaUtilsStatus Mocha_UnlockFSClientEx(int clientHandle);
 
 MochaUtilsStatus Mocha_LoadRPXOnNextLaunch(MochaRPXLoadInfo *loadInfo);
 
+#define MOCHA_BATCH_MAX_COMMANDS 8
+
+typedef struct MochaBatchCommand {
+    uint32_t command;        // IPC_CUSTOM_* command
+    uint32_t minApiVersion;  // The command is skipped with MOCHA_RESULT_UNSUPPORTED_COMMAND on older mocha versions
+    const void *in;          // Arguments of the command, may be NULL
+    uint32_t inLen;          // Size of the arguments in bytes
+    void *out;               // Where the response will be stored, may be NULL
+    uint32_t outLen;         // Size of the response in bytes
+    uint32_t inlineArg;      // Storage for small arguments, used by the Mocha_BatchAdd* helpers
+    MochaUtilsStatus result; // Result of the command, set by Mocha_BatchSubmit
+} MochaBatchCommand;
+
+typedef struct MochaCommandBatch {
+    uint32_t count;
+    MochaBatchCommand commands[MOCHA_BATCH_MAX_COMMANDS];
+} MochaCommandBatch;
+
+/**
+ * Prepares an empty batch of custom mocha commands.
+ */
+void Mocha_BatchInit(MochaCommandBatch *batch);
+
+/**
+ * Adds a custom command to a batch. The in and out buffers have to stay valid until Mocha_BatchSubmit returns.
+ * @return MOCHA_RESULT_SUCCESS: The command has been added <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid batch pointer or the batch is full.
+ */
+MochaUtilsStatus Mocha_BatchAdd(MochaCommandBatch *batch, uint32_t command, uint32_t minApiVersion, const void *in, uint32_t inLen, void *out, uint32_t outLen);
+
+/**
+ * Batched version of Mocha_CheckAPIVersion.
+ */
+MochaUtilsStatus Mocha_BatchAddCheckAPIVersion(MochaCommandBatch *batch, uint32_t *outVersion);
+
+/**
+ * Batched version of Mocha_GetEnvironmentPath. environmentPathBuffer needs to be at least 0x100 bytes.
+ */
+MochaUtilsStatus Mocha_BatchAddGetEnvironmentPath(MochaCommandBatch *batch, char *environmentPathBuffer, uint32_t bufferLen);
+
+/**
+ * Batched version of Mocha_StartMCPThread.
+ */
+MochaUtilsStatus Mocha_BatchAddStartMCPThread(MochaCommandBatch *batch);
+
+/**
+ * Batched version of Mocha_RPXHookCompleted.
+ */
+MochaUtilsStatus Mocha_BatchAddRPXHookCompleted(MochaCommandBatch *batch);
+
+/**
+ * Batched version of Mocha_StartUSBLogging.
+ */
+MochaUtilsStatus Mocha_BatchAddStartUSBLogging(MochaCommandBatch *batch, bool avoidLogCatchup);
+
+/**
+ * Batched version of Mocha_LoadRPXOnNextLaunch. loadInfo has to stay valid until Mocha_BatchSubmit returns.
+ */
+MochaUtilsStatus Mocha_BatchAddLoadRPXOnNextLaunch(MochaCommandBatch *batch, MochaRPXLoadInfo *loadInfo);
+
+/**
+ * Sends all commands of a batch to mocha. <br>
+ * If the loaded mocha version supports it, all commands are sent in a single request, otherwise they are sent one by
+ * one. The commands are executed in the order they were added, the result of each command is stored in its result
+ * field. If the single request fails, every command of it is marked as failed. They are not sent again one by one,
+ * some of them may have been executed already.
+ * @return MOCHA_RESULT_SUCCESS: All commands succeeded <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid batch pointer <br>
+ *         MOCHA_RESULT_LIB_UNINITIALIZED: Library was not initialized. Call Mocha_InitLibrary() before using this function.<br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: At least one command failed, see the result of each command.
+ */
+MochaUtilsStatus Mocha_BatchSubmit(MochaCommandBatch *batch);
+
 typedef struct WUDDiscKey {
     uint8_t key[0x10];
 } WUDDiscKey;
 
 MochaUtilsStatus Mocha_ODMGetDiscKey(WUDDiscKey *discKey);
 
+#define MOCHA_SEEPROM_SIZE 0x200
+
+typedef struct MochaSEEPROMSnapshot {
+    // Incremented every time the SEEPROM is read from the hardware, allows detecting whether the data has been refreshed.
+    uint32_t version;
+    uint8_t data[MOCHA_SEEPROM_SIZE];
+} MochaSEEPROMSnapshot;
+
+/**
+ * Copies the whole SEEPROM into the given snapshot. <br>
+ * The SEEPROM is only read from the hardware on the first call (or the first call after Mocha_InitLibrary), later calls
+ * are served from a cached copy unless refresh is set. <br>
+ * Requires Mocha API Version: 1
+ * @param snapshot Where the snapshot will be stored
+ * @param refresh Read the SEEPROM from the hardware again instead of using the cached copy
+ * @return MOCHA_RESULT_SUCCESS: The snapshot has been stored in snapshot <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid snapshot pointer <br>
+ *         MOCHA_RESULT_LIB_UNINITIALIZED: Library was not initialized. Call Mocha_InitLibrary() before using this function.<br>
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: Command not supported by the currently loaded mocha version.<br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: Failed to read the SEEPROM.
+ */
+MochaUtilsStatus Mocha_SEEPROMGetSnapshot(MochaSEEPROMSnapshot *snapshot, bool refresh);
+
+/**
+ * Reads from the SEEPROM. The data is served from the cached snapshot, see Mocha_SEEPROMGetSnapshot. <br>
+ * Requires Mocha API Version: 1
+ * @param out_buffer Where the data will be stored
+ * @param offset Offset in bytes, needs to be 2 byte aligned
+ * @param size Size in bytes, only whole 16-bit words are read
+ * @param refresh Read the SEEPROM from the hardware again instead of using the cached copy
+ * @return Number of bytes read on success <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid out_buffer pointer or offset <br>
+ *         MOCHA_RESULT_LIB_UNINITIALIZED: Library was not initialized. Call Mocha_InitLibrary() before using this function.<br>
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: Command not supported by the currently loaded mocha version.<br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: Failed to read the SEEPROM.
+ */
+MochaUtilsStatus Mocha_SEEPROMReadEx(uint8_t *out_buffer, uint32_t offset, uint32_t size, bool refresh);
+
+/**
+ * Same as Mocha_SEEPROMReadEx with refresh set to false.
+ */
 MochaUtilsStatus Mocha_SEEPROMRead(uint8_t *out_buffer, uint32_t offset, uint32_t size);
 
+/**
+ * Reads a 16-bit value from the cached SEEPROM snapshot.
+ * @param offset Offset in bytes, needs to be 2 byte aligned
+ * @return MOCHA_RESULT_SUCCESS on success, see Mocha_SEEPROMReadEx for errors.
+ */
+MochaUtilsStatus Mocha_SEEPROMReadU16(uint32_t offset, uint16_t *outValue);
+
+/**
+ * Reads a 32-bit value from the cached SEEPROM snapshot.
+ * @param offset Offset in bytes, needs to be 2 byte aligned
+ * @return MOCHA_RESULT_SUCCESS on success, see Mocha_SEEPROMReadEx for errors.
+ */
+MochaUtilsStatus Mocha_SEEPROMReadU32(uint32_t offset, uint32_t *outValue);
+
+typedef struct MochaImageBackendDevice {
+    const char *devicePath; // Path that is passed to FSAEx_RawOpen, e.g. "/dev/mlc01"
+    const char *imagePath;  // Image file that backs the device
+    bool readOnly;          // Reject FSAEx_RawWrite calls to this device
+} MochaImageBackendDevice;
+
+typedef struct MochaImageBackendConfig {
+    uint32_t apiVersion;                    // Version reported by Mocha_CheckAPIVersion
+    const char *environmentPath;            // Path returned by Mocha_GetEnvironmentPath, may be NULL
+    const char *seepromImagePath;           // 0x200 byte SEEPROM dump, may be NULL (SEEPROM reads will fail)
+    const MochaImageBackendDevice *devices; // Raw devices that can be opened via FSAEx_RawOpen
+    uint32_t deviceCount;
+} MochaImageBackendConfig;
+
+/**
+ * Serves all requests that would normally go to IOSU from files instead. <br>
+ * Raw devices are backed by image files, the custom mocha commands (API version, environment path, RPX loading) and
+ * SEEPROM reads are answered from the given config. This allows running (and profiling) code that uses the library
+ * without a console. <br>
+ * Must be called before Mocha_InitLibrary. All paths are copied.
+ * @param config Description of the emulated system
+ * @return MOCHA_RESULT_SUCCESS: The image backend is now active <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid config or the SEEPROM image could not be read <br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: Out of memory.
+ */
+MochaUtilsStatus Mocha_UseImageBackend(const MochaImageBackendConfig *config);
+
+/**
+ * Switches back to real IOSU (the default) and closes all files of the image backend.
+ * @return MOCHA_RESULT_SUCCESS
+ */
+MochaUtilsStatus Mocha_UseIOSUBackend();
+
+/**
+ * Returns the load info of the last Mocha_LoadRPXOnNextLaunch call that was handled by the image backend.
+ * @return MOCHA_RESULT_SUCCESS: The load info has been stored in outLoadInfo <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid outLoadInfo pointer <br>
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: The image backend is not active <br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: No RPX has been loaded yet.
+ */
+MochaUtilsStatus Mocha_ImageBackendGetRPXLoadInfo(MochaRPXLoadInfo *outLoadInfo);
+
+typedef enum MochaStatsEntry {
+    MOCHA_STATS_MCP_IOCTL,            // Every command sent to mocha via /dev/mcp
+    MOCHA_STATS_SEEPROM_READ,         // Mocha_SEEPROMRead(Ex)
+    MOCHA_STATS_UNLOCK_FS_CLIENT,     // Mocha_UnlockFSClient(Ex)
+    MOCHA_STATS_FSA_MOUNT,            // FSAEx_Mount(Ex)
+    MOCHA_STATS_FSA_UNMOUNT,          // FSAEx_Unmount(Ex)
+    MOCHA_STATS_FSA_RAW_OPEN,         // FSAEx_RawOpen(Ex)
+    MOCHA_STATS_FSA_RAW_CLOSE,        // FSAEx_RawClose(Ex)
+    MOCHA_STATS_FSA_RAW_READ,         // FSAEx_RawRead(Ex), including cache/write buffer/read-ahead handling
+    MOCHA_STATS_FSA_RAW_WRITE,        // FSAEx_RawWrite(Ex), including cache/write buffer/read-ahead handling
+    MOCHA_STATS_FSA_RAW_READ_IPC,     // Raw reads that were actually sent to the device
+    MOCHA_STATS_FSA_RAW_WRITE_IPC,    // Raw writes that were actually sent to the device
+    MOCHA_STATS_FSA_RAW_ASYNC_SUBMIT, // FSAEx_RawReadAsync(Ex)/FSAEx_RawWriteAsync(Ex), latency is the submission only
+    MOCHA_STATS_FSA_RAW_READV,        // FSAEx_RawReadV(Ex)
+    MOCHA_STATS_FSA_RAW_COPY,         // FSAEx_RawCopy(Ex)
+    MOCHA_STATS_ENTRY_COUNT,
+} MochaStatsEntry;
+
+// Bucket i counts calls that took less than 2^i microseconds, the last bucket counts everything slower.
+#define MOCHA_STATS_LATENCY_BUCKETS 24
+
+typedef struct MochaStatsEntryCounters {
+    uint32_t calls;
+    uint64_t bytes;
+    uint64_t totalLatencyUs;
+    uint32_t latencyHistogram[MOCHA_STATS_LATENCY_BUCKETS];
+} MochaStatsEntryCounters;
+
+typedef struct MochaStats {
+    MochaStatsEntryCounters entries[MOCHA_STATS_ENTRY_COUNT];
+    uint32_t bounceCopies; // Number of copies between a caller buffer and a bounce buffer (or within an unaligned buffer).
+    uint64_t bounceBytes;  // Number of bytes copied by these copies.
+    uint32_t allocations;  // Number of buffers that had to be allocated on the I/O paths (e.g. shim pool misses, bounce buffers).
+} MochaStats;
+
+/**
+ * Returns the instrumentation counters of the library. <br>
+ * Only available if the library was built with MOCHA_ENABLE_STATS (make MOCHA_STATS=1), otherwise the
+ * instrumentation is not compiled in at all. The counters are kept per core and summed up by this function.
+ * @param outStats Where the counters will be stored
+ * @return MOCHA_RESULT_SUCCESS: The counters have been stored in outStats <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: invalid outStats pointer <br>
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: The library was built without instrumentation.
+ */
+MochaUtilsStatus Mocha_GetStats(MochaStats *outStats);
+
+/**
+ * Resets all instrumentation counters.
+ * @return MOCHA_RESULT_SUCCESS or MOCHA_RESULT_UNSUPPORTED_COMMAND if the library was built without instrumentation.
+ */
+MochaUtilsStatus Mocha_ResetStats();
+
+#define MOCHA_DIAG_MESSAGE_LENGTH 0x78
+
+typedef struct MochaDiagMessage {
+    uint64_t time;                        // OSTime when the message was posted.
+    uint32_t repeatCount;                 // Number of identical messages that were posted after this one and merged into it.
+    char text[MOCHA_DIAG_MESSAGE_LENGTH]; // Message without trailing newline, truncated if it was longer.
+} MochaDiagMessage;
+
+typedef struct MochaDiagStats {
+    uint32_t posted;      // Messages that have been queued.
+    uint32_t merged;      // Messages that were merged into an identical queued message.
+    uint32_t rateLimited; // Messages that were discarded because too many were posted within a second.
+    uint32_t dropped;     // Messages that were discarded because the ring was full.
+} MochaDiagStats;
+
+typedef void (*MochaDiagCallback)(const MochaDiagMessage *message, void *userContext);
+
+/**
+ * Diagnostics of the library (e.g. warnings about unaligned raw I/O buffers) don't call OSReport on the I/O paths.
+ * They are queued in a fixed size lock-free ring instead, so posting never blocks and never allocates.
+ * Identical consecutive messages are merged and the number of messages per second is limited. <br>
+ * This function passes all queued messages to the callback in the order they were posted. It may be called from any
+ * thread, concurrent calls are serialized.
+ * @param callback Called for every message. NULL to print the messages via OSReport.
+ * @param userContext Passed to the callback.
+ * @return Number of messages that have been drained.
+ */
+uint32_t Mocha_DiagDrain(MochaDiagCallback callback, void *userContext);
+
+/**
+ * Starts a low priority thread that calls Mocha_DiagDrain periodically.
+ * @param intervalMs Interval between two drains in milliseconds.
+ * @param callback Passed to Mocha_DiagDrain, NULL to print the messages via OSReport.
+ * @param userContext Passed to the callback.
+ * @return MOCHA_RESULT_SUCCESS: The thread is running (or was already running) <br>
+ *         MOCHA_RESULT_INVALID_ARGUMENT: intervalMs is 0 <br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: The thread could not be created.
+ */
+MochaUtilsStatus Mocha_DiagStartDrainThread(uint32_t intervalMs, MochaDiagCallback callback, void *userContext);
+
+/**
+ * Stops the thread that was started by Mocha_DiagStartDrainThread after draining the remaining messages.
+ */
+void Mocha_DiagStopDrainThread();
+
+/**
+ * Returns the counters of the diagnostic ring.
+ */
+void Mocha_DiagGetStats(MochaDiagStats *outStats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,152 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "mocha/raw_device.hpp requires C++20"
+#endif
+
+#include "fsa.h"
+#include <coreinit/filesystem.h>
+#include <coreinit/filesystem_fsa.h>
+#include <cstddef>
+#include <cstdint>
+#include <malloc.h>
+#include <span>
+#include <utility>
+
+namespace mocha {
+
+/**
+ * A single sector of SectorSize bytes. <br>
+ * The type is 0x40 aligned and SectorSize is a multiple of 0x40, so any array or std::span of sectors is a valid
+ * buffer for a raw transfer without runtime alignment checks or bounce buffers.
+ */
+template <std::uint32_t SectorSize>
+struct alignas(0x40) RawSector {
+    static_assert(SectorSize > 0 && SectorSize % 0x40 == 0, "SectorSize must be a non-zero multiple of 0x40");
+
+    std::byte data[SectorSize];
+};
+
+/**
+ * Movable owner of a raw device handle, closed on destruction. <br>
+ * Every object keeps its own shim buffer that is reused for all transfers, so reads and writes don't allocate. An
+ * object must not be used by multiple threads at the same time.
+ *
+ * Example:
+ * @code
+ * mocha::RawDevice<512> sd;
+ * std::array<mocha::RawSector<512>, 64> sectors;
+ * if (sd.Open(clientHandle, "/dev/sdcard01") == FS_ERROR_OK) {
+ *     sd.Read(0, sectors);
+ * }
+ * @endcode
+ */
+template <std::uint32_t SectorSize>
+class RawDevice {
+public:
+    using Sector = RawSector<SectorSize>;
+    static_assert(sizeof(Sector) == SectorSize);
+
+    static constexpr std::uint32_t kSectorSize = SectorSize;
+
+    RawDevice() = default;
+
+    RawDevice(const RawDevice &)            = delete;
+    RawDevice &operator=(const RawDevice &) = delete;
+
+    RawDevice(RawDevice &&other) noexcept
+        : mClientHandle(std::exchange(other.mClientHandle, -1)),
+          mDeviceHandle(std::exchange(other.mDeviceHandle, -1)),
+          mShim(std::exchange(other.mShim, nullptr)) {}
+
+    RawDevice &operator=(RawDevice &&other) noexcept {
+        if (this != &other) {
+            Close();
+            free(mShim);
+            mClientHandle = std::exchange(other.mClientHandle, -1);
+            mDeviceHandle = std::exchange(other.mDeviceHandle, -1);
+            mShim         = std::exchange(other.mShim, nullptr);
+        }
+        return *this;
+    }
+
+    ~RawDevice() {
+        Close();
+        free(mShim);
+    }
+
+    /**
+     * Opens a device, a previously opened device of this object is closed first.
+     * @param clientHandle valid /dev/fsa handle with unlocked permissions, needs to stay valid until the device is closed.
+     * @param devicePath path of the device. e.g. /dev/sdcard01
+     */
+    FSError Open(int clientHandle, const char *devicePath) {
+        Close();
+        if (!mShim) {
+            mShim = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+            if (!mShim) {
+                return FS_ERROR_OUT_OF_RESOURCES;
+            }
+        }
+        int32_t handle = -1;
+        auto res       = FSAEx_RawOpenEx(clientHandle, const_cast<char *>(devicePath), &handle);
+        if (res == FS_ERROR_OK) {
+            mClientHandle = clientHandle;
+            mDeviceHandle = handle;
+        }
+        return res;
+    }
+
+    FSError Open(FSClient *client, const char *devicePath) {
+        if (!client) {
+            return FS_ERROR_INVALID_CLIENTHANDLE;
+        }
+        return Open(FSGetClientBody(client)->clientHandle, devicePath);
+    }
+
+    /**
+     * Closes the device. Does nothing if no device is open.
+     */
+    FSError Close() {
+        if (mDeviceHandle < 0) {
+            return FS_ERROR_OK;
+        }
+        auto res      = FSAEx_RawCloseEx(mClientHandle, std::exchange(mDeviceHandle, -1));
+        mClientHandle = -1;
+        return res;
+    }
+
+    /**
+     * Reads sectors.size() sectors starting at the given sector.
+     */
+    FSError Read(std::uint64_t sector, std::span<Sector> sectors) {
+        if (mDeviceHandle < 0) {
+            return FS_ERROR_INVALID_FILEHANDLE;
+        }
+        return FSAEx_RawReadWithShimEx(mShim, mClientHandle, sectors.data(), SectorSize, sectors.size(), sector, mDeviceHandle);
+    }
+
+    /**
+     * Writes sectors.size() sectors starting at the given sector.
+     */
+    FSError Write(std::uint64_t sector, std::span<const Sector> sectors) {
+        if (mDeviceHandle < 0) {
+            return FS_ERROR_INVALID_FILEHANDLE;
+        }
+        return FSAEx_RawWriteWithShimEx(mShim, mClientHandle, sectors.data(), SectorSize, sectors.size(), sector, mDeviceHandle);
+    }
+
+    [[nodiscard]] bool IsOpen() const { return mDeviceHandle >= 0; }
+
+    /**
+     * The raw device handle, for the C functions of mocha/fsa.h. The object keeps the ownership.
+     */
+    [[nodiscard]] int32_t GetHandle() const { return mDeviceHandle; }
+
+private:
+    int mClientHandle     = -1;
+    int32_t mDeviceHandle = -1;
+    FSAShimBuffer *mShim  = nullptr;
+};
+
+} // namespace mocha
@@ -0,0 +1,30 @@
+#pragma once
+#include "utils.h"
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/ios.h>
+#include <stdint.h>
+
+/**
+ * Replacement for the IOSU side of the library. <br>
+ * When gMochaBackend is set, every request that would normally reach IOSU (custom /dev/mcp commands, FSA requests via
+ * the FSA shim, bspRead) is handed to it instead. nullptr (the default) means real hardware.
+ */
+struct MochaBackend {
+    IOSError (*mcpIoctl)(void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen);
+    IOSError (*unlockFSClient)(int clientHandle);
+    int32_t (*seepromRead)(uint32_t halfwordIndex, uint16_t *outValue);
+    FSError (*fsaMount)(int clientHandle, const char *source, const char *target, uint32_t flags);
+    FSError (*fsaUnmount)(int clientHandle, const char *mountedTarget, uint32_t flags);
+    FSError (*fsaShimSend)(FSAShimBuffer *shim);
+    // Must call the callback exactly once, it may do so before returning.
+    IOSError (*fsaShimSendAsync)(FSAShimBuffer *shim, IOSAsyncCallbackFn callback, void *context);
+};
+
+extern const MochaBackend *gMochaBackend;
+
+static inline FSError Backend_FSAShimSend(FSAShimBuffer *shim) {
+    if (gMochaBackend) {
+        return gMochaBackend->fsaShimSend(shim);
+    }
+    return __FSAShimSend(shim, 0);
+}
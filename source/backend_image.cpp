@@ -0,0 +1,326 @@
+#include "backend.h"
+#include "mocha/commands.h"
+#include "mocha/mocha.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#define IMAGE_BACKEND_MAX_OPEN_HANDLES 16
+#define IMAGE_BACKEND_HANDLE_BASE      0x100
+
+const MochaBackend *gMochaBackend = nullptr;
+
+struct ImageBackendDevice {
+    char *devicePath;
+    char *imagePath;
+    bool readOnly;
+};
+
+struct ImageBackendHandle {
+    int fd; // -1 if unused
+    bool readOnly;
+};
+
+struct ImageBackendState {
+    OSMutex mutex;
+    uint32_t apiVersion;
+    char environmentPath[0x100];
+    bool hasSEEPROM;
+    uint8_t seeprom[MOCHA_SEEPROM_SIZE];
+    ImageBackendDevice *devices;
+    uint32_t deviceCount;
+    ImageBackendHandle handles[IMAGE_BACKEND_MAX_OPEN_HANDLES];
+    bool hasRPXLoadInfo;
+    MochaRPXLoadInfo rpxLoadInfo;
+};
+
+static ImageBackendState *sImageState = nullptr;
+
+static IOSError ImageBackend_MCPIoctl(void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen) {
+    if (inLen < 4) {
+        return IOS_ERROR_INVALID;
+    }
+    auto *in  = (uint32_t *) inBuf;
+    auto *out = (uint32_t *) outBuf;
+    switch (in[0]) {
+        case IPC_CUSTOM_GET_MOCHA_API_VERSION:
+            if (outLen < 4) {
+                return IOS_ERROR_INVALID;
+            }
+            out[0] = sImageState->apiVersion;
+            return IOS_ERROR_OK;
+        case IPC_CUSTOM_COPY_ENVIRONMENT_PATH:
+            if (outLen < sizeof(sImageState->environmentPath)) {
+                return IOS_ERROR_INVALID;
+            }
+            memcpy(outBuf, sImageState->environmentPath, sizeof(sImageState->environmentPath));
+            return IOS_ERROR_OK;
+        case IPC_CUSTOM_LOAD_CUSTOM_RPX:
+            if (inLen < sizeof(MochaRPXLoadInfo) + 4) {
+                return IOS_ERROR_INVALID;
+            }
+            OSLockMutex(&sImageState->mutex);
+            memcpy(&sImageState->rpxLoadInfo, &in[1], sizeof(MochaRPXLoadInfo));
+            sImageState->hasRPXLoadInfo = true;
+            OSUnlockMutex(&sImageState->mutex);
+            return IOS_ERROR_OK;
+        case IPC_CUSTOM_START_MCP_THREAD:
+        case IPC_CUSTOM_MEN_RPX_HOOK_COMPLETED:
+        case IPC_CUSTOM_START_USB_LOGGING:
+            return IOS_ERROR_OK;
+        default:
+            return IOS_ERROR_INVALID;
+    }
+}
+
+static IOSError ImageBackend_UnlockFSClient(int clientHandle) {
+    (void) clientHandle;
+    return IOS_ERROR_OK;
+}
+
+static int32_t ImageBackend_SEEPROMRead(uint32_t halfwordIndex, uint16_t *outValue) {
+    if (!sImageState->hasSEEPROM || halfwordIndex >= MOCHA_SEEPROM_SIZE / 2) {
+        return -1;
+    }
+    memcpy(outValue, &sImageState->seeprom[halfwordIndex * 2], sizeof(uint16_t));
+    return 0;
+}
+
+static FSError ImageBackend_Mount(int clientHandle, const char *source, const char *target, uint32_t flags) {
+    (void) clientHandle;
+    (void) source;
+    (void) target;
+    (void) flags;
+    // Nothing to mount, the images are only accessible via FSAEx_Raw*
+    return FS_ERROR_OK;
+}
+
+static FSError ImageBackend_Unmount(int clientHandle, const char *mountedTarget, uint32_t flags) {
+    (void) clientHandle;
+    (void) mountedTarget;
+    (void) flags;
+    return FS_ERROR_OK;
+}
+
+static ImageBackendHandle *ImageBackend_GetHandle(int32_t device_handle) {
+    int32_t idx = device_handle - IMAGE_BACKEND_HANDLE_BASE;
+    if (idx < 0 || idx >= IMAGE_BACKEND_MAX_OPEN_HANDLES || sImageState->handles[idx].fd < 0) {
+        return nullptr;
+    }
+    return &sImageState->handles[idx];
+}
+
+static FSError ImageBackend_RawOpen(FSAShimBuffer *shim) {
+    const char *path                 = shim->request.rawOpen.path;
+    const ImageBackendDevice *device = nullptr;
+    for (uint32_t i = 0; i < sImageState->deviceCount; i++) {
+        if (strncmp(sImageState->devices[i].devicePath, path, sizeof(shim->request.rawOpen.path)) == 0) {
+            device = &sImageState->devices[i];
+            break;
+        }
+    }
+    if (!device) {
+        return FS_ERROR_NOT_FOUND;
+    }
+
+    for (int32_t i = 0; i < IMAGE_BACKEND_MAX_OPEN_HANDLES; i++) {
+        auto &handle = sImageState->handles[i];
+        if (handle.fd >= 0) {
+            continue;
+        }
+        handle.fd = open(device->imagePath, device->readOnly ? O_RDONLY : O_RDWR);
+        if (handle.fd < 0) {
+            return FS_ERROR_NOT_FOUND;
+        }
+        handle.readOnly               = device->readOnly;
+        shim->response.rawOpen.handle = IMAGE_BACKEND_HANDLE_BASE + i;
+        return FS_ERROR_OK;
+    }
+    return FS_ERROR_MAX_CLIENTS;
+}
+
+static FSError ImageBackend_RawClose(FSAShimBuffer *shim) {
+    auto *handle = ImageBackend_GetHandle(shim->request.rawClose.handle);
+    if (!handle) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    close(handle->fd);
+    handle->fd = -1;
+    return FS_ERROR_OK;
+}
+
+static FSError ImageBackend_RawTransfer(FSAShimBuffer *shim) {
+    auto &request = shim->request.rawRead;
+    auto *handle  = ImageBackend_GetHandle(request.device_handle);
+    if (!handle) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    bool isRead = shim->command == FSA_COMMAND_RAW_READ;
+    if (!isRead && handle->readOnly) {
+        return FS_ERROR_UNSUPPORTED_COMMAND;
+    }
+    auto size   = (ssize_t) request.size * request.count;
+    auto offset = (off_t) (request.blocks_offset * request.size);
+    if (size > (ssize_t) shim->ioctlvVec[1].len) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (lseek(handle->fd, offset, SEEK_SET) != offset) {
+        return FS_ERROR_OUT_OF_RANGE;
+    }
+    if (isRead) {
+        if (read(handle->fd, shim->ioctlvVec[1].vaddr, size) != size) {
+            return FS_ERROR_OUT_OF_RANGE;
+        }
+    } else {
+        if (write(handle->fd, shim->ioctlvVec[1].vaddr, size) != size) {
+            return FS_ERROR_MEDIA_ERROR;
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+static FSError ImageBackend_FSAShimSend(FSAShimBuffer *shim) {
+    OSLockMutex(&sImageState->mutex);
+    FSError res;
+    switch (shim->command) {
+        case FSA_COMMAND_RAW_OPEN:
+            res = ImageBackend_RawOpen(shim);
+            break;
+        case FSA_COMMAND_RAW_CLOSE:
+            res = ImageBackend_RawClose(shim);
+            break;
+        case FSA_COMMAND_RAW_READ:
+        case FSA_COMMAND_RAW_WRITE:
+            res = ImageBackend_RawTransfer(shim);
+            break;
+        default:
+            res = FS_ERROR_UNSUPPORTED_COMMAND;
+            break;
+    }
+    OSUnlockMutex(&sImageState->mutex);
+    return res;
+}
+
+static IOSError ImageBackend_FSAShimSendAsync(FSAShimBuffer *shim, IOSAsyncCallbackFn callback, void *context) {
+    // Image files are fast enough to complete the request right away.
+    callback((IOSError) ImageBackend_FSAShimSend(shim), context);
+    return IOS_ERROR_OK;
+}
+
+static const MochaBackend sImageBackend = {
+        .mcpIoctl         = ImageBackend_MCPIoctl,
+        .unlockFSClient   = ImageBackend_UnlockFSClient,
+        .seepromRead      = ImageBackend_SEEPROMRead,
+        .fsaMount         = ImageBackend_Mount,
+        .fsaUnmount       = ImageBackend_Unmount,
+        .fsaShimSend      = ImageBackend_FSAShimSend,
+        .fsaShimSendAsync = ImageBackend_FSAShimSendAsync,
+};
+
+static void ImageBackend_FreeState(ImageBackendState *state) {
+    if (!state) {
+        return;
+    }
+    for (auto &handle : state->handles) {
+        if (handle.fd >= 0) {
+            close(handle.fd);
+        }
+    }
+    for (uint32_t i = 0; i < state->deviceCount; i++) {
+        free(state->devices[i].devicePath);
+        free(state->devices[i].imagePath);
+    }
+    free(state->devices);
+    free(state);
+}
+
+static bool ImageBackend_LoadSEEPROM(ImageBackendState *state, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool success = read(fd, state->seeprom, sizeof(state->seeprom)) == (ssize_t) sizeof(state->seeprom);
+    close(fd);
+    return success;
+}
+
+MochaUtilsStatus Mocha_UseImageBackend(const MochaImageBackendConfig *config) {
+    if (!config || (config->deviceCount > 0 && !config->devices)) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *state = (ImageBackendState *) malloc(sizeof(ImageBackendState));
+    if (!state) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    memset(state, 0, sizeof(ImageBackendState));
+    for (auto &handle : state->handles) {
+        handle.fd = -1;
+    }
+    OSInitMutex(&state->mutex);
+    state->apiVersion = config->apiVersion;
+    if (config->environmentPath) {
+        strncpy(state->environmentPath, config->environmentPath, sizeof(state->environmentPath) - 1);
+    }
+    if (config->seepromImagePath) {
+        if (!ImageBackend_LoadSEEPROM(state, config->seepromImagePath)) {
+            ImageBackend_FreeState(state);
+            return MOCHA_RESULT_INVALID_ARGUMENT;
+        }
+        state->hasSEEPROM = true;
+    }
+
+    if (config->deviceCount > 0) {
+        state->devices = (ImageBackendDevice *) malloc(sizeof(ImageBackendDevice) * config->deviceCount);
+        if (!state->devices) {
+            ImageBackend_FreeState(state);
+            return MOCHA_RESULT_UNKNOWN_ERROR;
+        }
+    }
+    for (uint32_t i = 0; i < config->deviceCount; i++) {
+        auto &src = config->devices[i];
+        if (!src.devicePath || !src.imagePath) {
+            ImageBackend_FreeState(state);
+            return MOCHA_RESULT_INVALID_ARGUMENT;
+        }
+        auto &dst      = state->devices[state->deviceCount];
+        dst.devicePath = strdup(src.devicePath);
+        dst.imagePath  = strdup(src.imagePath);
+        dst.readOnly   = src.readOnly;
+        state->deviceCount++;
+        if (!dst.devicePath || !dst.imagePath) {
+            ImageBackend_FreeState(state);
+            return MOCHA_RESULT_UNKNOWN_ERROR;
+        }
+    }
+
+    ImageBackend_FreeState(sImageState);
+    sImageState   = state;
+    gMochaBackend = &sImageBackend;
+    return MOCHA_RESULT_SUCCESS;
+}
+
+MochaUtilsStatus Mocha_UseIOSUBackend() {
+    gMochaBackend = nullptr;
+    ImageBackend_FreeState(sImageState);
+    sImageState = nullptr;
+    return MOCHA_RESULT_SUCCESS;
+}
+
+MochaUtilsStatus Mocha_ImageBackendGetRPXLoadInfo(MochaRPXLoadInfo *outLoadInfo) {
+    if (!outLoadInfo) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    if (!sImageState) {
+        return MOCHA_RESULT_UNSUPPORTED_COMMAND;
+    }
+    OSLockMutex(&sImageState->mutex);
+    auto res = sImageState->hasRPXLoadInfo ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNKNOWN_ERROR;
+    if (sImageState->hasRPXLoadInfo) {
+        memcpy(outLoadInfo, &sImageState->rpxLoadInfo, sizeof(MochaRPXLoadInfo));
+    }
+    OSUnlockMutex(&sImageState->mutex);
+    return res;
+}
@@ -0,0 +1,460 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "mocha/mocha.h"
+#include <atomic>
+#include <cerrno>
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/mutex.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/iosupport.h>
+
+#define RAW_DEVOPTAB_MAX_DEVICES         8
+#define RAW_DEVOPTAB_MAX_NAME_LENGTH     0x20
+#define RAW_DEVOPTAB_MAX_PATH_LENGTH     0x40
+#define RAW_DEVOPTAB_DEFAULT_BUFFER_SIZE (1024 * 1024)
+
+struct RawDevoptabDevice {
+    devoptab_t devoptab;
+    char name[RAW_DEVOPTAB_MAX_NAME_LENGTH];
+    char devicePath[RAW_DEVOPTAB_MAX_PATH_LENGTH];
+    uint32_t sectorSize;
+    uint64_t sectorCount; // 0 if unknown
+    uint32_t bufferSectors;
+    bool readOnly;
+    int clientHandle; // -1 if the slot is unused
+    std::atomic<uint32_t> openStreams;
+};
+
+/**
+ * Per stream state, allocated by newlib with devoptab_t::structSize.
+ */
+struct RawDevoptabFile {
+    RawDevoptabDevice *device;
+    int32_t deviceHandle;
+    bool writable;
+    uint64_t position; // in bytes
+    uint8_t *buffer;
+    uint64_t bufferSector; // first sector in the buffer
+    uint32_t bufferCount;  // number of valid sectors in the buffer, 0 if empty
+    bool dirty;
+};
+
+static RawDevoptabDevice sRawDevoptabDevices[RAW_DEVOPTAB_MAX_DEVICES];
+static OSMutex sRawDevoptabMutex;
+
+static bool RawDevoptab_Init() {
+    OSInitMutex(&sRawDevoptabMutex);
+    for (auto &device : sRawDevoptabDevices) {
+        device.clientHandle = -1;
+    }
+    return true;
+}
+
+static bool sRawDevoptabInitDone = RawDevoptab_Init();
+
+static uint64_t RawDevoptab_GetSize(const RawDevoptabDevice *device) {
+    return device->sectorCount * device->sectorSize;
+}
+
+static FSError RawDevoptab_Flush(RawDevoptabFile *file) {
+    if (!file->dirty) {
+        return FS_ERROR_OK;
+    }
+    auto *device = file->device;
+    auto res     = FSAEx_RawWriteEx(device->clientHandle, file->buffer, device->sectorSize, file->bufferCount, file->bufferSector, file->deviceHandle);
+    if (res == FS_ERROR_OK) {
+        file->dirty = false;
+    }
+    return res;
+}
+
+/**
+ * Fills the buffer with the sectors starting at the given sector, writing back buffered writes first.
+ */
+static FSError RawDevoptab_Load(RawDevoptabFile *file, uint64_t sector) {
+    auto *device = file->device;
+    auto res     = RawDevoptab_Flush(file);
+    if (res < 0) {
+        return res;
+    }
+    uint32_t count = device->bufferSectors;
+    if (device->sectorCount != 0) {
+        if (sector >= device->sectorCount) {
+            return FS_ERROR_END_OF_FILE;
+        }
+        if (device->sectorCount - sector < count) {
+            count = (uint32_t) (device->sectorCount - sector);
+        }
+    }
+    file->bufferCount = 0;
+    res               = FSAEx_RawReadEx(device->clientHandle, file->buffer, device->sectorSize, count, sector, file->deviceHandle);
+    if (res < 0) {
+        return res;
+    }
+    file->bufferSector = sector;
+    file->bufferCount  = count;
+    return FS_ERROR_OK;
+}
+
+static bool RawDevoptab_IsBuffered(const RawDevoptabFile *file, uint64_t sector) {
+    return file->bufferCount != 0 && sector >= file->bufferSector && sector < file->bufferSector + file->bufferCount;
+}
+
+static int RawDevoptab_ToErrno(FSError err) {
+    switch (err) {
+        case FS_ERROR_END_OF_FILE:
+        case FS_ERROR_OUT_OF_RANGE:
+            return EINVAL;
+        case FS_ERROR_OUT_OF_RESOURCES:
+            return ENOMEM;
+        case FS_ERROR_NOT_FOUND:
+            return ENODEV;
+        default:
+            return EIO;
+    }
+}
+
+static int RawDevoptab_Open(struct _reent *r, void *fileStruct, const char *path, int flags, int mode) {
+    (void) mode;
+    auto *device = (RawDevoptabDevice *) r->deviceData;
+    auto *file   = (RawDevoptabFile *) fileStruct;
+    // Only the device itself can be opened, e.g. "rawsd:" or "rawsd:/"
+    auto *sep = strchr(path, ':');
+    if (sep && sep[1] != '\0' && strcmp(sep + 1, "/") != 0) {
+        r->_errno = ENOENT;
+        return -1;
+    }
+    file->writable = (flags & O_ACCMODE) != O_RDONLY;
+    if (file->writable && device->readOnly) {
+        r->_errno = EROFS;
+        return -1;
+    }
+
+    file->device       = device;
+    file->position     = 0;
+    file->bufferSector = 0;
+    file->bufferCount  = 0;
+    file->dirty        = false;
+    file->buffer       = (uint8_t *) memalign(0x40, device->bufferSectors * device->sectorSize);
+    if (!file->buffer) {
+        r->_errno = ENOMEM;
+        return -1;
+    }
+    // FSAEx_RawDevoptabRemove checks openStreams under the same lock, so it can't remove the device in between.
+    OSLockMutex(&sRawDevoptabMutex);
+    FSError res = FS_ERROR_NOT_FOUND;
+    if (device->clientHandle >= 0) {
+        res = FSAEx_RawOpenEx(device->clientHandle, device->devicePath, &file->deviceHandle);
+    }
+    if (res >= 0) {
+        device->openStreams++;
+    }
+    OSUnlockMutex(&sRawDevoptabMutex);
+    if (res < 0) {
+        free(file->buffer);
+        r->_errno = RawDevoptab_ToErrno(res);
+        return -1;
+    }
+    return 0;
+}
+
+static int RawDevoptab_Close(struct _reent *r, void *fd) {
+    auto *file   = (RawDevoptabFile *) fd;
+    auto *device = file->device;
+    auto res     = RawDevoptab_Flush(file);
+    FSAEx_RawCloseEx(device->clientHandle, file->deviceHandle);
+    free(file->buffer);
+    device->openStreams--;
+    if (res < 0) {
+        r->_errno = RawDevoptab_ToErrno(res);
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t RawDevoptab_Read(struct _reent *r, void *fd, char *ptr, size_t len) {
+    auto *file          = (RawDevoptabFile *) fd;
+    auto *device        = file->device;
+    uint32_t sectorSize = device->sectorSize;
+    uint32_t bufferSize = device->bufferSectors * sectorSize;
+    if (device->sectorCount != 0) {
+        uint64_t size = RawDevoptab_GetSize(device);
+        if (file->position >= size) {
+            return 0;
+        }
+        if (size - file->position < len) {
+            len = (size_t) (size - file->position);
+        }
+    }
+
+    size_t done = 0;
+    FSError res = FS_ERROR_OK;
+    while (done < len) {
+        uint64_t sector   = file->position / sectorSize;
+        uint32_t inSector = file->position % sectorSize;
+        size_t remaining  = len - done;
+        if (inSector == 0 && remaining >= bufferSize) {
+            // Large sector aligned reads go straight into the destination.
+            uint32_t cnt = remaining / sectorSize;
+            if ((res = RawDevoptab_Flush(file)) < 0 ||
+                (res = FSAEx_RawReadEx(device->clientHandle, ptr + done, sectorSize, cnt, sector, file->deviceHandle)) < 0) {
+                break;
+            }
+            done += (size_t) cnt * sectorSize;
+            file->position += (uint64_t) cnt * sectorSize;
+            continue;
+        }
+        if (!RawDevoptab_IsBuffered(file, sector) && (res = RawDevoptab_Load(file, sector)) < 0) {
+            break;
+        }
+        uint32_t offset = (uint32_t) (sector - file->bufferSector) * sectorSize + inSector;
+        size_t n        = file->bufferCount * sectorSize - offset;
+        if (n > remaining) {
+            n = remaining;
+        }
+        memcpy(ptr + done, file->buffer + offset, n);
+        done += n;
+        file->position += n;
+    }
+
+    if (res < 0 && done == 0) {
+        r->_errno = RawDevoptab_ToErrno(res);
+        return -1;
+    }
+    return (ssize_t) done;
+}
+
+static ssize_t RawDevoptab_Write(struct _reent *r, void *fd, const char *ptr, size_t len) {
+    auto *file          = (RawDevoptabFile *) fd;
+    auto *device        = file->device;
+    uint32_t sectorSize = device->sectorSize;
+    uint32_t bufferSize = device->bufferSectors * sectorSize;
+    if (!file->writable) {
+        r->_errno = EBADF;
+        return -1;
+    }
+    if (device->sectorCount != 0) {
+        uint64_t size = RawDevoptab_GetSize(device);
+        if (file->position >= size) {
+            r->_errno = ENOSPC;
+            return -1;
+        }
+        if (size - file->position < len) {
+            len = (size_t) (size - file->position);
+        }
+    }
+
+    size_t done = 0;
+    FSError res = FS_ERROR_OK;
+    while (done < len) {
+        uint64_t sector   = file->position / sectorSize;
+        uint32_t inSector = file->position % sectorSize;
+        size_t remaining  = len - done;
+        if (inSector == 0 && remaining >= bufferSize) {
+            // Large sector aligned writes bypass the buffer, buffered sectors of the range would be stale afterwards.
+            uint32_t cnt = remaining / sectorSize;
+            if ((res = RawDevoptab_Flush(file)) < 0 ||
+                (res = FSAEx_RawWriteEx(device->clientHandle, ptr + done, sectorSize, cnt, sector, file->deviceHandle)) < 0) {
+                break;
+            }
+            if (file->bufferCount != 0 && file->bufferSector < sector + cnt && sector < file->bufferSector + file->bufferCount) {
+                file->bufferCount = 0;
+            }
+            done += (size_t) cnt * sectorSize;
+            file->position += (uint64_t) cnt * sectorSize;
+            continue;
+        }
+        // Partial sectors are merged into the buffer (read-modify-write) and written back on flush.
+        if (!RawDevoptab_IsBuffered(file, sector) && (res = RawDevoptab_Load(file, sector)) < 0) {
+            break;
+        }
+        uint32_t offset = (uint32_t) (sector - file->bufferSector) * sectorSize + inSector;
+        size_t n        = file->bufferCount * sectorSize - offset;
+        if (n > remaining) {
+            n = remaining;
+        }
+        memcpy(file->buffer + offset, ptr + done, n);
+        file->dirty = true;
+        done += n;
+        file->position += n;
+    }
+
+    if (res < 0 && done == 0) {
+        r->_errno = RawDevoptab_ToErrno(res);
+        return -1;
+    }
+    return (ssize_t) done;
+}
+
+static off_t RawDevoptab_Seek(struct _reent *r, void *fd, off_t pos, int dir) {
+    auto *file    = (RawDevoptabFile *) fd;
+    auto *device  = file->device;
+    int64_t start = 0;
+    switch (dir) {
+        case SEEK_SET:
+            start = 0;
+            break;
+        case SEEK_CUR:
+            start = (int64_t) file->position;
+            break;
+        case SEEK_END:
+            if (device->sectorCount == 0) {
+                r->_errno = EINVAL;
+                return -1;
+            }
+            start = (int64_t) RawDevoptab_GetSize(device);
+            break;
+        default:
+            r->_errno = EINVAL;
+            return -1;
+    }
+    if (start + pos < 0) {
+        r->_errno = EINVAL;
+        return -1;
+    }
+    // Only moves the position, the buffer is kept until a transfer needs other sectors.
+    file->position = (uint64_t) (start + pos);
+    return (off_t) file->position;
+}
+
+static void RawDevoptab_FillStat(const RawDevoptabDevice *device, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    // Reported as regular file, so tools that expect an image file accept the stream.
+    st->st_mode    = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH | (device->readOnly ? 0 : S_IWUSR | S_IWGRP | S_IWOTH);
+    st->st_nlink   = 1;
+    st->st_size    = (off_t) RawDevoptab_GetSize(device);
+    st->st_blksize = device->bufferSectors * device->sectorSize;
+    st->st_blocks  = (device->sectorCount * device->sectorSize + 511) / 512;
+}
+
+static int RawDevoptab_FStat(struct _reent *r, void *fd, struct stat *st) {
+    (void) r;
+    RawDevoptab_FillStat(((RawDevoptabFile *) fd)->device, st);
+    return 0;
+}
+
+static int RawDevoptab_Stat(struct _reent *r, const char *path, struct stat *st) {
+    auto *sep = strchr(path, ':');
+    if (sep && sep[1] != '\0' && strcmp(sep + 1, "/") != 0) {
+        r->_errno = ENOENT;
+        return -1;
+    }
+    RawDevoptab_FillStat((RawDevoptabDevice *) r->deviceData, st);
+    return 0;
+}
+
+static int RawDevoptab_FSync(struct _reent *r, void *fd) {
+    auto res = RawDevoptab_Flush((RawDevoptabFile *) fd);
+    if (res < 0) {
+        r->_errno = RawDevoptab_ToErrno(res);
+        return -1;
+    }
+    return 0;
+}
+
+FSError FSAEx_RawDevoptabAdd(const FSAExRawDevoptabConfig *config) {
+    if (!config || !config->name || !config->devicePath || config->sectorSize == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (strlen(config->name) >= RAW_DEVOPTAB_MAX_NAME_LENGTH || strlen(config->devicePath) >= RAW_DEVOPTAB_MAX_PATH_LENGTH) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    uint32_t bufferSize = config->bufferSize;
+    if (bufferSize == 0) {
+        bufferSize = RawAutotune_GetTransferSize(config->devicePath);
+    }
+    if (bufferSize == 0) {
+        bufferSize = RAW_DEVOPTAB_DEFAULT_BUFFER_SIZE;
+    }
+    uint32_t bufferSectors = bufferSize / config->sectorSize;
+    if (bufferSectors == 0) {
+        bufferSectors = 1;
+    }
+
+    OSLockMutex(&sRawDevoptabMutex);
+    RawDevoptabDevice *device = nullptr;
+    for (auto &d : sRawDevoptabDevices) {
+        if (d.clientHandle >= 0 && strcmp(d.name, config->name) == 0) {
+            OSUnlockMutex(&sRawDevoptabMutex);
+            return FS_ERROR_ALREADY_EXISTS;
+        }
+        if (!device && d.clientHandle < 0) {
+            device = &d;
+        }
+    }
+    if (!device) {
+        OSUnlockMutex(&sRawDevoptabMutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    // The streams can be used from any thread and outlive the client of the caller, so the device gets its own.
+    int clientHandle = FSAAddClient(nullptr);
+    if (clientHandle < 0) {
+        OSUnlockMutex(&sRawDevoptabMutex);
+        return FS_ERROR_MAX_CLIENTS;
+    }
+    if (Mocha_UnlockFSClientEx(clientHandle) != MOCHA_RESULT_SUCCESS) {
+        FSADelClient(clientHandle);
+        OSUnlockMutex(&sRawDevoptabMutex);
+        return FS_ERROR_NOT_INIT;
+    }
+
+    strcpy(device->name, config->name);
+    strcpy(device->devicePath, config->devicePath);
+    device->sectorSize    = config->sectorSize;
+    device->sectorCount   = config->sectorCount;
+    device->bufferSectors = bufferSectors;
+    device->readOnly      = config->readOnly;
+    device->openStreams.store(0);
+
+    auto &devoptab = device->devoptab;
+    memset(&devoptab, 0, sizeof(devoptab));
+    devoptab.name       = device->name;
+    devoptab.structSize = sizeof(RawDevoptabFile);
+    devoptab.open_r     = RawDevoptab_Open;
+    devoptab.close_r    = RawDevoptab_Close;
+    devoptab.write_r    = RawDevoptab_Write;
+    devoptab.read_r     = RawDevoptab_Read;
+    devoptab.seek_r     = RawDevoptab_Seek;
+    devoptab.fstat_r    = RawDevoptab_FStat;
+    devoptab.stat_r     = RawDevoptab_Stat;
+    devoptab.fsync_r    = RawDevoptab_FSync;
+    devoptab.deviceData = device;
+
+    if (AddDevice(&devoptab) < 0) {
+        FSADelClient(clientHandle);
+        OSUnlockMutex(&sRawDevoptabMutex);
+        return FS_ERROR_MAX_MOUNT_POINTS;
+    }
+    device->clientHandle = clientHandle;
+    OSUnlockMutex(&sRawDevoptabMutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawDevoptabRemove(const char *name) {
+    if (!name) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&sRawDevoptabMutex);
+    for (auto &device : sRawDevoptabDevices) {
+        if (device.clientHandle < 0 || strcmp(device.name, name) != 0) {
+            continue;
+        }
+        if (device.openStreams.load() != 0) {
+            OSUnlockMutex(&sRawDevoptabMutex);
+            return FS_ERROR_BUSY;
+        }
+        char prefix[RAW_DEVOPTAB_MAX_NAME_LENGTH + 1];
+        snprintf(prefix, sizeof(prefix), "%s:", device.name);
+        RemoveDevice(prefix);
+        FSADelClient(device.clientHandle);
+        device.clientHandle = -1;
+        OSUnlockMutex(&sRawDevoptabMutex);
+        return FS_ERROR_OK;
+    }
+    OSUnlockMutex(&sRawDevoptabMutex);
+    return FS_ERROR_NOT_FOUND;
+}
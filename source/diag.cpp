@@ -0,0 +1,268 @@
+#include "diag.h"
+#include "mocha/mocha.h"
+#include <atomic>
+#include <coreinit/debug.h>
+#include <coreinit/mutex.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+
+#define DIAG_RING_SIZE             64 // power of two
+#define DIAG_RATE_LIMIT_PER_SECOND 32
+#define DIAG_REPEATS_CLOSED        0xFFFFFFFF
+#define DIAG_NO_POSITION           0xFFFFFFFF
+#define DIAG_THREAD_STACK_SIZE     0x2000
+#define DIAG_THREAD_PRIORITY       30 // just above the idle priority
+
+/*
+ * Bounded multi-producer ring, see D. Vyukov's MPMC queue. Producers claim a position with a CAS on sEnqueuePos and
+ * publish the slot by storing position + 1 to its sequence. The single consumer (Mocha_DiagDrain, serialized by
+ * sDiagDrainMutex) releases a slot by storing position + DIAG_RING_SIZE. Producers never wait: a full ring drops
+ * the message.
+ */
+struct DiagSlot {
+    std::atomic<uint32_t> sequence;
+    // Identical messages posted while this one is the newest and not yet drained are counted here.
+    std::atomic<uint32_t> repeats;
+    std::atomic<uint32_t> hash;
+    OSTime time;
+    char text[MOCHA_DIAG_MESSAGE_LENGTH];
+};
+
+static DiagSlot sDiagRing[DIAG_RING_SIZE];
+static std::atomic<uint32_t> sEnqueuePos;
+static std::atomic<uint32_t> sLastEnqueuePos;
+static uint32_t sDequeuePos;
+
+static std::atomic<uint32_t> sRateWindow;
+static std::atomic<uint32_t> sRateWindowCount;
+
+static std::atomic<uint32_t> sPosted;
+static std::atomic<uint32_t> sMerged;
+static std::atomic<uint32_t> sRateLimited;
+static std::atomic<uint32_t> sDropped;
+
+static OSMutex sDiagDrainMutex;
+
+struct DiagDrainThread {
+    OSThread thread;
+    uint8_t *stack;
+    uint32_t intervalMs;
+    MochaDiagCallback callback;
+    void *userContext;
+    std::atomic<bool> stop;
+};
+
+static DiagDrainThread *sDrainThread = nullptr; // Guarded by sDiagDrainMutex.
+
+/**
+ * sDiagRing is dynamically initialized (it holds atomics), which may happen after __attribute__((constructor))
+ * functions. Called from the initializer of sDiagInitDone instead, which always runs after the one of sDiagRing.
+ */
+static bool Diag_Init() {
+    OSInitMutex(&sDiagDrainMutex);
+    for (uint32_t i = 0; i < DIAG_RING_SIZE; i++) {
+        sDiagRing[i].sequence.store(i, std::memory_order_relaxed);
+        sDiagRing[i].repeats.store(DIAG_REPEATS_CLOSED, std::memory_order_relaxed);
+    }
+    sEnqueuePos.store(0, std::memory_order_relaxed);
+    sLastEnqueuePos.store(DIAG_NO_POSITION, std::memory_order_relaxed);
+    sDequeuePos = 0;
+    return true;
+}
+
+static bool sDiagInitDone = Diag_Init();
+
+static uint32_t Diag_Hash(const char *text) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *text; text++) {
+        hash = (hash ^ (uint8_t) *text) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Counts the message as repeat of the newest queued message if they are identical and it hasn't been drained yet.
+ */
+static bool Diag_TryMerge(uint32_t hash) {
+    uint32_t last = sLastEnqueuePos.load(std::memory_order_acquire);
+    if (last == DIAG_NO_POSITION) {
+        return false;
+    }
+    auto &slot = sDiagRing[last % DIAG_RING_SIZE];
+    if (slot.sequence.load(std::memory_order_acquire) != last + 1 || slot.hash.load(std::memory_order_relaxed) != hash) {
+        return false;
+    }
+    uint32_t repeats = slot.repeats.load(std::memory_order_relaxed);
+    while (repeats != DIAG_REPEATS_CLOSED) {
+        if (slot.repeats.compare_exchange_weak(repeats, repeats + 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool Diag_TakeRateToken() {
+    uint32_t now    = (uint32_t) OSTicksToSeconds(OSGetSystemTime());
+    uint32_t window = sRateWindow.load(std::memory_order_relaxed);
+    if (window != now && sRateWindow.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+        sRateWindowCount.store(0, std::memory_order_relaxed);
+    }
+    return sRateWindowCount.fetch_add(1, std::memory_order_relaxed) < DIAG_RATE_LIMIT_PER_SECOND;
+}
+
+void Diag_Post(const char *format, ...) {
+    char text[MOCHA_DIAG_MESSAGE_LENGTH];
+    va_list va;
+    va_start(va, format);
+    vsnprintf(text, sizeof(text), format, va);
+    va_end(va);
+
+    uint32_t hash = Diag_Hash(text);
+    if (Diag_TryMerge(hash)) {
+        sMerged.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!Diag_TakeRateToken()) {
+        sRateLimited.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint32_t pos = sEnqueuePos.load(std::memory_order_relaxed);
+    DiagSlot *slot;
+    while (true) {
+        slot          = &sDiagRing[pos % DIAG_RING_SIZE];
+        auto distance = (int32_t) (slot->sequence.load(std::memory_order_acquire) - pos);
+        if (distance == 0) {
+            if (sEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (distance < 0) {
+            // The ring is full.
+            sDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = sEnqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->time = OSGetSystemTime();
+    memcpy(slot->text, text, sizeof(text));
+    slot->hash.store(hash, std::memory_order_relaxed);
+    slot->repeats.store(0, std::memory_order_relaxed);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    sLastEnqueuePos.store(pos, std::memory_order_release);
+    sPosted.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void Diag_Report(const MochaDiagMessage *message, void *userContext) {
+    (void) userContext;
+    if (message->repeatCount > 0) {
+        OSReport("%s (repeated %u times)\n", message->text, (unsigned int) message->repeatCount);
+    } else {
+        OSReport("%s\n", message->text);
+    }
+}
+
+uint32_t Mocha_DiagDrain(MochaDiagCallback callback, void *userContext) {
+    if (!callback) {
+        callback = Diag_Report;
+    }
+    uint32_t count = 0;
+    MochaDiagMessage message;
+    OSLockMutex(&sDiagDrainMutex);
+    while (true) {
+        auto &slot = sDiagRing[sDequeuePos % DIAG_RING_SIZE];
+        if (slot.sequence.load(std::memory_order_acquire) != sDequeuePos + 1) {
+            break;
+        }
+        // Closing the repeat counter stops producers from merging into a message that is already consumed.
+        message.repeatCount = slot.repeats.exchange(DIAG_REPEATS_CLOSED, std::memory_order_relaxed);
+        message.time        = slot.time;
+        memcpy(message.text, slot.text, sizeof(message.text));
+        slot.sequence.store(sDequeuePos + DIAG_RING_SIZE, std::memory_order_release);
+        sDequeuePos++;
+
+        callback(&message, userContext);
+        count++;
+    }
+    OSUnlockMutex(&sDiagDrainMutex);
+    return count;
+}
+
+void Mocha_DiagGetStats(MochaDiagStats *outStats) {
+    if (!outStats) {
+        return;
+    }
+    outStats->posted      = sPosted.load(std::memory_order_relaxed);
+    outStats->merged      = sMerged.load(std::memory_order_relaxed);
+    outStats->rateLimited = sRateLimited.load(std::memory_order_relaxed);
+    outStats->dropped     = sDropped.load(std::memory_order_relaxed);
+}
+
+static int Diag_ThreadEntry(int argc, const char **argv) {
+    (void) argc;
+    auto *drainThread = (DiagDrainThread *) argv;
+    while (!drainThread->stop.load()) {
+        OSSleepTicks(OSMillisecondsToTicks(drainThread->intervalMs));
+        Mocha_DiagDrain(drainThread->callback, drainThread->userContext);
+    }
+    return 0;
+}
+
+MochaUtilsStatus Mocha_DiagStartDrainThread(uint32_t intervalMs, MochaDiagCallback callback, void *userContext) {
+    if (intervalMs == 0) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    // Held until the thread is published, so concurrent calls start only one.
+    OSLockMutex(&sDiagDrainMutex);
+    if (sDrainThread) {
+        OSUnlockMutex(&sDiagDrainMutex);
+        return MOCHA_RESULT_SUCCESS;
+    }
+    auto *drainThread = (DiagDrainThread *) memalign(0x10, sizeof(DiagDrainThread));
+    if (!drainThread) {
+        OSUnlockMutex(&sDiagDrainMutex);
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    new (drainThread) DiagDrainThread();
+    drainThread->intervalMs  = intervalMs;
+    drainThread->callback    = callback;
+    drainThread->userContext = userContext;
+    drainThread->stop.store(false);
+    drainThread->stack = (uint8_t *) memalign(0x10, DIAG_THREAD_STACK_SIZE);
+    if (!drainThread->stack ||
+        !OSCreateThread(&drainThread->thread, Diag_ThreadEntry, 0, (char *) drainThread, drainThread->stack + DIAG_THREAD_STACK_SIZE, DIAG_THREAD_STACK_SIZE, DIAG_THREAD_PRIORITY, OS_THREAD_ATTRIB_AFFINITY_ANY)) {
+        free(drainThread->stack);
+        free(drainThread);
+        OSUnlockMutex(&sDiagDrainMutex);
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    OSSetThreadName(&drainThread->thread, "Mocha_DiagDrain");
+    OSResumeThread(&drainThread->thread);
+    sDrainThread = drainThread;
+    OSUnlockMutex(&sDiagDrainMutex);
+    return MOCHA_RESULT_SUCCESS;
+}
+
+void Mocha_DiagStopDrainThread() {
+    // Only one caller takes the thread. The join happens without the lock, the thread needs it for draining.
+    OSLockMutex(&sDiagDrainMutex);
+    auto *drainThread = sDrainThread;
+    sDrainThread      = nullptr;
+    OSUnlockMutex(&sDiagDrainMutex);
+    if (!drainThread) {
+        return;
+    }
+    drainThread->stop.store(true);
+    OSJoinThread(&drainThread->thread, nullptr);
+    // Whatever was posted during the last interval.
+    Mocha_DiagDrain(drainThread->callback, drainThread->userContext);
+    free(drainThread->stack);
+    free(drainThread);
+}
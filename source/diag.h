@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Queues a diagnostic message (printf style) in the in-memory ring of the library, never blocks. <br>
+ * Identical consecutive messages are merged and the number of messages per second is limited, the ring is
+ * drained by Mocha_DiagDrain or the drain thread.
+ */
+void Diag_Post(const char *format, ...) __attribute__((format(printf, 1, 2)));
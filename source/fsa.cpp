@@ -1,8 +1,15 @@
 #include "mocha/fsa.h"
+#include "backend.h"
+#include "diag.h"
+#include "fsa_internal.h"
+#include "raw_handle.h"
+#include "shim_pool.h"
+#include "stats.h"
 #include "utils.h"
 #include <coreinit/debug.h>
 #include <coreinit/filesystem.h>
 #include <coreinit/filesystem_fsa.h>
+#include <coreinit/time.h>
 #include <cstring>
 #include <malloc.h>
 #include <mocha/fsa.h>
@@ -16,11 +23,7 @@ FSError FSAEx_Mount(FSClient *client, const char *source, const char *target, FS
 }
 
 FSError FSAEx_MountEx(int clientHandle, const char *source, const char *target, FSAMountFlags flags, void *arg_buf, uint32_t arg_len) {
-    auto *buffer = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
-    if (!buffer) {
-        return FS_ERROR_INVALID_BUFFER;
-    }
-
+    STATS_SCOPE(MOCHA_STATS_FSA_MOUNT, 0);
     // Check if source and target path is valid.
     if (!std::string_view(target).starts_with("/vol/") || !std::string_view(source).starts_with("/dev/")) {
         return FS_ERROR_INVALID_PATH;
@@ -38,13 +41,22 @@ FSError FSAEx_MountEx(int clientHandle, const char *source, const char *target,
         }
     }
 
+    if (gMochaBackend) {
+        return gMochaBackend->fsaMount(clientHandle, source, target, flags);
+    }
+
+    auto *buffer = ShimPool_Acquire();
+    if (!buffer) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+
     auto res = __FSAShimSetupRequestMount(buffer, clientHandle, source, target, 2, arg_buf, arg_len);
     if (res != 0) {
-        free(buffer);
+        ShimPool_Release(buffer);
         return res;
     }
     res = __FSAShimSend(buffer, 0);
-    free(buffer);
+    ShimPool_Release(buffer);
     return res;
 }
 
@@ -56,18 +68,28 @@ FSError FSAEx_Unmount(FSClient *client, const char *mountedTarget, FSAUnmountFla
 }
 
 FSError FSAEx_UnmountEx(int clientHandle, const char *mountedTarget, FSAUnmountFlags flags) {
-    auto *buffer = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
-    if (!buffer) {
-        return FS_ERROR_INVALID_BUFFER;
-    }
+    STATS_SCOPE(MOCHA_STATS_FSA_UNMOUNT, 0);
+    FSError res;
+    if (gMochaBackend) {
+        res = gMochaBackend->fsaUnmount(clientHandle, mountedTarget, flags);
+    } else {
+        auto *buffer = ShimPool_Acquire();
+        if (!buffer) {
+            return FS_ERROR_INVALID_BUFFER;
+        }
 
-    auto res = __FSAShimSetupRequestUnmount(buffer, clientHandle, mountedTarget, flags);
-    if (res != 0) {
-        free(buffer);
-        return res;
+        res = __FSAShimSetupRequestUnmount(buffer, clientHandle, mountedTarget, flags);
+        if (res != 0) {
+            ShimPool_Release(buffer);
+            return res;
+        }
+        res = __FSAShimSend(buffer, 0);
+        ShimPool_Release(buffer);
+    }
+    if (res == FS_ERROR_OK) {
+        // Keep the mount registry in sync with direct unmounts.
+        MountRegistry_Forget(mountedTarget);
     }
-    res = __FSAShimSend(buffer, 0);
-    free(buffer);
     return res;
 }
 
@@ -79,13 +101,14 @@ FSError FSAEx_RawOpen(FSClient *client, char *device_path, int32_t *outHandle) {
 }
 
 FSError FSAEx_RawOpenEx(int clientHandle, char *device_path, int32_t *outHandle) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_OPEN, 0);
     if (!outHandle) {
         return FS_ERROR_INVALID_BUFFER;
     }
     if (!device_path) {
         return FS_ERROR_INVALID_PATH;
     }
-    auto *shim = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+    auto *shim = ShimPool_Acquire();
     if (!shim) {
         return FS_ERROR_INVALID_BUFFER;
     }
@@ -99,11 +122,16 @@ FSError FSAEx_RawOpenEx(int clientHandle, char *device_path, int32_t *outHandle)
 
     strncpy(requestBuffer->path, device_path, 0x27F);
 
-    auto res = __FSAShimSend(shim, 0);
+    auto res = Backend_FSAShimSend(shim);
     if (res >= 0) {
-        *outHandle = shim->response.rawOpen.handle;
+        *outHandle  = shim->response.rawOpen.handle;
+        RawHandleRef state(clientHandle, *outHandle, true);
+        if (state) {
+            strncpy(state->devicePath, device_path, sizeof(state->devicePath) - 1);
+            state->devicePath[sizeof(state->devicePath) - 1] = '\0';
+        }
     }
-    free(shim);
+    ShimPool_Release(shim);
     return res;
 }
 
@@ -115,7 +143,8 @@ FSError FSAEx_RawClose(FSClient *client, int32_t device_handle) {
 }
 
 FSError FSAEx_RawCloseEx(int clientHandle, int32_t device_handle) {
-    auto *buffer = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_CLOSE, 0);
+    auto *buffer = ShimPool_Acquire();
     if (!buffer) {
         return FS_ERROR_INVALID_BUFFER;
     }
@@ -132,8 +161,56 @@ FSError FSAEx_RawCloseEx(int clientHandle, int32_t device_handle) {
 
     requestBuffer->handle = device_handle;
 
-    auto res = __FSAShimSend(buffer, 0);
-    free(buffer);
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (state && state->readAhead) {
+        // A prefetch that is still in flight would be sent on a closed handle.
+        RawReadAhead_Stop(state->readAhead);
+    }
+    if (state) {
+        // Queued requests still need the handle, new ones are executed directly until it is closed.
+        RawScheduler_Suspend(state);
+    }
+
+    FSError res = FS_ERROR_OK;
+    if (state) {
+        // Held until the write buffer and cache are detached, so nothing new is buffered after they were flushed.
+        OSLockMutex(&state->mutex);
+        // Last chance to write back buffered data and dirty blocks. If that fails the handle stays open and they stay
+        // attached, so nothing is lost.
+        if (state->writeBuffer) {
+            res = FSAEx_RawWriteBufferFlush(state->writeBuffer);
+        }
+        if (res >= 0 && state->cache) {
+            res = FSAEx_RawCacheFlush(state->cache);
+        }
+    }
+    if (res >= 0) {
+        res = Backend_FSAShimSend(buffer);
+    }
+    if (state) {
+        if (res >= 0 && state->writeBuffer) {
+            RawWriteBuffer_Detach(state->writeBuffer);
+        }
+        if (res >= 0 && state->cache) {
+            RawCache_Detach(state->cache);
+        }
+        if (state->scheduler) {
+            if (res >= 0) {
+                RawScheduler_Detach(state->scheduler);
+            } else {
+                RawScheduler_Resume(state->scheduler);
+            }
+        }
+        OSUnlockMutex(&state->mutex);
+    }
+
+    if (res >= 0) {
+        RawHandle_Remove(clientHandle, device_handle);
+    } else if (state && state->readAhead) {
+        // The handle stays open.
+        RawReadAhead_Resume(state->readAhead);
+    }
+    ShimPool_Release(buffer);
     return res;
 }
 
@@ -144,38 +221,23 @@ FSError FSAEx_RawRead(FSClient *client, void *data, uint32_t size_bytes, uint32_
     return FSAEx_RawReadEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
 }
 
-FSError FSAEx_RawReadEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
-    if (data == nullptr) {
-        return FS_ERROR_INVALID_BUFFER;
-    }
-    auto *shim = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
-    if (!shim) {
-        return FS_ERROR_INVALID_BUFFER;
-    }
-
+void FSAEx_RawSetupRequest(FSAShimBuffer *shim, int clientHandle, FSACommandEnum command, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
     shim->clientHandle = clientHandle;
     shim->ipcReqType   = FSA_IPC_REQUEST_IOCTLV;
-    shim->command      = FSA_COMMAND_RAW_READ;
+    shim->command      = command;
 
-    shim->ioctlvVecIn  = uint8_t{1};
-    shim->ioctlvVecOut = uint8_t{2};
+    if (command == FSA_COMMAND_RAW_READ) {
+        shim->ioctlvVecIn  = uint8_t{1};
+        shim->ioctlvVecOut = uint8_t{2};
+    } else {
+        shim->ioctlvVecIn  = uint8_t{2};
+        shim->ioctlvVecOut = uint8_t{1};
+    }
 
     shim->ioctlvVec[0].vaddr = &shim->request;
     shim->ioctlvVec[0].len   = sizeof(FSARequest);
 
-    auto *tmp = data;
-
-    if ((uint32_t) data & 0x3F) {
-        auto *alignedBuffer = memalign(0x40, ROUNDUP(size_bytes * cnt, 0x40));
-        if (!alignedBuffer) {
-            OSReport("## ERROR: FSAEx_RawReadEx buffer not aligned (%08X).\n", data);
-            return FS_ERROR_INVALID_ALIGNMENT;
-        }
-        OSReport("## WARNING: FSAEx_RawReadEx buffer not aligned (%08X). Align to 0x40 for best performance\n", data);
-        tmp = alignedBuffer;
-    }
-
-    shim->ioctlvVec[1].vaddr = (void *) tmp;
+    shim->ioctlvVec[1].vaddr = data;
     shim->ioctlvVec[1].len   = size_bytes * cnt;
 
     shim->ioctlvVec[2].vaddr = &shim->response;
@@ -186,72 +248,280 @@ FSError FSAEx_RawReadEx(int clientHandle, void *data, uint32_t size_bytes, uint3
     request.count         = cnt;
     request.size          = size_bytes;
     request.device_handle = device_handle;
+}
+
+FSError FSAEx_RawTransfer(FSAShimBuffer *shim, int clientHandle, FSACommandEnum command, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    STATS_SCOPE(command == FSA_COMMAND_RAW_READ ? MOCHA_STATS_FSA_RAW_READ_IPC : MOCHA_STATS_FSA_RAW_WRITE_IPC, (uint64_t) size_bytes * cnt);
+    FSAEx_RawSetupRequest(shim, clientHandle, command, data, size_bytes, cnt, blocks_offset, device_handle);
+    OSTime start = OSGetSystemTime();
+    auto res     = Backend_FSAShimSend(shim);
+    RawLatency_Record(clientHandle, device_handle, OSTicksToMicroseconds(OSGetSystemTime() - start));
+    return res;
+}
 
-    auto res = __FSAShimSend(shim, 0);
-    if (res >= 0 && tmp != data) {
-        memcpy(data, tmp, size_bytes * cnt);
+/**
+ * Transfers the given sectors through an aligned bounce buffer of at most maxBounceSize bytes (0 = no limit).
+ */
+static FSError FSAEx_RawTransferBounced(FSAShimBuffer *shim, int clientHandle, FSACommandEnum command, uint8_t *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, uint32_t maxBounceSize) {
+    uint32_t chunkCnt = cnt;
+    if (maxBounceSize != 0 && size_bytes != 0) {
+        chunkCnt = maxBounceSize / size_bytes;
+        if (chunkCnt == 0) {
+            chunkCnt = 1;
+        } else if (chunkCnt > cnt) {
+            chunkCnt = cnt;
+        }
     }
-    if (tmp != data) {
-        free(tmp);
+
+    auto *bounce = (uint8_t *) memalign(0x40, ROUNDUP(size_bytes * chunkCnt, 0x40));
+    if (!bounce) {
+        return FS_ERROR_INVALID_ALIGNMENT;
     }
+    STATS_ALLOCATION();
+
+    FSError res   = FS_ERROR_OK;
+    uint32_t done = 0;
+    do {
+        uint32_t curCnt = cnt - done < chunkCnt ? cnt - done : chunkCnt;
+        uint8_t *cur    = data + done * size_bytes;
+        if (command == FSA_COMMAND_RAW_WRITE) {
+            memcpy(bounce, cur, size_bytes * curCnt);
+            STATS_BOUNCE(size_bytes * curCnt);
+        }
+        res = FSAEx_RawTransfer(shim, clientHandle, command, bounce, size_bytes, curCnt, blocks_offset + done, device_handle);
+        if (res < 0) {
+            break;
+        }
+        if (command == FSA_COMMAND_RAW_READ) {
+            memcpy(cur, bounce, size_bytes * curCnt);
+            STATS_BOUNCE(size_bytes * curCnt);
+        }
+        done += curCnt;
+    } while (done < cnt);
 
-    free(shim);
+    free(bounce);
     return res;
 }
 
-FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
-    if (!client) {
-        return FS_ERROR_INVALID_CLIENTHANDLE;
+/**
+ * Reads into a buffer that is not 0x40 aligned.
+ * The largest part of the transfer that fits into the aligned interior of the buffer is read directly into the callers
+ * buffer and moved into place afterwards, only the remaining tail goes through a (small) bounce buffer.
+ */
+static FSError FSAEx_RawReadUnaligned(FSAShimBuffer *shim, int clientHandle, uint8_t *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, uint32_t maxBounceSize) {
+    uint32_t total   = size_bytes * cnt;
+    uint32_t delta   = (uint32_t) (ROUNDUP((uintptr_t) data, 0x40) - (uintptr_t) data);
+    uint32_t bulkCnt = 0;
+    // maxBounceSize == 0 means the legacy behaviour, bounce everything.
+    if (maxBounceSize != 0 && size_bytes != 0 && total > delta) {
+        bulkCnt = (total - delta) / size_bytes;
+        while (bulkCnt > 0 && ROUNDUP(bulkCnt * size_bytes, 0x40) > total - delta) {
+            bulkCnt--;
+        }
     }
-    return FSAEx_RawWriteEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+
+    FSError res = FS_ERROR_OK;
+    if (bulkCnt > 0) {
+        res = FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_READ, data + delta, size_bytes, bulkCnt, blocks_offset, device_handle);
+        if (res < 0) {
+            return res;
+        }
+        memmove(data, data + delta, size_bytes * bulkCnt);
+        STATS_BOUNCE(size_bytes * bulkCnt);
+        if (bulkCnt == cnt) {
+            return res;
+        }
+    }
+
+    return FSAEx_RawTransferBounced(shim, clientHandle, FSA_COMMAND_RAW_READ, data + size_bytes * bulkCnt, size_bytes, cnt - bulkCnt, blocks_offset + bulkCnt, device_handle, maxBounceSize);
 }
 
-FSError FSAEx_RawWriteEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
-    auto *shim = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+static uint32_t FSAEx_RawGetMaxBounceSize(int clientHandle, int device_handle, const char *functionName, const void *data) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (!state) {
+        return RAW_HANDLE_DEFAULT_MAX_BOUNCE_SIZE;
+    }
+    if (!state->unalignedWarningDone.exchange(true, std::memory_order_relaxed)) {
+        Diag_Post("## WARNING: %s buffer not aligned (%08X). Align to 0x40 for best performance", functionName, (unsigned int) (uintptr_t) data);
+    }
+    return state->maxBounceSize;
+}
+
+FSError FSAEx_RawSetMaxBounceSize(int32_t device_handle, uint32_t maxBounceSize) {
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    state->maxBounceSize = maxBounceSize;
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawReadDevice(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (data == nullptr) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *shim = ShimPool_Acquire();
     if (!shim) {
         return FS_ERROR_INVALID_BUFFER;
     }
 
-    shim->clientHandle = clientHandle;
-    shim->ipcReqType   = FSA_IPC_REQUEST_IOCTLV;
-    shim->command      = FSA_COMMAND_RAW_WRITE;
+    FSError res;
+    if ((uintptr_t) data & 0x3F) {
+        auto maxBounceSize = FSAEx_RawGetMaxBounceSize(clientHandle, device_handle, "FSAEx_RawReadEx", data);
+        res                = FSAEx_RawReadUnaligned(shim, clientHandle, (uint8_t *) data, size_bytes, cnt, blocks_offset, device_handle, maxBounceSize);
+    } else {
+        res = FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_READ, data, size_bytes, cnt, blocks_offset, device_handle);
+    }
 
-    shim->ioctlvVecIn  = uint8_t{2};
-    shim->ioctlvVecOut = uint8_t{1};
+    ShimPool_Release(shim);
+    return res;
+}
 
-    shim->ioctlvVec[0].vaddr = &shim->request;
-    shim->ioctlvVec[0].len   = sizeof(FSARequest);
+FSError FSAEx_RawReadUncached(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (state && state->readAhead) {
+        return RawReadAhead_Read(state->readAhead, clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+    }
+    return FSAEx_RawReadDevice(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
 
-    void *tmp = (void *) data;
-    if ((uint32_t) data & 0x3F) {
-        auto *alignedBuffer = memalign(0x40, ROUNDUP(size_bytes * cnt, 0x40));
-        if (!alignedBuffer) {
-            OSReport("## ERROR: FSAEx_RawWriteEx buffer not aligned (%08X).\n", data);
-            return FS_ERROR_INVALID_ALIGNMENT;
-        }
-        OSReport("## WARNING: FSAEx_RawWriteEx buffer not aligned (%08X). Align to 0x40 for best performance\n", data);
-        tmp = alignedBuffer;
-        memcpy(tmp, data, size_bytes * cnt);
+FSError FSAEx_RawBeforeDeviceRead(RawHandleState *state, uint64_t blocks_offset, uint32_t cnt) {
+    if (!state) {
+        return FS_ERROR_OK;
+    }
+    // Keeps the write buffer and cache from being destroyed while they are used here.
+    OSLockMutex(&state->mutex);
+    FSError res = FS_ERROR_OK;
+    if (state->writeBuffer) {
+        // Buffered writes of this range need to reach the device first.
+        res = RawWriteBuffer_BeforeDeviceAccess(state->writeBuffer, blocks_offset, cnt);
     }
+    if (res >= 0 && state->cache) {
+        // Dirty blocks of a write-back cache need to reach the device first.
+        res = RawCache_BeforeDeviceRead(state->cache, blocks_offset, cnt);
+    }
+    OSUnlockMutex(&state->mutex);
+    return res;
+}
 
-    shim->ioctlvVec[1].vaddr = tmp;
-    shim->ioctlvVec[1].len   = size_bytes * cnt;
+FSError FSAEx_RawReadEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (data == nullptr) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    RawHandleRef state(clientHandle, device_handle, false);
+    FSError res;
+    if (state && RawScheduler_Route(state, false, data, size_bytes, cnt, blocks_offset, &res)) {
+        // Counted in the stats once the scheduler dispatches it.
+        return res;
+    }
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_READ, (uint64_t) size_bytes * cnt);
+    res = FSAEx_RawBeforeDeviceRead(state, blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    return FSAEx_RawReadUncached(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
 
-    shim->ioctlvVec[2].vaddr = &shim->response;
-    shim->ioctlvVec[2].len   = sizeof(FSAResponse);
+FSError FSAEx_RawReadWithShimEx(FSAShimBuffer *shim, int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_READ, (uint64_t) size_bytes * cnt);
+    if (!shim || !data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (((uintptr_t) shim | (uintptr_t) data) & 0x3F) {
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    auto res = FSAEx_RawBeforeDeviceRead(RawHandleRef(clientHandle, device_handle, false), blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    // The read-ahead window is skipped, it never holds data that is newer than the device.
+    return FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_READ, data, size_bytes, cnt, blocks_offset, device_handle);
+}
 
-    auto &request         = shim->request.rawRead;
-    request.blocks_offset = blocks_offset;
-    request.count         = cnt;
-    request.size          = size_bytes;
-    request.device_handle = device_handle;
+FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
 
-    auto res = __FSAShimSend(shim, 0);
+FSError FSAEx_RawWriteDevice(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    auto *shim = ShimPool_Acquire();
+    if (!shim) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
 
-    if (tmp != data) {
-        free(tmp);
+    FSError res;
+    if ((uintptr_t) data & 0x3F) {
+        auto maxBounceSize = FSAEx_RawGetMaxBounceSize(clientHandle, device_handle, "FSAEx_RawWriteEx", data);
+        res                = FSAEx_RawTransferBounced(shim, clientHandle, FSA_COMMAND_RAW_WRITE, (uint8_t *) data, size_bytes, cnt, blocks_offset, device_handle, maxBounceSize);
+    } else {
+        res = FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_WRITE, (void *) data, size_bytes, cnt, blocks_offset, device_handle);
     }
 
-    free(shim);
+    ShimPool_Release(shim);
+    return res;
+}
+
+FSError FSAEx_RawWriteUncached(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (state && state->readAhead) {
+        // Prefetched data of this range would be stale after the write.
+        RawReadAhead_Invalidate(state->readAhead, blocks_offset, cnt);
+    }
+    return FSAEx_RawWriteDevice(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
+
+FSError FSAEx_RawBeforeDeviceWrite(RawHandleState *state, uint64_t blocks_offset, uint32_t cnt) {
+    if (!state) {
+        return FS_ERROR_OK;
+    }
+    // Keeps the write buffer and cache from being destroyed while they are used here.
+    OSLockMutex(&state->mutex);
+    FSError res = FS_ERROR_OK;
+    if (state->writeBuffer) {
+        // Buffered writes of this range are older and must not overwrite this write later.
+        res = RawWriteBuffer_BeforeDeviceAccess(state->writeBuffer, blocks_offset, cnt);
+    }
+    if (res >= 0 && state->cache) {
+        // Cached blocks in this range would be stale after the write.
+        res = RawCache_BeforeDeviceWrite(state->cache, blocks_offset, cnt);
+    }
+    OSUnlockMutex(&state->mutex);
     return res;
-}
\ No newline at end of file
+}
+
+FSError FSAEx_RawWriteEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    FSError res;
+    if (data && state && RawScheduler_Route(state, true, (void *) data, size_bytes, cnt, blocks_offset, &res)) {
+        // Counted in the stats once the scheduler dispatches it.
+        return res;
+    }
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_WRITE, (uint64_t) size_bytes * cnt);
+    res = FSAEx_RawBeforeDeviceWrite(state, blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    return FSAEx_RawWriteUncached(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
+
+FSError FSAEx_RawWriteWithShimEx(FSAShimBuffer *shim, int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_WRITE, (uint64_t) size_bytes * cnt);
+    if (!shim || !data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (((uintptr_t) shim | (uintptr_t) data) & 0x3F) {
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    RawHandleRef state(clientHandle, device_handle, false);
+    auto res    = FSAEx_RawBeforeDeviceWrite(state, blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    if (state && state->readAhead) {
+        // Prefetched data of this range would be stale after the write.
+        RawReadAhead_Invalidate(state->readAhead, blocks_offset, cnt);
+    }
+    return FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_WRITE, (void *) data, size_bytes, cnt, blocks_offset, device_handle);
+}
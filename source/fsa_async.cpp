@@ -0,0 +1,331 @@
+#include "fsa_internal.h"
+#include "backend.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include "stats.h"
+#include <atomic>
+#include <coreinit/event.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/mutex.h>
+#include <malloc.h>
+#include <new>
+
+struct RawAsyncRequest {
+    FSAShimBuffer *shim;
+    RawAsyncQueue *queue;
+    std::atomic<bool> busy;
+    FSAExRawAsyncCallback callback;
+    FSAExRawAsyncResult result;
+};
+
+/**
+ * Allocated as one 0x40 aligned block: [FSAShimBuffer x depth][RawAsyncQueue][RawAsyncRequest x depth][OSMessage x depth]
+ * Every request slot owns its shim buffer, so nothing has to be allocated or freed from the IPC callback.
+ */
+struct RawAsyncQueue {
+    uint32_t depth;
+    std::atomic<uint32_t> inFlight; // Slots in use, including completed requests that were not polled yet.
+    // One reference of the owner, one per request whose IPC callback has not returned yet and one per thread that
+    // waits in FSAEx_RawPollCompletion or RawAsync_WaitForFreeSlot. Taken while asyncMutex is held, dropping the last one signals idleEvent.
+    std::atomic<uint32_t> refs;
+    OSEvent idleEvent;
+    OSEvent slotEvent; // Auto reset, signaled whenever a slot is released.
+    uint32_t queued; // Requests without callback whose result was not claimed by a poll yet, guarded by asyncMutex.
+    OSMessageQueue completionQueue;
+    RawAsyncRequest *requests;
+    OSMessage *messages;
+};
+
+static RawAsyncQueue *RawAsync_CreateQueue(uint32_t depth) {
+    uint32_t size = sizeof(FSAShimBuffer) * depth + sizeof(RawAsyncQueue) + sizeof(RawAsyncRequest) * depth + sizeof(OSMessage) * depth;
+    auto *block   = (uint8_t *) memalign(0x40, size);
+    if (!block) {
+        return nullptr;
+    }
+    auto *shims  = (FSAShimBuffer *) block;
+    auto *queue  = new (block + sizeof(FSAShimBuffer) * depth) RawAsyncQueue();
+    queue->depth = depth;
+    queue->inFlight.store(0);
+    queue->refs.store(1);
+    queue->queued   = 0;
+    queue->requests = (RawAsyncRequest *) (queue + 1);
+    queue->messages = (OSMessage *) (queue->requests + depth);
+    for (uint32_t i = 0; i < depth; i++) {
+        auto *request  = new (&queue->requests[i]) RawAsyncRequest();
+        request->shim  = &shims[i];
+        request->queue = queue;
+        request->busy.store(false);
+    }
+    OSInitMessageQueue(&queue->completionQueue, queue->messages, (int32_t) depth);
+    OSInitEvent(&queue->idleEvent, FALSE, OS_EVENT_MODE_MANUAL);
+    OSInitEvent(&queue->slotEvent, FALSE, OS_EVENT_MODE_AUTO);
+    return queue;
+}
+
+/**
+ * Drops a reference that was taken while the queue was in use. Must be the last access to the queue.
+ */
+static void RawAsync_Unref(RawAsyncQueue *queue) {
+    if (queue->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // RawAsync_DestroyQueue waits for this and frees the queue right after.
+        OSSignalEvent(&queue->idleEvent);
+    }
+}
+
+void RawAsync_DestroyQueue(RawAsyncQueue *queue) {
+    if (!queue) {
+        return;
+    }
+    // IPC callbacks and waiting polls still access the queue, the last of them wakes us up.
+    if (queue->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        OSWaitEvent(&queue->idleEvent);
+    }
+    // The queue lives at the start of the block after the shim buffers.
+    free((uint8_t *) queue - sizeof(FSAShimBuffer) * queue->depth);
+}
+
+static RawAsyncQueue *RawAsync_GetQueue(RawHandleState *state) {
+    auto *queue = state->asyncQueue.load(std::memory_order_acquire);
+    if (queue) {
+        return queue;
+    }
+    auto *newQueue = RawAsync_CreateQueue(state->queueDepth);
+    if (!newQueue) {
+        return nullptr;
+    }
+    if (!state->asyncQueue.compare_exchange_strong(queue, newQueue, std::memory_order_acq_rel)) {
+        // Another thread was faster.
+        RawAsync_DestroyQueue(newQueue);
+        return queue;
+    }
+    return newQueue;
+}
+
+static void RawAsync_ReleaseRequest(RawAsyncRequest *request) {
+    auto *queue = request->queue;
+    request->busy.store(false, std::memory_order_release);
+    queue->inFlight.fetch_sub(1, std::memory_order_release);
+    OSSignalEvent(&queue->slotEvent);
+}
+
+void RawAsync_WaitForFreeSlot(int clientHandle, int32_t device_handle, OSTime timeout) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (!state) {
+        return;
+    }
+    OSLockMutex(&state->asyncMutex);
+    auto *queue = state->asyncQueue.load(std::memory_order_acquire);
+    if (!queue || queue->inFlight.load(std::memory_order_acquire) < queue->depth) {
+        OSUnlockMutex(&state->asyncMutex);
+        return;
+    }
+    // Keeps the queue alive while this waits, like a waiting FSAEx_RawPollCompletion.
+    queue->refs.fetch_add(1, std::memory_order_relaxed);
+    OSUnlockMutex(&state->asyncMutex);
+    OSWaitEventWithTimeout(&queue->slotEvent, timeout);
+    RawAsync_Unref(queue);
+}
+
+// Called from the IPC completion context, must not block.
+static void RawAsync_IosCallback(IOSError err, void *context) {
+    auto *request          = (RawAsyncRequest *) context;
+    auto *queue            = request->queue;
+    request->result.result = FSAEx_DecodeIosError(err);
+
+    if (request->callback) {
+        request->callback(&request->result);
+        RawAsync_ReleaseRequest(request);
+        RawAsync_Unref(queue);
+        return;
+    }
+
+    OSMessage message;
+    message.message = request;
+    message.args[0] = 0;
+    message.args[1] = 0;
+    message.args[2] = 0;
+    // Can't fail, the queue has room for every in flight request.
+    OSSendMessage(&queue->completionQueue, &message, OS_MESSAGE_FLAGS_NONE);
+    RawAsync_Unref(queue);
+}
+
+static FSError FSAEx_RawSubmitAsync(int clientHandle, FSACommandEnum command, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_ASYNC_SUBMIT, (uint64_t) size_bytes * cnt);
+    if (data == nullptr) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if ((uintptr_t) data & 0x3F) {
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    RawHandleRef state(clientHandle, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    // Keeps FSAEx_RawSetQueueDepth and RawHandle_Remove from retiring the queue while it is used here.
+    OSLockMutex(&state->asyncMutex);
+    if (state->deviceHandle.load(std::memory_order_acquire) != device_handle) {
+        // Closed in the meantime.
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_NOT_FOUND;
+    }
+    auto *queue = RawAsync_GetQueue(state);
+    if (!queue) {
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    if (queue->inFlight.fetch_add(1, std::memory_order_acquire) >= queue->depth) {
+        queue->inFlight.fetch_sub(1, std::memory_order_release);
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_BUSY;
+    }
+
+    // There is at least one free slot as inFlight was below depth.
+    RawAsyncRequest *request = nullptr;
+    while (!request) {
+        for (uint32_t i = 0; i < queue->depth; i++) {
+            bool expected = false;
+            if (queue->requests[i].busy.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                request = &queue->requests[i];
+                break;
+            }
+        }
+    }
+
+    request->callback             = callback;
+    request->result.result        = FS_ERROR_OK;
+    request->result.device_handle = device_handle;
+    request->result.data          = data;
+    request->result.size_bytes    = size_bytes;
+    request->result.cnt           = cnt;
+    request->result.blocks_offset = blocks_offset;
+    request->result.userContext   = userContext;
+
+    auto *shim = request->shim;
+    FSAEx_RawSetupRequest(shim, clientHandle, command, data, size_bytes, cnt, blocks_offset, device_handle);
+
+    queue->refs.fetch_add(1, std::memory_order_relaxed);
+    IOSError err;
+    if (gMochaBackend) {
+        err = gMochaBackend->fsaShimSendAsync(shim, RawAsync_IosCallback, request);
+    } else {
+        err = IOS_IoctlvAsync(clientHandle, shim->command, shim->ioctlvVecIn, shim->ioctlvVecOut, shim->ioctlvVec, RawAsync_IosCallback, request);
+    }
+    if (err < 0) {
+        RawAsync_ReleaseRequest(request);
+        RawAsync_Unref(queue);
+        OSUnlockMutex(&state->asyncMutex);
+        return FSAEx_DecodeIosError(err);
+    }
+    if (!callback) {
+        queue->queued++;
+    }
+    OSUnlockMutex(&state->asyncMutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawSetQueueDepth(int32_t device_handle, uint32_t depth) {
+    if (depth == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    // Submissions take the same lock, so no request can be added between the check and the exchange.
+    OSLockMutex(&state->asyncMutex);
+    auto *queue = state->asyncQueue.load(std::memory_order_acquire);
+    if (queue && queue->inFlight.load(std::memory_order_acquire) != 0) {
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_BUSY;
+    }
+    state->queueDepth = depth;
+    // The queue will be recreated with the new depth on the next submission.
+    RawAsync_DestroyQueue(state->asyncQueue.exchange(nullptr, std::memory_order_acq_rel));
+    OSUnlockMutex(&state->asyncMutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawReadAsync(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadAsyncEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, callback, userContext);
+}
+
+FSError FSAEx_RawReadAsyncEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    // Dirty data of the write buffer or block cache has to reach the device before it is read from there.
+    auto res = FSAEx_RawBeforeDeviceRead(RawHandleRef(clientHandle, device_handle, false), blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    return FSAEx_RawReadAsyncDevice(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, callback, userContext);
+}
+
+FSError FSAEx_RawReadAsyncDevice(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    return FSAEx_RawSubmitAsync(clientHandle, FSA_COMMAND_RAW_READ, data, size_bytes, cnt, blocks_offset, device_handle, callback, userContext);
+}
+
+FSError FSAEx_RawWriteAsync(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteAsyncEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, callback, userContext);
+}
+
+FSError FSAEx_RawWriteAsyncEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    // Buffered and cached data of this range would overwrite or hide the new data.
+    auto res = FSAEx_RawBeforeDeviceWrite(state, blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+    if (state && state->readAhead) {
+        // Prefetched data of this range would be stale after the write.
+        RawReadAhead_Invalidate(state->readAhead, blocks_offset, cnt);
+    }
+    return FSAEx_RawSubmitAsync(clientHandle, FSA_COMMAND_RAW_WRITE, (void *) data, size_bytes, cnt, blocks_offset, device_handle, callback, userContext);
+}
+
+FSError FSAEx_RawPollCompletion(int32_t device_handle, FSAExRawAsyncResult *outResult, bool wait) {
+    if (!outResult) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, false);
+    if (!state) {
+        return FS_ERROR_NOT_FOUND;
+    }
+    // Requests with a callback never show up here, only wait if one without callback is outstanding.
+    OSLockMutex(&state->asyncMutex);
+    auto *queue = state->asyncQueue.load(std::memory_order_acquire);
+    if (!queue || queue->queued == 0) {
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_NOT_FOUND;
+    }
+
+    OSMessage message;
+    if (wait) {
+        // Claim one of the outstanding results, its message is guaranteed to arrive. The reference keeps a concurrent
+        // FSAEx_RawCloseEx from freeing the queue while this waits.
+        queue->queued--;
+        queue->refs.fetch_add(1, std::memory_order_relaxed);
+        OSUnlockMutex(&state->asyncMutex);
+        OSReceiveMessage(&queue->completionQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        auto *request = (RawAsyncRequest *) message.message;
+        *outResult    = request->result;
+        RawAsync_ReleaseRequest(request);
+        RawAsync_Unref(queue);
+        return FS_ERROR_OK;
+    }
+    if (!OSReceiveMessage(&queue->completionQueue, &message, OS_MESSAGE_FLAGS_NONE)) {
+        OSUnlockMutex(&state->asyncMutex);
+        return FS_ERROR_BUSY;
+    }
+    // Released while asyncMutex is held, RawHandle_Remove can't retire the queue before.
+    queue->queued--;
+    auto *request = (RawAsyncRequest *) message.message;
+    *outResult    = request->result;
+    RawAsync_ReleaseRequest(request);
+    OSUnlockMutex(&state->asyncMutex);
+    return FS_ERROR_OK;
+}
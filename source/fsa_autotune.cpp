@@ -0,0 +1,189 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include "utils.h"
+#include <coreinit/mutex.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <malloc.h>
+
+#define RAW_AUTOTUNE_CACHE_SIZE        16
+#define RAW_AUTOTUNE_MIN_TRANSFER_SIZE (16 * 1024)
+#define RAW_AUTOTUNE_DEFAULT_MAX_SIZE  (4 * 1024 * 1024)
+#define RAW_AUTOTUNE_BYTES_PER_STEP    (4 * 1024 * 1024)
+// A size is good enough once it reaches this share (in percent) of the best measured throughput.
+#define RAW_AUTOTUNE_SATURATION_PERCENT 95
+
+struct RawAutotuneEntry {
+    char devicePath[RAW_HANDLE_MAX_PATH_LENGTH];
+    uint32_t transferSize;
+};
+
+static RawAutotuneEntry sAutotuneCache[RAW_AUTOTUNE_CACHE_SIZE];
+static uint32_t sAutotuneNextSlot = 0;
+static OSMutex sAutotuneMutex;
+
+static bool RawAutotune_Init() {
+    OSInitMutex(&sAutotuneMutex);
+    return true;
+}
+
+static bool sAutotuneInitDone = RawAutotune_Init();
+
+// Copies the path, the state of the handle may be reused once it was closed.
+static bool RawAutotune_GetDevicePath(int clientHandle, int32_t device_handle, char (&outPath)[RAW_HANDLE_MAX_PATH_LENGTH]) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (!state || !state->devicePath[0]) {
+        return false;
+    }
+    memcpy(outPath, state->devicePath, sizeof(outPath));
+    return true;
+}
+
+uint32_t RawAutotune_GetTransferSize(const char *device_path) {
+    if (!device_path) {
+        return 0;
+    }
+    uint32_t res = 0;
+    OSLockMutex(&sAutotuneMutex);
+    for (auto &entry : sAutotuneCache) {
+        if (entry.transferSize && strncmp(entry.devicePath, device_path, sizeof(entry.devicePath)) == 0) {
+            res = entry.transferSize;
+            break;
+        }
+    }
+    OSUnlockMutex(&sAutotuneMutex);
+    return res;
+}
+
+uint32_t RawAutotune_GetTransferSizeForHandle(int clientHandle, int32_t device_handle) {
+    char device_path[RAW_HANDLE_MAX_PATH_LENGTH];
+    if (!RawAutotune_GetDevicePath(clientHandle, device_handle, device_path)) {
+        return 0;
+    }
+    return RawAutotune_GetTransferSize(device_path);
+}
+
+static void RawAutotune_Store(const char *device_path, uint32_t transferSize) {
+    OSLockMutex(&sAutotuneMutex);
+    RawAutotuneEntry *target = nullptr;
+    for (auto &entry : sAutotuneCache) {
+        if (entry.transferSize && strncmp(entry.devicePath, device_path, sizeof(entry.devicePath)) == 0) {
+            target = &entry;
+            break;
+        }
+    }
+    if (!target) {
+        // Replace the oldest entry once the cache is full.
+        target            = &sAutotuneCache[sAutotuneNextSlot];
+        sAutotuneNextSlot = (sAutotuneNextSlot + 1) % RAW_AUTOTUNE_CACHE_SIZE;
+        strncpy(target->devicePath, device_path, sizeof(target->devicePath) - 1);
+        target->devicePath[sizeof(target->devicePath) - 1] = '\0';
+    }
+    target->transferSize = transferSize;
+    OSUnlockMutex(&sAutotuneMutex);
+}
+
+/**
+ * Reads RAW_AUTOTUNE_BYTES_PER_STEP bytes with the given transfer size and returns the throughput in KiB/s.
+ * Every step continues where the previous one stopped, so the device can't serve the data from its own cache.
+ */
+static FSError RawAutotune_Measure(int clientHandle, int32_t device_handle, uint8_t *buffer, uint32_t size_bytes, uint32_t transferSize, uint64_t *position, uint32_t *outKiBPerSecond) {
+    uint32_t cnt       = transferSize / size_bytes;
+    uint32_t transfers = RAW_AUTOTUNE_BYTES_PER_STEP / transferSize;
+    if (transfers == 0) {
+        transfers = 1;
+    }
+
+    OSTime start = OSGetSystemTime();
+    for (uint32_t i = 0; i < transfers; i++) {
+        auto res = FSAEx_RawReadDevice(clientHandle, buffer, size_bytes, cnt, *position, device_handle);
+        if (res < 0) {
+            return res;
+        }
+        *position += cnt;
+    }
+    uint64_t us = OSTicksToMicroseconds(OSGetSystemTime() - start);
+    if (us == 0) {
+        us = 1;
+    }
+    *outKiBPerSecond = (uint32_t) ((uint64_t) transfers * transferSize / 1024 * 1000000 / us);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawAutotune(FSClient *client, int32_t device_handle, uint32_t size_bytes, uint32_t maxTransferSize, uint32_t *outTransferSize) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawAutotuneEx(FSGetClientBody(client)->clientHandle, device_handle, size_bytes, maxTransferSize, outTransferSize);
+}
+
+FSError FSAEx_RawAutotuneEx(int clientHandle, int32_t device_handle, uint32_t size_bytes, uint32_t maxTransferSize, uint32_t *outTransferSize) {
+    if (size_bytes == 0 || !outTransferSize) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    char device_path[RAW_HANDLE_MAX_PATH_LENGTH];
+    if (!RawAutotune_GetDevicePath(clientHandle, device_handle, device_path)) {
+        // The result is cached per device path, which is only known for handles opened via FSAEx_RawOpen(Ex).
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    if (maxTransferSize == 0) {
+        maxTransferSize = RAW_AUTOTUNE_DEFAULT_MAX_SIZE;
+    }
+    maxTransferSize -= maxTransferSize % size_bytes;
+    if (maxTransferSize == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    auto *buffer = (uint8_t *) memalign(0x40, ROUNDUP(maxTransferSize, 0x40));
+    if (!buffer) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    uint32_t sizes[32];
+    uint32_t speeds[32];
+    uint32_t count    = 0;
+    uint64_t position = 0;
+    FSError res       = FS_ERROR_OK;
+    uint32_t size     = RAW_AUTOTUNE_MIN_TRANSFER_SIZE < size_bytes ? size_bytes : RAW_AUTOTUNE_MIN_TRANSFER_SIZE;
+    size -= size % size_bytes;
+    while (count < 32) {
+        if (size > maxTransferSize) {
+            size = maxTransferSize;
+        }
+        res = RawAutotune_Measure(clientHandle, device_handle, buffer, size_bytes, size, &position, &speeds[count]);
+        if (res < 0) {
+            break;
+        }
+        sizes[count++] = size;
+        if (size == maxTransferSize) {
+            break;
+        }
+        size *= 2;
+    }
+    free(buffer);
+    if (count == 0) {
+        return res;
+    }
+
+    uint32_t best = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        best = speeds[i] > best ? speeds[i] : best;
+    }
+    // Bigger transfers only cost memory once the throughput is saturated, so take the smallest size that is close to the best.
+    uint32_t chosen = sizes[count - 1];
+    for (uint32_t i = 0; i < count; i++) {
+        if ((uint64_t) speeds[i] * 100 >= (uint64_t) best * RAW_AUTOTUNE_SATURATION_PERCENT) {
+            chosen = sizes[i];
+            break;
+        }
+    }
+
+    RawAutotune_Store(device_path, chosen);
+    *outTransferSize = chosen;
+    return FS_ERROR_OK;
+}
+
+uint32_t FSAEx_RawGetTunedTransferSize(const char *device_path) {
+    return RawAutotune_GetTransferSize(device_path);
+}
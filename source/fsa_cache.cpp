@@ -0,0 +1,547 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include "utils.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+#include <malloc.h>
+
+#define RAW_CACHE_INVALID_INDEX 0xFFFFFFFF
+
+struct RawCacheBlock {
+    uint64_t blockIndex; // Offset of the block in blocks of blockSectors sectors.
+    uint32_t lruPrev;
+    uint32_t lruNext;
+    uint32_t hashNext;
+    bool valid;
+    bool dirty;
+};
+
+struct FSAExRawCache {
+    int clientHandle;
+    int device_handle;
+    bool attached;
+    FSAExRawCachePolicy policy;
+    uint32_t sectorSize;
+    uint32_t blockSectors;
+    uint32_t blockCount;
+    uint32_t blockStride; // Size of a block in the data buffer, rounded up to 0x40.
+    RawHandleState *state; // The mutex of the handle guards the cache. Slots are never freed, so this stays valid after a detach.
+    uint8_t *data;
+    RawCacheBlock *blocks;
+    uint32_t *hashTable;
+    uint32_t hashMask;
+    uint32_t lruHead; // most recently used
+    uint32_t lruTail; // least recently used, invalid blocks are kept here.
+    uint32_t dirtyCount;
+    FSAExRawCacheStats stats;
+};
+
+static inline uint8_t *RawCache_BlockData(FSAExRawCache *cache, uint32_t idx) {
+    return cache->data + idx * cache->blockStride;
+}
+
+static inline uint32_t RawCache_Hash(FSAExRawCache *cache, uint64_t blockIndex) {
+    return ((uint32_t) (blockIndex ^ (blockIndex >> 32)) * 2654435761u) & cache->hashMask;
+}
+
+static uint32_t RawCache_Find(FSAExRawCache *cache, uint64_t blockIndex) {
+    uint32_t idx = cache->hashTable[RawCache_Hash(cache, blockIndex)];
+    while (idx != RAW_CACHE_INVALID_INDEX && cache->blocks[idx].blockIndex != blockIndex) {
+        idx = cache->blocks[idx].hashNext;
+    }
+    return idx;
+}
+
+static void RawCache_HashInsert(FSAExRawCache *cache, uint32_t idx) {
+    uint32_t bucket             = RawCache_Hash(cache, cache->blocks[idx].blockIndex);
+    cache->blocks[idx].hashNext = cache->hashTable[bucket];
+    cache->hashTable[bucket]    = idx;
+}
+
+static void RawCache_HashRemove(FSAExRawCache *cache, uint32_t idx) {
+    uint32_t *link = &cache->hashTable[RawCache_Hash(cache, cache->blocks[idx].blockIndex)];
+    while (*link != idx) {
+        link = &cache->blocks[*link].hashNext;
+    }
+    *link = cache->blocks[idx].hashNext;
+}
+
+static void RawCache_LRUUnlink(FSAExRawCache *cache, uint32_t idx) {
+    auto &block = cache->blocks[idx];
+    if (block.lruPrev != RAW_CACHE_INVALID_INDEX) {
+        cache->blocks[block.lruPrev].lruNext = block.lruNext;
+    } else {
+        cache->lruHead = block.lruNext;
+    }
+    if (block.lruNext != RAW_CACHE_INVALID_INDEX) {
+        cache->blocks[block.lruNext].lruPrev = block.lruPrev;
+    } else {
+        cache->lruTail = block.lruPrev;
+    }
+}
+
+static void RawCache_LRUPushFront(FSAExRawCache *cache, uint32_t idx) {
+    RawCache_LRUUnlink(cache, idx);
+    auto &block   = cache->blocks[idx];
+    block.lruPrev = RAW_CACHE_INVALID_INDEX;
+    block.lruNext = cache->lruHead;
+    if (cache->lruHead != RAW_CACHE_INVALID_INDEX) {
+        cache->blocks[cache->lruHead].lruPrev = idx;
+    }
+    cache->lruHead = idx;
+    if (cache->lruTail == RAW_CACHE_INVALID_INDEX) {
+        cache->lruTail = idx;
+    }
+}
+
+static void RawCache_LRUPushBack(FSAExRawCache *cache, uint32_t idx) {
+    RawCache_LRUUnlink(cache, idx);
+    auto &block   = cache->blocks[idx];
+    block.lruNext = RAW_CACHE_INVALID_INDEX;
+    block.lruPrev = cache->lruTail;
+    if (cache->lruTail != RAW_CACHE_INVALID_INDEX) {
+        cache->blocks[cache->lruTail].lruNext = idx;
+    }
+    cache->lruTail = idx;
+    if (cache->lruHead == RAW_CACHE_INVALID_INDEX) {
+        cache->lruHead = idx;
+    }
+}
+
+/**
+ * Writes back the data of the write buffer of the handle that overlaps the range. A range is never held by both, loads
+ * would read stale data from the device and write-backs would be overwritten by older data later otherwise.
+ */
+static FSError RawCache_FlushWriteBuffer(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt) {
+    if (!cache->attached || !cache->state->writeBuffer) {
+        return FS_ERROR_OK;
+    }
+    return RawWriteBuffer_BeforeDeviceAccess(cache->state->writeBuffer, blocks_offset, cnt);
+}
+
+static FSError RawCache_WriteBack(FSAExRawCache *cache, uint32_t idx) {
+    auto &block = cache->blocks[idx];
+    auto res    = RawCache_FlushWriteBuffer(cache, block.blockIndex * cache->blockSectors, cache->blockSectors);
+    if (res < 0) {
+        return res;
+    }
+    if (!block.valid || !block.dirty) {
+        // The flush of the write buffer already wrote back or dropped the block.
+        return FS_ERROR_OK;
+    }
+    res = FSAEx_RawWriteUncached(cache->clientHandle, RawCache_BlockData(cache, idx), cache->sectorSize, cache->blockSectors, block.blockIndex * cache->blockSectors, cache->device_handle);
+    if (res < 0) {
+        return res;
+    }
+    block.dirty = false;
+    cache->dirtyCount--;
+    cache->stats.writebacks++;
+    return FS_ERROR_OK;
+}
+
+static void RawCache_Drop(FSAExRawCache *cache, uint32_t idx) {
+    auto &block = cache->blocks[idx];
+    if (!block.valid) {
+        return;
+    }
+    RawCache_HashRemove(cache, idx);
+    if (block.dirty) {
+        block.dirty = false;
+        cache->dirtyCount--;
+    }
+    block.valid = false;
+    RawCache_LRUPushBack(cache, idx);
+}
+
+/**
+ * Evicts the least recently used block and reuses it for blockIndex.
+ * @param fill read the block from the device.
+ * @param outIdx index of the block.
+ */
+static FSError RawCache_Load(FSAExRawCache *cache, uint64_t blockIndex, bool fill, uint32_t *outIdx) {
+    uint32_t idx = cache->lruTail;
+    auto &block  = cache->blocks[idx];
+    if (block.valid) {
+        if (block.dirty) {
+            auto res = RawCache_WriteBack(cache, idx);
+            if (res < 0) {
+                return res;
+            }
+        }
+        RawCache_Drop(cache, idx);
+        cache->stats.evictions++;
+    }
+    if (fill) {
+        auto res = RawCache_FlushWriteBuffer(cache, blockIndex * cache->blockSectors, cache->blockSectors);
+        if (res < 0) {
+            return res;
+        }
+        res = FSAEx_RawReadUncached(cache->clientHandle, RawCache_BlockData(cache, idx), cache->sectorSize, cache->blockSectors, blockIndex * cache->blockSectors, cache->device_handle);
+        if (res < 0) {
+            return res;
+        }
+    }
+    block.blockIndex = blockIndex;
+    block.valid      = true;
+    RawCache_HashInsert(cache, idx);
+    RawCache_LRUPushFront(cache, idx);
+    *outIdx = idx;
+    return FS_ERROR_OK;
+}
+
+/**
+ * Calls fn for every valid block that overlaps the sector range. Walks either the range or all blocks, whatever is shorter.
+ */
+template<typename Fn>
+static FSError RawCache_ForEachInRange(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt, Fn fn) {
+    if (cnt == 0) {
+        return FS_ERROR_OK;
+    }
+    uint64_t firstBlock = blocks_offset / cache->blockSectors;
+    uint64_t lastBlock  = (blocks_offset + cnt - 1) / cache->blockSectors;
+    if (lastBlock - firstBlock < cache->blockCount) {
+        for (uint64_t b = firstBlock; b <= lastBlock; b++) {
+            uint32_t idx = RawCache_Find(cache, b);
+            if (idx != RAW_CACHE_INVALID_INDEX) {
+                auto res = fn(idx);
+                if (res < 0) {
+                    return res;
+                }
+            }
+        }
+        return FS_ERROR_OK;
+    }
+    for (uint32_t idx = 0; idx < cache->blockCount; idx++) {
+        auto &block = cache->blocks[idx];
+        if (block.valid && block.blockIndex >= firstBlock && block.blockIndex <= lastBlock) {
+            auto res = fn(idx);
+            if (res < 0) {
+                return res;
+            }
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+static FSError RawCache_FlushRange(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt) {
+    if (cache->dirtyCount == 0) {
+        return FS_ERROR_OK;
+    }
+    return RawCache_ForEachInRange(cache, blocks_offset, cnt, [cache](uint32_t idx) {
+        return cache->blocks[idx].dirty ? RawCache_WriteBack(cache, idx) : FS_ERROR_OK;
+    });
+}
+
+static FSError RawCache_FlushAll(FSAExRawCache *cache) {
+    for (uint32_t idx = 0; idx < cache->blockCount && cache->dirtyCount > 0; idx++) {
+        if (cache->blocks[idx].valid && cache->blocks[idx].dirty) {
+            auto res = RawCache_WriteBack(cache, idx);
+            if (res < 0) {
+                return res;
+            }
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+FSError RawCache_BeforeDeviceRead(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt) {
+    OSLockMutex(&cache->state->mutex);
+    auto res = RawCache_FlushRange(cache, blocks_offset, cnt);
+    OSUnlockMutex(&cache->state->mutex);
+    return res;
+}
+
+FSError RawCache_BeforeDeviceWrite(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt) {
+    OSLockMutex(&cache->state->mutex);
+    auto res = RawCache_ForEachInRange(cache, blocks_offset, cnt, [cache, blocks_offset, cnt](uint32_t idx) {
+        auto &block    = cache->blocks[idx];
+        uint64_t start = block.blockIndex * cache->blockSectors;
+        // Dirty sectors that are not overwritten by the upcoming write must not get lost.
+        bool covered = start >= blocks_offset && start + cache->blockSectors <= blocks_offset + cnt;
+        if (block.dirty && !covered) {
+            auto res = RawCache_WriteBack(cache, idx);
+            if (res < 0) {
+                return res;
+            }
+        }
+        RawCache_Drop(cache, idx);
+        return FS_ERROR_OK;
+    });
+    OSUnlockMutex(&cache->state->mutex);
+    return res;
+}
+
+void RawCache_Detach(FSAExRawCache *cache) {
+    OSLockMutex(&cache->state->mutex);
+    if (cache->attached) {
+        RawCache_FlushAll(cache);
+        cache->attached = false;
+        if (cache->state->cache == cache) {
+            cache->state->cache = nullptr;
+        }
+    }
+    OSUnlockMutex(&cache->state->mutex);
+}
+
+FSError FSAEx_RawCacheCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t blockSectors, uint32_t blockCount, FSAExRawCachePolicy policy, FSAExRawCache **outCache) {
+    if (!outCache || size_bytes == 0 || blockSectors == 0 || blockCount == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    RawHandleRef state(clientHandle, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    OSLockMutex(&state->mutex);
+    if (state->cache) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_ALREADY_EXISTS;
+    }
+
+    uint32_t hashSize = 1;
+    while (hashSize < blockCount * 2) {
+        hashSize <<= 1;
+    }
+
+    auto *cache = (FSAExRawCache *) malloc(sizeof(FSAExRawCache));
+    if (!cache) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(cache, 0, sizeof(FSAExRawCache));
+    cache->clientHandle  = clientHandle;
+    cache->device_handle = device_handle;
+    cache->attached      = true;
+    cache->policy        = policy;
+    cache->sectorSize    = size_bytes;
+    cache->blockSectors  = blockSectors;
+    cache->blockCount    = blockCount;
+    cache->blockStride   = ROUNDUP(size_bytes * blockSectors, 0x40);
+    cache->hashMask      = hashSize - 1;
+    cache->state         = state;
+    cache->data          = (uint8_t *) memalign(0x40, cache->blockStride * blockCount);
+    cache->blocks        = (RawCacheBlock *) malloc(sizeof(RawCacheBlock) * blockCount);
+    cache->hashTable     = (uint32_t *) malloc(sizeof(uint32_t) * hashSize);
+    if (!cache->data || !cache->blocks || !cache->hashTable) {
+        free(cache->data);
+        free(cache->blocks);
+        free(cache->hashTable);
+        free(cache);
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    memset(cache->hashTable, 0xFF, sizeof(uint32_t) * hashSize);
+    for (uint32_t i = 0; i < blockCount; i++) {
+        auto &block    = cache->blocks[i];
+        block.valid    = false;
+        block.dirty    = false;
+        block.hashNext = RAW_CACHE_INVALID_INDEX;
+        block.lruPrev  = i == 0 ? RAW_CACHE_INVALID_INDEX : i - 1;
+        block.lruNext  = i + 1 == blockCount ? RAW_CACHE_INVALID_INDEX : i + 1;
+    }
+    cache->lruHead = 0;
+    cache->lruTail = blockCount - 1;
+
+    state->cache = cache;
+    *outCache    = cache;
+    OSUnlockMutex(&state->mutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawCacheRead(FSAExRawCache *cache, void *data, uint32_t cnt, uint64_t blocks_offset) {
+    if (!cache || !data) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&cache->state->mutex);
+    if (!cache->attached) {
+        OSUnlockMutex(&cache->state->mutex);
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    FSError res = FS_ERROR_OK;
+    if (cnt >= cache->blockSectors * cache->blockCount / 2) {
+        // A read of this size would only thrash the cache.
+        res = RawCache_FlushRange(cache, blocks_offset, cnt);
+        if (res >= 0) {
+            res = RawCache_FlushWriteBuffer(cache, blocks_offset, cnt);
+        }
+        if (res >= 0) {
+            res = FSAEx_RawReadUncached(cache->clientHandle, data, cache->sectorSize, cnt, blocks_offset, cache->device_handle);
+        }
+        OSUnlockMutex(&cache->state->mutex);
+        return res;
+    }
+
+    auto *dst       = (uint8_t *) data;
+    uint64_t sector = blocks_offset;
+    uint32_t left   = cnt;
+    while (left > 0) {
+        uint64_t blockIndex = sector / cache->blockSectors;
+        auto inBlock        = (uint32_t) (sector % cache->blockSectors);
+        uint32_t n          = cache->blockSectors - inBlock < left ? cache->blockSectors - inBlock : left;
+
+        uint32_t idx = RawCache_Find(cache, blockIndex);
+        if (idx != RAW_CACHE_INVALID_INDEX) {
+            cache->stats.hits++;
+            RawCache_LRUPushFront(cache, idx);
+        } else {
+            cache->stats.misses++;
+            if (RawCache_Load(cache, blockIndex, true, &idx) < 0) {
+                // e.g. the last block of the device is incomplete, read the requested sectors uncached.
+                idx = RAW_CACHE_INVALID_INDEX;
+            }
+        }
+        if (idx != RAW_CACHE_INVALID_INDEX) {
+            memcpy(dst, RawCache_BlockData(cache, idx) + inBlock * cache->sectorSize, n * cache->sectorSize);
+        } else {
+            res = RawCache_FlushWriteBuffer(cache, sector, n);
+            if (res < 0) {
+                break;
+            }
+            res = FSAEx_RawReadUncached(cache->clientHandle, dst, cache->sectorSize, n, sector, cache->device_handle);
+            if (res < 0) {
+                break;
+            }
+        }
+        dst += n * cache->sectorSize;
+        sector += n;
+        left -= n;
+    }
+    OSUnlockMutex(&cache->state->mutex);
+    return res < 0 ? res : FS_ERROR_OK;
+}
+
+FSError FSAEx_RawCacheWrite(FSAExRawCache *cache, const void *data, uint32_t cnt, uint64_t blocks_offset) {
+    if (!cache || !data) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&cache->state->mutex);
+    if (!cache->attached) {
+        OSUnlockMutex(&cache->state->mutex);
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    // Older buffered data of this range must not overwrite the new data later.
+    FSError res = RawCache_FlushWriteBuffer(cache, blocks_offset, cnt);
+    if (res < 0) {
+        OSUnlockMutex(&cache->state->mutex);
+        return res;
+    }
+    if (cache->policy == FSAEX_RAW_CACHE_WRITE_THROUGH) {
+        res = FSAEx_RawWriteUncached(cache->clientHandle, data, cache->sectorSize, cnt, blocks_offset, cache->device_handle);
+        if (res < 0) {
+            // The device content of this range is unknown now.
+            RawCache_ForEachInRange(cache, blocks_offset, cnt, [cache](uint32_t idx) {
+                RawCache_Drop(cache, idx);
+                return FS_ERROR_OK;
+            });
+            OSUnlockMutex(&cache->state->mutex);
+            return res;
+        }
+    }
+
+    auto *src       = (const uint8_t *) data;
+    uint64_t sector = blocks_offset;
+    uint32_t left   = cnt;
+    while (left > 0) {
+        uint64_t blockIndex = sector / cache->blockSectors;
+        auto inBlock        = (uint32_t) (sector % cache->blockSectors);
+        uint32_t n          = cache->blockSectors - inBlock < left ? cache->blockSectors - inBlock : left;
+
+        uint32_t idx = RawCache_Find(cache, blockIndex);
+        if (cache->policy == FSAEX_RAW_CACHE_WRITE_THROUGH) {
+            // Only update blocks that are already cached, the device has the data anyway.
+            if (idx != RAW_CACHE_INVALID_INDEX) {
+                memcpy(RawCache_BlockData(cache, idx) + inBlock * cache->sectorSize, src, n * cache->sectorSize);
+            }
+        } else {
+            if (idx == RAW_CACHE_INVALID_INDEX) {
+                // Partially written blocks need the rest of their content from the device.
+                if (RawCache_Load(cache, blockIndex, n != cache->blockSectors, &idx) < 0) {
+                    idx = RAW_CACHE_INVALID_INDEX;
+                }
+            } else {
+                RawCache_LRUPushFront(cache, idx);
+            }
+            if (idx != RAW_CACHE_INVALID_INDEX) {
+                memcpy(RawCache_BlockData(cache, idx) + inBlock * cache->sectorSize, src, n * cache->sectorSize);
+                if (!cache->blocks[idx].dirty) {
+                    cache->blocks[idx].dirty = true;
+                    cache->dirtyCount++;
+                }
+            } else {
+                res = FSAEx_RawWriteUncached(cache->clientHandle, src, cache->sectorSize, n, sector, cache->device_handle);
+                if (res < 0) {
+                    break;
+                }
+            }
+        }
+        src += n * cache->sectorSize;
+        sector += n;
+        left -= n;
+    }
+    OSUnlockMutex(&cache->state->mutex);
+    return res < 0 ? res : FS_ERROR_OK;
+}
+
+FSError FSAEx_RawCacheFlush(FSAExRawCache *cache) {
+    if (!cache) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&cache->state->mutex);
+    auto res = cache->attached ? RawCache_FlushAll(cache) : FS_ERROR_OK;
+    OSUnlockMutex(&cache->state->mutex);
+    return res;
+}
+
+FSError FSAEx_RawCacheInvalidate(FSAExRawCache *cache) {
+    if (!cache) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&cache->state->mutex);
+    FSError res = cache->attached ? RawCache_FlushAll(cache) : FS_ERROR_OK;
+    if (res >= 0) {
+        for (uint32_t idx = 0; idx < cache->blockCount; idx++) {
+            RawCache_Drop(cache, idx);
+        }
+    }
+    OSUnlockMutex(&cache->state->mutex);
+    return res;
+}
+
+void FSAEx_RawCacheGetStats(FSAExRawCache *cache, FSAExRawCacheStats *outStats) {
+    if (!cache || !outStats) {
+        return;
+    }
+    OSLockMutex(&cache->state->mutex);
+    *outStats             = cache->stats;
+    outStats->dirtyBlocks = cache->dirtyCount;
+    OSUnlockMutex(&cache->state->mutex);
+}
+
+FSError FSAEx_RawCacheDestroy(FSAExRawCache *cache) {
+    if (!cache) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&cache->state->mutex);
+    FSError res = FS_ERROR_OK;
+    if (cache->attached) {
+        res = RawCache_FlushAll(cache);
+        if (res < 0) {
+            // Keep the cache alive, the dirty blocks would be lost otherwise.
+            OSUnlockMutex(&cache->state->mutex);
+            return res;
+        }
+        if (cache->state->cache == cache) {
+            cache->state->cache = nullptr;
+        }
+    }
+    OSUnlockMutex(&cache->state->mutex);
+
+    free(cache->data);
+    free(cache->blocks);
+    free(cache->hashTable);
+    free(cache);
+    return FS_ERROR_OK;
+}
@@ -0,0 +1,309 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "stats.h"
+#include "utils.h"
+#include <coreinit/messagequeue.h>
+#include <coreinit/time.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#define RAW_COPY_DEFAULT_CHUNK_SIZE   (1024 * 1024)
+#define RAW_COPY_DEFAULT_BUFFER_COUNT 3
+#define RAW_COPY_MAX_BUFFER_COUNT     16
+// Give up after waiting this long for a slot of the async queue while none of our transfers is in flight.
+#define RAW_COPY_BUSY_TIMEOUT_MS      1000
+
+struct RawCopyContext;
+
+struct RawCopySlot {
+    RawCopyContext *ctx;
+    uint8_t *buffer;
+    uint64_t sector;
+    uint32_t count;
+    bool loaded;
+    bool inFlight;
+    bool done;
+    bool hashPending;
+    uint32_t hashJob;
+    FSError result;
+};
+
+struct RawCopyContext {
+    int clientHandle;
+    int device_handle;
+    const FSAExRawCopyParams *params;
+    RawHashPipeline *hashPipeline; // NULL if the copy isn't hashed
+    uint32_t chunkSectors;
+    uint32_t slotCount;
+    RawCopySlot slots[RAW_COPY_MAX_BUFFER_COUNT];
+    uint32_t head;     // oldest submitted slot
+    uint32_t inFlight; // number of submitted but not yet retired slots
+    OSMessageQueue completionQueue;
+    OSMessage messages[RAW_COPY_MAX_BUFFER_COUNT];
+};
+
+// Called from the IPC completion context.
+static void RawCopy_AsyncCallback(const FSAExRawAsyncResult *result) {
+    auto *slot = (RawCopySlot *) result->userContext;
+    OSMessage message;
+    message.message = slot;
+    message.args[0] = (uint32_t) result->result;
+    message.args[1] = 0;
+    message.args[2] = 0;
+    OSSendMessage(&slot->ctx->completionQueue, &message, OS_MESSAGE_FLAGS_NONE);
+}
+
+static void RawCopy_ReceiveCompletion(RawCopyContext *ctx) {
+    OSMessage message;
+    OSReceiveMessage(&ctx->completionQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    auto *slot     = (RawCopySlot *) message.message;
+    slot->inFlight = false;
+    slot->done     = true;
+    slot->result   = (FSError) message.args[0];
+}
+
+/**
+ * Blocks until the oldest submitted slot has completed.
+ */
+static RawCopySlot *RawCopy_WaitOldest(RawCopyContext *ctx) {
+    auto *slot = &ctx->slots[ctx->head];
+    while (!slot->done) {
+        RawCopy_ReceiveCompletion(ctx);
+    }
+    return slot;
+}
+
+static void RawCopy_RetireOldest(RawCopyContext *ctx) {
+    ctx->slots[ctx->head].done = false;
+    ctx->head                  = (ctx->head + 1) % ctx->slotCount;
+    ctx->inFlight--;
+}
+
+static void RawCopy_Drain(RawCopyContext *ctx) {
+    while (ctx->inFlight > 0) {
+        RawCopy_WaitOldest(ctx);
+        RawCopy_RetireOldest(ctx);
+    }
+}
+
+/**
+ * Submits the async transfer for the next free slot.
+ * @return FS_ERROR_OK on success, FS_ERROR_BUSY if the queue depth of the device handle is reached.
+ */
+static FSError RawCopy_Submit(RawCopyContext *ctx, RawCopySlot *slot) {
+    auto *params   = ctx->params;
+    slot->inFlight = true;
+    slot->done     = false;
+    FSError res;
+    if (params->direction == FSAEX_RAW_COPY_DEVICE_TO_FILE) {
+        res = FSAEx_RawReadAsyncEx(ctx->clientHandle, slot->buffer, params->sectorSize, slot->count, slot->sector, ctx->device_handle, RawCopy_AsyncCallback, slot);
+    } else {
+        res = FSAEx_RawWriteAsyncEx(ctx->clientHandle, slot->buffer, params->sectorSize, slot->count, slot->sector, ctx->device_handle, RawCopy_AsyncCallback, slot);
+    }
+    if (res != FS_ERROR_OK) {
+        slot->inFlight = false;
+    }
+    return res;
+}
+
+static FSError RawCopy_FileIO(RawCopyContext *ctx, RawCopySlot *slot) {
+    auto *params  = ctx->params;
+    uint32_t size = slot->count * params->sectorSize;
+    if (params->fileCallback) {
+        uint64_t offset = (slot->sector - params->firstSector) * params->sectorSize;
+        if (params->fileCallback(slot->buffer, size, offset, params->userContext) != (int32_t) size) {
+            return params->direction == FSAEX_RAW_COPY_DEVICE_TO_FILE ? FS_ERROR_STORAGE_FULL : FS_ERROR_END_OF_FILE;
+        }
+        return FS_ERROR_OK;
+    }
+    if (params->direction == FSAEX_RAW_COPY_DEVICE_TO_FILE) {
+        if (write(params->fd, slot->buffer, size) != (ssize_t) size) {
+            return FS_ERROR_STORAGE_FULL;
+        }
+    } else {
+        if (read(params->fd, slot->buffer, size) != (ssize_t) size) {
+            return FS_ERROR_END_OF_FILE;
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+static void RawCopy_Hash(RawCopyContext *ctx, RawCopySlot *slot) {
+    if (ctx->hashPipeline) {
+        slot->hashJob     = RawHash_Submit(ctx->hashPipeline, slot->buffer, slot->count * ctx->params->sectorSize, slot->sector, slot->count);
+        slot->hashPending = true;
+    }
+}
+
+static FSError RawCopy_Run(RawCopyContext *ctx, uint64_t *nextSector) {
+    auto *params       = ctx->params;
+    uint64_t endSector = params->firstSector + params->sectorCount;
+    uint64_t submitPos = *nextSector;
+    uint32_t tail      = 0;
+    OSTime busyUntil   = 0;
+    bool toFile        = params->direction == FSAEX_RAW_COPY_DEVICE_TO_FILE;
+
+    while (true) {
+        // Keep as many transfers in flight as we have buffers.
+        while (ctx->inFlight < ctx->slotCount && submitPos < endSector) {
+            auto *slot = &ctx->slots[tail];
+            if (!slot->loaded) {
+                if (slot->hashPending) {
+                    // The buffer is about to be overwritten.
+                    RawHash_Wait(ctx->hashPipeline, slot->hashJob);
+                    slot->hashPending = false;
+                }
+                slot->sector = submitPos;
+                slot->count  = endSector - submitPos < ctx->chunkSectors ? (uint32_t) (endSector - submitPos) : ctx->chunkSectors;
+                if (!toFile) {
+                    // Reading the file overlaps with the device writes that are already in flight.
+                    auto res = RawCopy_FileIO(ctx, slot);
+                    if (res != FS_ERROR_OK) {
+                        return res;
+                    }
+                    // Hashing only reads the buffer, so it overlaps with the device write of the same chunk.
+                    RawCopy_Hash(ctx, slot);
+                }
+                slot->loaded = true;
+            }
+            auto res = RawCopy_Submit(ctx, slot);
+            if (res == FS_ERROR_BUSY && ctx->inFlight > 0) {
+                // The queue depth of the handle is smaller than our buffer count, wait for the oldest transfer first.
+                // The slot stays loaded and is submitted again in the next round.
+                break;
+            }
+            if (res == FS_ERROR_BUSY) {
+                // The slots are shared with read-ahead prefetches and async requests of other callers, none of ours
+                // would free one. Wait until one of theirs is released.
+                OSTime now = OSGetSystemTime();
+                if (busyUntil == 0) {
+                    busyUntil = now + OSMillisecondsToTicks(RAW_COPY_BUSY_TIMEOUT_MS);
+                }
+                if (now < busyUntil) {
+                    RawAsync_WaitForFreeSlot(ctx->clientHandle, ctx->device_handle, busyUntil - now);
+                    continue;
+                }
+            }
+            if (res != FS_ERROR_OK) {
+                return res;
+            }
+            busyUntil    = 0;
+            slot->loaded = false;
+            ctx->inFlight++;
+            tail = (tail + 1) % ctx->slotCount;
+            submitPos += slot->count;
+        }
+
+        if (ctx->inFlight == 0) {
+            return FS_ERROR_OK;
+        }
+
+        auto *slot = RawCopy_WaitOldest(ctx);
+        if (slot->result < 0) {
+            return slot->result;
+        }
+        if (toFile) {
+            // Writing the file and hashing overlap with the device reads that are still in flight.
+            RawCopy_Hash(ctx, slot);
+            auto res = RawCopy_FileIO(ctx, slot);
+            if (res != FS_ERROR_OK) {
+                return res;
+            }
+        }
+        *nextSector = slot->sector + slot->count;
+        RawCopy_RetireOldest(ctx);
+
+        if (params->progressCallback && !params->progressCallback(*nextSector - params->firstSector, params->sectorCount, params->userContext)) {
+            return FS_ERROR_CANCELLED;
+        }
+    }
+}
+
+FSError FSAEx_RawCopy(FSClient *client, int device_handle, const FSAExRawCopyParams *params, uint64_t *outNextSector) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawCopyEx(FSGetClientBody(client)->clientHandle, device_handle, params, outNextSector);
+}
+
+FSError FSAEx_RawCopyEx(int clientHandle, int device_handle, const FSAExRawCopyParams *params, uint64_t *outNextSector) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_COPY, 0);
+    if (!params || params->sectorSize == 0 || params->bufferCount > RAW_COPY_MAX_BUFFER_COUNT) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (!params->fileCallback && params->fd < 0) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    uint64_t endSector = params->firstSector + params->sectorCount;
+    if (params->resumeSector < params->firstSector || params->resumeSector > endSector) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    // Use the size determined by FSAEx_RawAutotune if the device has been tuned.
+    uint32_t chunkSize = RawAutotune_GetTransferSizeForHandle(clientHandle, device_handle);
+    if (chunkSize == 0) {
+        chunkSize = RAW_COPY_DEFAULT_CHUNK_SIZE;
+    }
+
+    auto *ctx = (RawCopyContext *) malloc(sizeof(RawCopyContext));
+    if (!ctx) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    ctx->clientHandle  = clientHandle;
+    ctx->device_handle = device_handle;
+    ctx->params        = params;
+    ctx->chunkSectors  = params->chunkSectors ? params->chunkSectors : chunkSize / params->sectorSize;
+    if (ctx->chunkSectors == 0) {
+        ctx->chunkSectors = 1;
+    }
+    ctx->slotCount    = params->bufferCount ? params->bufferCount : RAW_COPY_DEFAULT_BUFFER_COUNT;
+    ctx->head         = 0;
+    ctx->inFlight     = 0;
+    ctx->hashPipeline = nullptr;
+    OSInitMessageQueue(&ctx->completionQueue, ctx->messages, RAW_COPY_MAX_BUFFER_COUNT);
+
+    FSError res = FS_ERROR_OK;
+    for (uint32_t i = 0; i < ctx->slotCount; i++) {
+        auto &slot       = ctx->slots[i];
+        slot.ctx         = ctx;
+        slot.buffer      = (uint8_t *) memalign(0x40, ROUNDUP(ctx->chunkSectors * params->sectorSize, 0x40));
+        slot.loaded      = false;
+        slot.inFlight    = false;
+        slot.done        = false;
+        slot.hashPending = false;
+        if (!slot.buffer) {
+            res = FS_ERROR_OUT_OF_RESOURCES;
+        }
+    }
+
+    uint64_t nextSector = params->resumeSector;
+    if (res == FS_ERROR_OK && !params->fileCallback && nextSector != params->firstSector) {
+        if (lseek(params->fd, (off_t) ((nextSector - params->firstSector) * params->sectorSize), SEEK_SET) < 0) {
+            res = FS_ERROR_INVALID_FILEHANDLE;
+        }
+    }
+    if (res == FS_ERROR_OK && params->hashParams) {
+        ctx->hashPipeline = RawHash_Create(params->hashParams);
+        if (!ctx->hashPipeline) {
+            res = FS_ERROR_OUT_OF_RESOURCES;
+        }
+    }
+    if (res == FS_ERROR_OK) {
+        res = RawCopy_Run(ctx, &nextSector);
+    }
+    // All buffers need to be idle before they can be freed.
+    RawCopy_Drain(ctx);
+    if (ctx->hashPipeline) {
+        RawHash_Finish(ctx->hashPipeline, res == FS_ERROR_OK ? params->hashParams->outDigest : nullptr);
+    }
+
+    for (uint32_t i = 0; i < ctx->slotCount; i++) {
+        free(ctx->slots[i].buffer);
+    }
+    free(ctx);
+
+    if (outNextSector) {
+        *outNextSector = nextSector;
+    }
+    return res;
+}
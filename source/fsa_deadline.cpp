@@ -0,0 +1,202 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include <coreinit/time.h>
+
+#define RAW_DEADLINE_DEFAULT_CHUNK_SIZE (128 * 1024)
+
+/*
+ * Latencies are kept in a log-linear histogram: values below 4 us have their own bucket, above that every power of two
+ * is split into 4 buckets. The relative error of a percentile is at most 25%.
+ */
+static uint32_t RawLatency_Bucket(uint32_t us) {
+    if (us < 4) {
+        return us;
+    }
+    uint32_t msb    = 31 - __builtin_clz(us);
+    uint32_t bucket = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+    return bucket < RAW_HANDLE_LATENCY_BUCKETS ? bucket : RAW_HANDLE_LATENCY_BUCKETS - 1;
+}
+
+/**
+ * Largest latency that falls into a bucket.
+ */
+static uint32_t RawLatency_BucketUpperBound(uint32_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    uint32_t shift = bucket / 4 - 1;
+    return ((4 + bucket % 4) << shift) + (1 << shift) - 1;
+}
+
+void RawLatency_Record(int clientHandle, int32_t device_handle, uint64_t latencyUs) {
+    RawHandleRef state(clientHandle, device_handle, false);
+    if (!state) {
+        return;
+    }
+    uint32_t us = latencyUs > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) latencyUs;
+    state->latencyBuckets[RawLatency_Bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = state->latencyMaxUs.load(std::memory_order_relaxed);
+    while (us > max && !state->latencyMaxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+        // A failed exchange reloads max.
+    }
+}
+
+FSError FSAEx_RawGetLatencyStats(int32_t device_handle, FSAExRawLatencyStats *outStats) {
+    if (!outStats) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, false);
+    if (!state) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    uint32_t buckets[RAW_HANDLE_LATENCY_BUCKETS];
+    uint32_t samples = 0;
+    for (uint32_t i = 0; i < RAW_HANDLE_LATENCY_BUCKETS; i++) {
+        buckets[i] = state->latencyBuckets[i].load(std::memory_order_relaxed);
+        samples += buckets[i];
+    }
+
+    outStats->samples = samples;
+    outStats->p50Us   = 0;
+    outStats->p90Us   = 0;
+    outStats->p99Us   = 0;
+    outStats->maxUs   = state->latencyMaxUs.load(std::memory_order_relaxed);
+    if (samples == 0) {
+        return FS_ERROR_OK;
+    }
+
+    // Smallest bucket that contains at least the given share of the samples.
+    uint64_t p50Rank = ((uint64_t) samples * 50 + 99) / 100;
+    uint64_t p90Rank = ((uint64_t) samples * 90 + 99) / 100;
+    uint64_t p99Rank = ((uint64_t) samples * 99 + 99) / 100;
+    uint64_t seen    = 0;
+    for (uint32_t i = 0; i < RAW_HANDLE_LATENCY_BUCKETS; i++) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        uint64_t before = seen;
+        seen += buckets[i];
+        uint32_t upper = RawLatency_BucketUpperBound(i);
+        if (upper > outStats->maxUs) {
+            upper = outStats->maxUs;
+        }
+        if (before < p50Rank && seen >= p50Rank) {
+            outStats->p50Us = upper;
+        }
+        if (before < p90Rank && seen >= p90Rank) {
+            outStats->p90Us = upper;
+        }
+        if (before < p99Rank && seen >= p99Rank) {
+            outStats->p99Us = upper;
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawResetLatencyStats(int32_t device_handle) {
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, false);
+    if (!state) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    for (auto &bucket : state->latencyBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    state->latencyMaxUs.store(0, std::memory_order_relaxed);
+    return FS_ERROR_OK;
+}
+
+static uint32_t RawDeadline_GetChunkSectors(const FSAExRawDeadlineParams *params, uint32_t size_bytes, int clientHandle, int device_handle) {
+    if (params->chunkSectors) {
+        return params->chunkSectors;
+    }
+    // Smaller chunks check the deadline more often, so the tuned size is only used if it's smaller than the default.
+    uint32_t chunkSize = RawAutotune_GetTransferSizeForHandle(clientHandle, device_handle);
+    if (chunkSize == 0 || chunkSize > RAW_DEADLINE_DEFAULT_CHUNK_SIZE) {
+        chunkSize = RAW_DEADLINE_DEFAULT_CHUNK_SIZE;
+    }
+    return chunkSize / size_bytes ? chunkSize / size_bytes : 1;
+}
+
+/**
+ * Checks the cancel token and the deadline before the next chunk is started.
+ */
+static FSError RawDeadline_Check(const FSAExRawDeadlineParams *params) {
+    if (params->cancelToken && params->cancelToken->cancelled) {
+        return FS_ERROR_CANCELLED;
+    }
+    if (params->deadline != 0 && OSGetSystemTime() >= params->deadline) {
+        return FS_ERROR_BUSY;
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawReadDeadline(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadDeadlineEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, params, outSectorsDone);
+}
+
+FSError FSAEx_RawReadDeadlineEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone) {
+    if (!data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (!params || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    uint32_t chunkSectors = RawDeadline_GetChunkSectors(params, size_bytes, clientHandle, device_handle);
+    auto *dst             = (uint8_t *) data;
+    uint32_t done         = 0;
+    FSError res           = FS_ERROR_OK;
+    while (done < cnt) {
+        if ((res = RawDeadline_Check(params)) < 0) {
+            break;
+        }
+        uint32_t count = cnt - done < chunkSectors ? cnt - done : chunkSectors;
+        if ((res = FSAEx_RawReadEx(clientHandle, dst, size_bytes, count, blocks_offset + done, device_handle)) < 0) {
+            break;
+        }
+        dst += count * size_bytes;
+        done += count;
+    }
+    if (outSectorsDone) {
+        *outSectorsDone = done;
+    }
+    return res;
+}
+
+FSError FSAEx_RawWriteDeadline(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteDeadlineEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, params, outSectorsDone);
+}
+
+FSError FSAEx_RawWriteDeadlineEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawDeadlineParams *params, uint32_t *outSectorsDone) {
+    if (!data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (!params || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    uint32_t chunkSectors = RawDeadline_GetChunkSectors(params, size_bytes, clientHandle, device_handle);
+    auto *src             = (const uint8_t *) data;
+    uint32_t done         = 0;
+    FSError res           = FS_ERROR_OK;
+    while (done < cnt) {
+        if ((res = RawDeadline_Check(params)) < 0) {
+            break;
+        }
+        uint32_t count = cnt - done < chunkSectors ? cnt - done : chunkSectors;
+        if ((res = FSAEx_RawWriteEx(clientHandle, src, size_bytes, count, blocks_offset + done, device_handle)) < 0) {
+            break;
+        }
+        src += count * size_bytes;
+        done += count;
+    }
+    if (outSectorsDone) {
+        *outSectorsDone = done;
+    }
+    return res;
+}
@@ -0,0 +1,220 @@
+#include "fsa_internal.h"
+#include "hash.h"
+#include "mocha/fsa.h"
+#include <coreinit/core.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <malloc.h>
+#include <new>
+
+#define RAW_HASH_DEFAULT_CHUNK_SIZE (1024 * 1024)
+#define RAW_HASH_THREAD_STACK_SIZE  0x4000
+#define RAW_HASH_THREAD_PRIORITY    16
+
+struct RawHashJob {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t cnt;
+    uint64_t blocks_offset;
+};
+
+struct RawHashPipeline {
+    OSThread thread;
+    const FSAExRawHashParams *params;
+    HashState whole;
+    HashState chunk;
+    uint8_t *stack;
+    // Only touched by the submitting thread, jobs complete in submission order.
+    uint32_t submitted;
+    uint32_t completed;
+    RawHashJob jobs[RAW_HASH_MAX_PENDING];
+    OSMessageQueue jobQueue;
+    OSMessage jobMessages[RAW_HASH_MAX_PENDING];
+    OSMessageQueue doneQueue;
+    OSMessage doneMessages[RAW_HASH_MAX_PENDING];
+};
+
+static int RawHash_ThreadEntry(int argc, const char **argv) {
+    (void) argc;
+    auto *pipeline = (RawHashPipeline *) argv;
+    auto *params   = pipeline->params;
+    OSMessage message;
+    while (true) {
+        OSReceiveMessage(&pipeline->jobQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        if (!message.message) {
+            break;
+        }
+        auto *job = (RawHashJob *) message.message;
+        Hash_Update(&pipeline->whole, job->data, job->size);
+        if (params->chunkCallback) {
+            FSAExHashDigest digest;
+            Hash_Init(&pipeline->chunk, params->algorithms);
+            Hash_Update(&pipeline->chunk, job->data, job->size);
+            Hash_Final(&pipeline->chunk, &digest);
+            params->chunkCallback(job->blocks_offset, job->cnt, &digest, params->userContext);
+        }
+        OSSendMessage(&pipeline->doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    }
+    return 0;
+}
+
+RawHashPipeline *RawHash_Create(const FSAExRawHashParams *params) {
+    auto *pipeline = (RawHashPipeline *) memalign(0x40, sizeof(RawHashPipeline));
+    if (!pipeline) {
+        return nullptr;
+    }
+    new (pipeline) RawHashPipeline();
+    pipeline->params    = params;
+    pipeline->submitted = 0;
+    pipeline->completed = 0;
+    pipeline->stack     = (uint8_t *) memalign(0x10, RAW_HASH_THREAD_STACK_SIZE);
+    Hash_Init(&pipeline->whole, params->algorithms);
+    OSInitMessageQueue(&pipeline->jobQueue, pipeline->jobMessages, RAW_HASH_MAX_PENDING);
+    OSInitMessageQueue(&pipeline->doneQueue, pipeline->doneMessages, RAW_HASH_MAX_PENDING);
+
+    // Run on the next core, the submitting thread keeps its core for the I/O.
+    auto affinity = (OSThreadAttributes) (OS_THREAD_ATTRIB_AFFINITY_CPU0 << ((OSGetCoreId() + 1) % 3));
+    if (!pipeline->stack ||
+        !OSCreateThread(&pipeline->thread, RawHash_ThreadEntry, 0, (char *) pipeline, pipeline->stack + RAW_HASH_THREAD_STACK_SIZE, RAW_HASH_THREAD_STACK_SIZE, RAW_HASH_THREAD_PRIORITY, affinity)) {
+        free(pipeline->stack);
+        free(pipeline);
+        return nullptr;
+    }
+    OSSetThreadName(&pipeline->thread, "FSAEx_RawHash");
+    OSResumeThread(&pipeline->thread);
+    return pipeline;
+}
+
+uint32_t RawHash_Submit(RawHashPipeline *pipeline, const void *data, uint32_t size, uint64_t blocks_offset, uint32_t cnt) {
+    if (pipeline->submitted - pipeline->completed == RAW_HASH_MAX_PENDING) {
+        RawHash_Wait(pipeline, pipeline->completed);
+    }
+    auto *job          = &pipeline->jobs[pipeline->submitted % RAW_HASH_MAX_PENDING];
+    job->data          = (const uint8_t *) data;
+    job->size          = size;
+    job->cnt           = cnt;
+    job->blocks_offset = blocks_offset;
+
+    OSMessage message;
+    message.message = job;
+    message.args[0] = 0;
+    message.args[1] = 0;
+    message.args[2] = 0;
+    OSSendMessage(&pipeline->jobQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    return pipeline->submitted++;
+}
+
+void RawHash_Wait(RawHashPipeline *pipeline, uint32_t job) {
+    // Sequence numbers wrap, compare the distance instead of the values.
+    while ((int32_t) (pipeline->completed - job) <= 0) {
+        OSMessage message;
+        OSReceiveMessage(&pipeline->doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        pipeline->completed++;
+    }
+}
+
+void RawHash_Finish(RawHashPipeline *pipeline, FSAExHashDigest *outDigest) {
+    if (pipeline->submitted != pipeline->completed) {
+        RawHash_Wait(pipeline, pipeline->submitted - 1);
+    }
+    OSMessage message;
+    message.message = nullptr;
+    message.args[0] = 0;
+    message.args[1] = 0;
+    message.args[2] = 0;
+    OSSendMessage(&pipeline->jobQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    OSJoinThread(&pipeline->thread, nullptr);
+
+    if (outDigest) {
+        Hash_Final(&pipeline->whole, outDigest);
+    }
+    free(pipeline->stack);
+    free(pipeline);
+}
+
+static uint32_t RawHash_GetChunkSectors(const FSAExRawHashParams *hashParams, uint32_t size_bytes, int clientHandle, int device_handle) {
+    if (hashParams->chunkSectors) {
+        return hashParams->chunkSectors;
+    }
+    uint32_t chunkSize = RawAutotune_GetTransferSizeForHandle(clientHandle, device_handle);
+    if (chunkSize == 0) {
+        chunkSize = RAW_HASH_DEFAULT_CHUNK_SIZE;
+    }
+    return chunkSize / size_bytes ? chunkSize / size_bytes : 1;
+}
+
+FSError FSAEx_RawReadHashed(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadHashedEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, hashParams);
+}
+
+FSError FSAEx_RawReadHashedEx(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams) {
+    if (!data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (!hashParams || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto *pipeline = RawHash_Create(hashParams);
+    if (!pipeline) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    uint32_t chunkSectors = RawHash_GetChunkSectors(hashParams, size_bytes, clientHandle, device_handle);
+    auto *dst             = (uint8_t *) data;
+    FSError res           = FS_ERROR_OK;
+    for (uint32_t done = 0; done < cnt;) {
+        uint32_t count = cnt - done < chunkSectors ? cnt - done : chunkSectors;
+        res            = FSAEx_RawReadEx(clientHandle, dst, size_bytes, count, blocks_offset + done, device_handle);
+        if (res < 0) {
+            break;
+        }
+        // The chunk is hashed on the other core while the next one is read.
+        RawHash_Submit(pipeline, dst, count * size_bytes, blocks_offset + done, count);
+        dst += count * size_bytes;
+        done += count;
+    }
+
+    RawHash_Finish(pipeline, res == FS_ERROR_OK ? hashParams->outDigest : nullptr);
+    return res;
+}
+
+FSError FSAEx_RawWriteHashed(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteHashedEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, hashParams);
+}
+
+FSError FSAEx_RawWriteHashedEx(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, const FSAExRawHashParams *hashParams) {
+    if (!data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (!hashParams || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto *pipeline = RawHash_Create(hashParams);
+    if (!pipeline) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    uint32_t chunkSectors = RawHash_GetChunkSectors(hashParams, size_bytes, clientHandle, device_handle);
+    auto *src             = (const uint8_t *) data;
+    FSError res           = FS_ERROR_OK;
+    for (uint32_t done = 0; done < cnt;) {
+        uint32_t count = cnt - done < chunkSectors ? cnt - done : chunkSectors;
+        // Both only read the chunk, so it can be hashed while it is written.
+        RawHash_Submit(pipeline, src, count * size_bytes, blocks_offset + done, count);
+        res = FSAEx_RawWriteEx(clientHandle, src, size_bytes, count, blocks_offset + done, device_handle);
+        if (res < 0) {
+            break;
+        }
+        src += count * size_bytes;
+        done += count;
+    }
+
+    RawHash_Finish(pipeline, res == FS_ERROR_OK ? hashParams->outDigest : nullptr);
+    return res;
+}
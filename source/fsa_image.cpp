@@ -0,0 +1,439 @@
+#include "lz_codec.h"
+#include "mocha/fsa.h"
+#include "utils.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+#include <malloc.h>
+#include <unistd.h>
+
+/*
+ * Container layout, all values big endian, offsets relative to the position of the file descriptor at creation:
+ * [header, 0x40 bytes][stored blocks][index: blockCount entries of 16 bytes]
+ * Header: magic "MOCHAIMG", version, blockSize, imageSize (u64), blockCount, reserved, indexOffset (u64)
+ * Index entry: offset of the stored data (u64), stored size (u32), type (u32)
+ */
+#define RAW_IMAGE_MAGIC              "MOCHAIMG"
+#define RAW_IMAGE_VERSION            1
+#define RAW_IMAGE_HEADER_SIZE        0x40
+#define RAW_IMAGE_INDEX_ENTRY_SIZE   16
+#define RAW_IMAGE_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define RAW_IMAGE_MAX_BLOCK_SIZE     (1024 * 1024)
+
+enum RawImageBlockType {
+    RAW_IMAGE_BLOCK_HOLE = 0, // all zeros, nothing stored
+    RAW_IMAGE_BLOCK_RAW  = 1, // stored as is
+    RAW_IMAGE_BLOCK_LZ   = 2, // compressed with LZ_Compress
+};
+
+struct RawImageIndexEntry {
+    uint64_t offset;
+    uint32_t storedSize;
+    uint32_t type;
+};
+
+struct FSAExRawImageWriter {
+    int fd;
+    off_t base;
+    uint32_t blockSize;
+    uint64_t imageSize;
+    uint64_t filePos;
+    uint8_t *block;
+    uint32_t blockFill;
+    uint8_t *compressed;
+    uint32_t *hashTable;
+    RawImageIndexEntry *index;
+    uint32_t indexCount;
+    uint32_t indexCapacity;
+    FSError error;
+    FSAExRawImageStats stats;
+};
+
+struct FSAExRawImageReader {
+    int fd;
+    off_t base;
+    uint32_t blockSize;
+    uint64_t imageSize;
+    uint32_t blockCount;
+    RawImageIndexEntry *index;
+    uint8_t *block;
+    uint8_t *compressed;
+    int64_t cachedBlock;
+    OSMutex mutex;
+};
+
+static inline void RawImage_Put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static inline void RawImage_Put64(uint8_t *p, uint64_t v) {
+    RawImage_Put32(p, (uint32_t) (v >> 32));
+    RawImage_Put32(p + 4, (uint32_t) v);
+}
+
+static inline uint32_t RawImage_Get32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline uint64_t RawImage_Get64(const uint8_t *p) {
+    return ((uint64_t) RawImage_Get32(p) << 32) | RawImage_Get32(p + 4);
+}
+
+static bool RawImage_WriteAt(int fd, off_t offset, const void *data, uint32_t size) {
+    return lseek(fd, offset, SEEK_SET) == offset && write(fd, data, size) == (ssize_t) size;
+}
+
+static bool RawImage_ReadAt(int fd, off_t offset, void *data, uint32_t size) {
+    return lseek(fd, offset, SEEK_SET) == offset && read(fd, data, size) == (ssize_t) size;
+}
+
+/**
+ * Checks a 0x40 aligned block for zeros, a word at a time.
+ */
+static bool RawImage_IsZero(const uint8_t *data, uint32_t size) {
+    auto *words    = (const uint32_t *) data;
+    uint32_t count = size / sizeof(uint32_t);
+    uint32_t i     = 0;
+    for (; i + 4 <= count; i += 4) {
+        if (words[i] | words[i + 1] | words[i + 2] | words[i + 3]) {
+            return false;
+        }
+    }
+    for (; i < count; i++) {
+        if (words[i]) {
+            return false;
+        }
+    }
+    for (i = count * sizeof(uint32_t); i < size; i++) {
+        if (data[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static FSError RawImage_WriteBlock(FSAExRawImageWriter *writer) {
+    if (writer->indexCount == writer->indexCapacity) {
+        uint32_t newCapacity = writer->indexCapacity ? writer->indexCapacity * 2 : 256;
+        auto *newIndex       = (RawImageIndexEntry *) realloc(writer->index, sizeof(RawImageIndexEntry) * newCapacity);
+        if (!newIndex) {
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+        writer->index         = newIndex;
+        writer->indexCapacity = newCapacity;
+    }
+
+    // The last block is padded with zeros.
+    if (writer->blockFill < writer->blockSize) {
+        memset(writer->block + writer->blockFill, 0, writer->blockSize - writer->blockFill);
+    }
+
+    auto &entry  = writer->index[writer->indexCount];
+    entry.offset = writer->filePos;
+    if (RawImage_IsZero(writer->block, writer->blockSize)) {
+        entry.type       = RAW_IMAGE_BLOCK_HOLE;
+        entry.storedSize = 0;
+        writer->stats.holeBlocks++;
+    } else {
+        // Only keep the compressed data if it is actually smaller.
+        uint32_t compressedSize = LZ_Compress(writer->block, writer->blockSize, writer->compressed, writer->blockSize - 1, writer->hashTable);
+        const uint8_t *stored   = compressedSize ? writer->compressed : writer->block;
+        entry.type              = compressedSize ? RAW_IMAGE_BLOCK_LZ : RAW_IMAGE_BLOCK_RAW;
+        entry.storedSize        = compressedSize ? compressedSize : writer->blockSize;
+        if (!RawImage_WriteAt(writer->fd, writer->base + (off_t) writer->filePos, stored, entry.storedSize)) {
+            return FS_ERROR_STORAGE_FULL;
+        }
+        writer->filePos += entry.storedSize;
+        writer->stats.storedBytes += entry.storedSize;
+        if (compressedSize) {
+            writer->stats.compressedBlocks++;
+        } else {
+            writer->stats.rawBlocks++;
+        }
+    }
+    writer->indexCount++;
+    writer->blockFill = 0;
+    return FS_ERROR_OK;
+}
+
+static void RawImage_FreeWriter(FSAExRawImageWriter *writer) {
+    free(writer->block);
+    free(writer->compressed);
+    free(writer->hashTable);
+    free(writer->index);
+    free(writer);
+}
+
+FSError FSAEx_RawImageWriterCreate(int fd, uint32_t blockSize, FSAExRawImageWriter **outWriter) {
+    if (fd < 0) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    if (!outWriter || blockSize > RAW_IMAGE_MAX_BLOCK_SIZE) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (blockSize == 0) {
+        blockSize = RAW_IMAGE_DEFAULT_BLOCK_SIZE;
+    }
+    auto base = lseek(fd, 0, SEEK_CUR);
+    if (base < 0) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+
+    auto *writer = (FSAExRawImageWriter *) malloc(sizeof(FSAExRawImageWriter));
+    if (!writer) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(writer, 0, sizeof(FSAExRawImageWriter));
+    writer->fd         = fd;
+    writer->base       = base;
+    writer->blockSize  = blockSize;
+    writer->filePos    = RAW_IMAGE_HEADER_SIZE;
+    writer->block      = (uint8_t *) memalign(0x40, ROUNDUP(blockSize, 0x40));
+    writer->compressed = (uint8_t *) malloc(blockSize);
+    writer->hashTable  = (uint32_t *) malloc(sizeof(uint32_t) * LZ_HASH_TABLE_SIZE);
+    if (!writer->block || !writer->compressed || !writer->hashTable) {
+        RawImage_FreeWriter(writer);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    // Placeholder, the real header is written by FSAEx_RawImageWriterFinish.
+    uint8_t header[RAW_IMAGE_HEADER_SIZE] = {};
+    if (!RawImage_WriteAt(fd, base, header, sizeof(header))) {
+        RawImage_FreeWriter(writer);
+        return FS_ERROR_STORAGE_FULL;
+    }
+
+    *outWriter = writer;
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawImageWriterWrite(FSAExRawImageWriter *writer, const void *data, uint32_t size) {
+    if (!writer || (!data && size > 0)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (writer->error < 0) {
+        return writer->error;
+    }
+    auto *src = (const uint8_t *) data;
+    while (size > 0) {
+        uint32_t toCopy = writer->blockSize - writer->blockFill;
+        if (toCopy > size) {
+            toCopy = size;
+        }
+        memcpy(writer->block + writer->blockFill, src, toCopy);
+        writer->blockFill += toCopy;
+        writer->imageSize += toCopy;
+        src += toCopy;
+        size -= toCopy;
+        if (writer->blockFill == writer->blockSize) {
+            auto res = RawImage_WriteBlock(writer);
+            if (res < 0) {
+                // The container is unusable after a failed write.
+                writer->error = res;
+                return res;
+            }
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+int32_t FSAEx_RawImageWriterFileCallback(void *buffer, uint32_t size, uint64_t offset, void *userContext) {
+    auto *writer = (FSAExRawImageWriter *) userContext;
+    // The container can only be written sequentially.
+    if (!writer || offset != writer->imageSize || FSAEx_RawImageWriterWrite(writer, buffer, size) < 0) {
+        return -1;
+    }
+    return (int32_t) size;
+}
+
+void FSAEx_RawImageWriterGetStats(FSAExRawImageWriter *writer, FSAExRawImageStats *outStats) {
+    if (writer && outStats) {
+        *outStats = writer->stats;
+    }
+}
+
+FSError FSAEx_RawImageWriterFinish(FSAExRawImageWriter *writer) {
+    if (!writer) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    FSError res = writer->error;
+    if (res >= 0 && writer->blockFill > 0) {
+        res = RawImage_WriteBlock(writer);
+    }
+
+    if (res >= 0) {
+        uint64_t indexOffset = writer->filePos;
+        uint8_t entryBuffer[64 * RAW_IMAGE_INDEX_ENTRY_SIZE];
+        uint32_t done = 0;
+        while (done < writer->indexCount && res >= 0) {
+            uint32_t count = writer->indexCount - done < 64 ? writer->indexCount - done : 64;
+            for (uint32_t i = 0; i < count; i++) {
+                auto &entry = writer->index[done + i];
+                uint8_t *p  = &entryBuffer[i * RAW_IMAGE_INDEX_ENTRY_SIZE];
+                RawImage_Put64(p, entry.offset);
+                RawImage_Put32(p + 8, entry.storedSize);
+                RawImage_Put32(p + 12, entry.type);
+            }
+            if (!RawImage_WriteAt(writer->fd, writer->base + (off_t) (indexOffset + (uint64_t) done * RAW_IMAGE_INDEX_ENTRY_SIZE), entryBuffer, count * RAW_IMAGE_INDEX_ENTRY_SIZE)) {
+                res = FS_ERROR_STORAGE_FULL;
+            }
+            done += count;
+        }
+
+        uint8_t header[RAW_IMAGE_HEADER_SIZE] = {};
+        memcpy(header, RAW_IMAGE_MAGIC, 8);
+        RawImage_Put32(header + 0x08, RAW_IMAGE_VERSION);
+        RawImage_Put32(header + 0x0C, writer->blockSize);
+        RawImage_Put64(header + 0x10, writer->imageSize);
+        RawImage_Put32(header + 0x18, writer->indexCount);
+        RawImage_Put64(header + 0x20, indexOffset);
+        if (res >= 0 && !RawImage_WriteAt(writer->fd, writer->base, header, sizeof(header))) {
+            res = FS_ERROR_STORAGE_FULL;
+        }
+    }
+
+    RawImage_FreeWriter(writer);
+    return res;
+}
+
+static void RawImage_FreeReader(FSAExRawImageReader *reader) {
+    free(reader->index);
+    free(reader->block);
+    free(reader->compressed);
+    free(reader);
+}
+
+FSError FSAEx_RawImageReaderOpen(int fd, FSAExRawImageReader **outReader) {
+    if (fd < 0) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    if (!outReader) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    auto base = lseek(fd, 0, SEEK_CUR);
+    uint8_t header[RAW_IMAGE_HEADER_SIZE];
+    if (base < 0 || !RawImage_ReadAt(fd, base, header, sizeof(header))) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    uint32_t blockSize = RawImage_Get32(header + 0x0C);
+    if (memcmp(header, RAW_IMAGE_MAGIC, 8) != 0 || RawImage_Get32(header + 0x08) != RAW_IMAGE_VERSION || blockSize == 0 || blockSize > RAW_IMAGE_MAX_BLOCK_SIZE) {
+        return FS_ERROR_MEDIA_ERROR;
+    }
+
+    auto *reader = (FSAExRawImageReader *) malloc(sizeof(FSAExRawImageReader));
+    if (!reader) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(reader, 0, sizeof(FSAExRawImageReader));
+    reader->fd          = fd;
+    reader->base        = base;
+    reader->blockSize   = blockSize;
+    reader->imageSize   = RawImage_Get64(header + 0x10);
+    reader->blockCount  = RawImage_Get32(header + 0x18);
+    reader->cachedBlock = -1;
+    if ((reader->imageSize + blockSize - 1) / blockSize != reader->blockCount) {
+        RawImage_FreeReader(reader);
+        return FS_ERROR_MEDIA_ERROR;
+    }
+    reader->index      = (RawImageIndexEntry *) malloc(sizeof(RawImageIndexEntry) * (reader->blockCount ? reader->blockCount : 1));
+    reader->block      = (uint8_t *) malloc(blockSize);
+    reader->compressed = (uint8_t *) malloc(blockSize);
+    if (!reader->index || !reader->block || !reader->compressed) {
+        RawImage_FreeReader(reader);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    uint64_t indexOffset = RawImage_Get64(header + 0x20);
+    uint8_t entryBuffer[64 * RAW_IMAGE_INDEX_ENTRY_SIZE];
+    for (uint32_t done = 0; done < reader->blockCount;) {
+        uint32_t count = reader->blockCount - done < 64 ? reader->blockCount - done : 64;
+        if (!RawImage_ReadAt(fd, base + (off_t) (indexOffset + (uint64_t) done * RAW_IMAGE_INDEX_ENTRY_SIZE), entryBuffer, count * RAW_IMAGE_INDEX_ENTRY_SIZE)) {
+            RawImage_FreeReader(reader);
+            return FS_ERROR_MEDIA_ERROR;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            auto &entry      = reader->index[done + i];
+            const uint8_t *p = &entryBuffer[i * RAW_IMAGE_INDEX_ENTRY_SIZE];
+            entry.offset     = RawImage_Get64(p);
+            entry.storedSize = RawImage_Get32(p + 8);
+            entry.type       = RawImage_Get32(p + 12);
+            if (entry.type > RAW_IMAGE_BLOCK_LZ || entry.storedSize > blockSize) {
+                RawImage_FreeReader(reader);
+                return FS_ERROR_MEDIA_ERROR;
+            }
+        }
+        done += count;
+    }
+
+    OSInitMutex(&reader->mutex);
+    *outReader = reader;
+    return FS_ERROR_OK;
+}
+
+uint64_t FSAEx_RawImageReaderGetSize(FSAExRawImageReader *reader) {
+    return reader ? reader->imageSize : 0;
+}
+
+/**
+ * Makes sure reader->block contains the given (stored) block.
+ */
+static FSError RawImage_LoadBlock(FSAExRawImageReader *reader, uint32_t blockIndex) {
+    if (reader->cachedBlock == blockIndex) {
+        return FS_ERROR_OK;
+    }
+    auto &entry         = reader->index[blockIndex];
+    reader->cachedBlock = -1;
+    off_t offset        = reader->base + (off_t) entry.offset;
+    if (entry.type == RAW_IMAGE_BLOCK_RAW) {
+        if (entry.storedSize != reader->blockSize || !RawImage_ReadAt(reader->fd, offset, reader->block, reader->blockSize)) {
+            return FS_ERROR_MEDIA_ERROR;
+        }
+    } else {
+        if (!RawImage_ReadAt(reader->fd, offset, reader->compressed, entry.storedSize) ||
+            LZ_Decompress(reader->compressed, entry.storedSize, reader->block, reader->blockSize) != (int32_t) reader->blockSize) {
+            return FS_ERROR_MEDIA_ERROR;
+        }
+    }
+    reader->cachedBlock = blockIndex;
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawImageReaderRead(FSAExRawImageReader *reader, void *data, uint64_t offset, uint32_t size) {
+    if (!reader || (!data && size > 0)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (offset > reader->imageSize || reader->imageSize - offset < size) {
+        return FS_ERROR_OUT_OF_RANGE;
+    }
+
+    FSError res = FS_ERROR_OK;
+    auto *dst   = (uint8_t *) data;
+    OSLockMutex(&reader->mutex);
+    while (size > 0) {
+        auto blockIndex      = (uint32_t) (offset / reader->blockSize);
+        uint32_t blockOffset = (uint32_t) (offset % reader->blockSize);
+        uint32_t toCopy      = reader->blockSize - blockOffset < size ? reader->blockSize - blockOffset : size;
+        if (reader->index[blockIndex].type == RAW_IMAGE_BLOCK_HOLE) {
+            memset(dst, 0, toCopy);
+        } else {
+            res = RawImage_LoadBlock(reader, blockIndex);
+            if (res < 0) {
+                break;
+            }
+            memcpy(dst, reader->block + blockOffset, toCopy);
+        }
+        dst += toCopy;
+        offset += toCopy;
+        size -= toCopy;
+    }
+    OSUnlockMutex(&reader->mutex);
+    return res;
+}
+
+void FSAEx_RawImageReaderClose(FSAExRawImageReader *reader) {
+    if (reader) {
+        RawImage_FreeReader(reader);
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include "mocha/fsa.h"
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/time.h>
+#include <stdint.h>
+
+/**
+ * Fills a shim buffer with a FSA_COMMAND_RAW_READ or FSA_COMMAND_RAW_WRITE request. data must be 0x40 aligned.
+ */
+void FSAEx_RawSetupRequest(FSAShimBuffer *shim, int clientHandle, FSACommandEnum command, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+/**
+ * Sets up and sends a raw read/write request in a single round trip. data must be 0x40 aligned.
+ */
+FSError FSAEx_RawTransfer(FSAShimBuffer *shim, int clientHandle, FSACommandEnum command, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+/*
+ * Raw reads/writes pass through these layers:
+ * FSAEx_RawReadEx/FSAEx_RawWriteEx: keep the write buffer and block cache of the handle coherent
+ * -> FSAEx_RawReadUncached/FSAEx_RawWriteUncached: read-ahead of the handle
+ * -> FSAEx_RawReadDevice/FSAEx_RawWriteDevice: bounce buffers for unaligned buffers, send the request
+ * None of them requires an aligned buffer.
+ */
+FSError FSAEx_RawReadUncached(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+FSError FSAEx_RawWriteUncached(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+FSError FSAEx_RawReadDevice(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+FSError FSAEx_RawWriteDevice(int clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+/**
+ * Same as FSAEx_RawReadAsyncEx without the write buffer and block cache of the handle, used for prefetches.
+ */
+FSError FSAEx_RawReadAsyncDevice(int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSAExRawAsyncCallback callback, void *userContext);
+
+/**
+ * Blocks until a slot of the async queue of a device handle is released or the timeout expired, for submissions that
+ * failed with FS_ERROR_BUSY. Returns right away if a slot is free already.
+ */
+void RawAsync_WaitForFreeSlot(int clientHandle, int32_t device_handle, OSTime timeout);
+
+struct RawHandleState;
+
+/**
+ * Makes the device content of a range current before it is read, bypassing the write buffer and block cache of the handle.
+ * Every path that reads from the device without going through FSAEx_RawReadEx needs to call this first.
+ * @param state may be NULL
+ */
+FSError FSAEx_RawBeforeDeviceRead(RawHandleState *state, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Keeps the write buffer and block cache of the handle coherent with a write of a range that bypasses them.
+ * Every path that writes to the device without going through FSAEx_RawWriteEx needs to call this first.
+ * @param state may be NULL
+ */
+FSError FSAEx_RawBeforeDeviceWrite(RawHandleState *state, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Writes back dirty cache blocks that overlap the given range. Called before an uncached read of the range.
+ */
+FSError RawCache_BeforeDeviceRead(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Writes back dirty cache blocks that overlap the given range and drops them. Called before an uncached write of the range.
+ */
+FSError RawCache_BeforeDeviceWrite(FSAExRawCache *cache, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Flushes the cache and detaches it from its device handle. Called before the device handle is closed.
+ */
+void RawCache_Detach(FSAExRawCache *cache);
+
+/**
+ * Writes back buffered writes that overlap the given range. Called before an unbuffered read/write of the range.
+ */
+FSError RawWriteBuffer_BeforeDeviceAccess(FSAExRawWriteBuffer *writeBuffer, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Flushes the write buffer and detaches it from its device handle. Called before the device handle is closed.
+ */
+void RawWriteBuffer_Detach(FSAExRawWriteBuffer *writeBuffer);
+
+/**
+ * Returns the transfer size that was determined by FSAEx_RawAutotune(Ex) for a device, or 0 if the device hasn't been tuned.
+ */
+uint32_t RawAutotune_GetTransferSize(const char *device_path);
+
+/**
+ * Same as RawAutotune_GetTransferSize for the device an open device handle belongs to.
+ */
+uint32_t RawAutotune_GetTransferSizeForHandle(int clientHandle, int32_t device_handle);
+
+/*
+ * Hashes buffers on a thread on another core, used to digest raw transfers while the next transfer is in flight.
+ * Buffers must stay unchanged until RawHash_Wait returned for their job.
+ */
+#define RAW_HASH_MAX_PENDING 16
+
+struct RawHashPipeline;
+
+/**
+ * Starts the hasher thread.
+ * @return the pipeline or NULL if the thread could not be created.
+ */
+RawHashPipeline *RawHash_Create(const FSAExRawHashParams *params);
+
+/**
+ * Queues a buffer for hashing. Blocks if RAW_HASH_MAX_PENDING buffers are pending.
+ * @return the job number that can be passed to RawHash_Wait.
+ */
+uint32_t RawHash_Submit(RawHashPipeline *pipeline, const void *data, uint32_t size, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Blocks until the given job has been hashed.
+ */
+void RawHash_Wait(RawHashPipeline *pipeline, uint32_t job);
+
+/**
+ * Waits for all pending jobs, stops the hasher thread and frees the pipeline.
+ * @param outDigest optional, receives the digest of all submitted buffers.
+ */
+void RawHash_Finish(RawHashPipeline *pipeline, FSAExHashDigest *outDigest);
+
+/**
+ * Drops the mount registry entry of a target. Called after a successful unmount.
+ */
+void MountRegistry_Forget(const char *target);
+
+/**
+ * Adds the latency of a synchronous transfer to the latency histogram of a device handle.
+ */
+void RawLatency_Record(int clientHandle, int32_t device_handle, uint64_t latencyUs);
+
+/**
+ * Queues a FSAEx_RawReadEx/FSAEx_RawWriteEx of another thread on the scheduler of the handle and waits for it.
+ * @return false if the request must be executed directly, e.g. because the handle has no scheduler or it was issued by
+ *         the scheduler itself. Must not be called with the mutex of the handle held, the worker needs it.
+ */
+bool RawScheduler_Route(RawHandleState *state, bool write, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, FSError *outResult);
+
+/**
+ * Waits for all queued requests of the scheduler of a handle, FSAEx_RawReadEx/FSAEx_RawWriteEx are executed directly and
+ * FSAEx_RawSchedulerRead/FSAEx_RawSchedulerWrite fail with FS_ERROR_BUSY until it is resumed or detached. Called before
+ * the device handle is closed, must not be called with the mutex of the handle held.
+ */
+void RawScheduler_Suspend(RawHandleState *state);
+
+/**
+ * Undoes RawScheduler_Suspend, e.g. after the device handle failed to close.
+ */
+void RawScheduler_Resume(FSAExRawScheduler *scheduler);
+
+/**
+ * Waits for all queued requests and detaches the scheduler from its device handle. Called once the device handle is
+ * closed. Must not be called with the mutex of the handle held unless the scheduler is suspended.
+ */
+void RawScheduler_Detach(FSAExRawScheduler *scheduler);
+
+struct RawReadAhead;
+
+/**
+ * Reads through the read-ahead window of a handle and schedules the next prefetch.
+ */
+FSError RawReadAhead_Read(RawReadAhead *readAhead, int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+/**
+ * Drops prefetched data that overlaps the given range.
+ */
+void RawReadAhead_Invalidate(RawReadAhead *readAhead, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Waits for an in flight prefetch and starts no new ones until RawReadAhead_Resume. Called before the device handle is closed.
+ */
+void RawReadAhead_Stop(RawReadAhead *readAhead);
+
+/**
+ * Allows prefetches again after RawReadAhead_Stop, e.g. because closing the device handle failed.
+ */
+void RawReadAhead_Resume(RawReadAhead *readAhead);
+
+/**
+ * Waits for an in flight prefetch and frees the read-ahead state.
+ */
+void RawReadAhead_Destroy(RawReadAhead *readAhead);
+
+/**
+ * Converts the result of an IOS_Ioctlv(Async) on a /dev/fsa handle into a FSError.
+ */
+static inline FSError FSAEx_DecodeIosError(IOSError err) {
+    // FSA statuses are passed through as they are, plain IPC errors (-1 ... -0xFFFF) are mapped.
+    if (err >= 0 || err <= -0x10000) {
+        return (FSError) err;
+    }
+    return err == IOS_ERROR_INVALID ? FS_ERROR_INVALID_CLIENTHANDLE : FS_ERROR_INVALID_PARAM;
+}
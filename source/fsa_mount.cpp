@@ -0,0 +1,144 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+
+#define MOUNT_REGISTRY_MAX_ENTRIES 16
+
+struct MountRegistryEntry {
+    char source[FSAEX_MOUNT_MAX_PATH_LENGTH];
+    char target[FSAEX_MOUNT_MAX_PATH_LENGTH];
+    FSAMountFlags flags;
+    uint32_t refCount; // 0 if the entry is unused
+};
+
+// One registry per library instance, modules that link libmocha separately don't see each other's mounts and may
+// unmount a target another module still uses, see FSAEx_MountAcquire.
+static MountRegistryEntry sMountRegistry[MOUNT_REGISTRY_MAX_ENTRIES];
+// Held across the mount/unmount IPC, so concurrent acquires of the same target only mount once.
+static OSMutex sMountRegistryMutex;
+
+static bool MountRegistry_Init() {
+    OSInitMutex(&sMountRegistryMutex);
+    return true;
+}
+
+static bool sMountRegistryInitDone = MountRegistry_Init();
+
+static MountRegistryEntry *MountRegistry_Find(const char *target) {
+    for (auto &entry : sMountRegistry) {
+        if (entry.refCount > 0 && strcmp(entry.target, target) == 0) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void MountRegistry_Forget(const char *target) {
+    if (!target) {
+        return;
+    }
+    OSLockMutex(&sMountRegistryMutex);
+    auto *entry = MountRegistry_Find(target);
+    if (entry) {
+        entry->refCount = 0;
+    }
+    OSUnlockMutex(&sMountRegistryMutex);
+}
+
+FSError FSAEx_MountAcquire(FSClient *client, const char *source, const char *target, FSAMountFlags flags, void *arg_buf, uint32_t arg_len) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_MountAcquireEx(FSGetClientBody(client)->clientHandle, source, target, flags, arg_buf, arg_len);
+}
+
+FSError FSAEx_MountAcquireEx(int clientHandle, const char *source, const char *target, FSAMountFlags flags, void *arg_buf, uint32_t arg_len) {
+    if (!source || !target || strlen(source) >= FSAEX_MOUNT_MAX_PATH_LENGTH || strlen(target) >= FSAEX_MOUNT_MAX_PATH_LENGTH) {
+        return FS_ERROR_INVALID_PATH;
+    }
+
+    OSLockMutex(&sMountRegistryMutex);
+    FSError res = FS_ERROR_OK;
+    auto *entry = MountRegistry_Find(target);
+    if (entry) {
+        if (strcmp(entry->source, source) == 0 && entry->flags == flags) {
+            entry->refCount++;
+        } else {
+            // Something else is already mounted there.
+            res = FS_ERROR_ALREADY_EXISTS;
+        }
+        OSUnlockMutex(&sMountRegistryMutex);
+        return res;
+    }
+
+    for (auto &e : sMountRegistry) {
+        if (e.refCount == 0) {
+            entry = &e;
+            break;
+        }
+    }
+    if (!entry) {
+        OSUnlockMutex(&sMountRegistryMutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    res = FSAEx_MountEx(clientHandle, source, target, flags, arg_buf, arg_len);
+    if (res == FS_ERROR_OK) {
+        strcpy(entry->source, source);
+        strcpy(entry->target, target);
+        entry->flags    = flags;
+        entry->refCount = 1;
+    }
+    OSUnlockMutex(&sMountRegistryMutex);
+    return res;
+}
+
+FSError FSAEx_MountRelease(FSClient *client, const char *target) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_MountReleaseEx(FSGetClientBody(client)->clientHandle, target);
+}
+
+FSError FSAEx_MountReleaseEx(int clientHandle, const char *target) {
+    if (!target) {
+        return FS_ERROR_INVALID_PATH;
+    }
+
+    OSLockMutex(&sMountRegistryMutex);
+    auto *entry = MountRegistry_Find(target);
+    if (!entry) {
+        OSUnlockMutex(&sMountRegistryMutex);
+        return FS_ERROR_NOT_FOUND;
+    }
+    FSError res = FS_ERROR_OK;
+    if (entry->refCount > 1) {
+        entry->refCount--;
+    } else {
+        // Last user, FSAEx_UnmountEx removes the entry once the unmount succeeded.
+        res = FSAEx_UnmountEx(clientHandle, target, (entry->flags & FSA_MOUNT_FLAG_BIND_MOUNT) ? FSA_UNMOUNT_FLAG_BIND_MOUNT : (FSAUnmountFlags) 0);
+    }
+    OSUnlockMutex(&sMountRegistryMutex);
+    return res;
+}
+
+uint32_t FSAEx_GetActiveMounts(FSAExMountInfo *outMounts, uint32_t maxCount) {
+    uint32_t count = 0;
+    OSLockMutex(&sMountRegistryMutex);
+    for (auto &entry : sMountRegistry) {
+        if (entry.refCount == 0) {
+            continue;
+        }
+        if (outMounts && count < maxCount) {
+            auto &info = outMounts[count];
+            strcpy(info.source, entry.source);
+            strcpy(info.target, entry.target);
+            info.flags    = entry.flags;
+            info.refCount = entry.refCount;
+        }
+        count++;
+    }
+    OSUnlockMutex(&sMountRegistryMutex);
+    return count;
+}
@@ -0,0 +1,183 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "mocha/mocha.h"
+#include "raw_handle.h"
+#include <atomic>
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/thread.h>
+#include <malloc.h>
+#include <new>
+
+#define RAW_PARALLEL_MAX_WORKERS         8
+#define RAW_PARALLEL_DEFAULT_STRIPE_SIZE (1024 * 1024)
+#define RAW_PARALLEL_THREAD_STACK_SIZE   0x4000
+#define RAW_PARALLEL_THREAD_PRIORITY     16
+
+struct RawParallelContext {
+    char *device_path;
+    uint8_t *data;
+    uint32_t size_bytes;
+    uint32_t cnt;
+    uint64_t blocks_offset;
+    uint32_t stripeSectors;
+    uint32_t stripeCount;
+    // Dynamic self-scheduling: idle workers claim the next unread stripe, so a worker that is stuck on a slow stripe
+    // doesn't hold up the others.
+    std::atomic<uint32_t> nextStripe;
+    std::atomic<int32_t> firstError;
+};
+
+struct RawParallelWorker {
+    OSThread thread;
+    RawParallelContext *ctx;
+    int clientHandle;
+    uint8_t *stack;
+};
+
+static FSError RawParallel_Work(RawParallelContext *ctx, int clientHandle) {
+    // Device handles belong to a client, every worker needs its own.
+    int32_t device_handle = -1;
+    auto res              = FSAEx_RawOpenEx(clientHandle, ctx->device_path, &device_handle);
+    if (res < 0) {
+        return res;
+    }
+
+    while (ctx->firstError.load(std::memory_order_relaxed) == FS_ERROR_OK) {
+        uint32_t stripe = ctx->nextStripe.fetch_add(1, std::memory_order_relaxed);
+        if (stripe >= ctx->stripeCount) {
+            break;
+        }
+        uint32_t first = stripe * ctx->stripeSectors;
+        uint32_t count = ctx->cnt - first < ctx->stripeSectors ? ctx->cnt - first : ctx->stripeSectors;
+        res            = FSAEx_RawReadEx(clientHandle, ctx->data + (uint64_t) first * ctx->size_bytes, ctx->size_bytes, count, ctx->blocks_offset + first, device_handle);
+        if (res < 0) {
+            int32_t expected = FS_ERROR_OK;
+            ctx->firstError.compare_exchange_strong(expected, res, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    FSAEx_RawCloseEx(clientHandle, device_handle);
+    return res < 0 ? res : FS_ERROR_OK;
+}
+
+static int RawParallel_ThreadEntry(int argc, const char **argv) {
+    (void) argc;
+    auto *worker = (RawParallelWorker *) argv;
+    RawParallel_Work(worker->ctx, worker->clientHandle);
+    return 0;
+}
+
+FSError FSAEx_RawReadParallel(FSClient *client, const char *device_path, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, uint32_t maxWorkers, uint32_t stripeSize) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadParallelEx(FSGetClientBody(client)->clientHandle, device_path, data, size_bytes, cnt, blocks_offset, maxWorkers, stripeSize);
+}
+
+FSError FSAEx_RawReadParallelEx(int clientHandle, const char *device_path, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, uint32_t maxWorkers, uint32_t stripeSize) {
+    if (!device_path) {
+        return FS_ERROR_INVALID_PATH;
+    }
+    if (!data) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if ((uintptr_t) data & 0x3F) {
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    if (size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (cnt == 0) {
+        return FS_ERROR_OK;
+    }
+    if (stripeSize == 0) {
+        stripeSize = RawAutotune_GetTransferSize(device_path);
+    }
+    if (stripeSize == 0) {
+        stripeSize = RAW_PARALLEL_DEFAULT_STRIPE_SIZE;
+    }
+    uint32_t stripeSectors = stripeSize / size_bytes;
+    if (stripeSectors == 0) {
+        stripeSectors = 1;
+    }
+    // Every stripe has to start at an aligned address of the destination.
+    if ((stripeSectors * size_bytes) & 0x3F) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (maxWorkers == 0 || maxWorkers > RAW_PARALLEL_MAX_WORKERS) {
+        maxWorkers = RAW_PARALLEL_MAX_WORKERS;
+    }
+    // The workers open their own handles, dirty data of handles that are already open has to reach the device first.
+    auto res = RawHandle_BeforeDeviceReadByPath(device_path, blocks_offset, cnt);
+    if (res < 0) {
+        return res;
+    }
+
+    RawParallelContext ctx;
+    ctx.device_path   = (char *) device_path;
+    ctx.data          = (uint8_t *) data;
+    ctx.size_bytes    = size_bytes;
+    ctx.cnt           = cnt;
+    ctx.blocks_offset = blocks_offset;
+    ctx.stripeSectors = stripeSectors;
+    ctx.stripeCount   = (cnt + stripeSectors - 1) / stripeSectors;
+    ctx.nextStripe.store(0);
+    ctx.firstError.store(FS_ERROR_OK);
+
+    // The calling thread is a worker too, the others get their own client handles.
+    uint32_t helperCount = maxWorkers - 1;
+    if (helperCount > ctx.stripeCount - 1) {
+        helperCount = ctx.stripeCount - 1;
+    }
+
+    RawParallelWorker *workers = nullptr;
+    if (helperCount > 0) {
+        workers = (RawParallelWorker *) memalign(0x40, sizeof(RawParallelWorker) * helperCount);
+        if (!workers) {
+            helperCount = 0;
+        }
+    }
+
+    uint32_t started = 0;
+    for (; started < helperCount; started++) {
+        auto *worker         = new (&workers[started]) RawParallelWorker();
+        worker->ctx          = &ctx;
+        worker->stack        = nullptr;
+        worker->clientHandle = FSAAddClient(nullptr);
+        if (worker->clientHandle < 0) {
+            break;
+        }
+        // Stops at MOCHA_RESULT_MAX_CLIENT, so the number of workers is capped by the available unlocked clients.
+        if (Mocha_UnlockFSClientEx(worker->clientHandle) != MOCHA_RESULT_SUCCESS) {
+            FSADelClient(worker->clientHandle);
+            break;
+        }
+        worker->stack = (uint8_t *) memalign(0x10, RAW_PARALLEL_THREAD_STACK_SIZE);
+        if (!worker->stack ||
+            !OSCreateThread(&worker->thread, RawParallel_ThreadEntry, 0, (char *) worker, worker->stack + RAW_PARALLEL_THREAD_STACK_SIZE, RAW_PARALLEL_THREAD_STACK_SIZE, RAW_PARALLEL_THREAD_PRIORITY, OS_THREAD_ATTRIB_AFFINITY_ANY)) {
+            free(worker->stack);
+            FSADelClient(worker->clientHandle);
+            break;
+        }
+        OSSetThreadName(&worker->thread, "FSAEx_RawReadParallel");
+        OSResumeThread(&worker->thread);
+    }
+
+    res = RawParallel_Work(&ctx, clientHandle);
+    if (res < 0) {
+        // Let the helpers stop early.
+        int32_t expected = FS_ERROR_OK;
+        ctx.firstError.compare_exchange_strong(expected, res, std::memory_order_relaxed);
+    }
+
+    for (uint32_t i = 0; i < started; i++) {
+        auto &worker = workers[i];
+        OSJoinThread(&worker.thread, nullptr);
+        free(worker.stack);
+        FSADelClient(worker.clientHandle);
+    }
+    free(workers);
+
+    return (FSError) ctx.firstError.load();
+}
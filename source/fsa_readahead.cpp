@@ -0,0 +1,239 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include <coreinit/messagequeue.h>
+#include <coreinit/mutex.h>
+#include <cstring>
+#include <malloc.h>
+
+// The first prefetch window is this many times the size of the read that triggered it.
+#define RAW_READ_AHEAD_INITIAL_FACTOR 4
+
+struct RawReadAheadWindow {
+    uint8_t *buffer;
+    uint64_t start;
+    uint32_t cnt;  // 0 if the window holds no data.
+    uint32_t used; // Sectors that have been copied out of the window.
+};
+
+struct RawReadAhead {
+    OSMutex mutex;
+    uint32_t maxWindowSize;
+    uint32_t sectorSize;    // Sector size of the reads, prefetched data is dropped if it changes.
+    uint32_t windowSectors; // Size of the next prefetch, 0 while the access pattern is not sequential.
+    uint64_t lastOffset;    // Start of the previous read.
+    uint64_t lastEnd;       // Sector after the previous read.
+    uint64_t nextExpected;  // Predicted start of the next read, lastEnd unless the reads skip sectors.
+    RawReadAheadWindow cur;
+    RawReadAheadWindow pending;
+    bool pendingInFlight;
+    bool stopped; // Set by RawReadAhead_Stop, no new prefetch is started.
+    OSMessageQueue completionQueue;
+    OSMessage completionMessage;
+};
+
+static inline bool RawReadAhead_Contains(const RawReadAheadWindow &window, uint64_t sector) {
+    return window.cnt != 0 && sector >= window.start && sector < window.start + window.cnt;
+}
+
+static inline bool RawReadAhead_Overlaps(const RawReadAheadWindow &window, uint64_t blocks_offset, uint32_t cnt) {
+    return window.cnt != 0 && blocks_offset < window.start + window.cnt && window.start < blocks_offset + cnt;
+}
+
+// Called from the IPC completion context.
+static void RawReadAhead_AsyncCallback(const FSAExRawAsyncResult *result) {
+    auto *readAhead = (RawReadAhead *) result->userContext;
+    OSMessage message;
+    message.message = readAhead;
+    message.args[0] = (uint32_t) result->result;
+    message.args[1] = 0;
+    message.args[2] = 0;
+    OSSendMessage(&readAhead->completionQueue, &message, OS_MESSAGE_FLAGS_NONE);
+}
+
+static void RawReadAhead_WaitPending(RawReadAhead *readAhead) {
+    if (!readAhead->pendingInFlight) {
+        return;
+    }
+    OSMessage message;
+    OSReceiveMessage(&readAhead->completionQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    readAhead->pendingInFlight = false;
+    if ((int32_t) message.args[0] < 0) {
+        // e.g. read past the end of the device
+        readAhead->pending.cnt = 0;
+    }
+}
+
+static void RawReadAhead_StartPrefetch(RawReadAhead *readAhead, int clientHandle, int device_handle, uint64_t start) {
+    if (readAhead->stopped || readAhead->pendingInFlight || readAhead->windowSectors == 0 || RawReadAhead_Contains(readAhead->pending, start)) {
+        return;
+    }
+    readAhead->pending.start = start;
+    readAhead->pending.cnt   = readAhead->windowSectors;
+    readAhead->pending.used  = 0;
+    auto res                 = FSAEx_RawReadAsyncDevice(clientHandle, readAhead->pending.buffer, readAhead->sectorSize, readAhead->pending.cnt, start, device_handle, RawReadAhead_AsyncCallback, readAhead);
+    if (res != FS_ERROR_OK) {
+        // e.g. the async queue of the handle is full, just skip the prefetch.
+        readAhead->pending.cnt = 0;
+        return;
+    }
+    readAhead->pendingInFlight = true;
+}
+
+FSError RawReadAhead_Read(RawReadAhead *readAhead, int clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (data == nullptr) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    uint32_t maxSectors = size_bytes ? readAhead->maxWindowSize / size_bytes : 0;
+    if (maxSectors == 0) {
+        return FSAEx_RawReadDevice(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+    }
+
+    OSLockMutex(&readAhead->mutex);
+    if (readAhead->sectorSize != size_bytes) {
+        RawReadAhead_WaitPending(readAhead);
+        readAhead->sectorSize    = size_bytes;
+        readAhead->windowSectors = 0;
+        readAhead->cur.cnt       = 0;
+        readAhead->pending.cnt   = 0;
+    }
+
+    if (blocks_offset != readAhead->lastEnd && blocks_offset != readAhead->nextExpected) {
+        // Random access, stop prefetching until the reads are sequential or strided again.
+        readAhead->windowSectors = 0;
+    } else if (readAhead->windowSectors == 0) {
+        uint32_t window          = cnt * RAW_READ_AHEAD_INITIAL_FACTOR;
+        readAhead->windowSectors = window < maxSectors && window >= cnt ? window : maxSectors;
+    }
+    // Reads that skip a few sectors each time still profit from a prefetch, a stride larger than the window doesn't.
+    uint64_t stride         = blocks_offset > readAhead->lastOffset ? blocks_offset - readAhead->lastOffset : 0;
+    readAhead->lastOffset   = blocks_offset;
+    readAhead->lastEnd      = blocks_offset + cnt;
+    readAhead->nextExpected = stride > cnt && stride <= maxSectors ? blocks_offset + stride : readAhead->lastEnd;
+
+    auto *dst       = (uint8_t *) data;
+    uint64_t sector = blocks_offset;
+    uint32_t left   = cnt;
+    while (left > 0) {
+        if (RawReadAhead_Contains(readAhead->cur, sector)) {
+            auto inWindow = (uint32_t) (sector - readAhead->cur.start);
+            uint32_t n    = readAhead->cur.cnt - inWindow < left ? readAhead->cur.cnt - inWindow : left;
+            memcpy(dst, readAhead->cur.buffer + inWindow * size_bytes, n * size_bytes);
+            readAhead->cur.used += n;
+            dst += n * size_bytes;
+            sector += n;
+            left -= n;
+            continue;
+        }
+        if (RawReadAhead_Contains(readAhead->pending, sector)) {
+            RawReadAhead_WaitPending(readAhead);
+            if (readAhead->pending.cnt != 0) {
+                // The prefetch was used, make it the current window. The next one grows if the previous window was used
+                // completely and shrinks if the reads skipped parts of it.
+                bool partlyUsed           = readAhead->cur.cnt != 0 && readAhead->cur.used < readAhead->cur.cnt;
+                auto *buffer              = readAhead->cur.buffer;
+                readAhead->cur            = readAhead->pending;
+                readAhead->pending.buffer = buffer;
+                readAhead->pending.cnt    = 0;
+                if (partlyUsed) {
+                    readAhead->windowSectors = readAhead->windowSectors > 1 ? readAhead->windowSectors / 2 : 1;
+                } else {
+                    readAhead->windowSectors = readAhead->windowSectors * 2 < maxSectors ? readAhead->windowSectors * 2 : maxSectors;
+                }
+                continue;
+            }
+        }
+        break;
+    }
+
+    FSError res = FS_ERROR_OK;
+    if (left > 0) {
+        // Other threads may use the windows meanwhile, the read itself doesn't touch the read-ahead state.
+        OSUnlockMutex(&readAhead->mutex);
+        res = FSAEx_RawReadDevice(clientHandle, dst, size_bytes, left, sector, device_handle);
+        OSLockMutex(&readAhead->mutex);
+    }
+
+    if (res >= 0 && readAhead->windowSectors != 0 && readAhead->sectorSize == size_bytes) {
+        // Prefetch right behind the current window if the read ended inside of it.
+        uint64_t next = readAhead->nextExpected;
+        if (RawReadAhead_Contains(readAhead->cur, next)) {
+            next = readAhead->cur.start + readAhead->cur.cnt;
+        }
+        RawReadAhead_StartPrefetch(readAhead, clientHandle, device_handle, next);
+    }
+    OSUnlockMutex(&readAhead->mutex);
+    return res;
+}
+
+void RawReadAhead_Invalidate(RawReadAhead *readAhead, uint64_t blocks_offset, uint32_t cnt) {
+    OSLockMutex(&readAhead->mutex);
+    if (RawReadAhead_Overlaps(readAhead->pending, blocks_offset, cnt)) {
+        RawReadAhead_WaitPending(readAhead);
+        readAhead->pending.cnt = 0;
+    }
+    if (RawReadAhead_Overlaps(readAhead->cur, blocks_offset, cnt)) {
+        readAhead->cur.cnt = 0;
+    }
+    OSUnlockMutex(&readAhead->mutex);
+}
+
+void RawReadAhead_Stop(RawReadAhead *readAhead) {
+    OSLockMutex(&readAhead->mutex);
+    readAhead->stopped = true;
+    RawReadAhead_WaitPending(readAhead);
+    OSUnlockMutex(&readAhead->mutex);
+}
+
+void RawReadAhead_Resume(RawReadAhead *readAhead) {
+    OSLockMutex(&readAhead->mutex);
+    readAhead->stopped = false;
+    OSUnlockMutex(&readAhead->mutex);
+}
+
+void RawReadAhead_Destroy(RawReadAhead *readAhead) {
+    OSLockMutex(&readAhead->mutex);
+    RawReadAhead_WaitPending(readAhead);
+    OSUnlockMutex(&readAhead->mutex);
+    free(readAhead->cur.buffer);
+    free(readAhead->pending.buffer);
+    free(readAhead);
+}
+
+FSError FSAEx_RawSetReadAhead(int32_t device_handle, uint32_t maxWindowSize) {
+    RawHandleRef state(RAW_HANDLE_ANY_CLIENT, device_handle, maxWindowSize != 0);
+    if (!state) {
+        return maxWindowSize != 0 ? FS_ERROR_OUT_OF_RESOURCES : FS_ERROR_OK;
+    }
+    if (state->readAhead) {
+        RawReadAhead_Destroy(state->readAhead);
+        state->readAhead = nullptr;
+    }
+    if (maxWindowSize == 0) {
+        return FS_ERROR_OK;
+    }
+
+    auto *readAhead = (RawReadAhead *) malloc(sizeof(RawReadAhead));
+    if (!readAhead) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(readAhead, 0, sizeof(RawReadAhead));
+    readAhead->maxWindowSize  = maxWindowSize;
+    readAhead->cur.buffer     = (uint8_t *) memalign(0x40, maxWindowSize);
+    readAhead->pending.buffer = (uint8_t *) memalign(0x40, maxWindowSize);
+    if (!readAhead->cur.buffer || !readAhead->pending.buffer) {
+        free(readAhead->cur.buffer);
+        free(readAhead->pending.buffer);
+        free(readAhead);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    // Doesn't match any offset, so the first read never counts as sequential.
+    readAhead->lastOffset   = UINT64_MAX;
+    readAhead->lastEnd      = UINT64_MAX;
+    readAhead->nextExpected = UINT64_MAX;
+    OSInitMutex(&readAhead->mutex);
+    OSInitMessageQueue(&readAhead->completionQueue, &readAhead->completionMessage, 1);
+
+    state->readAhead = readAhead;
+    return FS_ERROR_OK;
+}
@@ -0,0 +1,167 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include "shim_pool.h"
+#include "stats.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
+
+// Gaps of up to this many sectors between two extents are read and discarded instead of splitting the request.
+#define RAW_READV_MAX_GAP_SECTORS 8
+// Upper limit for a merged request, and for the pieces an extent is read in when it needs to go through the scratch
+// buffer.
+#define RAW_READV_MAX_RUN_SIZE    (512 * 1024)
+#define RAW_READV_STACK_EXTENTS   32
+
+/**
+ * Checks if the extents of a run can be read directly into the callers buffers (aligned, contiguous, no gaps).
+ */
+static bool RawReadV_IsDirect(FSAExRawExtent *extents, const uint32_t *order, uint32_t first, uint32_t last, uint32_t size_bytes) {
+    auto &start = extents[order[first]];
+    if ((uintptr_t) start.data & 0x3F) {
+        return false;
+    }
+    for (uint32_t i = first + 1; i <= last; i++) {
+        auto &prev = extents[order[i - 1]];
+        auto &cur  = extents[order[i]];
+        if (cur.blocks_offset != prev.blocks_offset + prev.cnt || (uint8_t *) cur.data != (uint8_t *) prev.data + prev.cnt * size_bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FSError FSAEx_RawReadV(FSClient *client, uint32_t size_bytes, FSAExRawExtent *extents, uint32_t extentCount, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadVEx(FSGetClientBody(client)->clientHandle, size_bytes, extents, extentCount, device_handle);
+}
+
+FSError FSAEx_RawReadVEx(int clientHandle, uint32_t size_bytes, FSAExRawExtent *extents, uint32_t extentCount, int device_handle) {
+    STATS_SCOPE(MOCHA_STATS_FSA_RAW_READV, 0);
+    if (!extents || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    // Empty extents are done without reading anything.
+    uint32_t readCount = 0;
+    for (uint32_t i = 0; i < extentCount; i++) {
+        if (!extents[i].data) {
+            return FS_ERROR_INVALID_BUFFER;
+        }
+        extents[i].result = FS_ERROR_OK;
+        if (extents[i].cnt != 0) {
+            readCount++;
+        }
+    }
+    if (readCount == 0) {
+        return FS_ERROR_OK;
+    }
+
+    uint32_t stackOrder[RAW_READV_STACK_EXTENTS];
+    uint32_t *order = stackOrder;
+    if (readCount > RAW_READV_STACK_EXTENTS) {
+        order = (uint32_t *) malloc(sizeof(uint32_t) * readCount);
+        if (!order) {
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+    }
+    for (uint32_t i = 0, j = 0; i < extentCount; i++) {
+        if (extents[i].cnt != 0) {
+            order[j++] = i;
+        }
+    }
+    std::sort(order, order + readCount, [extents](uint32_t a, uint32_t b) { return extents[a].blocks_offset < extents[b].blocks_offset; });
+
+    auto *shim = ShimPool_Acquire();
+    if (!shim) {
+        if (order != stackOrder) {
+            free(order);
+        }
+        return FS_ERROR_INVALID_BUFFER;
+    }
+
+    uint32_t maxRunSectors = RAW_READV_MAX_RUN_SIZE / size_bytes;
+    if (maxRunSectors == 0) {
+        maxRunSectors = 1;
+    }
+    uint8_t *scratch     = nullptr;
+    uint32_t scratchSize = 0;
+    FSError res          = FS_ERROR_OK;
+    RawHandleRef state(clientHandle, device_handle, false);
+
+    uint32_t first = 0;
+    while (first < readCount) {
+        // Merge all following extents that are adjacent, overlapping or only separated by a small gap.
+        uint64_t runStart = extents[order[first]].blocks_offset;
+        uint64_t runEnd   = runStart + extents[order[first]].cnt;
+        uint32_t last     = first;
+        while (last + 1 < readCount) {
+            auto &next       = extents[order[last + 1]];
+            uint64_t nextEnd = std::max(runEnd, next.blocks_offset + next.cnt);
+            if (next.blocks_offset > runEnd + RAW_READV_MAX_GAP_SECTORS || nextEnd - runStart > maxRunSectors) {
+                break;
+            }
+            runEnd = nextEnd;
+            last++;
+        }
+
+        auto runCnt = (uint32_t) (runEnd - runStart);
+        // Dirty data of the write buffer or block cache has to reach the device before the run is read from there.
+        FSError runRes = FSAEx_RawBeforeDeviceRead(state, runStart, runCnt);
+        if (runRes >= 0) {
+            if (RawReadV_IsDirect(extents, order, first, last, size_bytes)) {
+                runRes = FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_READ, extents[order[first]].data, size_bytes, runCnt, runStart, device_handle);
+            } else {
+                // A single extent may be larger than a merged run, the scratch buffer only holds a piece of it.
+                uint32_t pieceSectors = std::min(runCnt, maxRunSectors);
+                uint32_t pieceSize    = ROUNDUP(pieceSectors * size_bytes, 0x40);
+                if (pieceSize > scratchSize) {
+                    free(scratch);
+                    scratch     = (uint8_t *) memalign(0x40, pieceSize);
+                    scratchSize = scratch ? pieceSize : 0;
+                    STATS_ALLOCATION();
+                }
+                if (!scratch) {
+                    runRes = FS_ERROR_OUT_OF_RESOURCES;
+                }
+                for (uint64_t pieceStart = runStart; runRes >= 0 && pieceStart < runEnd; pieceStart += pieceSectors) {
+                    pieceSectors = (uint32_t) std::min<uint64_t>(runEnd - pieceStart, maxRunSectors);
+                    runRes       = FSAEx_RawTransfer(shim, clientHandle, FSA_COMMAND_RAW_READ, scratch, size_bytes, pieceSectors, pieceStart, device_handle);
+                    if (runRes < 0) {
+                        break;
+                    }
+                    // Copy the part of every extent that is in this piece.
+                    uint64_t pieceEnd = pieceStart + pieceSectors;
+                    for (uint32_t i = first; i <= last; i++) {
+                        auto &extent  = extents[order[i]];
+                        uint64_t from = std::max(extent.blocks_offset, pieceStart);
+                        uint64_t to   = std::min(extent.blocks_offset + extent.cnt, pieceEnd);
+                        if (from >= to) {
+                            continue;
+                        }
+                        memcpy((uint8_t *) extent.data + (from - extent.blocks_offset) * size_bytes, scratch + (from - pieceStart) * size_bytes, (to - from) * size_bytes);
+                        STATS_BOUNCE((to - from) * size_bytes);
+                    }
+                }
+            }
+        }
+
+        for (uint32_t i = first; i <= last; i++) {
+            extents[order[i]].result = runRes < 0 ? runRes : FS_ERROR_OK;
+        }
+        if (runRes < 0 && res == FS_ERROR_OK) {
+            res = runRes;
+        }
+        first = last + 1;
+    }
+
+    free(scratch);
+    ShimPool_Release(shim);
+    if (order != stackOrder) {
+        free(order);
+    }
+    return res;
+}
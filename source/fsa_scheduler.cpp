@@ -0,0 +1,458 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include <coreinit/condition.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/mutex.h>
+#include <coreinit/thread.h>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+
+#define RAW_SCHED_DEFAULT_MERGE_SIZE (1024 * 1024)
+#define RAW_SCHED_THREAD_STACK_SIZE  0x4000
+#define RAW_SCHED_THREAD_PRIORITY    16
+// A higher class is served at most this many times in a row while a lower class is waiting.
+#define RAW_SCHED_MAX_BURST          8
+
+/**
+ * A request of a blocked caller, lives on the stack of the caller until it has been completed.
+ */
+struct RawSchedRequest {
+    RawSchedRequest *next;      // next pending request of the same class, in submission order
+    RawSchedRequest *groupNext; // next request of the same dispatch
+    uint8_t *data;
+    uint64_t sector;
+    uint32_t cnt;
+    bool write;
+    FSError result;
+    OSMessageQueue doneQueue;
+    OSMessage doneMessage;
+};
+
+struct FSAExRawScheduler {
+    OSThread thread;
+    int clientHandle;
+    int device_handle;
+    uint32_t sectorSize;
+    uint32_t mergeCapacity; // in sectors
+    uint8_t *scratch;
+    uint8_t *stack;
+    RawHandleState *state; // Route and Detach take the mutex of the handle before the one of the scheduler.
+    OSMutex mutex;
+    OSCondition workCond;
+    OSCondition idleCond;
+    bool attached;
+    bool suspended; // while the device handle is being closed, see RawScheduler_Suspend
+    bool stop;
+    bool dispatching;
+    RawSchedRequest *pending[FSAEX_RAW_PRIORITY_COUNT];
+    uint64_t headSector; // end of the last dispatch, the elevator continues from here
+    uint32_t burst;      // dispatches in a row from burstClass
+    uint32_t burstClass;
+    FSAExRawSchedulerStats stats;
+};
+
+static inline uint64_t RawSched_End(const RawSchedRequest *request) {
+    return request->sector + request->cnt;
+}
+
+/**
+ * Picks the class that is served next. Strict priority, but a class can't starve the lower ones for more than
+ * RAW_SCHED_MAX_BURST dispatches.
+ */
+static int32_t RawSched_PickClass(FSAExRawScheduler *scheduler) {
+    int32_t first = -1;
+    for (int32_t c = 0; c < FSAEX_RAW_PRIORITY_COUNT; c++) {
+        if (!scheduler->pending[c]) {
+            continue;
+        }
+        if (first < 0) {
+            first = c;
+            if (scheduler->burstClass != (uint32_t) c || scheduler->burst < RAW_SCHED_MAX_BURST) {
+                break;
+            }
+        } else {
+            // The burst of the higher class is over, serve the next waiting class once.
+            scheduler->burst = 0;
+            return c;
+        }
+    }
+    if (first >= 0) {
+        if (scheduler->burstClass != (uint32_t) first) {
+            scheduler->burstClass = first;
+            scheduler->burst      = 0;
+        }
+        scheduler->burst++;
+    }
+    return first;
+}
+
+static void RawSched_Unlink(RawSchedRequest **list, RawSchedRequest *request) {
+    for (auto **it = list; *it; it = &(*it)->next) {
+        if (*it == request) {
+            *it = request->next;
+            return;
+        }
+    }
+}
+
+/**
+ * Takes the next request of a class in elevator order (ascending offsets starting at the head, then wrapping around)
+ * and merges all pending requests of any class that can be served by the same transfer.
+ * @return first request of the group, the others are linked via groupNext.
+ */
+static RawSchedRequest *RawSched_TakeGroup(FSAExRawScheduler *scheduler, int32_t cls, uint64_t *outStart, uint32_t *outCnt) {
+    RawSchedRequest *ahead  = nullptr;
+    RawSchedRequest *lowest = nullptr;
+    for (auto *r = scheduler->pending[cls]; r; r = r->next) {
+        if (r->sector >= scheduler->headSector && (!ahead || r->sector < ahead->sector)) {
+            ahead = r;
+        }
+        if (!lowest || r->sector < lowest->sector) {
+            lowest = r;
+        }
+    }
+    auto *first = ahead ? ahead : lowest;
+    RawSched_Unlink(&scheduler->pending[cls], first);
+    first->groupNext = nullptr;
+
+    uint64_t start = first->sector;
+    uint64_t end   = RawSched_End(first);
+    if (first->cnt < scheduler->mergeCapacity) {
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (int32_t c = 0; c < FSAEX_RAW_PRIORITY_COUNT; c++) {
+                for (auto *r = scheduler->pending[c]; r; r = r->next) {
+                    if (r->write != first->write) {
+                        continue;
+                    }
+                    // Reads may overlap, writes are only merged if they are adjacent, so no data of a write is dropped.
+                    bool fits = first->write ? (r->sector == end || RawSched_End(r) == start) : (r->sector <= end && RawSched_End(r) >= start);
+                    if (!fits) {
+                        continue;
+                    }
+                    uint64_t newStart = r->sector < start ? r->sector : start;
+                    uint64_t newEnd   = RawSched_End(r) > end ? RawSched_End(r) : end;
+                    if (newEnd - newStart > scheduler->mergeCapacity) {
+                        continue;
+                    }
+                    RawSched_Unlink(&scheduler->pending[c], r);
+                    r->groupNext     = first->groupNext;
+                    first->groupNext = r;
+                    start            = newStart;
+                    end              = newEnd;
+                    merged           = true;
+                    break;
+                }
+            }
+        }
+    }
+    *outStart = start;
+    *outCnt   = (uint32_t) (end - start);
+    return first;
+}
+
+static FSError RawSched_Dispatch(FSAExRawScheduler *scheduler, RawSchedRequest *group, uint64_t start, uint32_t cnt) {
+    uint32_t sectorSize = scheduler->sectorSize;
+    if (!group->groupNext) {
+        // Nothing merged, transfer straight from/into the buffer of the caller.
+        if (group->write) {
+            return FSAEx_RawWriteEx(scheduler->clientHandle, group->data, sectorSize, group->cnt, group->sector, scheduler->device_handle);
+        }
+        return FSAEx_RawReadEx(scheduler->clientHandle, group->data, sectorSize, group->cnt, group->sector, scheduler->device_handle);
+    }
+
+    FSError res;
+    if (group->write) {
+        for (auto *r = group; r; r = r->groupNext) {
+            memcpy(scheduler->scratch + (r->sector - start) * sectorSize, r->data, r->cnt * sectorSize);
+        }
+        res = FSAEx_RawWriteEx(scheduler->clientHandle, scheduler->scratch, sectorSize, cnt, start, scheduler->device_handle);
+    } else {
+        res = FSAEx_RawReadEx(scheduler->clientHandle, scheduler->scratch, sectorSize, cnt, start, scheduler->device_handle);
+        if (res >= 0) {
+            for (auto *r = group; r; r = r->groupNext) {
+                memcpy(r->data, scheduler->scratch + (r->sector - start) * sectorSize, r->cnt * sectorSize);
+            }
+        }
+    }
+    return res;
+}
+
+static int RawSched_ThreadEntry(int argc, const char **argv) {
+    (void) argc;
+    auto *scheduler = (FSAExRawScheduler *) argv;
+    OSLockMutex(&scheduler->mutex);
+    while (true) {
+        int32_t cls;
+        while ((cls = RawSched_PickClass(scheduler)) < 0) {
+            if (scheduler->stop) {
+                OSUnlockMutex(&scheduler->mutex);
+                return 0;
+            }
+            OSWaitCond(&scheduler->workCond, &scheduler->mutex);
+        }
+        uint64_t start;
+        uint32_t cnt;
+        auto *group            = RawSched_TakeGroup(scheduler, cls, &start, &cnt);
+        scheduler->headSector  = start + cnt;
+        scheduler->dispatching = true;
+        scheduler->stats.dispatches++;
+        for (auto *r = group; r; r = r->groupNext) {
+            scheduler->stats.queueDepth--;
+            if (r != group) {
+                scheduler->stats.mergedRequests++;
+            }
+        }
+        OSUnlockMutex(&scheduler->mutex);
+
+        auto res = RawSched_Dispatch(scheduler, group, start, cnt);
+        for (auto *r = group; r;) {
+            // The request is gone once its caller has been woken up.
+            auto *next = r->groupNext;
+            r->result  = res;
+            OSMessage message;
+            message.message = r;
+            message.args[0] = 0;
+            message.args[1] = 0;
+            message.args[2] = 0;
+            OSSendMessage(&r->doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            r = next;
+        }
+
+        OSLockMutex(&scheduler->mutex);
+        scheduler->dispatching = false;
+        if (scheduler->stats.queueDepth == 0) {
+            OSSignalCond(&scheduler->idleCond);
+        }
+    }
+}
+
+static void RawSched_InitRequest(RawSchedRequest *request, bool write, void *data, uint32_t cnt, uint64_t blocks_offset) {
+    request->next      = nullptr;
+    request->groupNext = nullptr;
+    request->data      = (uint8_t *) data;
+    request->sector    = blocks_offset;
+    request->cnt       = cnt;
+    request->write     = write;
+    request->result    = FS_ERROR_OK;
+    OSInitMessageQueue(&request->doneQueue, &request->doneMessage, 1);
+}
+
+/**
+ * Queues a request for the worker.
+ * @return FS_ERROR_INVALID_PARAM if the scheduler is detached, FS_ERROR_BUSY if it is suspended.
+ */
+static FSError RawSched_Enqueue(FSAExRawScheduler *scheduler, RawSchedRequest *request, FSAExRawPriority priority) {
+    OSLockMutex(&scheduler->mutex);
+    if (!scheduler->attached || scheduler->suspended) {
+        OSUnlockMutex(&scheduler->mutex);
+        return scheduler->attached ? FS_ERROR_BUSY : FS_ERROR_INVALID_PARAM;
+    }
+    auto **tail = &scheduler->pending[priority];
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = request;
+    scheduler->stats.requests++;
+    scheduler->stats.queueDepth++;
+    if (scheduler->stats.queueDepth > scheduler->stats.maxQueueDepth) {
+        scheduler->stats.maxQueueDepth = scheduler->stats.queueDepth;
+    }
+    OSSignalCond(&scheduler->workCond);
+    OSUnlockMutex(&scheduler->mutex);
+    return FS_ERROR_OK;
+}
+
+static FSError RawSched_Wait(RawSchedRequest *request) {
+    OSMessage message;
+    OSReceiveMessage(&request->doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+    return request->result;
+}
+
+/**
+ * Waits until no request is queued or being dispatched anymore. Needs to be called with the mutex of the scheduler.
+ */
+static void RawSched_WaitIdle(FSAExRawScheduler *scheduler) {
+    while (scheduler->stats.queueDepth > 0 || scheduler->dispatching) {
+        OSWaitCond(&scheduler->idleCond, &scheduler->mutex);
+    }
+}
+
+static FSError RawSched_Submit(FSAExRawScheduler *scheduler, bool write, void *data, uint32_t cnt, uint64_t blocks_offset, FSAExRawPriority priority) {
+    if (cnt == 0) {
+        return FS_ERROR_OK;
+    }
+    RawSchedRequest request;
+    RawSched_InitRequest(&request, write, data, cnt, blocks_offset);
+    auto res = RawSched_Enqueue(scheduler, &request, priority);
+    if (res < 0) {
+        return res;
+    }
+    return RawSched_Wait(&request);
+}
+
+bool RawScheduler_Route(RawHandleState *state, bool write, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, FSError *outResult) {
+    if (!state->scheduler) {
+        return false;
+    }
+    // The scheduler can only be detached while the mutex of the handle is held, so it can't go away before the
+    // request is queued. The worker needs that mutex for its own transfers, so it is not held while waiting.
+    OSLockMutex(&state->mutex);
+    auto *scheduler = state->scheduler;
+    // The worker itself issues its transfers via FSAEx_RawReadEx/FSAEx_RawWriteEx.
+    if (!scheduler || size_bytes != scheduler->sectorSize || OSGetCurrentThread() == &scheduler->thread) {
+        OSUnlockMutex(&state->mutex);
+        return false;
+    }
+    if (cnt == 0) {
+        OSUnlockMutex(&state->mutex);
+        *outResult = FS_ERROR_OK;
+        return true;
+    }
+    RawSchedRequest request;
+    RawSched_InitRequest(&request, write, data, cnt, blocks_offset);
+    auto res = RawSched_Enqueue(scheduler, &request, FSAEX_RAW_PRIORITY_NORMAL);
+    OSUnlockMutex(&state->mutex);
+    if (res < 0) {
+        // Suspended, the handle is being closed.
+        return false;
+    }
+    *outResult = RawSched_Wait(&request);
+    return true;
+}
+
+void RawScheduler_Suspend(RawHandleState *state) {
+    OSLockMutex(&state->mutex);
+    auto *scheduler = state->scheduler;
+    if (!scheduler) {
+        OSUnlockMutex(&state->mutex);
+        return;
+    }
+    OSLockMutex(&scheduler->mutex);
+    scheduler->suspended = true;
+    OSUnlockMutex(&state->mutex);
+    // Requests that are already queued still need the device handle.
+    RawSched_WaitIdle(scheduler);
+    OSUnlockMutex(&scheduler->mutex);
+}
+
+void RawScheduler_Resume(FSAExRawScheduler *scheduler) {
+    OSLockMutex(&scheduler->mutex);
+    scheduler->suspended = false;
+    OSUnlockMutex(&scheduler->mutex);
+}
+
+void RawScheduler_Detach(FSAExRawScheduler *scheduler) {
+    OSLockMutex(&scheduler->state->mutex);
+    OSLockMutex(&scheduler->mutex);
+    if (scheduler->state->scheduler == scheduler) {
+        scheduler->state->scheduler = nullptr;
+    }
+    bool wasAttached    = scheduler->attached;
+    scheduler->attached = false;
+    OSUnlockMutex(&scheduler->state->mutex);
+    if (wasAttached) {
+        // Requests that are already queued still need the device handle.
+        RawSched_WaitIdle(scheduler);
+    }
+    OSUnlockMutex(&scheduler->mutex);
+}
+
+FSError FSAEx_RawSchedulerCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t maxMergeSize, FSAExRawScheduler **outScheduler) {
+    if (!outScheduler || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (maxMergeSize == 0) {
+        maxMergeSize = RawAutotune_GetTransferSizeForHandle(clientHandle, device_handle);
+    }
+    if (maxMergeSize == 0) {
+        maxMergeSize = RAW_SCHED_DEFAULT_MERGE_SIZE;
+    }
+    if (maxMergeSize < size_bytes) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    RawHandleRef state(clientHandle, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    OSLockMutex(&state->mutex);
+    if (state->scheduler) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_ALREADY_EXISTS;
+    }
+
+    auto *scheduler = (FSAExRawScheduler *) memalign(0x40, sizeof(FSAExRawScheduler));
+    if (!scheduler) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    new (scheduler) FSAExRawScheduler();
+    scheduler->clientHandle  = clientHandle;
+    scheduler->device_handle = device_handle;
+    scheduler->sectorSize    = size_bytes;
+    scheduler->mergeCapacity = maxMergeSize / size_bytes;
+    scheduler->attached      = true;
+    scheduler->state         = state;
+    scheduler->scratch       = (uint8_t *) memalign(0x40, scheduler->mergeCapacity * size_bytes);
+    scheduler->stack         = (uint8_t *) memalign(0x10, RAW_SCHED_THREAD_STACK_SIZE);
+    OSInitMutex(&scheduler->mutex);
+    OSInitCond(&scheduler->workCond);
+    OSInitCond(&scheduler->idleCond);
+    if (!scheduler->scratch || !scheduler->stack ||
+        !OSCreateThread(&scheduler->thread, RawSched_ThreadEntry, 0, (char *) scheduler, scheduler->stack + RAW_SCHED_THREAD_STACK_SIZE, RAW_SCHED_THREAD_STACK_SIZE, RAW_SCHED_THREAD_PRIORITY, OS_THREAD_ATTRIB_AFFINITY_ANY)) {
+        free(scheduler->scratch);
+        free(scheduler->stack);
+        free(scheduler);
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    OSSetThreadName(&scheduler->thread, "FSAEx_RawScheduler");
+    OSResumeThread(&scheduler->thread);
+
+    state->scheduler = scheduler;
+    *outScheduler    = scheduler;
+    OSUnlockMutex(&state->mutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawSchedulerRead(FSAExRawScheduler *scheduler, void *data, uint32_t cnt, uint64_t blocks_offset, FSAExRawPriority priority) {
+    if (!scheduler || !data || (uint32_t) priority >= FSAEX_RAW_PRIORITY_COUNT) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    return RawSched_Submit(scheduler, false, data, cnt, blocks_offset, priority);
+}
+
+FSError FSAEx_RawSchedulerWrite(FSAExRawScheduler *scheduler, const void *data, uint32_t cnt, uint64_t blocks_offset, FSAExRawPriority priority) {
+    if (!scheduler || !data || (uint32_t) priority >= FSAEX_RAW_PRIORITY_COUNT) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    return RawSched_Submit(scheduler, true, (void *) data, cnt, blocks_offset, priority);
+}
+
+void FSAEx_RawSchedulerGetStats(FSAExRawScheduler *scheduler, FSAExRawSchedulerStats *outStats) {
+    if (!scheduler || !outStats) {
+        return;
+    }
+    OSLockMutex(&scheduler->mutex);
+    *outStats = scheduler->stats;
+    OSUnlockMutex(&scheduler->mutex);
+}
+
+void FSAEx_RawSchedulerDestroy(FSAExRawScheduler *scheduler) {
+    if (!scheduler) {
+        return;
+    }
+    RawScheduler_Detach(scheduler);
+    OSLockMutex(&scheduler->mutex);
+    scheduler->stop = true;
+    OSSignalCond(&scheduler->workCond);
+    OSUnlockMutex(&scheduler->mutex);
+    OSJoinThread(&scheduler->thread, nullptr);
+
+    free(scheduler->scratch);
+    free(scheduler->stack);
+    free(scheduler);
+}
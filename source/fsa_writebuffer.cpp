@@ -0,0 +1,306 @@
+#include "fsa_internal.h"
+#include "mocha/fsa.h"
+#include "raw_handle.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+#include <malloc.h>
+
+#define RAW_WRITE_BUFFER_MAX_RUNS 4
+
+struct RawWriteRun {
+    uint8_t *buffer;
+    uint64_t start;
+    uint32_t cnt; // 0 if the run is unused.
+    uint32_t lastUse;
+};
+
+struct FSAExRawWriteBuffer {
+    int clientHandle;
+    int device_handle;
+    bool attached;
+    uint32_t sectorSize;
+    uint32_t runCapacity; // in sectors
+    uint32_t useCounter;
+    RawHandleState *state; // The mutex of the handle guards the write buffer. Slots are never freed, so this stays valid after a detach.
+    RawWriteRun runs[RAW_WRITE_BUFFER_MAX_RUNS];
+    FSAExRawWriteBufferStats stats;
+};
+
+static inline bool RawWriteBuffer_Touches(const RawWriteRun &run, uint64_t blocks_offset, uint32_t cnt) {
+    // overlapping or directly adjacent
+    return run.cnt != 0 && blocks_offset <= run.start + run.cnt && run.start <= blocks_offset + cnt;
+}
+
+static inline bool RawWriteBuffer_Overlaps(const RawWriteRun &run, uint64_t blocks_offset, uint32_t cnt) {
+    return run.cnt != 0 && blocks_offset < run.start + run.cnt && run.start < blocks_offset + cnt;
+}
+
+/**
+ * Writes to the device without going through FSAEx_RawWriteEx. That could queue the write on the scheduler of the
+ * handle, whose worker would wait for the mutex of the handle that is held here.
+ */
+static FSError RawWriteBuffer_WriteDevice(FSAExRawWriteBuffer *writeBuffer, const void *data, uint32_t cnt, uint64_t blocks_offset) {
+    if (writeBuffer->state->cache) {
+        auto res = RawCache_BeforeDeviceWrite(writeBuffer->state->cache, blocks_offset, cnt);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return FSAEx_RawWriteUncached(writeBuffer->clientHandle, data, writeBuffer->sectorSize, cnt, blocks_offset, writeBuffer->device_handle);
+}
+
+static FSError RawWriteBuffer_FlushRun(FSAExRawWriteBuffer *writeBuffer, RawWriteRun &run) {
+    if (run.cnt == 0) {
+        return FS_ERROR_OK;
+    }
+    uint32_t cnt = run.cnt;
+    // Mark the run as empty first, the write-back of overlapping dirty cache blocks would try to flush it again otherwise.
+    run.cnt  = 0;
+    auto res = RawWriteBuffer_WriteDevice(writeBuffer, run.buffer, cnt, run.start);
+    if (res < 0) {
+        run.cnt = cnt;
+        return res;
+    }
+    writeBuffer->stats.flushes++;
+    writeBuffer->stats.flushedSectors += cnt;
+    return FS_ERROR_OK;
+}
+
+static FSError RawWriteBuffer_FlushOverlapping(FSAExRawWriteBuffer *writeBuffer, uint64_t blocks_offset, uint32_t cnt) {
+    for (auto &run : writeBuffer->runs) {
+        if (RawWriteBuffer_Overlaps(run, blocks_offset, cnt)) {
+            auto res = RawWriteBuffer_FlushRun(writeBuffer, run);
+            if (res < 0) {
+                return res;
+            }
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+static FSError RawWriteBuffer_FlushAll(FSAExRawWriteBuffer *writeBuffer) {
+    for (auto &run : writeBuffer->runs) {
+        auto res = RawWriteBuffer_FlushRun(writeBuffer, run);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return FS_ERROR_OK;
+}
+
+FSError RawWriteBuffer_BeforeDeviceAccess(FSAExRawWriteBuffer *writeBuffer, uint64_t blocks_offset, uint32_t cnt) {
+    OSLockMutex(&writeBuffer->state->mutex);
+    auto res = RawWriteBuffer_FlushOverlapping(writeBuffer, blocks_offset, cnt);
+    OSUnlockMutex(&writeBuffer->state->mutex);
+    return res;
+}
+
+void RawWriteBuffer_Detach(FSAExRawWriteBuffer *writeBuffer) {
+    OSLockMutex(&writeBuffer->state->mutex);
+    if (writeBuffer->attached) {
+        RawWriteBuffer_FlushAll(writeBuffer);
+        writeBuffer->attached = false;
+        if (writeBuffer->state->writeBuffer == writeBuffer) {
+            writeBuffer->state->writeBuffer = nullptr;
+        }
+    }
+    OSUnlockMutex(&writeBuffer->state->mutex);
+}
+
+FSError FSAEx_RawWriteBufferCreate(int clientHandle, int device_handle, uint32_t size_bytes, uint32_t maxRunSize, FSAExRawWriteBuffer **outWriteBuffer) {
+    if (!outWriteBuffer || size_bytes == 0 || maxRunSize < size_bytes) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    RawHandleRef state(clientHandle, device_handle, true);
+    if (!state) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    OSLockMutex(&state->mutex);
+    if (state->writeBuffer) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_ALREADY_EXISTS;
+    }
+
+    auto *writeBuffer = (FSAExRawWriteBuffer *) malloc(sizeof(FSAExRawWriteBuffer));
+    if (!writeBuffer) {
+        OSUnlockMutex(&state->mutex);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(writeBuffer, 0, sizeof(FSAExRawWriteBuffer));
+    writeBuffer->clientHandle  = clientHandle;
+    writeBuffer->device_handle = device_handle;
+    writeBuffer->attached      = true;
+    writeBuffer->sectorSize    = size_bytes;
+    writeBuffer->runCapacity   = maxRunSize / size_bytes;
+    writeBuffer->state         = state;
+    for (auto &run : writeBuffer->runs) {
+        run.buffer = (uint8_t *) memalign(0x40, writeBuffer->runCapacity * size_bytes);
+        if (!run.buffer) {
+            for (auto &other : writeBuffer->runs) {
+                free(other.buffer);
+            }
+            free(writeBuffer);
+            OSUnlockMutex(&state->mutex);
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+    }
+
+    state->writeBuffer = writeBuffer;
+    *outWriteBuffer    = writeBuffer;
+    OSUnlockMutex(&state->mutex);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawWriteBufferWrite(FSAExRawWriteBuffer *writeBuffer, const void *data, uint32_t cnt, uint64_t blocks_offset) {
+    if (!writeBuffer || !data) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (cnt == 0) {
+        return FS_ERROR_OK;
+    }
+    OSLockMutex(&writeBuffer->state->mutex);
+    if (!writeBuffer->attached) {
+        OSUnlockMutex(&writeBuffer->state->mutex);
+        return FS_ERROR_INVALID_PARAM;
+    }
+    writeBuffer->stats.writes++;
+
+    // A range is never held by both, cached blocks of this range would hide the buffered data.
+    FSError res = FS_ERROR_OK;
+    if (writeBuffer->state->cache) {
+        res = RawCache_BeforeDeviceWrite(writeBuffer->state->cache, blocks_offset, cnt);
+        if (res < 0) {
+            OSUnlockMutex(&writeBuffer->state->mutex);
+            return res;
+        }
+    }
+
+    uint32_t sectorSize = writeBuffer->sectorSize;
+    uint32_t capacity   = writeBuffer->runCapacity;
+    uint64_t writeEnd   = blocks_offset + cnt;
+    RawWriteRun *target = nullptr;
+    if (cnt >= capacity) {
+        // Nothing to gain from buffering. The overlapping runs are older and must not overwrite the data later.
+        res = RawWriteBuffer_FlushOverlapping(writeBuffer, blocks_offset, cnt);
+        if (res >= 0) {
+            res = RawWriteBuffer_WriteDevice(writeBuffer, data, cnt, blocks_offset);
+        }
+        OSUnlockMutex(&writeBuffer->state->mutex);
+        return res;
+    }
+
+    while (!target) {
+        RawWriteRun *touching = nullptr;
+        uint32_t touchCount   = 0;
+        for (auto &run : writeBuffer->runs) {
+            if (RawWriteBuffer_Touches(run, blocks_offset, cnt)) {
+                touching = &run;
+                touchCount++;
+            }
+        }
+        if (touchCount == 1) {
+            uint64_t newStart = touching->start < blocks_offset ? touching->start : blocks_offset;
+            uint64_t newEnd   = touching->start + touching->cnt > writeEnd ? touching->start + touching->cnt : writeEnd;
+            if (newEnd - newStart <= capacity) {
+                if (newStart < touching->start) {
+                    // Make room in front of the buffered data.
+                    memmove(touching->buffer + (touching->start - newStart) * sectorSize, touching->buffer, touching->cnt * sectorSize);
+                    touching->start = newStart;
+                }
+                touching->cnt = (uint32_t) (newEnd - newStart);
+                writeBuffer->stats.coalescedWrites++;
+                target = touching;
+                break;
+            }
+        }
+        if (touchCount > 0) {
+            // Can't merge, write back what's there. Runs never overlap each other, so the order of the flushes doesn't matter.
+            res = RawWriteBuffer_FlushOverlapping(writeBuffer, blocks_offset > 0 ? blocks_offset - 1 : 0, cnt + 2);
+            if (res < 0) {
+                break;
+            }
+            continue;
+        }
+
+        // Start a new run in a free slot, or in the least recently used one.
+        RawWriteRun *victim = &writeBuffer->runs[0];
+        for (auto &run : writeBuffer->runs) {
+            if (run.cnt == 0) {
+                victim = &run;
+                break;
+            }
+            if (run.lastUse < victim->lastUse) {
+                victim = &run;
+            }
+        }
+        res = RawWriteBuffer_FlushRun(writeBuffer, *victim);
+        if (res < 0) {
+            break;
+        }
+        victim->start = blocks_offset;
+        victim->cnt   = cnt;
+        target        = victim;
+    }
+
+    if (target) {
+        memcpy(target->buffer + (blocks_offset - target->start) * sectorSize, data, cnt * sectorSize);
+        target->lastUse = ++writeBuffer->useCounter;
+        if (target->cnt == capacity) {
+            res = RawWriteBuffer_FlushRun(writeBuffer, *target);
+        }
+    }
+    OSUnlockMutex(&writeBuffer->state->mutex);
+    return res;
+}
+
+FSError FSAEx_RawWriteBufferRead(FSAExRawWriteBuffer *writeBuffer, void *data, uint32_t cnt, uint64_t blocks_offset) {
+    if (!writeBuffer || !data) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    // FSAEx_RawReadEx writes back the buffered data of this range first.
+    return FSAEx_RawReadEx(writeBuffer->clientHandle, data, writeBuffer->sectorSize, cnt, blocks_offset, writeBuffer->device_handle);
+}
+
+FSError FSAEx_RawWriteBufferFlush(FSAExRawWriteBuffer *writeBuffer) {
+    if (!writeBuffer) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&writeBuffer->state->mutex);
+    auto res = writeBuffer->attached ? RawWriteBuffer_FlushAll(writeBuffer) : FS_ERROR_OK;
+    OSUnlockMutex(&writeBuffer->state->mutex);
+    return res;
+}
+
+void FSAEx_RawWriteBufferGetStats(FSAExRawWriteBuffer *writeBuffer, FSAExRawWriteBufferStats *outStats) {
+    if (!writeBuffer || !outStats) {
+        return;
+    }
+    OSLockMutex(&writeBuffer->state->mutex);
+    *outStats = writeBuffer->stats;
+    OSUnlockMutex(&writeBuffer->state->mutex);
+}
+
+FSError FSAEx_RawWriteBufferDestroy(FSAExRawWriteBuffer *writeBuffer) {
+    if (!writeBuffer) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    OSLockMutex(&writeBuffer->state->mutex);
+    if (writeBuffer->attached) {
+        auto res = RawWriteBuffer_FlushAll(writeBuffer);
+        if (res < 0) {
+            // Keep the buffer alive, the buffered data would be lost otherwise.
+            OSUnlockMutex(&writeBuffer->state->mutex);
+            return res;
+        }
+        if (writeBuffer->state->writeBuffer == writeBuffer) {
+            writeBuffer->state->writeBuffer = nullptr;
+        }
+    }
+    OSUnlockMutex(&writeBuffer->state->mutex);
+
+    for (auto &run : writeBuffer->runs) {
+        free(run.buffer);
+    }
+    free(writeBuffer);
+    return FS_ERROR_OK;
+}
@@ -0,0 +1,217 @@
+#include "hash.h"
+#include <cstring>
+
+static uint32_t sCrc32Table[256];
+static bool sCrc32TableReady = false;
+
+static void Hash_InitCrc32Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        sCrc32Table[i] = c;
+    }
+    sCrc32TableReady = true;
+}
+
+static inline uint32_t Hash_Rol(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+static inline uint32_t Hash_Ror(uint32_t v, int n) {
+    return (v >> n) | (v << (32 - n));
+}
+
+// Byte wise loads/stores keep the code independent of the host endianness.
+static inline uint32_t Hash_LoadBE32(const uint8_t *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void Hash_StoreBE32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void Hash_Sha1Block(uint32_t *h, const uint8_t *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = Hash_LoadBE32(block + i * 4);
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = Hash_Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = Hash_Rol(a, 5) + f + e + k + w[i];
+        e          = d;
+        d          = c;
+        c          = Hash_Rol(b, 30);
+        b          = a;
+        a          = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static const uint32_t sSha256K[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static void Hash_Sha256Block(uint32_t *h, const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = Hash_LoadBE32(block + i * 4);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = Hash_Ror(w[i - 15], 7) ^ Hash_Ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Hash_Ror(w[i - 2], 17) ^ Hash_Ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i]        = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = Hash_Ror(e, 6) ^ Hash_Ror(e, 11) ^ Hash_Ror(e, 25);
+        uint32_t t1 = hh + s1 + ((e & f) ^ (~e & g)) + sSha256K[i] + w[i];
+        uint32_t s0 = Hash_Ror(a, 2) ^ Hash_Ror(a, 13) ^ Hash_Ror(a, 22);
+        uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+        hh          = g;
+        g           = f;
+        f           = e;
+        e           = d + t1;
+        d           = c;
+        c           = b;
+        b           = a;
+        a           = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
+
+static void Hash_Blocks(HashState *state, const uint8_t *data, uint32_t blockCount) {
+    for (uint32_t i = 0; i < blockCount; i++, data += 64) {
+        if (state->algorithms & FSAEX_HASH_SHA1) {
+            Hash_Sha1Block(state->sha1, data);
+        }
+        if (state->algorithms & FSAEX_HASH_SHA256) {
+            Hash_Sha256Block(state->sha256, data);
+        }
+    }
+}
+
+void Hash_Init(HashState *state, uint32_t algorithms) {
+    static const uint32_t sha1Init[5]   = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    static const uint32_t sha256Init[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+    if ((algorithms & FSAEX_HASH_CRC32) && !sCrc32TableReady) {
+        // Racing initializations write the same values.
+        Hash_InitCrc32Table();
+    }
+    state->algorithms  = algorithms;
+    state->crc32       = 0xFFFFFFFF;
+    state->length      = 0;
+    state->blockLength = 0;
+    memcpy(state->sha1, sha1Init, sizeof(sha1Init));
+    memcpy(state->sha256, sha256Init, sizeof(sha256Init));
+}
+
+void Hash_Update(HashState *state, const void *data, uint32_t size) {
+    auto *p = (const uint8_t *) data;
+    if (state->algorithms & FSAEX_HASH_CRC32) {
+        uint32_t crc = state->crc32;
+        for (uint32_t i = 0; i < size; i++) {
+            crc = sCrc32Table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        }
+        state->crc32 = crc;
+    }
+    state->length += size;
+    if (!(state->algorithms & (FSAEX_HASH_SHA1 | FSAEX_HASH_SHA256))) {
+        return;
+    }
+
+    if (state->blockLength > 0) {
+        uint32_t fill = 64 - state->blockLength;
+        if (fill > size) {
+            fill = size;
+        }
+        memcpy(state->block + state->blockLength, p, fill);
+        state->blockLength += fill;
+        p += fill;
+        size -= fill;
+        if (state->blockLength < 64) {
+            return;
+        }
+        Hash_Blocks(state, state->block, 1);
+        state->blockLength = 0;
+    }
+    // Full blocks are hashed straight from the source buffer.
+    Hash_Blocks(state, p, size / 64);
+    p += size & ~63;
+    size &= 63;
+    memcpy(state->block, p, size);
+    state->blockLength = size;
+}
+
+void Hash_Final(HashState *state, FSAExHashDigest *outDigest) {
+    memset(outDigest, 0, sizeof(*outDigest));
+    if (state->algorithms & FSAEX_HASH_CRC32) {
+        outDigest->crc32 = ~state->crc32;
+    }
+    if (!(state->algorithms & (FSAEX_HASH_SHA1 | FSAEX_HASH_SHA256))) {
+        return;
+    }
+
+    // Both algorithms use the same padding: 0x80, zeros and the message length in bits as big endian 64 bit value.
+    uint64_t bits                      = state->length * 8;
+    state->block[state->blockLength++] = 0x80;
+    if (state->blockLength > 56) {
+        memset(state->block + state->blockLength, 0, 64 - state->blockLength);
+        Hash_Blocks(state, state->block, 1);
+        state->blockLength = 0;
+    }
+    memset(state->block + state->blockLength, 0, 56 - state->blockLength);
+    Hash_StoreBE32(state->block + 56, (uint32_t) (bits >> 32));
+    Hash_StoreBE32(state->block + 60, (uint32_t) bits);
+    Hash_Blocks(state, state->block, 1);
+
+    if (state->algorithms & FSAEX_HASH_SHA1) {
+        for (int i = 0; i < 5; i++) {
+            Hash_StoreBE32(outDigest->sha1 + i * 4, state->sha1[i]);
+        }
+    }
+    if (state->algorithms & FSAEX_HASH_SHA256) {
+        for (int i = 0; i < 8; i++) {
+            Hash_StoreBE32(outDigest->sha256 + i * 4, state->sha256[i]);
+        }
+    }
+}
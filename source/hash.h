@@ -0,0 +1,27 @@
+#pragma once
+#include "mocha/fsa.h"
+#include <stdint.h>
+
+/*
+ * Incremental CRC32 (IEEE 802.3), SHA-1 and SHA-256, used to digest raw transfers without a second pass over the data.
+ * Only the algorithms that are enabled in HashState::algorithms (FSAExHashAlgorithm flags) are computed.
+ */
+
+struct HashState {
+    uint32_t algorithms;
+    uint32_t crc32;
+    uint64_t length;
+    uint32_t sha1[5];
+    uint32_t sha256[8];
+    uint8_t block[64];
+    uint32_t blockLength;
+};
+
+void Hash_Init(HashState *state, uint32_t algorithms);
+
+void Hash_Update(HashState *state, const void *data, uint32_t size);
+
+/**
+ * Stores the digests of all enabled algorithms in outDigest, the other fields are zeroed. The state can't be updated afterwards.
+ */
+void Hash_Final(HashState *state, FSAExHashDigest *outDigest);
@@ -0,0 +1,151 @@
+#include "lz_codec.h"
+#include <cstring>
+
+#define LZ_MIN_MATCH     4
+#define LZ_MAX_OFFSET    0xFFFF
+// The last bytes are always emitted as literals, this keeps the match search away from the end of the input.
+#define LZ_LAST_LITERALS 5
+#define LZ_NO_POSITION   0xFFFFFFFF
+
+static inline uint32_t LZ_Read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t LZ_Hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline bool LZ_WriteLength(uint8_t **op, const uint8_t *end, uint32_t len) {
+    while (len >= 255) {
+        if (*op >= end) {
+            return false;
+        }
+        *(*op)++ = 255;
+        len -= 255;
+    }
+    if (*op >= end) {
+        return false;
+    }
+    *(*op)++ = (uint8_t) len;
+    return true;
+}
+
+static bool LZ_WriteSequence(uint8_t **op, const uint8_t *end, const uint8_t *literals, uint32_t literalLen, uint32_t offset, uint32_t matchLen) {
+    if (*op >= end) {
+        return false;
+    }
+    uint32_t matchCode = matchLen ? matchLen - LZ_MIN_MATCH : 0;
+    uint8_t *token     = (*op)++;
+    *token             = (uint8_t) (((literalLen < 15 ? literalLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLen >= 15 && !LZ_WriteLength(op, end, literalLen - 15)) {
+        return false;
+    }
+    if ((uint32_t) (end - *op) < literalLen) {
+        return false;
+    }
+    memcpy(*op, literals, literalLen);
+    *op += literalLen;
+    if (matchLen == 0) {
+        return true;
+    }
+    if (end - *op < 2) {
+        return false;
+    }
+    *(*op)++ = (uint8_t) (offset & 0xFF);
+    *(*op)++ = (uint8_t) (offset >> 8);
+    return matchCode < 15 || LZ_WriteLength(op, end, matchCode - 15);
+}
+
+uint32_t LZ_Compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity, uint32_t *hashTable) {
+    for (uint32_t i = 0; i < LZ_HASH_TABLE_SIZE; i++) {
+        hashTable[i] = LZ_NO_POSITION;
+    }
+
+    uint8_t *op        = dst;
+    const uint8_t *end = dst + dstCapacity;
+    uint32_t anchor    = 0;
+    uint32_t ip        = 0;
+    uint32_t limit     = srcLen > LZ_LAST_LITERALS + LZ_MIN_MATCH ? srcLen - LZ_LAST_LITERALS - LZ_MIN_MATCH : 0;
+    while (ip < limit) {
+        uint32_t seq = LZ_Read32(src + ip);
+        uint32_t h   = LZ_Hash(seq);
+        uint32_t ref = hashTable[h];
+        hashTable[h] = ip;
+        if (ref == LZ_NO_POSITION || ip - ref > LZ_MAX_OFFSET || LZ_Read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+        uint32_t matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < srcLen - LZ_LAST_LITERALS && src[ref + matchLen] == src[ip + matchLen]) {
+            matchLen++;
+        }
+        if (!LZ_WriteSequence(&op, end, src + anchor, ip - anchor, ip - ref, matchLen)) {
+            return 0;
+        }
+        ip += matchLen;
+        anchor = ip;
+    }
+    if (!LZ_WriteSequence(&op, end, src + anchor, srcLen - anchor, 0, 0)) {
+        return 0;
+    }
+    return (uint32_t) (op - dst);
+}
+
+static inline bool LZ_ReadLength(const uint8_t **ip, const uint8_t *end, uint32_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int32_t LZ_Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity) {
+    const uint8_t *ip    = src;
+    const uint8_t *ipEnd = src + srcLen;
+    uint8_t *op          = dst;
+    const uint8_t *opEnd = dst + dstCapacity;
+    while (ip < ipEnd) {
+        uint8_t token       = *ip++;
+        uint32_t literalLen = token >> 4;
+        if (literalLen == 15 && !LZ_ReadLength(&ip, ipEnd, &literalLen)) {
+            return -1;
+        }
+        if ((uint32_t) (ipEnd - ip) < literalLen || (uint32_t) (opEnd - op) < literalLen) {
+            return -1;
+        }
+        memcpy(op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+        if (ip == ipEnd) {
+            // Last sequence
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        uint32_t matchLen = token & 0x0F;
+        if (matchLen == 15 && !LZ_ReadLength(&ip, ipEnd, &matchLen)) {
+            return -1;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint32_t) (op - dst) || (uint32_t) (opEnd - op) < matchLen) {
+            return -1;
+        }
+        // Byte wise, the match may overlap the output.
+        const uint8_t *match = op - offset;
+        for (uint32_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+    return (int32_t) (op - dst);
+}
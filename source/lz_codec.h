@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Small LZ77 codec in the spirit of LZ4, used by the raw image container. Speed matters more than ratio here.
+ * Sequence format: [token: literal count << 4 | (match length - 4)][literal count extension][literals][offset, 16 bit LE][match length extension]
+ * Counts >= 15 are extended with bytes of 255 and a final byte < 255. The last sequence only contains literals.
+ */
+
+#define LZ_HASH_BITS       12
+#define LZ_HASH_TABLE_SIZE (1 << LZ_HASH_BITS)
+
+/**
+ * Compresses src into dst.
+ * @param hashTable scratch space of LZ_HASH_TABLE_SIZE entries, kept off the stack as thread stacks are small.
+ * @return size of the compressed data, or 0 if it doesn't fit into dstCapacity.
+ */
+uint32_t LZ_Compress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity, uint32_t *hashTable);
+
+/**
+ * Decompresses src into dst.
+ * @return size of the decompressed data, or -1 if the data is corrupt or doesn't fit into dstCapacity.
+ */
+int32_t LZ_Decompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstCapacity);
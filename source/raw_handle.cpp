@@ -0,0 +1,155 @@
+#include "fsa_internal.h"
+#include "raw_handle.h"
+#include <coreinit/mutex.h>
+#include <cstring>
+
+static RawHandleState sRawHandles[RAW_HANDLE_MAX_COUNT];
+static OSMutex sRawHandleMutex;
+
+/**
+ * sRawHandles is dynamically initialized (it holds atomics), which may happen after __attribute__((constructor))
+ * functions. Called from the initializer of sRawHandleInitDone instead, which always runs after the one of sRawHandles.
+ * The per slot mutexes are initialized once here and survive the reuse of a slot.
+ */
+static bool RawHandle_Init() {
+    OSInitMutex(&sRawHandleMutex);
+    for (auto &state : sRawHandles) {
+        OSInitMutex(&state.mutex);
+        OSInitMutex(&state.asyncMutex);
+    }
+    return true;
+}
+
+static bool sRawHandleInitDone = RawHandle_Init();
+
+static void RawHandle_Reset(RawHandleState *state) {
+    state->maxBounceSize        = RAW_HANDLE_DEFAULT_MAX_BOUNCE_SIZE;
+    state->unalignedWarningDone = false;
+    state->queueDepth           = RAW_HANDLE_DEFAULT_QUEUE_DEPTH;
+    state->asyncQueue           = nullptr;
+    state->cache                = nullptr;
+    state->writeBuffer          = nullptr;
+    state->readAhead            = nullptr;
+    state->scheduler            = nullptr;
+    state->devicePath[0]        = '\0';
+    for (auto &bucket : state->latencyBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    state->latencyMaxUs.store(0, std::memory_order_relaxed);
+}
+
+static bool RawHandle_Matches(const RawHandleState &state, int clientHandle, int32_t device_handle) {
+    if (state.deviceHandle.load() != device_handle) {
+        return false;
+    }
+    int32_t owner = state.clientHandle.load();
+    return clientHandle == RAW_HANDLE_ANY_CLIENT || owner == RAW_HANDLE_ANY_CLIENT || owner == clientHandle;
+}
+
+// Only while sRawHandleMutex is held, states are neither created nor removed then.
+static RawHandleState *RawHandle_Find(int clientHandle, int32_t device_handle) {
+    for (auto &state : sRawHandles) {
+        if (RawHandle_Matches(state, clientHandle, device_handle)) {
+            return &state;
+        }
+    }
+    return nullptr;
+}
+
+RawHandleState *RawHandle_Acquire(int clientHandle, int32_t device_handle, bool create) {
+    if (device_handle < 0) {
+        return nullptr;
+    }
+    // Lookups are lock free, only creating and removing a state is serialized. The key is checked again once the
+    // reference is taken: A slot that was removed and reused for another handle in between doesn't match anymore, and
+    // from then on it can't be reused until the reference is dropped.
+    for (auto &state : sRawHandles) {
+        if (!RawHandle_Matches(state, clientHandle, device_handle)) {
+            continue;
+        }
+        state.users.fetch_add(1);
+        if (RawHandle_Matches(state, clientHandle, device_handle)) {
+            return &state;
+        }
+        state.users.fetch_sub(1);
+    }
+    if (!create) {
+        return nullptr;
+    }
+
+    OSLockMutex(&sRawHandleMutex);
+    auto *state = RawHandle_Find(clientHandle, device_handle);
+    if (state) {
+        if (clientHandle != RAW_HANDLE_ANY_CLIENT) {
+            state->clientHandle.store(clientHandle);
+        }
+        state->users.fetch_add(1);
+    } else {
+        for (auto &slot : sRawHandles) {
+            if (slot.deviceHandle.load() == -1 && slot.users.load() == 0) {
+                state = &slot;
+                break;
+            }
+        }
+        if (state) {
+            RawHandle_Reset(state);
+            state->users.fetch_add(1);
+            state->clientHandle.store(clientHandle);
+            state->deviceHandle.store(device_handle);
+        }
+    }
+    OSUnlockMutex(&sRawHandleMutex);
+    return state;
+}
+
+void RawHandle_Release(RawHandleState *state) {
+    if (state) {
+        state->users.fetch_sub(1);
+    }
+}
+
+void RawHandle_Remove(int clientHandle, int32_t device_handle) {
+    if (device_handle < 0) {
+        return;
+    }
+    RawReadAhead *readAhead = nullptr;
+    RawAsyncQueue *queue    = nullptr;
+    OSLockMutex(&sRawHandleMutex);
+    auto *state = RawHandle_Find(clientHandle, device_handle);
+    if (state) {
+        state->deviceHandle.store(-1);
+        readAhead        = state->readAhead;
+        state->readAhead = nullptr;
+        // Submissions and polls take their reference on the queue while holding asyncMutex.
+        OSLockMutex(&state->asyncMutex);
+        queue = state->asyncQueue.exchange(nullptr);
+        OSUnlockMutex(&state->asyncMutex);
+    }
+    OSUnlockMutex(&sRawHandleMutex);
+
+    // Both wait for in flight requests and waiting polls, so they are freed without holding the lock.
+    // The prefetch of the read-ahead state uses a slot of the async queue, so it goes first.
+    if (readAhead) {
+        RawReadAhead_Destroy(readAhead);
+    }
+    RawAsync_DestroyQueue(queue);
+}
+
+FSError RawHandle_BeforeDeviceReadByPath(const char *device_path, uint64_t blocks_offset, uint32_t cnt) {
+    for (auto &state : sRawHandles) {
+        if (state.deviceHandle.load() < 0) {
+            continue;
+        }
+        // Same as in RawHandle_Acquire, the path is only compared while the slot can't be reused.
+        state.users.fetch_add(1);
+        FSError res = FS_ERROR_OK;
+        if (state.deviceHandle.load() >= 0 && strncmp(state.devicePath, device_path, sizeof(state.devicePath)) == 0) {
+            res = FSAEx_RawBeforeDeviceRead(&state, blocks_offset, cnt);
+        }
+        RawHandle_Release(&state);
+        if (res < 0) {
+            return res;
+        }
+    }
+    return FS_ERROR_OK;
+}
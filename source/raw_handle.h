@@ -0,0 +1,86 @@
+#pragma once
+#include "mocha/fsa.h"
+#include <atomic>
+#include <coreinit/mutex.h>
+#include <stdint.h>
+
+#define RAW_HANDLE_MAX_COUNT               32
+#define RAW_HANDLE_DEFAULT_MAX_BOUNCE_SIZE (128 * 1024)
+#define RAW_HANDLE_DEFAULT_QUEUE_DEPTH     4
+#define RAW_HANDLE_MAX_PATH_LENGTH         0x40
+#define RAW_HANDLE_LATENCY_BUCKETS         96 // 4 buckets per power of two, up to ~16 s
+#define RAW_HANDLE_ANY_CLIENT              -1 // For functions that only get a device handle, matches every client.
+
+struct RawAsyncQueue;
+struct RawReadAhead;
+
+/**
+ * Per device handle state that is kept by the library between FSAEx_RawOpenEx and FSAEx_RawCloseEx. Device handles
+ * belong to a client, so a state is identified by both handles.
+ */
+struct RawHandleState {
+    std::atomic<int32_t> deviceHandle{-1};                    // -1 if the slot is unused
+    std::atomic<int32_t> clientHandle{RAW_HANDLE_ANY_CLIENT}; // RAW_HANDLE_ANY_CLIENT if the state was created without one
+    std::atomic<uint32_t> users{0};                           // References of RawHandle_Acquire, the slot is only reused once there are none.
+    // Recursive. Guards cache, writeBuffer and scheduler, which are only published and retired while it is held, and
+    // is held by the cache and write buffer while they move data between each other or to the device.
+    OSMutex mutex;
+    uint32_t maxBounceSize;
+    std::atomic<bool> unalignedWarningDone; // Unaligned transfers of several threads may race to warn first.
+    uint32_t queueDepth;
+    OSMutex asyncMutex; // Taken while the async queue is used by a submission or replaced, never from IPC callbacks.
+    std::atomic<RawAsyncQueue *> asyncQueue;
+    FSAExRawCache *cache;
+    FSAExRawWriteBuffer *writeBuffer;
+    RawReadAhead *readAhead;
+    FSAExRawScheduler *scheduler;
+    char devicePath[RAW_HANDLE_MAX_PATH_LENGTH]; // Path that was passed to FSAEx_RawOpenEx, empty if unknown.
+    // Histogram of the latencies of synchronous transfers in microseconds, see RawLatency_Record.
+    std::atomic<uint32_t> latencyBuckets[RAW_HANDLE_LATENCY_BUCKETS];
+    std::atomic<uint32_t> latencyMaxUs;
+};
+
+/**
+ * Returns the state of a device handle and takes a reference on it, which needs to be dropped via RawHandle_Release.
+ * The state may still be removed meanwhile, but its slot is not reused for another handle before.
+ * @param clientHandle client the device handle belongs to, or RAW_HANDLE_ANY_CLIENT.
+ * @param device_handle raw device handle
+ * @param create allocate a new state if none exists yet.
+ * @return pointer to the state or NULL if none exists (or no free slot is left when create is set).
+ */
+RawHandleState *RawHandle_Acquire(int clientHandle, int32_t device_handle, bool create);
+
+/**
+ * Drops a reference taken by RawHandle_Acquire. Does nothing for NULL.
+ */
+void RawHandle_Release(RawHandleState *state);
+
+/**
+ * Holds the reference of RawHandle_Acquire until the end of the scope and converts to the state pointer.
+ */
+struct RawHandleRef {
+    RawHandleRef(int clientHandle, int32_t device_handle, bool create) : state(RawHandle_Acquire(clientHandle, device_handle, create)) {}
+    ~RawHandleRef() { RawHandle_Release(state); }
+    RawHandleRef(const RawHandleRef &)            = delete;
+    RawHandleRef &operator=(const RawHandleRef &) = delete;
+    operator RawHandleState *() const { return state; }
+    RawHandleState *operator->() const { return state; }
+
+    RawHandleState *const state;
+};
+
+/**
+ * Releases the state of a device handle. Needs to be called once the device handle was closed.
+ */
+void RawHandle_Remove(int clientHandle, int32_t device_handle);
+
+/**
+ * Calls FSAEx_RawBeforeDeviceRead for every open handle of a device, for reads that go through handles of their own.
+ */
+FSError RawHandle_BeforeDeviceReadByPath(const char *device_path, uint64_t blocks_offset, uint32_t cnt);
+
+/**
+ * Waits until no IPC callback and no waiting FSAEx_RawPollCompletion uses an async queue anymore, then frees the queue
+ * including all its request slots. Results that were not polled yet are dropped. Implemented in fsa_async.cpp
+ */
+void RawAsync_DestroyQueue(RawAsyncQueue *queue);
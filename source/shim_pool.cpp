@@ -0,0 +1,76 @@
+#include "shim_pool.h"
+#include "mocha/fsa.h"
+#include "stats.h"
+#include <atomic>
+#include <coreinit/core.h>
+#include <malloc.h>
+
+#define SHIM_POOL_CORE_COUNT   3
+#define SHIM_POOL_SHARED_SLOTS 8
+
+// Each core has a one entry cache, so a thread that keeps issuing FSAEx calls will get the same buffer back without touching the shared slots.
+static std::atomic<FSAShimBuffer *> sCoreCache[SHIM_POOL_CORE_COUNT];
+// Shared free list. Slots are only ever swapped with exchange/compare_exchange, so no lock is needed and a buffer can't be handed out twice.
+static std::atomic<FSAShimBuffer *> sSharedSlots[SHIM_POOL_SHARED_SLOTS];
+
+static std::atomic<uint32_t> sHits;
+static std::atomic<uint32_t> sMisses;
+
+static uint32_t ShimPool_GetCoreIndex() {
+    uint32_t core = OSGetCoreId();
+    return core < SHIM_POOL_CORE_COUNT ? core : 0;
+}
+
+FSAShimBuffer *ShimPool_Acquire() {
+    auto *shim = sCoreCache[ShimPool_GetCoreIndex()].exchange(nullptr, std::memory_order_acquire);
+    if (!shim) {
+        for (auto &slot : sSharedSlots) {
+            if (slot.load(std::memory_order_relaxed) == nullptr) {
+                continue;
+            }
+            shim = slot.exchange(nullptr, std::memory_order_acquire);
+            if (shim) {
+                break;
+            }
+        }
+    }
+
+    if (shim) {
+        sHits.fetch_add(1, std::memory_order_relaxed);
+        return shim;
+    }
+
+    sMisses.fetch_add(1, std::memory_order_relaxed);
+    STATS_ALLOCATION();
+    return (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+}
+
+void ShimPool_Release(FSAShimBuffer *shim) {
+    if (!shim) {
+        return;
+    }
+    FSAShimBuffer *expected = nullptr;
+    if (sCoreCache[ShimPool_GetCoreIndex()].compare_exchange_strong(expected, shim, std::memory_order_release)) {
+        return;
+    }
+    for (auto &slot : sSharedSlots) {
+        expected = nullptr;
+        if (slot.compare_exchange_strong(expected, shim, std::memory_order_release)) {
+            return;
+        }
+    }
+    free(shim);
+}
+
+void FSAEx_GetShimPoolStats(FSAExShimPoolStats *outStats) {
+    if (!outStats) {
+        return;
+    }
+    outStats->hits   = sHits.load(std::memory_order_relaxed);
+    outStats->misses = sMisses.load(std::memory_order_relaxed);
+}
+
+void FSAEx_ResetShimPoolStats() {
+    sHits.store(0, std::memory_order_relaxed);
+    sMisses.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <coreinit/filesystem_fsa.h>
+
+/**
+ * Returns a 0x40 aligned FSAShimBuffer. Buffers are taken from the pool if possible and only allocated on a miss.
+ * @return pointer to the shim buffer or NULL if the allocation failed.
+ */
+FSAShimBuffer *ShimPool_Acquire();
+
+/**
+ * Returns a buffer that was obtained via ShimPool_Acquire to the pool. Buffers that don't fit into the pool are freed.
+ */
+void ShimPool_Release(FSAShimBuffer *shim);
@@ -0,0 +1,97 @@
+#include "stats.h"
+#include "mocha/mocha.h"
+#include <cstring>
+
+#ifdef MOCHA_ENABLE_STATS
+#include <coreinit/core.h>
+#include <coreinit/interrupts.h>
+#include <coreinit/time.h>
+
+#define STATS_CORE_COUNT 3
+
+// One set of counters per core. They are only updated with interrupts disabled on the owning core, so no
+// atomics/locks are needed. Readers may see a slightly torn snapshot while calls are in flight.
+static MochaStats sCoreStats[STATS_CORE_COUNT];
+
+static inline MochaStats *Stats_LockCore(BOOL *outInterrupts) {
+    *outInterrupts = OSDisableInterrupts();
+    uint32_t core  = OSGetCoreId();
+    return &sCoreStats[core < STATS_CORE_COUNT ? core : 0];
+}
+
+static inline uint32_t Stats_LatencyBucket(uint64_t us) {
+    uint32_t bucket = 0;
+    while (us > 0 && bucket < MOCHA_STATS_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void Stats_RecordCall(MochaStatsEntry entry, uint64_t bytes, OSTime start) {
+    if ((uint32_t) entry >= MOCHA_STATS_ENTRY_COUNT) {
+        return;
+    }
+    uint64_t us = OSTicksToMicroseconds(OSGetSystemTime() - start);
+    BOOL interrupts;
+    auto &counters = Stats_LockCore(&interrupts)->entries[entry];
+    counters.calls++;
+    counters.bytes += bytes;
+    counters.totalLatencyUs += us;
+    counters.latencyHistogram[Stats_LatencyBucket(us)]++;
+    OSRestoreInterrupts(interrupts);
+}
+
+void Stats_RecordBounce(uint32_t bytes) {
+    BOOL interrupts;
+    auto *stats = Stats_LockCore(&interrupts);
+    stats->bounceCopies++;
+    stats->bounceBytes += bytes;
+    OSRestoreInterrupts(interrupts);
+}
+
+void Stats_RecordAllocation() {
+    BOOL interrupts;
+    Stats_LockCore(&interrupts)->allocations++;
+    OSRestoreInterrupts(interrupts);
+}
+#endif
+
+MochaUtilsStatus Mocha_GetStats(MochaStats *outStats) {
+#ifdef MOCHA_ENABLE_STATS
+    if (!outStats) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    memset(outStats, 0, sizeof(MochaStats));
+    for (auto &core : sCoreStats) {
+        for (uint32_t i = 0; i < MOCHA_STATS_ENTRY_COUNT; i++) {
+            auto &dst = outStats->entries[i];
+            auto &src = core.entries[i];
+            dst.calls += src.calls;
+            dst.bytes += src.bytes;
+            dst.totalLatencyUs += src.totalLatencyUs;
+            for (uint32_t j = 0; j < MOCHA_STATS_LATENCY_BUCKETS; j++) {
+                dst.latencyHistogram[j] += src.latencyHistogram[j];
+            }
+        }
+        outStats->bounceCopies += core.bounceCopies;
+        outStats->bounceBytes += core.bounceBytes;
+        outStats->allocations += core.allocations;
+    }
+    return MOCHA_RESULT_SUCCESS;
+#else
+    (void) outStats;
+    return MOCHA_RESULT_UNSUPPORTED_COMMAND;
+#endif
+}
+
+MochaUtilsStatus Mocha_ResetStats() {
+#ifdef MOCHA_ENABLE_STATS
+    for (auto &core : sCoreStats) {
+        memset(&core, 0, sizeof(core));
+    }
+    return MOCHA_RESULT_SUCCESS;
+#else
+    return MOCHA_RESULT_UNSUPPORTED_COMMAND;
+#endif
+}
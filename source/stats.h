@@ -0,0 +1,36 @@
+#pragma once
+#include "mocha/mocha.h"
+#include <stdint.h>
+
+/*
+ * Instrumentation is only compiled in when MOCHA_ENABLE_STATS is defined (make MOCHA_STATS=1),
+ * otherwise all STATS_* macros expand to nothing.
+ */
+#ifdef MOCHA_ENABLE_STATS
+#include <coreinit/time.h>
+
+void Stats_RecordCall(MochaStatsEntry entry, uint64_t bytes, OSTime start);
+void Stats_RecordBounce(uint32_t bytes);
+void Stats_RecordAllocation();
+
+class StatsScope {
+public:
+    StatsScope(MochaStatsEntry entry, uint64_t bytes) : mEntry(entry), mBytes(bytes), mStart(OSGetSystemTime()) {}
+    ~StatsScope() { Stats_RecordCall(mEntry, mBytes, mStart); }
+
+private:
+    MochaStatsEntry mEntry;
+    uint64_t mBytes;
+    OSTime mStart;
+};
+
+#define STATS_CONCAT_(a, b)       a##b
+#define STATS_CONCAT(a, b)        STATS_CONCAT_(a, b)
+#define STATS_SCOPE(entry, bytes) StatsScope STATS_CONCAT(statsScope, __LINE__)((entry), (bytes))
+#define STATS_BOUNCE(bytes)       Stats_RecordBounce(bytes)
+#define STATS_ALLOCATION()        Stats_RecordAllocation()
+#else
+#define STATS_SCOPE(entry, bytes)
+#define STATS_BOUNCE(bytes)
+#define STATS_ALLOCATION()
+#endif
@@ -1,29 +1,184 @@
 #include "utils.h"
+#include "backend.h"
+#include "stats.h"
 #include "mocha/commands.h"
 #include "mocha/mocha.h"
 #include <coreinit/ios.h>
+#include <coreinit/mutex.h>
 #include <cstring>
+#include <malloc.h>
 #include <stdint.h>
 
 int mochaInitDone        = 0;
 uint32_t mochaApiVersion = 0;
 
+// Shared /dev/mcp handle, kept open between Mocha_InitLibrary and Mocha_DeInitLibrary.
+static IOSHandle mcpHandle   = -1;
+static OSMutex mcpMutex      = {};
+static bool mcpMutexInitDone = false;
+
+// Copy of the whole SEEPROM, filled on the first read. Protected by mcpMutex.
+static MochaSEEPROMSnapshot seepromSnapshot = {};
+static bool seepromSnapshotValid            = false;
+
+// IPC_CUSTOM_BATCH support of the loaded mocha version. -1: unknown, 0: rejected, 1: supported
+static int32_t batchSupported = -1;
+
+// MochaCapability bits of the loaded mocha version, determined by Mocha_InitLibrary.
+static uint32_t mochaCapabilities = 0;
+
+// The environment path can't change while mocha is running. Protected by mcpMutex.
+static char environmentPathCache[0x100] = {};
+static bool environmentPathCacheValid   = false;
+
+/**
+ * Sends a custom command to mocha via a /dev/mcp handle that is only opened for this command.
+ */
+static MochaUtilsStatus Mocha_MCPIoctlTemporary(IOSOpenMode mode, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen) {
+    int mcpFd = IOS_Open("/dev/mcp", mode);
+    if (mcpFd < 0) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    auto res = IOS_Ioctl(mcpFd, 100, inBuf, inLen, outBuf, outLen);
+    IOS_Close(mcpFd);
+    return res == IOS_ERROR_OK ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNSUPPORTED_COMMAND;
+}
+
+/**
+ * Checks if a custom command only queries state, so it can be sent again when it's unknown whether mocha executed it.
+ */
+static bool Mocha_MCPIsQuery(const void *inBuf, uint32_t inLen) {
+    auto *words = (const uint32_t *) inBuf;
+    switch (words[0]) {
+        case IPC_CUSTOM_GET_MOCHA_API_VERSION:
+        case IPC_CUSTOM_COPY_ENVIRONMENT_PATH:
+            return true;
+        case IPC_CUSTOM_BATCH:
+            // The empty batch that probes the support of the command.
+            return inLen >= 8 && words[1] == 0;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Sends a custom command to mocha via the shared /dev/mcp handle.
+ * @return MOCHA_RESULT_SUCCESS: The ioctl succeeded <br>
+ *         MOCHA_RESULT_UNSUPPORTED_COMMAND: The ioctl was rejected <br>
+ *         MOCHA_RESULT_UNKNOWN_ERROR: Failed to open /dev/mcp
+ */
+static MochaUtilsStatus Mocha_MCPIoctl(void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen) {
+    STATS_SCOPE(MOCHA_STATS_MCP_IOCTL, inLen + outLen);
+    if (gMochaBackend) {
+        return gMochaBackend->mcpIoctl(inBuf, inLen, outBuf, outLen) == IOS_ERROR_OK ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNSUPPORTED_COMMAND;
+    }
+    if (!mochaInitDone) {
+        // No shared handle without an initialized library, fall back to a temporary one.
+        return Mocha_MCPIoctlTemporary((IOSOpenMode) 0, inBuf, inLen, outBuf, outLen);
+    }
+
+    OSLockMutex(&mcpMutex);
+    if (mcpHandle < 0) {
+        mcpHandle = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
+        if (mcpHandle < 0) {
+            mcpHandle = -1;
+            OSUnlockMutex(&mcpMutex);
+            return MOCHA_RESULT_UNKNOWN_ERROR;
+        }
+    }
+
+    auto res = IOS_Ioctl(mcpHandle, 100, inBuf, inLen, outBuf, outLen);
+    if (res == IOS_ERROR_INVALID) {
+        // The handle may have gone stale, the next command opens a new one. A rejected command fails the same way, so
+        // only queries are sent again right away, anything else could be executed twice.
+        IOS_Close(mcpHandle);
+        mcpHandle = -1;
+        if (Mocha_MCPIsQuery(inBuf, inLen)) {
+            mcpHandle = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
+            if (mcpHandle < 0) {
+                mcpHandle = -1;
+                OSUnlockMutex(&mcpMutex);
+                return MOCHA_RESULT_UNKNOWN_ERROR;
+            }
+            res = IOS_Ioctl(mcpHandle, 100, inBuf, inLen, outBuf, outLen);
+        }
+    }
+    OSUnlockMutex(&mcpMutex);
+
+    return res == IOS_ERROR_OK ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNSUPPORTED_COMMAND;
+}
+
+/**
+ * Determines which commands are supported by the loaded mocha version. Requires mochaApiVersion to be set.
+ */
+static uint32_t Mocha_ProbeCapabilities() {
+    uint32_t capabilities = 0;
+    if (mochaApiVersion >= 1) {
+        capabilities |= MOCHA_CAPABILITY_ENVIRONMENT_PATH | MOCHA_CAPABILITY_RPX_HOOK_COMPLETED | MOCHA_CAPABILITY_START_MCP_THREAD |
+                        MOCHA_CAPABILITY_START_USB_LOGGING | MOCHA_CAPABILITY_UNLOCK_FS_CLIENT | MOCHA_CAPABILITY_LOAD_RPX |
+                        MOCHA_CAPABILITY_SEEPROM;
+        if (!gMochaBackend) {
+            capabilities |= MOCHA_CAPABILITY_ODM_DISC_KEY;
+        }
+    }
+    if (mochaApiVersion >= MOCHA_API_VERSION_BATCH) {
+        // An empty batch has no side effects, older payloads reject the unknown command.
+        ALIGN_0x40 uint32_t io_buffer[0x40 / 4];
+        io_buffer[0]   = IPC_CUSTOM_BATCH;
+        io_buffer[1]   = 0;
+        batchSupported = Mocha_MCPIoctl(io_buffer, 8, io_buffer, 4) == MOCHA_RESULT_SUCCESS ? 1 : 0;
+        if (batchSupported) {
+            capabilities |= MOCHA_CAPABILITY_BATCH;
+        }
+    }
+    return capabilities;
+}
+
 MochaUtilsStatus Mocha_InitLibrary() {
-    mochaInitDone    = 1;
-    mochaApiVersion  = 0;
-    uint32_t version = 0;
-    if (Mocha_CheckAPIVersion(&version) != MOCHA_RESULT_SUCCESS) {
-        return MOCHA_RESULT_SUCCESS;
+    if (!mcpMutexInitDone) {
+        OSInitMutex(&mcpMutex);
+        mcpMutexInitDone = true;
+    }
+
+    OSLockMutex(&mcpMutex);
+    if (mcpHandle < 0 && !gMochaBackend) {
+        mcpHandle = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
+    }
+    OSUnlockMutex(&mcpMutex);
+
+    mochaInitDone     = 1;
+    mochaApiVersion   = 0;
+    mochaCapabilities = 0;
+    batchSupported    = -1;
+    uint32_t version  = 0;
+    auto res          = Mocha_CheckAPIVersion(&version);
+    if (res != MOCHA_RESULT_SUCCESS) {
+        Mocha_DeInitLibrary();
+        return res == MOCHA_RESULT_UNSUPPORTED_API_VERSION ? MOCHA_RESULT_UNSUPPORTED_COMMAND : res;
     }
 
-    mochaApiVersion = version;
+    mochaApiVersion   = version;
+    mochaCapabilities = Mocha_ProbeCapabilities();
 
     return MOCHA_RESULT_SUCCESS;
 }
 
 MochaUtilsStatus Mocha_DeInitLibrary() {
-    mochaInitDone   = 0;
-    mochaApiVersion = 0;
+    mochaInitDone     = 0;
+    mochaApiVersion   = 0;
+    mochaCapabilities = 0;
+    batchSupported    = -1;
+
+    if (mcpMutexInitDone) {
+        OSLockMutex(&mcpMutex);
+        seepromSnapshotValid      = false;
+        environmentPathCacheValid = false;
+        if (mcpHandle >= 0) {
+            IOS_Close(mcpHandle);
+            mcpHandle = -1;
+        }
+        OSUnlockMutex(&mcpMutex);
+    }
 
     return MOCHA_RESULT_SUCCESS;
 }
@@ -32,24 +187,25 @@ MochaUtilsStatus Mocha_CheckAPIVersion(uint32_t *version) {
     if (!version) {
         return MOCHA_RESULT_INVALID_ARGUMENT;
     }
-    MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
-    int mcpFd            = IOS_Open("/dev/mcp", IOS_OPEN_READ);
-    if (mcpFd >= 0) {
-        ALIGN_0x40 uint32_t io_buffer[0x100 / 4];
-        io_buffer[0] = IPC_CUSTOM_GET_MOCHA_API_VERSION;
-
-        if (IOS_Ioctl(mcpFd, 100, io_buffer, 4, io_buffer, 4) == IOS_ERROR_OK) {
-            *version = io_buffer[0];
-            res      = MOCHA_RESULT_SUCCESS;
-        } else {
-            res = MOCHA_RESULT_UNSUPPORTED_API_VERSION;
-        }
+    ALIGN_0x40 uint32_t io_buffer[0x100 / 4];
+    io_buffer[0] = IPC_CUSTOM_GET_MOCHA_API_VERSION;
 
-        IOS_Close(mcpFd);
-    } else {
-        return res;
+    MochaUtilsStatus res = MOCHA_RESULT_UNSUPPORTED_COMMAND;
+    if (mochaInitDone || gMochaBackend) {
+        res = Mocha_MCPIoctl(io_buffer, 4, io_buffer, 4);
+    }
+    if (res != MOCHA_RESULT_SUCCESS && !gMochaBackend) {
+        // Before Mocha_InitLibrary there is no shared handle, and old payloads may reject the query on it. A read only
+        // handle of its own works with any IOSU.
+        io_buffer[0] = IPC_CUSTOM_GET_MOCHA_API_VERSION;
+        STATS_SCOPE(MOCHA_STATS_MCP_IOCTL, 8);
+        res = Mocha_MCPIoctlTemporary(IOS_OPEN_READ, io_buffer, 4, io_buffer, 4);
+    }
+    if (res == MOCHA_RESULT_SUCCESS) {
+        *version = io_buffer[0];
+    } else if (res == MOCHA_RESULT_UNSUPPORTED_COMMAND) {
+        res = MOCHA_RESULT_UNSUPPORTED_API_VERSION;
     }
-
     return res;
 }
 
@@ -63,21 +219,44 @@ MochaUtilsStatus Mocha_GetEnvironmentPath(char *environmentPathBuffer, uint32_t
     if (!environmentPathBuffer || bufferLen < 0x100) {
         return MOCHA_RESULT_INVALID_ARGUMENT;
     }
-    MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
-    int mcpFd            = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
-    if (mcpFd >= 0) {
+
+    OSLockMutex(&mcpMutex);
+    if (!environmentPathCacheValid) {
         ALIGN_0x40 uint32_t io_buffer[0x100 / 4];
         io_buffer[0] = IPC_CUSTOM_COPY_ENVIRONMENT_PATH;
 
-        if (IOS_Ioctl(mcpFd, 100, io_buffer, 4, io_buffer, 0x100) == IOS_ERROR_OK) {
-            memcpy(environmentPathBuffer, reinterpret_cast<const char *>(io_buffer), 0xFF);
-            res = MOCHA_RESULT_SUCCESS;
+        if (Mocha_MCPIoctl(io_buffer, 4, io_buffer, 0x100) != MOCHA_RESULT_SUCCESS) {
+            OSUnlockMutex(&mcpMutex);
+            return MOCHA_RESULT_UNKNOWN_ERROR;
         }
+        memcpy(environmentPathCache, io_buffer, sizeof(environmentPathCache));
+        environmentPathCacheValid = true;
+    }
+    memcpy(environmentPathBuffer, environmentPathCache, 0xFF);
+    OSUnlockMutex(&mcpMutex);
+    return MOCHA_RESULT_SUCCESS;
+}
 
-        IOS_Close(mcpFd);
+MochaUtilsStatus Mocha_GetCapabilities(uint32_t *outCapabilities) {
+    if (!mochaInitDone) {
+        return MOCHA_RESULT_LIB_UNINITIALIZED;
+    }
+    if (!outCapabilities) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
     }
+    *outCapabilities = mochaCapabilities;
+    return MOCHA_RESULT_SUCCESS;
+}
 
-    return res;
+MochaUtilsStatus Mocha_InvalidateCache() {
+    if (!mochaInitDone) {
+        return MOCHA_RESULT_LIB_UNINITIALIZED;
+    }
+    OSLockMutex(&mcpMutex);
+    environmentPathCacheValid = false;
+    seepromSnapshotValid      = false;
+    OSUnlockMutex(&mcpMutex);
+    return MOCHA_RESULT_SUCCESS;
 }
 
 MochaUtilsStatus Mocha_SimpleCommand(uint32_t command, uint32_t apiVersion) {
@@ -87,20 +266,13 @@ MochaUtilsStatus Mocha_SimpleCommand(uint32_t command, uint32_t apiVersion) {
     if (mochaApiVersion < apiVersion) {
         return MOCHA_RESULT_UNSUPPORTED_COMMAND;
     }
-    MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
-    int mcpFd            = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
-    if (mcpFd >= 0) {
-        ALIGN_0x40 uint32_t io_buffer[0x40 / 4];
-        io_buffer[0] = command;
-
-        if (IOS_Ioctl(mcpFd, 100, io_buffer, 4, io_buffer, 0x4) == IOS_ERROR_OK) {
-            res = MOCHA_RESULT_SUCCESS;
-        }
+    ALIGN_0x40 uint32_t io_buffer[0x40 / 4];
+    io_buffer[0] = command;
 
-        IOS_Close(mcpFd);
+    if (Mocha_MCPIoctl(io_buffer, 4, io_buffer, 0x4) != MOCHA_RESULT_SUCCESS) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
     }
-
-    return res;
+    return MOCHA_RESULT_SUCCESS;
 }
 
 MochaUtilsStatus Mocha_RPXHookCompleted() {
@@ -118,21 +290,14 @@ MochaUtilsStatus Mocha_StartUSBLogging(bool avoidLogCatchup) {
     if (mochaApiVersion < 1) {
         return MOCHA_RESULT_UNSUPPORTED_COMMAND;
     }
-    MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
-    int mcpFd            = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
-    if (mcpFd >= 0) {
-        ALIGN_0x40 uint32_t io_buffer[0x40 / 4];
-        io_buffer[0] = IPC_CUSTOM_START_USB_LOGGING;
-        io_buffer[1] = avoidLogCatchup;
-
-        if (IOS_Ioctl(mcpFd, 100, io_buffer, 8, io_buffer, 0x4) == IOS_ERROR_OK) {
-            res = MOCHA_RESULT_SUCCESS;
-        }
+    ALIGN_0x40 uint32_t io_buffer[0x40 / 4];
+    io_buffer[0] = IPC_CUSTOM_START_USB_LOGGING;
+    io_buffer[1] = avoidLogCatchup;
 
-        IOS_Close(mcpFd);
+    if (Mocha_MCPIoctl(io_buffer, 8, io_buffer, 0x4) != MOCHA_RESULT_SUCCESS) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
     }
-
-    return res;
+    return MOCHA_RESULT_SUCCESS;
 }
 
 MochaUtilsStatus Mocha_UnlockFSClient(FSClient *client) {
@@ -144,6 +309,7 @@ MochaUtilsStatus Mocha_UnlockFSClient(FSClient *client) {
 }
 
 MochaUtilsStatus Mocha_UnlockFSClientEx(int clientHandle) {
+    STATS_SCOPE(MOCHA_STATS_UNLOCK_FS_CLIENT, 0);
     if (!mochaInitDone) {
         return MOCHA_RESULT_LIB_UNINITIALIZED;
     }
@@ -152,7 +318,7 @@ MochaUtilsStatus Mocha_UnlockFSClientEx(int clientHandle) {
     }
     ALIGN_0x40 int dummy[0x40 >> 2];
 
-    auto res = IOS_Ioctl(clientHandle, 0x28, dummy, sizeof(dummy), dummy, sizeof(dummy));
+    auto res = gMochaBackend ? gMochaBackend->unlockFSClient(clientHandle) : IOS_Ioctl(clientHandle, 0x28, dummy, sizeof(dummy), dummy, sizeof(dummy));
     if (res == 0) {
         return MOCHA_RESULT_SUCCESS;
     }
@@ -169,23 +335,195 @@ MochaUtilsStatus Mocha_LoadRPXOnNextLaunch(MochaRPXLoadInfo *loadInfo) {
     if (mochaApiVersion < 1) {
         return MOCHA_RESULT_UNSUPPORTED_COMMAND;
     }
-    MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
-    int mcpFd            = IOS_Open("/dev/mcp", (IOSOpenMode) 0);
-    if (mcpFd >= 0) {
-        ALIGN_0x40 uint32_t io_buffer[ROUNDUP(sizeof(MochaRPXLoadInfo) + 4, 0x40)];
-        io_buffer[0] = IPC_CUSTOM_LOAD_CUSTOM_RPX;
-        memcpy(&io_buffer[1], loadInfo, sizeof(MochaRPXLoadInfo));
+    ALIGN_0x40 uint32_t io_buffer[ROUNDUP(sizeof(MochaRPXLoadInfo) + 4, 0x40)];
+    io_buffer[0] = IPC_CUSTOM_LOAD_CUSTOM_RPX;
+    memcpy(&io_buffer[1], loadInfo, sizeof(MochaRPXLoadInfo));
 
-        if (IOS_Ioctl(mcpFd, 100, io_buffer, sizeof(MochaRPXLoadInfo) + 4, io_buffer, 0x4) == IOS_ERROR_OK) {
-            res = MOCHA_RESULT_SUCCESS;
+    if (Mocha_MCPIoctl(io_buffer, sizeof(MochaRPXLoadInfo) + 4, io_buffer, 0x4) != MOCHA_RESULT_SUCCESS) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    return MOCHA_RESULT_SUCCESS;
+}
+
+void Mocha_BatchInit(MochaCommandBatch *batch) {
+    if (batch) {
+        memset(batch, 0, sizeof(MochaCommandBatch));
+    }
+}
+
+MochaUtilsStatus Mocha_BatchAdd(MochaCommandBatch *batch, uint32_t command, uint32_t minApiVersion, const void *in, uint32_t inLen, void *out, uint32_t outLen) {
+    if (!batch || batch->count >= MOCHA_BATCH_MAX_COMMANDS || (inLen > 0 && !in) || (outLen > 0 && !out)) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    auto &cmd         = batch->commands[batch->count++];
+    cmd.command       = command;
+    cmd.minApiVersion = minApiVersion;
+    cmd.in            = in;
+    cmd.inLen         = inLen;
+    cmd.out           = out;
+    cmd.outLen        = outLen;
+    cmd.inlineArg     = 0;
+    cmd.result        = MOCHA_RESULT_UNKNOWN_ERROR;
+    return MOCHA_RESULT_SUCCESS;
+}
+
+MochaUtilsStatus Mocha_BatchAddCheckAPIVersion(MochaCommandBatch *batch, uint32_t *outVersion) {
+    return Mocha_BatchAdd(batch, IPC_CUSTOM_GET_MOCHA_API_VERSION, 0, nullptr, 0, outVersion, outVersion ? 4 : 0);
+}
+
+MochaUtilsStatus Mocha_BatchAddGetEnvironmentPath(MochaCommandBatch *batch, char *environmentPathBuffer, uint32_t bufferLen) {
+    if (!environmentPathBuffer || bufferLen < 0x100) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    return Mocha_BatchAdd(batch, IPC_CUSTOM_COPY_ENVIRONMENT_PATH, 1, nullptr, 0, environmentPathBuffer, 0x100);
+}
+
+MochaUtilsStatus Mocha_BatchAddStartMCPThread(MochaCommandBatch *batch) {
+    return Mocha_BatchAdd(batch, IPC_CUSTOM_START_MCP_THREAD, 1, nullptr, 0, nullptr, 0);
+}
+
+MochaUtilsStatus Mocha_BatchAddRPXHookCompleted(MochaCommandBatch *batch) {
+    return Mocha_BatchAdd(batch, IPC_CUSTOM_MEN_RPX_HOOK_COMPLETED, 1, nullptr, 0, nullptr, 0);
+}
+
+MochaUtilsStatus Mocha_BatchAddStartUSBLogging(MochaCommandBatch *batch, bool avoidLogCatchup) {
+    auto res = Mocha_BatchAdd(batch, IPC_CUSTOM_START_USB_LOGGING, 1, nullptr, 0, nullptr, 0);
+    if (res == MOCHA_RESULT_SUCCESS) {
+        auto &cmd     = batch->commands[batch->count - 1];
+        cmd.inlineArg = avoidLogCatchup;
+        cmd.in        = &cmd.inlineArg;
+        cmd.inLen     = sizeof(cmd.inlineArg);
+    }
+    return res;
+}
+
+MochaUtilsStatus Mocha_BatchAddLoadRPXOnNextLaunch(MochaCommandBatch *batch, MochaRPXLoadInfo *loadInfo) {
+    if (!loadInfo) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    return Mocha_BatchAdd(batch, IPC_CUSTOM_LOAD_CUSTOM_RPX, 1, loadInfo, sizeof(MochaRPXLoadInfo), nullptr, 0);
+}
+
+/**
+ * Sends the given commands one by one.
+ */
+static void Mocha_BatchSubmitSequential(MochaBatchCommand **commands, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        auto &cmd       = *commands[i];
+        uint32_t inSize = ROUNDUP(4 + cmd.inLen, 0x40);
+        uint32_t ioSize = inSize > ROUNDUP(cmd.outLen + 4, 0x40) ? inSize : ROUNDUP(cmd.outLen + 4, 0x40);
+        auto *io_buffer = (uint32_t *) memalign(0x40, ioSize);
+        if (!io_buffer) {
+            cmd.result = MOCHA_RESULT_UNKNOWN_ERROR;
+            continue;
+        }
+        io_buffer[0] = cmd.command;
+        if (cmd.inLen > 0) {
+            memcpy(&io_buffer[1], cmd.in, cmd.inLen);
         }
+        // Commands without a response still return 4 bytes.
+        cmd.result = Mocha_MCPIoctl(io_buffer, 4 + cmd.inLen, io_buffer, cmd.outLen > 0 ? cmd.outLen : 4) == MOCHA_RESULT_SUCCESS ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNKNOWN_ERROR;
+        if (cmd.result == MOCHA_RESULT_SUCCESS && cmd.outLen > 0) {
+            memcpy(cmd.out, io_buffer, cmd.outLen);
+        }
+        free(io_buffer);
+    }
+}
 
-        IOS_Close(mcpFd);
+/**
+ * Sends the given commands with a single IPC_CUSTOM_BATCH request. <br>
+ * Request: [IPC_CUSTOM_BATCH][count] followed by [command][inLen][outLen][args, padded to 4 bytes] for each command <br>
+ * Response: [result][response, padded to 4 bytes] for each command
+ * @return MOCHA_RESULT_UNSUPPORTED_COMMAND if mocha rejected the batch command, nothing has been executed in this case.
+ */
+static MochaUtilsStatus Mocha_BatchSubmitCombined(MochaBatchCommand **commands, uint32_t count) {
+    uint32_t inSize  = 8;
+    uint32_t outSize = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        inSize += 12 + ROUNDUP(commands[i]->inLen, 4);
+        outSize += 4 + ROUNDUP(commands[i]->outLen, 4);
+    }
+    uint32_t inAlloc = ROUNDUP(inSize, 0x40);
+    auto *block      = (uint8_t *) memalign(0x40, inAlloc + ROUNDUP(outSize, 0x40));
+    if (!block) {
+        return MOCHA_RESULT_UNKNOWN_ERROR;
+    }
+    auto *inBuf  = (uint32_t *) block;
+    auto *outBuf = block + inAlloc;
+
+    inBuf[0]     = IPC_CUSTOM_BATCH;
+    inBuf[1]     = count;
+    uint8_t *cur = (uint8_t *) &inBuf[2];
+    for (uint32_t i = 0; i < count; i++) {
+        auto &cmd    = *commands[i];
+        auto *header = (uint32_t *) cur;
+        header[0]    = cmd.command;
+        header[1]    = cmd.inLen;
+        header[2]    = cmd.outLen;
+        cur += 12;
+        if (cmd.inLen > 0) {
+            memcpy(cur, cmd.in, cmd.inLen);
+        }
+        cur += ROUNDUP(cmd.inLen, 4);
     }
 
+    auto res = Mocha_MCPIoctl(inBuf, inSize, outBuf, outSize);
+    if (res == MOCHA_RESULT_SUCCESS) {
+        cur = outBuf;
+        for (uint32_t i = 0; i < count; i++) {
+            auto &cmd  = *commands[i];
+            cmd.result = *(int32_t *) cur == 0 ? MOCHA_RESULT_SUCCESS : MOCHA_RESULT_UNKNOWN_ERROR;
+            cur += 4;
+            if (cmd.result == MOCHA_RESULT_SUCCESS && cmd.outLen > 0) {
+                memcpy(cmd.out, cur, cmd.outLen);
+            }
+            cur += ROUNDUP(cmd.outLen, 4);
+        }
+    }
+    free(block);
     return res;
 }
 
+MochaUtilsStatus Mocha_BatchSubmit(MochaCommandBatch *batch) {
+    if (!batch || batch->count > MOCHA_BATCH_MAX_COMMANDS) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    if (!mochaInitDone) {
+        return MOCHA_RESULT_LIB_UNINITIALIZED;
+    }
+
+    MochaBatchCommand *toSend[MOCHA_BATCH_MAX_COMMANDS];
+    uint32_t sendCount = 0;
+    for (uint32_t i = 0; i < batch->count; i++) {
+        auto &cmd = batch->commands[i];
+        if (mochaApiVersion < cmd.minApiVersion) {
+            cmd.result = MOCHA_RESULT_UNSUPPORTED_COMMAND;
+            continue;
+        }
+        toSend[sendCount++] = &cmd;
+    }
+
+    // batchSupported is set by the empty batch that Mocha_InitLibrary sends.
+    if (sendCount > 1 && mochaApiVersion >= MOCHA_API_VERSION_BATCH && batchSupported != 0) {
+        if (Mocha_BatchSubmitCombined(toSend, sendCount) != MOCHA_RESULT_SUCCESS) {
+            // Some commands may have been executed already, sending them again could execute them twice.
+            for (uint32_t i = 0; i < sendCount; i++) {
+                toSend[i]->result = MOCHA_RESULT_UNKNOWN_ERROR;
+            }
+        }
+        sendCount = 0;
+    }
+    // Mocha versions that don't support or rejected the batch command.
+    Mocha_BatchSubmitSequential(toSend, sendCount);
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (batch->commands[i].result != MOCHA_RESULT_SUCCESS) {
+            return MOCHA_RESULT_UNKNOWN_ERROR;
+        }
+    }
+    return MOCHA_RESULT_SUCCESS;
+}
+
 MochaUtilsStatus Mocha_ODMGetDiscKey(WUDDiscKey *discKey) {
     if (!mochaInitDone) {
         return MOCHA_RESULT_LIB_UNINITIALIZED;
@@ -196,6 +534,10 @@ MochaUtilsStatus Mocha_ODMGetDiscKey(WUDDiscKey *discKey) {
     if (!discKey) {
         return MOCHA_RESULT_INVALID_ARGUMENT;
     }
+    if (gMochaBackend) {
+        // There is no disc drive to emulate.
+        return MOCHA_RESULT_UNSUPPORTED_COMMAND;
+    }
     int odm_handle       = IOS_Open("/dev/odm", IOS_OPEN_READ);
     MochaUtilsStatus res = MOCHA_RESULT_UNKNOWN_ERROR;
     if (odm_handle >= 0) {
@@ -213,37 +555,110 @@ MochaUtilsStatus Mocha_ODMGetDiscKey(WUDDiscKey *discKey) {
 }
 
 extern "C" int bspRead(const char *, uint32_t, const char *, uint32_t, uint16_t *);
-MochaUtilsStatus Mocha_SEEPROMRead(uint8_t *out_buffer, uint32_t offset, uint32_t size) {
+
+/**
+ * Reads the whole SEEPROM into the snapshot. The "access" attribute of "EE" only supports 16-bit transfers, so this
+ * is still one bspRead per halfword, but it only happens once instead of on every read.
+ * Must be called with mcpMutex locked.
+ */
+static MochaUtilsStatus Mocha_SEEPROMLoadSnapshot() {
+    ALIGN_0x40 uint16_t buffer[MOCHA_SEEPROM_SIZE / 2];
+    for (uint32_t i = 0; i < MOCHA_SEEPROM_SIZE / 2; i++) {
+        int32_t res = gMochaBackend ? gMochaBackend->seepromRead(i, &buffer[i]) : bspRead("EE", i, "access", 2, &buffer[i]);
+        if (res != 0) {
+            return MOCHA_RESULT_UNKNOWN_ERROR;
+        }
+    }
+    memcpy(seepromSnapshot.data, buffer, sizeof(seepromSnapshot.data));
+    seepromSnapshot.version++;
+    seepromSnapshotValid = true;
+    return MOCHA_RESULT_SUCCESS;
+}
+
+MochaUtilsStatus Mocha_SEEPROMGetSnapshot(MochaSEEPROMSnapshot *snapshot, bool refresh) {
     if (!mochaInitDone) {
         return MOCHA_RESULT_LIB_UNINITIALIZED;
     }
     if (mochaApiVersion < 1) {
         return MOCHA_RESULT_UNSUPPORTED_COMMAND;
     }
-    if (out_buffer == nullptr || offset > 0x200 || offset & 0x01) {
+    if (snapshot == nullptr) {
         return MOCHA_RESULT_INVALID_ARGUMENT;
     }
 
-    uint32_t sizeInShorts   = size >> 1;
-    uint32_t offsetInShorts = offset >> 1;
-    int32_t maxReadCount    = 0x100 - offsetInShorts;
+    MochaUtilsStatus res = MOCHA_RESULT_SUCCESS;
+    OSLockMutex(&mcpMutex);
+    if (refresh || !seepromSnapshotValid) {
+        res = Mocha_SEEPROMLoadSnapshot();
+    }
+    if (res == MOCHA_RESULT_SUCCESS) {
+        *snapshot = seepromSnapshot;
+    }
+    OSUnlockMutex(&mcpMutex);
+    return res;
+}
 
-    if (maxReadCount <= 0) {
+MochaUtilsStatus Mocha_SEEPROMReadEx(uint8_t *out_buffer, uint32_t offset, uint32_t size, bool refresh) {
+    STATS_SCOPE(MOCHA_STATS_SEEPROM_READ, size);
+    if (!mochaInitDone) {
+        return MOCHA_RESULT_LIB_UNINITIALIZED;
+    }
+    if (mochaApiVersion < 1) {
+        return MOCHA_RESULT_UNSUPPORTED_COMMAND;
+    }
+    if (out_buffer == nullptr || offset > MOCHA_SEEPROM_SIZE || offset & 0x01) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+
+    // Only whole halfwords are copied.
+    uint32_t maxSize = MOCHA_SEEPROM_SIZE - offset;
+    uint32_t count   = (size > maxSize ? maxSize : size) & ~1;
+    if (count == 0) {
         return MOCHA_RESULT_SUCCESS;
     }
 
-    uint32_t count = sizeInShorts > (uint32_t) maxReadCount ? (uint32_t) maxReadCount : sizeInShorts;
-    auto *ptr      = (uint16_t *) out_buffer;
+    MochaUtilsStatus res = MOCHA_RESULT_SUCCESS;
+    OSLockMutex(&mcpMutex);
+    if (refresh || !seepromSnapshotValid) {
+        res = Mocha_SEEPROMLoadSnapshot();
+    }
+    if (res == MOCHA_RESULT_SUCCESS) {
+        memcpy(out_buffer, &seepromSnapshot.data[offset], count);
+    }
+    OSUnlockMutex(&mcpMutex);
 
-    int res = 0;
+    if (res != MOCHA_RESULT_SUCCESS) {
+        return res;
+    }
+    return static_cast<MochaUtilsStatus>(count);
+}
 
-    for (uint32_t i = 0; i < count; i++) {
-        if (bspRead("EE", offsetInShorts + i, "access", 2, ptr) != 0) {
-            return MOCHA_RESULT_UNKNOWN_ERROR;
-        }
-        res += 2;
-        ptr++;
+MochaUtilsStatus Mocha_SEEPROMRead(uint8_t *out_buffer, uint32_t offset, uint32_t size) {
+    return Mocha_SEEPROMReadEx(out_buffer, offset, size, false);
+}
+
+MochaUtilsStatus Mocha_SEEPROMReadU16(uint32_t offset, uint16_t *outValue) {
+    if (outValue == nullptr || offset + sizeof(uint16_t) > MOCHA_SEEPROM_SIZE) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    uint8_t buffer[sizeof(uint32_t)];
+    auto res = Mocha_SEEPROMReadEx(buffer, offset, sizeof(uint16_t), false);
+    if (res < 0) {
+        return res;
     }
+    memcpy(outValue, buffer, sizeof(uint16_t));
+    return MOCHA_RESULT_SUCCESS;
+}
 
-    return static_cast<MochaUtilsStatus>(res);
+MochaUtilsStatus Mocha_SEEPROMReadU32(uint32_t offset, uint32_t *outValue) {
+    if (outValue == nullptr || offset + sizeof(uint32_t) > MOCHA_SEEPROM_SIZE) {
+        return MOCHA_RESULT_INVALID_ARGUMENT;
+    }
+    uint8_t buffer[sizeof(uint32_t)];
+    auto res = Mocha_SEEPROMReadEx(buffer, offset, sizeof(uint32_t), false);
+    if (res < 0) {
+        return res;
+    }
+    memcpy(outValue, buffer, sizeof(uint32_t));
+    return MOCHA_RESULT_SUCCESS;
 }
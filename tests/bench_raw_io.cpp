@@ -0,0 +1,233 @@
+// Raw I/O and /dev/mcp benchmark against the stubbed IOSU. Prints one line per configuration, as CSV or JSON lines.
+//
+//   bench_raw_io [--latency-us N] [--per-mib-us N] [--ops N] [--json] [--quick]
+//
+// --latency-us/--per-mib-us set the simulated duration of every transfer (StubIosu_SetLatency), --ops the number of
+// operations per thread and configuration. --quick runs a reduced sweep, that is what ctest runs.
+#include "stub_alloc.h"
+#include "stub_iosu.h"
+#include <algorithm>
+#include <chrono>
+#include <coreinit/filesystem_fsa.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <mocha/fsa.h>
+#include <mocha/mocha.h>
+#include <sys/prctl.h>
+#include <thread>
+#include <vector>
+
+#define DEVICE_SIZE (32 * 1024 * 1024)
+
+typedef enum BenchOp {
+    BENCH_OP_READ,
+    BENCH_OP_WRITE,
+    BENCH_OP_MCP, // Mocha_CheckAPIVersion, one /dev/mcp command per op
+} BenchOp;
+
+static const char *sOpNames[] = {"read", "write", "mcp"};
+
+typedef struct BenchConfig {
+    BenchOp op;
+    uint32_t sectorSize;
+    uint32_t sectorCount;
+    bool aligned;
+    uint32_t threads;
+    uint32_t ops; // per thread
+} BenchConfig;
+
+typedef struct BenchResult {
+    double seconds;
+    uint64_t totalOps;
+    uint64_t failures;
+    uint64_t allocations;
+    double p50Us;
+    double p99Us;
+} BenchResult;
+
+static bool sJson = false;
+
+static double Percentile(std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = (size_t) (p * (double) (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void RunThread(const BenchConfig &config, int client, int32_t handle, uint32_t threadIndex, std::vector<double> &latencies, uint64_t &failures) {
+    uint32_t size = config.sectorSize * config.sectorCount;
+    // Unaligned buffers are off by 3 bytes, that forces the bounce buffer path.
+    auto *base   = (uint8_t *) memalign(0x40, size + 0x40);
+    uint8_t *buf = config.aligned ? base : base + 3;
+    memset(base, (int) threadIndex, size + 0x40);
+
+    // The mcp op has no transfer size.
+    uint64_t slots = config.op == BENCH_OP_MCP ? 1 : DEVICE_SIZE / config.sectorSize / config.sectorCount;
+    latencies.reserve(config.ops);
+    for (uint32_t i = 0; i < config.ops; i++) {
+        // Every thread walks its own stride through the device.
+        uint64_t offset = ((uint64_t) i * config.threads + threadIndex) % slots * config.sectorCount;
+        auto start      = std::chrono::steady_clock::now();
+        int32_t res;
+        switch (config.op) {
+            case BENCH_OP_READ:
+                res = FSAEx_RawReadEx(client, buf, config.sectorSize, config.sectorCount, offset, handle);
+                break;
+            case BENCH_OP_WRITE:
+                res = FSAEx_RawWriteEx(client, buf, config.sectorSize, config.sectorCount, offset, handle);
+                break;
+            default: {
+                uint32_t version;
+                res = Mocha_CheckAPIVersion(&version) == MOCHA_RESULT_SUCCESS ? 0 : -1;
+                break;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        if (res != 0) {
+            failures++;
+        }
+    }
+    free(base);
+}
+
+static BenchResult RunConfig(const BenchConfig &config, int client, int32_t handle) {
+    std::vector<std::vector<double>> latencies(config.threads);
+    std::vector<uint64_t> failures(config.threads, 0);
+
+    // The thread creation and the per thread buffer are not part of the measured allocations.
+    uint64_t allocationsBefore = StubAlloc_GetMemalignCount() + StubAlloc_GetMallocCount();
+    auto start                 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < config.threads; t++) {
+        threads.emplace_back([&, t] { RunThread(config, client, handle, t, latencies[t], failures[t]); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    auto end                  = std::chrono::steady_clock::now();
+    uint64_t allocationsAfter = StubAlloc_GetMemalignCount() + StubAlloc_GetMallocCount();
+
+    BenchResult result = {};
+    result.seconds     = std::chrono::duration<double>(end - start).count();
+    result.totalOps    = (uint64_t) config.threads * config.ops;
+    result.allocations = allocationsAfter - allocationsBefore - config.threads;
+
+    std::vector<double> all;
+    for (uint32_t t = 0; t < config.threads; t++) {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        result.failures += failures[t];
+    }
+    std::sort(all.begin(), all.end());
+    result.p50Us = Percentile(all, 0.50);
+    result.p99Us = Percentile(all, 0.99);
+    return result;
+}
+
+static void PrintHeader() {
+    if (!sJson) {
+        printf("op,sector_size,sector_count,aligned,threads,ops,failures,ops_per_s,mb_per_s,allocs_per_op,p50_us,p99_us\n");
+    }
+}
+
+static void PrintResult(const BenchConfig &config, const BenchResult &result) {
+    uint64_t bytesPerOp = config.op == BENCH_OP_MCP ? 0 : (uint64_t) config.sectorSize * config.sectorCount;
+    double opsPerSec    = result.seconds > 0 ? (double) result.totalOps / result.seconds : 0;
+    double mbPerSec     = opsPerSec * (double) bytesPerOp / (1024.0 * 1024.0);
+    double allocsPerOp  = result.totalOps ? (double) result.allocations / (double) result.totalOps : 0;
+    if (sJson) {
+        printf("{\"op\":\"%s\",\"sector_size\":%u,\"sector_count\":%u,\"aligned\":%s,\"threads\":%u,\"ops\":%llu,\"failures\":%llu,"
+               "\"ops_per_s\":%.1f,\"mb_per_s\":%.2f,\"allocs_per_op\":%.3f,\"p50_us\":%.2f,\"p99_us\":%.2f}\n",
+               sOpNames[config.op], config.sectorSize, config.sectorCount, config.aligned ? "true" : "false", config.threads,
+               (unsigned long long) result.totalOps, (unsigned long long) result.failures, opsPerSec, mbPerSec, allocsPerOp,
+               result.p50Us, result.p99Us);
+    } else {
+        printf("%s,%u,%u,%d,%u,%llu,%llu,%.1f,%.2f,%.3f,%.2f,%.2f\n",
+               sOpNames[config.op], config.sectorSize, config.sectorCount, config.aligned ? 1 : 0, config.threads,
+               (unsigned long long) result.totalOps, (unsigned long long) result.failures, opsPerSec, mbPerSec, allocsPerOp,
+               result.p50Us, result.p99Us);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    uint32_t latencyUs = 0;
+    uint32_t perMiBUs  = 0;
+    uint32_t ops       = 1000;
+    bool quick         = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--latency-us") == 0 && i + 1 < argc) {
+            latencyUs = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--per-mib-us") == 0 && i + 1 < argc) {
+            perMiBUs = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = (uint32_t) strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            sJson = true;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            fprintf(stderr, "usage: %s [--latency-us N] [--per-mib-us N] [--ops N] [--json] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (quick) {
+        ops = std::min(ops, 20u);
+    }
+
+    // The default timer slack of 50us would be added to every simulated latency. Threads inherit the setting.
+    prctl(PR_SET_TIMERSLACK, 1);
+
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", DEVICE_SIZE);
+    StubIosu_SetLatency(latencyUs, perMiBUs);
+    if (Mocha_InitLibrary() != MOCHA_RESULT_SUCCESS) {
+        fprintf(stderr, "Mocha_InitLibrary failed\n");
+        return 1;
+    }
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    if (FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle) != FS_ERROR_OK) {
+        fprintf(stderr, "FSAEx_RawOpenEx failed\n");
+        return 1;
+    }
+
+    std::vector<uint32_t> sectorSizes  = {0x200, 0x1000};
+    std::vector<uint32_t> sectorCounts = quick ? std::vector<uint32_t>{1, 64} : std::vector<uint32_t>{1, 8, 64, 256};
+    std::vector<uint32_t> threadCounts = quick ? std::vector<uint32_t>{1, 4} : std::vector<uint32_t>{1, 2, 4, 8};
+
+    uint64_t failures = 0;
+    PrintHeader();
+    for (BenchOp op : {BENCH_OP_READ, BENCH_OP_WRITE}) {
+        for (uint32_t sectorSize : sectorSizes) {
+            for (uint32_t sectorCount : sectorCounts) {
+                for (bool aligned : {true, false}) {
+                    for (uint32_t threads : threadCounts) {
+                        BenchConfig config = {op, sectorSize, sectorCount, aligned, threads, ops};
+                        BenchResult result = RunConfig(config, client, handle);
+                        PrintResult(config, result);
+                        failures += result.failures;
+                    }
+                }
+            }
+        }
+    }
+    for (uint32_t threads : threadCounts) {
+        BenchConfig config = {BENCH_OP_MCP, 0, 0, true, threads, ops};
+        BenchResult result = RunConfig(config, client, handle);
+        PrintResult(config, result);
+        failures += result.failures;
+    }
+
+    FSAEx_RawCloseEx(client, handle);
+    FSADelClient(client);
+    Mocha_DeInitLibrary();
+    if (failures) {
+        fprintf(stderr, "%llu operations failed\n", (unsigned long long) failures);
+        return 1;
+    }
+    return 0;
+}
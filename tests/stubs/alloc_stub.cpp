@@ -0,0 +1,28 @@
+// Counts the allocations of the library. Linked with -Wl,--wrap=memalign,--wrap=malloc, see tests/CMakeLists.txt
+#include "stub_alloc.h"
+#include <atomic>
+#include <cstddef>
+
+static std::atomic<uint64_t> sMemalignCount;
+static std::atomic<uint64_t> sMallocCount;
+
+extern "C" void *__real_memalign(size_t alignment, size_t size);
+extern "C" void *__real_malloc(size_t size);
+
+extern "C" void *__wrap_memalign(size_t alignment, size_t size) {
+    sMemalignCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_memalign(alignment, size);
+}
+
+extern "C" void *__wrap_malloc(size_t size) {
+    sMallocCount.fetch_add(1, std::memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+uint64_t StubAlloc_GetMemalignCount() {
+    return sMemalignCount.load(std::memory_order_relaxed);
+}
+
+uint64_t StubAlloc_GetMallocCount() {
+    return sMallocCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,309 @@
+// Host implementations of the coreinit functions the library uses, on top of pthreads.
+#include <coreinit/condition.h>
+#include <coreinit/core.h>
+#include <coreinit/debug.h>
+#include <coreinit/event.h>
+#include <coreinit/filesystem.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/mutex.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <sched.h>
+#include <sys/iosupport.h>
+#include <time.h>
+
+void OSInitMutex(OSMutex *mutex) {
+    pthread_mutex_init(&mutex->lock, nullptr);
+    pthread_cond_init(&mutex->released, nullptr);
+    mutex->count = 0;
+}
+
+void OSInitMutexEx(OSMutex *mutex, const char *name) {
+    (void) name;
+    OSInitMutex(mutex);
+}
+
+void OSLockMutex(OSMutex *mutex) {
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&mutex->lock);
+    if (mutex->count == 0 || !pthread_equal(mutex->owner, self)) {
+        while (mutex->count > 0) {
+            pthread_cond_wait(&mutex->released, &mutex->lock);
+        }
+        mutex->owner = self;
+    }
+    mutex->count++;
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+BOOL OSTryLockMutex(OSMutex *mutex) {
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&mutex->lock);
+    BOOL success = mutex->count == 0 || pthread_equal(mutex->owner, self);
+    if (success) {
+        mutex->owner = self;
+        mutex->count++;
+    }
+    pthread_mutex_unlock(&mutex->lock);
+    return success;
+}
+
+void OSUnlockMutex(OSMutex *mutex) {
+    pthread_mutex_lock(&mutex->lock);
+    if (mutex->count > 0 && --mutex->count == 0) {
+        pthread_cond_broadcast(&mutex->released);
+    }
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void OSInitCond(OSCondition *condition) {
+    pthread_cond_init(&condition->cond, nullptr);
+}
+
+void OSInitCondEx(OSCondition *condition, const char *name) {
+    (void) name;
+    OSInitCond(condition);
+}
+
+void OSWaitCond(OSCondition *condition, OSMutex *mutex) {
+    pthread_mutex_lock(&mutex->lock);
+    int32_t count = mutex->count;
+    mutex->count  = 0;
+    pthread_cond_broadcast(&mutex->released);
+    pthread_cond_wait(&condition->cond, &mutex->lock);
+    while (mutex->count > 0) {
+        pthread_cond_wait(&mutex->released, &mutex->lock);
+    }
+    mutex->owner = pthread_self();
+    mutex->count = count;
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void OSSignalCond(OSCondition *condition) {
+    pthread_cond_broadcast(&condition->cond);
+}
+
+void OSInitEvent(OSEvent *event, BOOL value, OSEventMode mode) {
+    pthread_mutex_init(&event->lock, nullptr);
+    pthread_cond_init(&event->cond, nullptr);
+    event->value = value;
+    event->mode  = mode;
+}
+
+void OSSignalEvent(OSEvent *event) {
+    pthread_mutex_lock(&event->lock);
+    event->value = TRUE;
+    pthread_cond_broadcast(&event->cond);
+    pthread_mutex_unlock(&event->lock);
+}
+
+void OSResetEvent(OSEvent *event) {
+    pthread_mutex_lock(&event->lock);
+    event->value = FALSE;
+    pthread_mutex_unlock(&event->lock);
+}
+
+void OSWaitEvent(OSEvent *event) {
+    pthread_mutex_lock(&event->lock);
+    while (!event->value) {
+        pthread_cond_wait(&event->cond, &event->lock);
+    }
+    if (event->mode == OS_EVENT_MODE_AUTO) {
+        event->value = FALSE;
+    }
+    pthread_mutex_unlock(&event->lock);
+}
+
+BOOL OSWaitEventWithTimeout(OSEvent *event, OSTime timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    int64_t ns       = deadline.tv_nsec + (int64_t) OSTicksToNanoseconds(timeout);
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+    pthread_mutex_lock(&event->lock);
+    while (!event->value) {
+        if (pthread_cond_timedwait(&event->cond, &event->lock, &deadline) != 0) {
+            break;
+        }
+    }
+    BOOL signaled = event->value;
+    if (signaled && event->mode == OS_EVENT_MODE_AUTO) {
+        event->value = FALSE;
+    }
+    pthread_mutex_unlock(&event->lock);
+    return signaled;
+}
+
+static thread_local OSThread *sCurrentThread = nullptr;
+
+static void *OSThread_Trampoline(void *arg) {
+    auto *thread   = (OSThread *) arg;
+    sCurrentThread = thread;
+    thread->result = thread->entry(thread->argc, (const char **) thread->argv);
+    return nullptr;
+}
+
+BOOL OSCreateThread(OSThread *thread, OSThreadEntryPointFn entry, int32_t argc, char *argv, void *stack, uint32_t stackSize, int32_t priority, OSThreadAttributes attributes) {
+    (void) stack;
+    (void) stackSize;
+    (void) priority;
+    (void) attributes;
+    memset(thread, 0, sizeof(OSThread));
+    thread->entry = entry;
+    thread->argc  = argc;
+    thread->argv  = argv;
+    return TRUE;
+}
+
+int32_t OSResumeThread(OSThread *thread) {
+    if (thread->started) {
+        return 0;
+    }
+    thread->started = true;
+    pthread_create(&thread->handle, nullptr, OSThread_Trampoline, thread);
+    return 1;
+}
+
+BOOL OSJoinThread(OSThread *thread, int *threadResult) {
+    if (!thread->started) {
+        return FALSE;
+    }
+    pthread_join(thread->handle, nullptr);
+    thread->started = false;
+    if (threadResult) {
+        *threadResult = thread->result;
+    }
+    return TRUE;
+}
+
+OSThread *OSGetCurrentThread() {
+    // Threads that were not created via OSCreateThread (e.g. main) get a placeholder.
+    static thread_local OSThread sForeignThread;
+    return sCurrentThread ? sCurrentThread : &sForeignThread;
+}
+
+void OSSetThreadName(OSThread *thread, const char *name) {
+    thread->name = name;
+}
+
+void OSYieldThread() {
+    sched_yield();
+}
+
+void OSSleepTicks(int64_t ticks) {
+    if (ticks <= 0) {
+        sched_yield();
+        return;
+    }
+    int64_t ns = (int64_t) ((__int128) ticks * 1000000000 / OSTimerClockSpeed);
+    timespec ts;
+    ts.tv_sec  = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    nanosleep(&ts, nullptr);
+}
+
+void OSInitMessageQueue(OSMessageQueue *queue, OSMessage *messages, int32_t size) {
+    pthread_mutex_init(&queue->lock, nullptr);
+    pthread_cond_init(&queue->changed, nullptr);
+    queue->messages = messages;
+    queue->size     = (uint32_t) size;
+    queue->first    = 0;
+    queue->used     = 0;
+}
+
+BOOL OSSendMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->used == queue->size) {
+        if (!(flags & OS_MESSAGE_FLAGS_BLOCKING)) {
+            pthread_mutex_unlock(&queue->lock);
+            return FALSE;
+        }
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    if (flags & OS_MESSAGE_FLAGS_HIGH_PRIORITY) {
+        queue->first                  = (queue->first + queue->size - 1) % queue->size;
+        queue->messages[queue->first] = *message;
+    } else {
+        queue->messages[(queue->first + queue->used) % queue->size] = *message;
+    }
+    queue->used++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return TRUE;
+}
+
+BOOL OSReceiveMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->used == 0) {
+        if (!(flags & OS_MESSAGE_FLAGS_BLOCKING)) {
+            pthread_mutex_unlock(&queue->lock);
+            return FALSE;
+        }
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    *message     = queue->messages[queue->first];
+    queue->first = (queue->first + 1) % queue->size;
+    queue->used--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return TRUE;
+}
+
+OSTime OSGetSystemTime() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    __int128 ns = (__int128) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return (OSTime) (ns * OSTimerClockSpeed / 1000000000);
+}
+
+OSTime OSGetTime() {
+    return OSGetSystemTime();
+}
+
+uint32_t OSGetCoreId() {
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : (uint32_t) cpu % 3;
+}
+
+uint32_t OSGetCoreCount() {
+    return 3;
+}
+
+void OSReport(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+FSClientBody *FSGetClientBody(FSClient *client) {
+    return (FSClientBody *) client;
+}
+
+#define STUB_MAX_DEVOPTABS 16
+
+static const devoptab_t *sDevoptabs[STUB_MAX_DEVOPTABS];
+
+int AddDevice(const devoptab_t *device) {
+    for (int i = 0; i < STUB_MAX_DEVOPTABS; i++) {
+        if (!sDevoptabs[i]) {
+            sDevoptabs[i] = device;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int RemoveDevice(const char *name) {
+    size_t len = strcspn(name, ":");
+    for (int i = 0; i < STUB_MAX_DEVOPTABS; i++) {
+        if (sDevoptabs[i] && strlen(sDevoptabs[i]->name) == len && strncmp(sDevoptabs[i]->name, name, len) == 0) {
+            sDevoptabs[i] = nullptr;
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <coreinit/mutex.h>
+#include <pthread.h>
+#include <wut_types.h>
+
+typedef struct OSCondition {
+    pthread_cond_t cond;
+} OSCondition;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSInitCond(OSCondition *condition);
+void OSInitCondEx(OSCondition *condition, const char *name);
+/**
+ * Releases the mutex completely (also if it was locked recursively) while waiting, like on the console.
+ */
+void OSWaitCond(OSCondition *condition, OSMutex *mutex);
+/**
+ * Wakes up all waiting threads, like on the console.
+ */
+void OSSignalCond(OSCondition *condition);
+
+#ifdef __cplusplus
+}
+#endif
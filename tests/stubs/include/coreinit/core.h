@@ -0,0 +1,13 @@
+#pragma once
+#include <wut_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t OSGetCoreId();
+uint32_t OSGetCoreCount();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,12 @@
+#pragma once
+#include <wut_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSReport(const char *fmt, ...) __attribute__((__format__(__printf__, 1, 2)));
+
+#ifdef __cplusplus
+}
+#endif
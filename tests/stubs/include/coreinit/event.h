@@ -0,0 +1,33 @@
+#pragma once
+#include <coreinit/time.h>
+#include <pthread.h>
+#include <wut_types.h>
+
+typedef enum OSEventMode {
+    OS_EVENT_MODE_MANUAL = 0,
+    OS_EVENT_MODE_AUTO   = 1,
+} OSEventMode;
+
+typedef struct OSEvent {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    BOOL value;
+    OSEventMode mode;
+} OSEvent;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSInitEvent(OSEvent *event, BOOL value, OSEventMode mode);
+/**
+ * Woken threads only return once this released the event, so they may free it right away, like on the console.
+ */
+void OSSignalEvent(OSEvent *event);
+void OSResetEvent(OSEvent *event);
+void OSWaitEvent(OSEvent *event);
+BOOL OSWaitEventWithTimeout(OSEvent *event, OSTime timeout);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+#include <wut_types.h>
+
+typedef enum FSError {
+    FS_ERROR_OK                   = 0,
+    FS_ERROR_NOT_INIT             = -0x30001,
+    FS_ERROR_BUSY                 = -0x30002,
+    FS_ERROR_CANCELLED            = -0x30003,
+    FS_ERROR_END_OF_DIR           = -0x30004,
+    FS_ERROR_END_OF_FILE          = -0x30005,
+    FS_ERROR_MAX_MOUNT_POINTS     = -0x30010,
+    FS_ERROR_MAX_CLIENTS          = -0x30012,
+    FS_ERROR_ALREADY_EXISTS       = -0x30016,
+    FS_ERROR_NOT_FOUND            = -0x30017,
+    FS_ERROR_STORAGE_FULL         = -0x3001C,
+    FS_ERROR_UNSUPPORTED_COMMAND  = -0x30020,
+    FS_ERROR_INVALID_PARAM        = -0x30021,
+    FS_ERROR_INVALID_PATH         = -0x30022,
+    FS_ERROR_INVALID_BUFFER       = -0x30023,
+    FS_ERROR_INVALID_ALIGNMENT    = -0x30024,
+    FS_ERROR_INVALID_CLIENTHANDLE = -0x30025,
+    FS_ERROR_INVALID_FILEHANDLE   = -0x30026,
+    FS_ERROR_OUT_OF_RANGE         = -0x3002B,
+    FS_ERROR_OUT_OF_RESOURCES     = -0x3002C,
+    FS_ERROR_MEDIA_ERROR          = -0x3002E,
+} FSError;
+
+typedef struct FSClient {
+    uint8_t data[0x1700];
+} FSClient;
+
+typedef struct FSClientBody {
+    uint8_t unk0[0x1444];
+    int32_t clientHandle;
+} FSClientBody;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FSClientBody *FSGetClientBody(FSClient *client);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+#include <coreinit/filesystem.h>
+#include <coreinit/ios.h>
+#include <wut_types.h>
+
+typedef IOSHandle FSAClientHandle;
+typedef struct FSAClientAttachAsyncData FSAClientAttachAsyncData;
+
+typedef enum FSACommandEnum {
+    FSA_COMMAND_RAW_OPEN  = 0x6A,
+    FSA_COMMAND_RAW_READ  = 0x6B,
+    FSA_COMMAND_RAW_WRITE = 0x6C,
+    FSA_COMMAND_RAW_CLOSE = 0x6D,
+} FSACommandEnum;
+
+typedef enum FSAIpcRequestTypeEnum {
+    FSA_IPC_REQUEST_IOCTL  = 0,
+    FSA_IPC_REQUEST_IOCTLV = 1,
+} FSAIpcRequestTypeEnum;
+
+typedef struct __attribute__((__packed__)) FSARequestRawOpen {
+    char path[0x280];
+} FSARequestRawOpen;
+
+typedef struct __attribute__((__packed__)) FSARequestRawClose {
+    int32_t handle;
+} FSARequestRawClose;
+
+typedef struct __attribute__((__packed__)) FSARequestRawRead {
+    uint32_t unk0x0;
+    uint64_t blocks_offset;
+    uint32_t count;
+    uint32_t size;
+    uint32_t device_handle;
+} FSARequestRawRead;
+
+typedef struct __attribute__((__packed__)) FSARequestRawWrite {
+    uint32_t unk0x0;
+    uint64_t blocks_offset;
+    uint32_t count;
+    uint32_t size;
+    uint32_t device_handle;
+} FSARequestRawWrite;
+
+typedef struct FSARequest {
+    FSError emulatedError;
+    union {
+        FSARequestRawOpen rawOpen;
+        FSARequestRawClose rawClose;
+        FSARequestRawRead rawRead;
+        FSARequestRawWrite rawWrite;
+        uint8_t data[0x51C];
+    };
+} FSARequest;
+
+typedef struct FSAResponseRawOpen {
+    int32_t handle;
+} FSAResponseRawOpen;
+
+typedef struct FSAResponse {
+    uint32_t word0;
+    union {
+        FSAResponseRawOpen rawOpen;
+        uint8_t data[0x28F];
+    };
+} FSAResponse;
+
+typedef struct WUT_ALIGNAS(0x40) FSAShimBuffer {
+    FSARequest request;
+    uint8_t unk0x520[0x60];
+    FSAResponse response;
+    uint8_t unk0x813[0x4C];
+    IOSVec ioctlvVec[3];
+    uint8_t unk0x884[0x1C];
+    uint16_t command;
+    uint16_t ipcReqType;
+    uint8_t ioctlvVecIn;
+    uint8_t ioctlvVecOut;
+    uint8_t unk0x8A6[2];
+    FSAClientHandle clientHandle;
+} FSAShimBuffer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FSError FSAInit();
+FSAClientHandle FSAAddClient(FSAClientAttachAsyncData *attachAsyncData);
+FSError FSADelClient(FSAClientHandle client);
+
+#ifdef __cplusplus
+}
+#endif
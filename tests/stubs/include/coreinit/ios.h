@@ -0,0 +1,47 @@
+#pragma once
+#include <wut_types.h>
+
+typedef int32_t IOSHandle;
+
+typedef enum IOSError {
+    IOS_ERROR_OK          = 0,
+    IOS_ERROR_ACCESS      = -1,
+    IOS_ERROR_EXISTS      = -2,
+    IOS_ERROR_INTR        = -3,
+    IOS_ERROR_INVALID     = -4,
+    IOS_ERROR_MAX         = -5,
+    IOS_ERROR_NOEXISTS    = -6,
+    IOS_ERROR_QEMPTY      = -7,
+    IOS_ERROR_QFULL       = -8,
+    IOS_ERROR_UNKNOWN     = -9,
+    IOS_ERROR_NOTREADY    = -10,
+    IOS_ERROR_INVALIDSIZE = -22,
+} IOSError;
+
+typedef enum IOSOpenMode {
+    IOS_OPEN_READ      = 1 << 0,
+    IOS_OPEN_WRITE     = 1 << 1,
+    IOS_OPEN_READWRITE = IOS_OPEN_READ | IOS_OPEN_WRITE,
+} IOSOpenMode;
+
+typedef struct IOSVec {
+    void *vaddr;
+    uint32_t len;
+    uint32_t paddr;
+} IOSVec;
+
+typedef void (*IOSAsyncCallbackFn)(IOSError, void *);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+IOSError IOS_Open(const char *device, IOSOpenMode mode);
+IOSError IOS_Close(IOSHandle handle);
+IOSError IOS_Ioctl(IOSHandle handle, uint32_t request, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen);
+IOSError IOS_Ioctlv(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec);
+IOSError IOS_IoctlvAsync(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec, IOSAsyncCallbackFn callback, void *context);
+
+#ifdef __cplusplus
+}
+#endif
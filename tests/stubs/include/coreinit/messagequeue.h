@@ -0,0 +1,35 @@
+#pragma once
+#include <pthread.h>
+#include <wut_types.h>
+
+typedef struct OSMessage {
+    void *message;
+    uint32_t args[3];
+} OSMessage;
+
+typedef struct OSMessageQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    OSMessage *messages;
+    uint32_t size;
+    uint32_t first;
+    uint32_t used;
+} OSMessageQueue;
+
+typedef enum OSMessageFlags {
+    OS_MESSAGE_FLAGS_NONE          = 0,
+    OS_MESSAGE_FLAGS_BLOCKING      = 1 << 0,
+    OS_MESSAGE_FLAGS_HIGH_PRIORITY = 1 << 1,
+} OSMessageFlags;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSInitMessageQueue(OSMessageQueue *queue, OSMessage *messages, int32_t size);
+BOOL OSSendMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags);
+BOOL OSReceiveMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags);
+
+#ifdef __cplusplus
+}
+#endif
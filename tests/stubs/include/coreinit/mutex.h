@@ -0,0 +1,27 @@
+#pragma once
+#include <pthread.h>
+#include <wut_types.h>
+
+/**
+ * Recursive like the coreinit mutex. A zero initialized mutex is usable, like a static one on the console.
+ */
+typedef struct OSMutex {
+    pthread_mutex_t lock; // protects owner and count
+    pthread_cond_t released;
+    pthread_t owner;
+    int32_t count;
+} OSMutex;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void OSInitMutex(OSMutex *mutex);
+void OSInitMutexEx(OSMutex *mutex, const char *name);
+void OSLockMutex(OSMutex *mutex);
+void OSUnlockMutex(OSMutex *mutex);
+BOOL OSTryLockMutex(OSMutex *mutex);
+
+#ifdef __cplusplus
+}
+#endif
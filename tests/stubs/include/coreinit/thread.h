@@ -0,0 +1,42 @@
+#pragma once
+#include <pthread.h>
+#include <wut_types.h>
+
+typedef int (*OSThreadEntryPointFn)(int argc, const char **argv);
+
+typedef enum OSThreadAttributes {
+    OS_THREAD_ATTRIB_AFFINITY_CPU0 = 1 << 0,
+    OS_THREAD_ATTRIB_AFFINITY_CPU1 = 1 << 1,
+    OS_THREAD_ATTRIB_AFFINITY_CPU2 = 1 << 2,
+    OS_THREAD_ATTRIB_AFFINITY_ANY  = (1 << 0) | (1 << 1) | (1 << 2),
+    OS_THREAD_ATTRIB_DETACHED      = 1 << 3,
+} OSThreadAttributes;
+
+/**
+ * Threads are created suspended and started by OSResumeThread, the stack passed to OSCreateThread is not used.
+ */
+typedef struct OSThread {
+    pthread_t handle;
+    OSThreadEntryPointFn entry;
+    int32_t argc;
+    char *argv;
+    bool started;
+    int result;
+    const char *name;
+} OSThread;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOL OSCreateThread(OSThread *thread, OSThreadEntryPointFn entry, int32_t argc, char *argv, void *stack, uint32_t stackSize, int32_t priority, OSThreadAttributes attributes);
+int32_t OSResumeThread(OSThread *thread);
+BOOL OSJoinThread(OSThread *thread, int *threadResult);
+OSThread *OSGetCurrentThread();
+void OSSetThreadName(OSThread *thread, const char *name);
+void OSYieldThread();
+void OSSleepTicks(int64_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
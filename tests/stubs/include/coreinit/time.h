@@ -0,0 +1,28 @@
+#pragma once
+#include <wut_types.h>
+
+typedef int64_t OSTime;
+typedef int32_t OSTick;
+
+// Bus clock of the console / 4, the stubs count ticks at the same rate.
+#define OSTimerClockSpeed               62156250
+
+#define OSTicksToSeconds(val)           ((val) / OSTimerClockSpeed)
+#define OSTicksToMilliseconds(val)      ((val) / (OSTimerClockSpeed / 1000))
+#define OSTicksToMicroseconds(val)      (((val) * 8) / (OSTimerClockSpeed / 125000))
+#define OSTicksToNanoseconds(val)       (((val) * 8000) / (OSTimerClockSpeed / 125000))
+#define OSSecondsToTicks(val)           ((uint64_t) (val) * (uint64_t) OSTimerClockSpeed)
+#define OSMillisecondsToTicks(val)      (((uint64_t) (val) * (uint64_t) OSTimerClockSpeed) / 1000ull)
+#define OSMicrosecondsToTicks(val)      (((uint64_t) (val) * ((uint64_t) OSTimerClockSpeed / 125000)) / 8ull)
+#define OSNanosecondsToTicks(val)       (((uint64_t) (val) * ((uint64_t) OSTimerClockSpeed / 125000)) / 8000ull)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+OSTime OSGetSystemTime();
+OSTime OSGetTime();
+
+#ifdef __cplusplus
+}
+#endif
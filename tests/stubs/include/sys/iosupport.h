@@ -0,0 +1,34 @@
+#pragma once
+// Host stand-in for the devoptab interface of newlib, only the members the library fills in.
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct _reent {
+    int _errno;
+    void *deviceData;
+};
+
+typedef struct {
+    const char *name;
+    size_t structSize;
+    int (*open_r)(struct _reent *r, void *fileStruct, const char *path, int flags, int mode);
+    int (*close_r)(struct _reent *r, void *fd);
+    ssize_t (*write_r)(struct _reent *r, void *fd, const char *ptr, size_t len);
+    ssize_t (*read_r)(struct _reent *r, void *fd, char *ptr, size_t len);
+    off_t (*seek_r)(struct _reent *r, void *fd, off_t pos, int dir);
+    int (*fstat_r)(struct _reent *r, void *fd, struct stat *st);
+    int (*stat_r)(struct _reent *r, const char *file, struct stat *st);
+    int (*fsync_r)(struct _reent *r, void *fd);
+    void *deviceData;
+} devoptab_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int AddDevice(const devoptab_t *device);
+int RemoveDevice(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
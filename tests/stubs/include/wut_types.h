@@ -0,0 +1,15 @@
+#pragma once
+// Host stand-in for the wut headers, only what the library uses. See tests/CMakeLists.txt
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int32_t BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define WUT_ALIGNAS(align) __attribute__((__aligned__(align)))
@@ -0,0 +1,490 @@
+// Simulated IOSU side of the library for host builds, see stub_iosu.h
+#include "stub_iosu.h"
+#include "mocha/commands.h"
+#include <condition_variable>
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/ios.h>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STUB_MCP_HANDLE_BASE     0x100
+#define STUB_ODM_HANDLE          0x80
+#define STUB_CLIENT_HANDLE_BASE  0x1000
+#define STUB_DEVICE_HANDLE_BASE  0x200
+#define STUB_ASYNC_WORKER_COUNT  4
+#define STUB_FSA_COMMAND_MOUNT   0x01
+#define STUB_FSA_COMMAND_UNMOUNT 0x02
+
+struct StubDevice {
+    std::string path;
+    std::vector<uint8_t> data;
+};
+
+struct StubAsyncJob {
+    int32_t clientHandle;
+    uint16_t command;
+    FSARequest *request;
+    void *data;
+    uint32_t len;
+    IOSAsyncCallbackFn callback;
+    void *context;
+};
+
+static std::mutex sLock;
+static std::vector<std::unique_ptr<StubDevice>> sDevices;
+static std::vector<StubDevice *> sDeviceHandles; // index = handle - STUB_DEVICE_HANDLE_BASE, nullptr if closed
+static std::set<int32_t> sMcpHandles;
+static int32_t sNextMcpHandle = STUB_MCP_HANDLE_BASE;
+static std::set<int32_t> sClients;
+static int32_t sNextClient = STUB_CLIENT_HANDLE_BASE;
+static std::set<std::string> sMounts;
+static std::map<int32_t, uint32_t> sTransfersInFlight; // per device handle
+static uint32_t sPerRequestUs         = 0;
+static uint32_t sPerMiBUs             = 0;
+static uint32_t sMochaApiVersion      = 3;
+static bool sBatchSupported           = false;
+static uint32_t sFailMcpCount         = 0;
+static IOSError sFailMcpError         = IOS_ERROR_OK;
+static uint32_t sMcpCommandCount[256] = {};
+static uint32_t sMcpOpenCount         = 0;
+static uint32_t sMcpIoctlCount        = 0;
+static StubIosuStats sStats           = {};
+
+// Never destroyed, the detached workers still wait on them while the process exits.
+static std::mutex &sAsyncLock               = *new std::mutex;
+static std::condition_variable &sAsyncCond  = *new std::condition_variable;
+static std::deque<StubAsyncJob> &sAsyncJobs = *new std::deque<StubAsyncJob>;
+static bool sAsyncWorkersStarted            = false;
+
+void StubIosu_Reset() {
+    std::lock_guard<std::mutex> lock(sLock);
+    sDevices.clear();
+    sDeviceHandles.clear();
+    sMcpHandles.clear();
+    sClients.clear();
+    sMounts.clear();
+    sTransfersInFlight.clear();
+    sPerRequestUs    = 0;
+    sPerMiBUs        = 0;
+    sMochaApiVersion = 3;
+    sBatchSupported  = false;
+    sFailMcpCount    = 0;
+    sFailMcpError    = IOS_ERROR_OK;
+    memset(sMcpCommandCount, 0, sizeof(sMcpCommandCount));
+    sMcpOpenCount  = 0;
+    sMcpIoctlCount = 0;
+    sStats         = {};
+}
+
+uint8_t *StubIosu_AddDevice(const char *path, uint64_t size) {
+    std::lock_guard<std::mutex> lock(sLock);
+    auto device  = std::make_unique<StubDevice>();
+    device->path = path;
+    device->data.resize(size);
+    auto *data = device->data.data();
+    sDevices.push_back(std::move(device));
+    return data;
+}
+
+void StubIosu_SetLatency(uint32_t perRequestUs, uint32_t perMiBUs) {
+    std::lock_guard<std::mutex> lock(sLock);
+    sPerRequestUs = perRequestUs;
+    sPerMiBUs     = perMiBUs;
+}
+
+void StubIosu_SetMochaApiVersion(uint32_t version) {
+    std::lock_guard<std::mutex> lock(sLock);
+    sMochaApiVersion = version;
+}
+
+void StubIosu_SetBatchSupported(bool supported) {
+    std::lock_guard<std::mutex> lock(sLock);
+    sBatchSupported = supported;
+}
+
+void StubIosu_FailMcpIoctls(uint32_t count, IOSError err) {
+    std::lock_guard<std::mutex> lock(sLock);
+    sFailMcpCount = count;
+    sFailMcpError = err;
+}
+
+void StubIosu_InvalidateMcpHandles() {
+    std::lock_guard<std::mutex> lock(sLock);
+    sMcpHandles.clear();
+}
+
+uint32_t StubIosu_GetMcpCommandCount(uint32_t command) {
+    std::lock_guard<std::mutex> lock(sLock);
+    return command < 256 ? sMcpCommandCount[command] : 0;
+}
+
+uint32_t StubIosu_GetMcpOpenCount() {
+    std::lock_guard<std::mutex> lock(sLock);
+    return sMcpOpenCount;
+}
+
+uint32_t StubIosu_GetMcpIoctlCount() {
+    std::lock_guard<std::mutex> lock(sLock);
+    return sMcpIoctlCount;
+}
+
+void StubIosu_GetStats(StubIosuStats *outStats) {
+    std::lock_guard<std::mutex> lock(sLock);
+    *outStats = sStats;
+}
+
+/**
+ * Executes a single custom mocha command. Must be called with sLock held.
+ */
+static IOSError StubIosu_McpCommand(uint32_t command, const uint8_t *args, uint32_t argsLen, uint8_t *out, uint32_t outLen) {
+    switch (command) {
+        case IPC_CUSTOM_GET_MOCHA_API_VERSION:
+            if (outLen < 4) {
+                return IOS_ERROR_INVALID;
+            }
+            memcpy(out, &sMochaApiVersion, 4);
+            break;
+        case IPC_CUSTOM_COPY_ENVIRONMENT_PATH:
+            if (outLen < 0x100) {
+                return IOS_ERROR_INVALID;
+            }
+            memset(out, 0, 0x100);
+            strcpy((char *) out, "fs:/vol/external01/wiiu/environments/stub");
+            break;
+        case IPC_CUSTOM_LOAD_CUSTOM_RPX:
+            if (argsLen < sizeof(MochaRPXLoadInfo)) {
+                return IOS_ERROR_INVALID;
+            }
+            break;
+        case IPC_CUSTOM_START_USB_LOGGING:
+            if (argsLen < 4) {
+                return IOS_ERROR_INVALID;
+            }
+            break;
+        case IPC_CUSTOM_START_MCP_THREAD:
+        case IPC_CUSTOM_MEN_RPX_HOOK_COMPLETED:
+            break;
+        default:
+            return IOS_ERROR_INVALID;
+    }
+    sMcpCommandCount[command]++;
+    return IOS_ERROR_OK;
+}
+
+/**
+ * [IPC_CUSTOM_BATCH][count] followed by [command][inLen][outLen][args, padded to 4 bytes], see Mocha_BatchSubmitCombined.
+ */
+static IOSError StubIosu_McpBatch(const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t outLen) {
+    if (!sBatchSupported || inLen < 8) {
+        return IOS_ERROR_INVALID;
+    }
+    uint32_t count;
+    memcpy(&count, in + 4, 4);
+    uint32_t inPos  = 8;
+    uint32_t outPos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t header[3];
+        if (inPos + 12 > inLen) {
+            return IOS_ERROR_INVALID;
+        }
+        memcpy(header, in + inPos, 12);
+        inPos += 12;
+        uint32_t argsLen = (header[1] + 3) & ~3u;
+        uint32_t respLen = (header[2] + 3) & ~3u;
+        if (inPos + argsLen > inLen || outPos + 4 + respLen > outLen) {
+            return IOS_ERROR_INVALID;
+        }
+        int32_t result = StubIosu_McpCommand(header[0], in + inPos, header[1], out + outPos + 4, header[2]);
+        memcpy(out + outPos, &result, 4);
+        inPos += argsLen;
+        outPos += 4 + respLen;
+    }
+    return IOS_ERROR_OK;
+}
+
+IOSError IOS_Open(const char *device, IOSOpenMode mode) {
+    (void) mode;
+    std::lock_guard<std::mutex> lock(sLock);
+    if (strcmp(device, "/dev/mcp") == 0) {
+        sMcpOpenCount++;
+        int32_t handle = sNextMcpHandle++;
+        sMcpHandles.insert(handle);
+        return (IOSError) handle;
+    }
+    if (strcmp(device, "/dev/odm") == 0) {
+        return (IOSError) STUB_ODM_HANDLE;
+    }
+    return IOS_ERROR_NOEXISTS;
+}
+
+IOSError IOS_Close(IOSHandle handle) {
+    std::lock_guard<std::mutex> lock(sLock);
+    if (handle == STUB_ODM_HANDLE) {
+        return IOS_ERROR_OK;
+    }
+    return sMcpHandles.erase(handle) ? IOS_ERROR_OK : IOS_ERROR_INVALID;
+}
+
+IOSError IOS_Ioctl(IOSHandle handle, uint32_t request, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen) {
+    std::lock_guard<std::mutex> lock(sLock);
+    if (sClients.count(handle)) {
+        // 0x28: Mocha_UnlockFSClient
+        return request == 0x28 ? IOS_ERROR_OK : IOS_ERROR_INVALID;
+    }
+    if (handle == STUB_ODM_HANDLE) {
+        // Disc keys need a disc.
+        return IOS_ERROR_ACCESS;
+    }
+    if (handle >= STUB_MCP_HANDLE_BASE && handle < sNextMcpHandle) {
+        sMcpIoctlCount++;
+    }
+    if (!sMcpHandles.count(handle) || request != 100) {
+        return IOS_ERROR_INVALID;
+    }
+    if (sMochaApiVersion == 0 || inLen < 4) {
+        return IOS_ERROR_INVALID;
+    }
+    // The commands may use the same buffer for input and output.
+    std::vector<uint8_t> in((uint8_t *) inBuf, (uint8_t *) inBuf + inLen);
+    uint32_t command;
+    memcpy(&command, in.data(), 4);
+    IOSError res;
+    if (command == IPC_CUSTOM_BATCH) {
+        res = StubIosu_McpBatch(in.data(), inLen, (uint8_t *) outBuf, outLen);
+    } else {
+        res = StubIosu_McpCommand(command, in.data() + 4, inLen - 4, (uint8_t *) outBuf, outLen);
+    }
+    if (sFailMcpCount > 0) {
+        sFailMcpCount--;
+        return sFailMcpError;
+    }
+    return res;
+}
+
+IOSError IOS_Ioctlv(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec) {
+    (void) handle;
+    (void) request;
+    (void) vecIn;
+    (void) vecOut;
+    (void) vec;
+    return IOS_ERROR_INVALID;
+}
+
+FSError FSAInit() {
+    return FS_ERROR_OK;
+}
+
+FSAClientHandle FSAAddClient(FSAClientAttachAsyncData *attachAsyncData) {
+    (void) attachAsyncData;
+    std::lock_guard<std::mutex> lock(sLock);
+    int32_t handle = sNextClient++;
+    sClients.insert(handle);
+    return handle;
+}
+
+FSError FSADelClient(FSAClientHandle client) {
+    std::lock_guard<std::mutex> lock(sLock);
+    return sClients.erase(client) ? FS_ERROR_OK : FS_ERROR_INVALID_CLIENTHANDLE;
+}
+
+static StubDevice *StubIosu_GetDeviceHandle(int32_t handle) {
+    int32_t idx = handle - STUB_DEVICE_HANDLE_BASE;
+    if (idx < 0 || idx >= (int32_t) sDeviceHandles.size()) {
+        return nullptr;
+    }
+    return sDeviceHandles[idx];
+}
+
+static void StubIosu_Delay(uint32_t bytes) {
+    uint64_t us;
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        us = sPerRequestUs + (uint64_t) sPerMiBUs * bytes / (1024 * 1024);
+    }
+    if (us > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+}
+
+// Needs to be called with sLock held once a transfer is submitted, StubIosu_RawTransfer ends it.
+static void StubIosu_BeginTransfer(const FSARequestRawRead &request) {
+    sTransfersInFlight[(int32_t) request.device_handle]++;
+}
+
+static FSError StubIosu_RawTransfer(int32_t clientHandle, uint16_t command, const FSARequestRawRead &request, void *data, uint32_t len) {
+    uint64_t size = (uint64_t) request.size * request.count;
+    auto handle   = (int32_t) request.device_handle;
+    StubIosu_Delay((uint32_t) size);
+
+    std::lock_guard<std::mutex> lock(sLock);
+    sTransfersInFlight[handle]--;
+    if (!sClients.count(clientHandle)) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    auto *device = StubIosu_GetDeviceHandle((int32_t) request.device_handle);
+    if (!device) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    if ((uintptr_t) data & 0x3F) {
+        sStats.alignmentErrors++;
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    if (size > len) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    uint64_t offset = request.blocks_offset * request.size;
+    if (offset + size > device->data.size()) {
+        return FS_ERROR_OUT_OF_RANGE;
+    }
+    if (command == FSA_COMMAND_RAW_READ) {
+        memcpy(data, device->data.data() + offset, size);
+        sStats.rawReads++;
+        sStats.bytesRead += size;
+    } else {
+        memcpy(device->data.data() + offset, data, size);
+        sStats.rawWrites++;
+        sStats.bytesWritten += size;
+    }
+    return FS_ERROR_OK;
+}
+
+static FSError StubIosu_RawOpen(FSAShimBuffer *shim) {
+    std::lock_guard<std::mutex> lock(sLock);
+    if (!sClients.count(shim->clientHandle)) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    for (auto &device : sDevices) {
+        if (strncmp(device->path.c_str(), shim->request.rawOpen.path, sizeof(shim->request.rawOpen.path)) != 0) {
+            continue;
+        }
+        sStats.rawOpens++;
+        sDeviceHandles.push_back(device.get());
+        shim->response.rawOpen.handle = STUB_DEVICE_HANDLE_BASE + (int32_t) sDeviceHandles.size() - 1;
+        return FS_ERROR_OK;
+    }
+    return FS_ERROR_NOT_FOUND;
+}
+
+static FSError StubIosu_RawClose(FSAShimBuffer *shim) {
+    std::lock_guard<std::mutex> lock(sLock);
+    int32_t idx = shim->request.rawClose.handle - STUB_DEVICE_HANDLE_BASE;
+    if (!StubIosu_GetDeviceHandle(shim->request.rawClose.handle)) {
+        return FS_ERROR_INVALID_FILEHANDLE;
+    }
+    sStats.rawCloses++;
+    if (sTransfersInFlight[shim->request.rawClose.handle] != 0) {
+        sStats.closesWithTransfersInFlight++;
+    }
+    sDeviceHandles[idx] = nullptr;
+    return FS_ERROR_OK;
+}
+
+extern "C" FSError __FSAShimSetupRequestMount(FSAShimBuffer *shim, uint32_t clientHandle, const char *source, const char *target, uint32_t unk, void *arg_buf, uint32_t arg_len) {
+    (void) source;
+    (void) unk;
+    (void) arg_buf;
+    (void) arg_len;
+    memset(shim, 0, sizeof(FSAShimBuffer));
+    shim->clientHandle = (FSAClientHandle) clientHandle;
+    shim->command      = STUB_FSA_COMMAND_MOUNT;
+    shim->ipcReqType   = FSA_IPC_REQUEST_IOCTL;
+    strncpy(shim->request.rawOpen.path, target, sizeof(shim->request.rawOpen.path) - 1);
+    return FS_ERROR_OK;
+}
+
+extern "C" FSError __FSAShimSetupRequestUnmount(FSAShimBuffer *shim, uint32_t clientHandle, const char *mountedTarget, uint32_t flags) {
+    (void) flags;
+    memset(shim, 0, sizeof(FSAShimBuffer));
+    shim->clientHandle = (FSAClientHandle) clientHandle;
+    shim->command      = STUB_FSA_COMMAND_UNMOUNT;
+    shim->ipcReqType   = FSA_IPC_REQUEST_IOCTL;
+    strncpy(shim->request.rawOpen.path, mountedTarget, sizeof(shim->request.rawOpen.path) - 1);
+    return FS_ERROR_OK;
+}
+
+extern "C" FSError __FSAShimSend(FSAShimBuffer *shim, uint32_t unk) {
+    (void) unk;
+    if ((uintptr_t) shim & 0x3F) {
+        return FS_ERROR_INVALID_ALIGNMENT;
+    }
+    switch (shim->command) {
+        case STUB_FSA_COMMAND_MOUNT: {
+            std::lock_guard<std::mutex> lock(sLock);
+            return sMounts.insert(shim->request.rawOpen.path).second ? FS_ERROR_OK : FS_ERROR_ALREADY_EXISTS;
+        }
+        case STUB_FSA_COMMAND_UNMOUNT: {
+            std::lock_guard<std::mutex> lock(sLock);
+            return sMounts.erase(shim->request.rawOpen.path) ? FS_ERROR_OK : FS_ERROR_NOT_FOUND;
+        }
+        case FSA_COMMAND_RAW_OPEN:
+            return StubIosu_RawOpen(shim);
+        case FSA_COMMAND_RAW_CLOSE:
+            return StubIosu_RawClose(shim);
+        case FSA_COMMAND_RAW_READ:
+        case FSA_COMMAND_RAW_WRITE: {
+            {
+                std::lock_guard<std::mutex> lock(sLock);
+                StubIosu_BeginTransfer(shim->request.rawRead);
+            }
+            return StubIosu_RawTransfer(shim->clientHandle, shim->command, shim->request.rawRead, shim->ioctlvVec[1].vaddr, shim->ioctlvVec[1].len);
+        }
+        default:
+            return FS_ERROR_UNSUPPORTED_COMMAND;
+    }
+}
+
+static void StubIosu_AsyncWorker() {
+    while (true) {
+        StubAsyncJob job;
+        {
+            std::unique_lock<std::mutex> lock(sAsyncLock);
+            sAsyncCond.wait(lock, [] { return !sAsyncJobs.empty(); });
+            job = sAsyncJobs.front();
+            sAsyncJobs.pop_front();
+        }
+        auto res = StubIosu_RawTransfer(job.clientHandle, job.command, job.request->rawRead, job.data, job.len);
+        job.callback((IOSError) res, job.context);
+    }
+}
+
+IOSError IOS_IoctlvAsync(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec, IOSAsyncCallbackFn callback, void *context) {
+    (void) vecIn;
+    (void) vecOut;
+    if (request != FSA_COMMAND_RAW_READ && request != FSA_COMMAND_RAW_WRITE) {
+        return IOS_ERROR_INVALID;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sLock);
+        if (!sClients.count(handle)) {
+            return IOS_ERROR_INVALID;
+        }
+        sStats.asyncRequests++;
+        StubIosu_BeginTransfer(((FSARequest *) vec[0].vaddr)->rawRead);
+    }
+    std::lock_guard<std::mutex> lock(sAsyncLock);
+    if (!sAsyncWorkersStarted) {
+        sAsyncWorkersStarted = true;
+        for (int i = 0; i < STUB_ASYNC_WORKER_COUNT; i++) {
+            std::thread(StubIosu_AsyncWorker).detach();
+        }
+    }
+    sAsyncJobs.push_back({handle, (uint16_t) request, (FSARequest *) vec[0].vaddr, vec[1].vaddr, vec[1].len, callback, context});
+    sAsyncCond.notify_one();
+    return IOS_ERROR_OK;
+}
+
+extern "C" int bspRead(const char *entity, uint32_t instance, const char *attribute, uint32_t size, uint16_t *outValue) {
+    if (strcmp(entity, "EE") != 0 || strcmp(attribute, "access") != 0 || size != 2 || instance >= 0x100) {
+        return -1;
+    }
+    // Recognizable content, every halfword holds its own index.
+    *outValue = (uint16_t) instance;
+    return 0;
+}
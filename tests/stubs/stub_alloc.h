@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Number of memalign calls since the start of the process. Every call is counted, including calls from the tests.
+ * The library allocates all aligned IPC buffers (shim buffers, bounce buffers, queues) with memalign.
+ */
+uint64_t StubAlloc_GetMemalignCount();
+
+/**
+ * Number of malloc calls since the start of the process that were made by the library or the tests. Allocations
+ * inside the C++ runtime (operator new, std::thread) are not seen.
+ */
+uint64_t StubAlloc_GetMallocCount();
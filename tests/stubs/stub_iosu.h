@@ -0,0 +1,74 @@
+#pragma once
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/ios.h>
+#include <stdint.h>
+
+/*
+ * Simulated IOSU for host builds. Serves /dev/mcp (the mocha custom commands), FSA clients and raw devices that are kept
+ * in memory. Raw transfers enforce the 0x40 alignment of the real FSA and can be slowed down to emulate a device.
+ */
+
+typedef struct StubIosuStats {
+    uint32_t rawOpens;
+    uint32_t rawCloses;
+    uint32_t rawReads;  // synchronous and asynchronous
+    uint32_t rawWrites; // synchronous and asynchronous
+    uint32_t asyncRequests;
+    uint32_t alignmentErrors;
+    uint32_t closesWithTransfersInFlight; // the handle was closed while a transfer on it was still running
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+} StubIosuStats;
+
+/**
+ * Drops all devices, handles and counters and restores the default configuration.
+ */
+void StubIosu_Reset();
+
+/**
+ * Adds a zero filled device that can be opened via FSAEx_RawOpen.
+ * @return pointer to the device content, valid until StubIosu_Reset.
+ */
+uint8_t *StubIosu_AddDevice(const char *path, uint64_t size);
+
+/**
+ * Simulated duration of every raw transfer: perRequestUs plus perMiBUs for every MiB that is transferred.
+ */
+void StubIosu_SetLatency(uint32_t perRequestUs, uint32_t perMiBUs);
+
+/**
+ * Mocha API version reported via /dev/mcp. 0 rejects every custom command like an unpatched IOSU.
+ */
+void StubIosu_SetMochaApiVersion(uint32_t version);
+
+/**
+ * Lets IPC_CUSTOM_BATCH requests succeed (true) or get rejected as unknown command (false, the default).
+ */
+void StubIosu_SetBatchSupported(bool supported);
+
+/**
+ * Executes the next count /dev/mcp ioctls and returns err for them afterwards, e.g. to emulate a failing command.
+ */
+void StubIosu_FailMcpIoctls(uint32_t count, IOSError err);
+
+/**
+ * Closes every /dev/mcp handle on the IOSU side. Ioctls on them fail with IOS_ERROR_INVALID without being executed.
+ */
+void StubIosu_InvalidateMcpHandles();
+
+/**
+ * Number of times a custom mocha command has been executed, including the commands of batches.
+ */
+uint32_t StubIosu_GetMcpCommandCount(uint32_t command);
+
+/**
+ * Number of IOS_Open calls for /dev/mcp.
+ */
+uint32_t StubIosu_GetMcpOpenCount();
+
+/**
+ * Number of IOS_Ioctl calls on /dev/mcp handles, including the ones that failed.
+ */
+uint32_t StubIosu_GetMcpIoctlCount();
+
+void StubIosu_GetStats(StubIosuStats *outStats);
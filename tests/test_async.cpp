@@ -0,0 +1,181 @@
+// Lifetime of the per handle async queue: polling, changing the depth and closing while requests are in flight.
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <atomic>
+#include <chrono>
+#include <coreinit/filesystem_fsa.h>
+#include <malloc.h>
+#include <mocha/fsa.h>
+#include <thread>
+#include <vector>
+
+#define SECTOR_SIZE 0x200
+
+static std::atomic<uint32_t> sCallbacks;
+
+static void CountCallback(const FSAExRawAsyncResult *result) {
+    (void) result;
+    sCallbacks++;
+}
+
+static void TestPollIgnoresCallbackRequests() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    StubIosu_SetLatency(20000, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    auto *buffer = (uint8_t *) memalign(0x40, SECTOR_SIZE);
+
+    // Only a request with callback is in flight, waiting for a polled result would never return.
+    sCallbacks = 0;
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, 0, handle, CountCallback, nullptr), FS_ERROR_OK);
+    FSAExRawAsyncResult result;
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_NOT_FOUND);
+
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, 1, handle, nullptr, nullptr), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_OK);
+    CHECK_EQ(result.blocks_offset, 1u);
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_NOT_FOUND);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestCloseWaitsForInFlightRequests() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    StubIosu_SetLatency(20000, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    auto *buffer = (uint8_t *) memalign(0x40, 4 * SECTOR_SIZE);
+
+    sCallbacks = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer + i * SECTOR_SIZE, SECTOR_SIZE, 1, i, handle, CountCallback, nullptr), FS_ERROR_OK);
+    }
+    // The queue is freed on close, that has to wait for the callbacks that still use its slots.
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    CHECK_EQ(sCallbacks.load(), 4u);
+
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestCloseWhilePolling() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    StubIosu_SetLatency(20000, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    auto *buffer = (uint8_t *) memalign(0x40, SECTOR_SIZE);
+
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, 2, handle, nullptr, nullptr), FS_ERROR_OK);
+    // The poll waits on the queue that the close frees, the close has to wait for it.
+    FSAExRawAsyncResult result = {};
+    FSError pollRes            = FS_ERROR_NOT_FOUND;
+    std::thread poller([&] { pollRes = FSAEx_RawPollCompletion(handle, &result, true); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    poller.join();
+    // The request itself may fail as its handle was closed on the IOSU side.
+    CHECK_EQ(pollRes, FS_ERROR_OK);
+    CHECK_EQ(result.blocks_offset, 2u);
+
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestSetQueueDepthWhileSubmitting() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    StubIosu_SetLatency(100, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+
+    sCallbacks = 0;
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> submitted{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 2; t++) {
+        threads.emplace_back([&, t] {
+            auto *buffer = (uint8_t *) memalign(0x40, SECTOR_SIZE);
+            while (!stop) {
+                auto res = FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, t, handle, CountCallback, nullptr);
+                if (res == FS_ERROR_OK) {
+                    submitted++;
+                } else {
+                    CHECK_EQ(res, FS_ERROR_BUSY);
+                }
+            }
+            free(buffer);
+        });
+    }
+    // Every successful change replaces the queue, it must never be freed under a submission.
+    uint32_t changes = 0;
+    for (uint32_t i = 0; i < 2000 && changes < 50; i++) {
+        auto res = FSAEx_RawSetQueueDepth(handle, 1 + i % 4);
+        if (res == FS_ERROR_OK) {
+            changes++;
+        } else {
+            CHECK_EQ(res, FS_ERROR_BUSY);
+        }
+    }
+    stop = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    CHECK_EQ(sCallbacks.load(), submitted.load());
+    FSADelClient(client);
+}
+
+static int32_t CountBytes(void *buffer, uint32_t size, uint64_t offset, void *userContext) {
+    (void) buffer;
+    (void) offset;
+    *(uint64_t *) userContext += size;
+    return (int32_t) size;
+}
+
+static void TestCopyWaitsForSharedSlot() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    StubIosu_SetLatency(20000, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawSetQueueDepth(handle, 1), FS_ERROR_OK);
+    auto *buffer = (uint8_t *) memalign(0x40, SECTOR_SIZE);
+
+    // The only slot is taken by a request of another caller, the copy has none in flight that could free it.
+    sCallbacks = 0;
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, 0, handle, CountCallback, nullptr), FS_ERROR_OK);
+    uint64_t copied           = 0;
+    FSAExRawCopyParams params = {};
+    params.direction          = FSAEX_RAW_COPY_DEVICE_TO_FILE;
+    params.fileCallback       = CountBytes;
+    params.sectorSize         = SECTOR_SIZE;
+    params.sectorCount        = 16;
+    params.chunkSectors       = 8;
+    params.userContext        = &copied;
+    CHECK_EQ(FSAEx_RawCopyEx(client, handle, &params, nullptr), FS_ERROR_OK);
+    CHECK_EQ(copied, 16u * SECTOR_SIZE);
+    CHECK_EQ(sCallbacks.load(), 1u);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(buffer);
+    FSADelClient(client);
+}
+
+int main() {
+    RUN_TEST(TestPollIgnoresCallbackRequests);
+    RUN_TEST(TestCloseWaitsForInFlightRequests);
+    RUN_TEST(TestCloseWhilePolling);
+    RUN_TEST(TestSetQueueDepthWhileSubmitting);
+    RUN_TEST(TestCopyWaitsForSharedSlot);
+    return 0;
+}
@@ -0,0 +1,233 @@
+// Exercises both backends of the library: the (stubbed) IOSU path via the FSA shim and IOS_*, and the image backend.
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <coreinit/filesystem_fsa.h>
+#include <cstring>
+#include <malloc.h>
+#include <mocha/commands.h>
+#include <mocha/fsa.h>
+#include <mocha/mocha.h>
+#include <unistd.h>
+
+#define SECTOR_SIZE 0x200
+
+static void FillPattern(uint8_t *data, uint32_t size, uint32_t seed) {
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = (uint8_t) (i * 7 + seed);
+    }
+}
+
+static void TestIOSURawTransfers() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", 64 * SECTOR_SIZE);
+    FillPattern(device, 64 * SECTOR_SIZE, 1);
+
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+
+    auto *aligned = (uint8_t *) memalign(0x40, 16 * SECTOR_SIZE + 0x40);
+    CHECK_EQ(FSAEx_RawReadEx(client, aligned, SECTOR_SIZE, 16, 4, handle), FS_ERROR_OK);
+    CHECK(memcmp(aligned, device + 4 * SECTOR_SIZE, 16 * SECTOR_SIZE) == 0);
+
+    // Unaligned buffers go through the bounce logic, the stub rejects unaligned transfers like the real FSA.
+    uint8_t *unaligned = aligned + 3;
+    CHECK_EQ(FSAEx_RawReadEx(client, unaligned, SECTOR_SIZE, 16, 8, handle), FS_ERROR_OK);
+    CHECK(memcmp(unaligned, device + 8 * SECTOR_SIZE, 16 * SECTOR_SIZE) == 0);
+
+    FillPattern(unaligned, 3 * SECTOR_SIZE, 99);
+    CHECK_EQ(FSAEx_RawWriteEx(client, unaligned, SECTOR_SIZE, 3, 40, handle), FS_ERROR_OK);
+    CHECK(memcmp(unaligned, device + 40 * SECTOR_SIZE, 3 * SECTOR_SIZE) == 0);
+
+    CHECK_EQ(FSAEx_RawReadEx(client, aligned, SECTOR_SIZE, 2, 63, handle), FS_ERROR_OUT_OF_RANGE);
+
+    StubIosuStats stats;
+    StubIosu_GetStats(&stats);
+    CHECK_EQ(stats.alignmentErrors, 0u);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawReadEx(client, aligned, SECTOR_SIZE, 1, 0, handle), FS_ERROR_INVALID_FILEHANDLE);
+
+    free(aligned);
+    FSADelClient(client);
+    Mocha_DeInitLibrary();
+}
+
+static void TestIOSURawReadV() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", 3072 * SECTOR_SIZE);
+    FillPattern(device, 3072 * SECTOR_SIZE, 5);
+
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+
+    // An unaligned 1.25 MiB extent is read in 512 KiB pieces, the empty extent is out of range but never read.
+    auto *buffer              = (uint8_t *) memalign(0x40, 2560 * SECTOR_SIZE + 0x40);
+    FSAExRawExtent extents[2] = {};
+    extents[0].blocks_offset  = 100;
+    extents[0].cnt            = 2560;
+    extents[0].data           = buffer + 3;
+    extents[1].blocks_offset  = 1000000;
+    extents[1].cnt            = 0;
+    extents[1].data           = buffer;
+    StubIosuStats before, after;
+    StubIosu_GetStats(&before);
+    CHECK_EQ(FSAEx_RawReadVEx(client, SECTOR_SIZE, extents, 2, handle), FS_ERROR_OK);
+    StubIosu_GetStats(&after);
+    CHECK_EQ(extents[0].result, FS_ERROR_OK);
+    CHECK_EQ(extents[1].result, FS_ERROR_OK);
+    CHECK_EQ(after.rawReads - before.rawReads, 3u);
+    CHECK(memcmp(buffer + 3, device + 100 * SECTOR_SIZE, 2560 * SECTOR_SIZE) == 0);
+
+    // Only empty extents, nothing is sent at all.
+    CHECK_EQ(FSAEx_RawReadVEx(client, SECTOR_SIZE, &extents[1], 1, handle), FS_ERROR_OK);
+    StubIosu_GetStats(&before);
+    CHECK_EQ(before.rawReads, after.rawReads);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(buffer);
+    FSADelClient(client);
+    Mocha_DeInitLibrary();
+}
+
+static void TestIOSUMount() {
+    StubIosu_Reset();
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    int client = FSAAddClient(nullptr);
+    CHECK_EQ(FSAEx_MountEx(client, "/dev/sdcard01", "/vol/storage_test", FSA_MOUNT_FLAG_GLOBAL_MOUNT, nullptr, 0), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_UnmountEx(client, "/vol/storage_test", FSA_UNMOUNT_FLAG_BIND_MOUNT), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_UnmountEx(client, "/vol/storage_test", FSA_UNMOUNT_FLAG_BIND_MOUNT), FS_ERROR_NOT_FOUND);
+    FSADelClient(client);
+    Mocha_DeInitLibrary();
+}
+
+static void TestIOSUMochaCommands() {
+    StubIosu_Reset();
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    uint32_t version = 0;
+    CHECK_EQ(Mocha_CheckAPIVersion(&version), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(version, 3u);
+    char path[0x100];
+    CHECK_EQ(Mocha_GetEnvironmentPath(path, sizeof(path)), MOCHA_RESULT_SUCCESS);
+    CHECK(strcmp(path, "fs:/vol/external01/wiiu/environments/stub") == 0);
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_START_MCP_THREAD), 1u);
+    Mocha_DeInitLibrary();
+}
+
+static void TestIOSUBatchFailureIsNotResent() {
+    StubIosu_Reset();
+    StubIosu_SetBatchSupported(true);
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    uint32_t capabilities = 0;
+    CHECK_EQ(Mocha_GetCapabilities(&capabilities), MOCHA_RESULT_SUCCESS);
+    CHECK(capabilities & MOCHA_CAPABILITY_BATCH);
+
+    // The batch is executed, but the request reports an error. Its commands must not run a second time.
+    MochaCommandBatch batch;
+    Mocha_BatchInit(&batch);
+    CHECK_EQ(Mocha_BatchAddStartMCPThread(&batch), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_BatchAddRPXHookCompleted(&batch), MOCHA_RESULT_SUCCESS);
+    StubIosu_FailMcpIoctls(1, IOS_ERROR_UNKNOWN);
+    CHECK_EQ(Mocha_BatchSubmit(&batch), MOCHA_RESULT_UNKNOWN_ERROR);
+    CHECK_EQ(batch.commands[0].result, MOCHA_RESULT_UNKNOWN_ERROR);
+    CHECK_EQ(batch.commands[1].result, MOCHA_RESULT_UNKNOWN_ERROR);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_START_MCP_THREAD), 1u);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_MEN_RPX_HOOK_COMPLETED), 1u);
+    Mocha_DeInitLibrary();
+
+    // Without batch support the commands are sent one by one.
+    StubIosu_Reset();
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    Mocha_BatchInit(&batch);
+    CHECK_EQ(Mocha_BatchAddStartMCPThread(&batch), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_BatchAddRPXHookCompleted(&batch), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_BatchSubmit(&batch), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_START_MCP_THREAD), 1u);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_MEN_RPX_HOOK_COMPLETED), 1u);
+    Mocha_DeInitLibrary();
+}
+
+static void TestImageBackend() {
+    StubIosu_Reset();
+    char imagePath[] = "/tmp/mocha_image_XXXXXX";
+    int fd           = mkstemp(imagePath);
+    CHECK(fd >= 0);
+    uint8_t image[32 * SECTOR_SIZE];
+    FillPattern(image, sizeof(image), 5);
+    CHECK(write(fd, image, sizeof(image)) == (ssize_t) sizeof(image));
+    close(fd);
+
+    MochaImageBackendDevice devices[] = {
+            {"/dev/mlc01", imagePath, false},
+            {"/dev/slc01", imagePath, true},
+    };
+    MochaImageBackendConfig config = {};
+    config.apiVersion              = 2;
+    config.environmentPath         = "fs:/vol/external01/wiiu/environments/image";
+    config.devices                 = devices;
+    config.deviceCount             = 2;
+    CHECK_EQ(Mocha_UseImageBackend(&config), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+
+    uint32_t version = 0;
+    CHECK_EQ(Mocha_CheckAPIVersion(&version), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(version, 2u);
+
+    MochaRPXLoadInfo loadInfo = {};
+    strcpy(loadInfo.path, "wiiu/apps/test.rpx");
+    CHECK_EQ(Mocha_LoadRPXOnNextLaunch(&loadInfo), MOCHA_RESULT_SUCCESS);
+    MochaRPXLoadInfo storedLoadInfo;
+    CHECK_EQ(Mocha_ImageBackendGetRPXLoadInfo(&storedLoadInfo), MOCHA_RESULT_SUCCESS);
+    CHECK(strcmp(storedLoadInfo.path, loadInfo.path) == 0);
+
+    // The client handle is never looked at by the image backend.
+    int client = 1;
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/mlc01", &handle), FS_ERROR_OK);
+    auto *buffer = (uint8_t *) memalign(0x40, 8 * SECTOR_SIZE);
+    CHECK_EQ(FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, 8, 2, handle), FS_ERROR_OK);
+    CHECK(memcmp(buffer, image + 2 * SECTOR_SIZE, 8 * SECTOR_SIZE) == 0);
+
+    FillPattern(buffer, SECTOR_SIZE, 42);
+    CHECK_EQ(FSAEx_RawWriteEx(client, buffer, SECTOR_SIZE, 1, 30, handle), FS_ERROR_OK);
+
+    FSAExRawAsyncResult result;
+    memset(buffer, 0, SECTOR_SIZE);
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, 1, 30, handle, nullptr, nullptr), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_OK);
+    CHECK_EQ(result.result, FS_ERROR_OK);
+    uint8_t expected[SECTOR_SIZE];
+    FillPattern(expected, SECTOR_SIZE, 42);
+    CHECK(memcmp(buffer, expected, SECTOR_SIZE) == 0);
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/slc01", &handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawWriteEx(client, buffer, SECTOR_SIZE, 1, 0, handle), FS_ERROR_UNSUPPORTED_COMMAND);
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/usb01", &handle), FS_ERROR_NOT_FOUND);
+
+    // Nothing of this may have reached IOSU.
+    StubIosuStats stats;
+    StubIosu_GetStats(&stats);
+    CHECK_EQ(stats.rawOpens, 0u);
+    CHECK_EQ(StubIosu_GetMcpOpenCount(), 0u);
+
+    free(buffer);
+    Mocha_DeInitLibrary();
+    CHECK_EQ(Mocha_UseIOSUBackend(), MOCHA_RESULT_SUCCESS);
+    unlink(imagePath);
+}
+
+int main() {
+    RUN_TEST(TestIOSURawTransfers);
+    RUN_TEST(TestIOSURawReadV);
+    RUN_TEST(TestIOSUMount);
+    RUN_TEST(TestIOSUMochaCommands);
+    RUN_TEST(TestIOSUBatchFailureIsNotResent);
+    RUN_TEST(TestImageBackend);
+    return 0;
+}
@@ -0,0 +1,191 @@
+// Reads and writes that bypass the write buffer and block cache of a handle must still see and keep their data current.
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <coreinit/filesystem_fsa.h>
+#include <cstring>
+#include <malloc.h>
+#include <mocha/fsa.h>
+#include <thread>
+#include <vector>
+
+#define SECTOR_SIZE    0x200
+#define DEVICE_SECTORS 256
+#define BLOCK_SECTORS  8
+
+static void FillPattern(uint8_t *data, uint32_t size, uint32_t seed) {
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = (uint8_t) (i * 7 + seed);
+    }
+}
+
+static void TestBypassReadsSeeDirtyBlocks() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    int client   = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    FSAExRawCache *cache;
+    CHECK_EQ(FSAEx_RawCacheCreate(client, handle, SECTOR_SIZE, BLOCK_SECTORS, 4, FSAEX_RAW_CACHE_WRITE_BACK, &cache), FS_ERROR_OK);
+
+    auto *data   = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+    auto *buffer = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+
+    // Vectored read
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 1);
+    CHECK_EQ(FSAEx_RawCacheWrite(cache, data, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK(memcmp(device, data, BLOCK_SECTORS * SECTOR_SIZE) != 0);
+    FSAExRawExtent extent = {};
+    extent.data           = buffer;
+    extent.cnt            = BLOCK_SECTORS;
+    extent.blocks_offset  = 0;
+    CHECK_EQ(FSAEx_RawReadVEx(client, SECTOR_SIZE, &extent, 1, handle), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    // Async read
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 2);
+    CHECK_EQ(FSAEx_RawCacheWrite(cache, data, BLOCK_SECTORS, BLOCK_SECTORS), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawReadAsyncEx(client, buffer, SECTOR_SIZE, BLOCK_SECTORS, BLOCK_SECTORS, handle, nullptr, nullptr), FS_ERROR_OK);
+    FSAExRawAsyncResult result;
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_OK);
+    CHECK_EQ(result.result, FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    // Parallel read, the workers use handles of their own.
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 3);
+    CHECK_EQ(FSAEx_RawCacheWrite(cache, data, BLOCK_SECTORS, 2 * BLOCK_SECTORS), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawReadParallelEx(client, "/dev/sdcard01", buffer, SECTOR_SIZE, BLOCK_SECTORS, 2 * BLOCK_SECTORS, 2, 2 * SECTOR_SIZE), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    CHECK_EQ(FSAEx_RawCacheDestroy(cache), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(buffer);
+    free(data);
+    FSADelClient(client);
+}
+
+static void TestAsyncWriteInvalidatesCache() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    FSAExRawCache *cache;
+    CHECK_EQ(FSAEx_RawCacheCreate(client, handle, SECTOR_SIZE, BLOCK_SECTORS, 4, FSAEX_RAW_CACHE_WRITE_BACK, &cache), FS_ERROR_OK);
+
+    // Loads the block into the cache.
+    auto *buffer = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+    CHECK_EQ(FSAEx_RawCacheRead(cache, buffer, BLOCK_SECTORS, 0), FS_ERROR_OK);
+
+    auto *data = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 4);
+    CHECK_EQ(FSAEx_RawWriteAsyncEx(client, data, SECTOR_SIZE, BLOCK_SECTORS, 0, handle, nullptr, nullptr), FS_ERROR_OK);
+    FSAExRawAsyncResult result;
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_OK);
+    CHECK_EQ(result.result, FS_ERROR_OK);
+
+    CHECK_EQ(FSAEx_RawCacheRead(cache, buffer, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    CHECK_EQ(FSAEx_RawCacheDestroy(cache), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(data);
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestCacheAndWriteBufferShareRanges() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    int client   = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    FSAExRawCache *cache;
+    CHECK_EQ(FSAEx_RawCacheCreate(client, handle, SECTOR_SIZE, BLOCK_SECTORS, 4, FSAEX_RAW_CACHE_WRITE_BACK, &cache), FS_ERROR_OK);
+    FSAExRawWriteBuffer *writeBuffer;
+    CHECK_EQ(FSAEx_RawWriteBufferCreate(client, handle, SECTOR_SIZE, 4 * BLOCK_SECTORS * SECTOR_SIZE, &writeBuffer), FS_ERROR_OK);
+
+    auto *data   = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+    auto *buffer = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+
+    // A cache miss has to load the buffered data.
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 5);
+    CHECK_EQ(FSAEx_RawWriteBufferWrite(writeBuffer, data, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCacheRead(cache, buffer, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    // A buffered write must not be hidden by the cached block.
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 6);
+    CHECK_EQ(FSAEx_RawWriteBufferWrite(writeBuffer, data, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCacheRead(cache, buffer, BLOCK_SECTORS, 0), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    // An older buffered write must not overwrite a newer dirty block, whatever is flushed last.
+    auto *older = (uint8_t *) memalign(0x40, BLOCK_SECTORS * SECTOR_SIZE);
+    FillPattern(older, BLOCK_SECTORS * SECTOR_SIZE, 7);
+    CHECK_EQ(FSAEx_RawWriteBufferWrite(writeBuffer, older, BLOCK_SECTORS / 2, BLOCK_SECTORS), FS_ERROR_OK);
+    FillPattern(data, BLOCK_SECTORS * SECTOR_SIZE, 8);
+    CHECK_EQ(FSAEx_RawCacheWrite(cache, data, BLOCK_SECTORS, BLOCK_SECTORS), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCacheFlush(cache), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawWriteBufferFlush(writeBuffer), FS_ERROR_OK);
+    CHECK(memcmp(device + BLOCK_SECTORS * SECTOR_SIZE, data, BLOCK_SECTORS * SECTOR_SIZE) == 0);
+
+    CHECK_EQ(FSAEx_RawWriteBufferDestroy(writeBuffer), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCacheDestroy(cache), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(older);
+    free(buffer);
+    free(data);
+    FSADelClient(client);
+}
+
+static void TestSchedulerWithWriteBuffer() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    StubIosu_SetLatency(200, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    FSAExRawScheduler *scheduler;
+    CHECK_EQ(FSAEx_RawSchedulerCreate(client, handle, SECTOR_SIZE, 0, &scheduler), FS_ERROR_OK);
+    FSAExRawWriteBuffer *writeBuffer;
+    CHECK_EQ(FSAEx_RawWriteBufferCreate(client, handle, SECTOR_SIZE, 4 * SECTOR_SIZE, &writeBuffer), FS_ERROR_OK);
+
+    // Flushes of the write buffer hold the mutex of the handle, which the scheduler worker needs for its own writes.
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        uint8_t sector[SECTOR_SIZE];
+        for (uint32_t i = 0; i < DEVICE_SECTORS / 2; i++) {
+            memset(sector, (int) i, SECTOR_SIZE);
+            CHECK_EQ(FSAEx_RawWriteBufferWrite(writeBuffer, sector, 1, i), FS_ERROR_OK);
+        }
+    });
+    for (uint32_t t = 0; t < 2; t++) {
+        threads.emplace_back([&, t] {
+            auto *sector = (uint8_t *) memalign(0x40, SECTOR_SIZE);
+            for (uint32_t i = t; i < DEVICE_SECTORS / 2; i += 2) {
+                memset(sector, (int) i, SECTOR_SIZE);
+                CHECK_EQ(FSAEx_RawWriteEx(client, sector, SECTOR_SIZE, 1, DEVICE_SECTORS / 2 + i, handle), FS_ERROR_OK);
+            }
+            free(sector);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    for (uint32_t i = 0; i < DEVICE_SECTORS; i++) {
+        CHECK_EQ(device[i * SECTOR_SIZE], (uint8_t) (i % (DEVICE_SECTORS / 2)));
+    }
+    CHECK_EQ(FSAEx_RawWriteBufferDestroy(writeBuffer), FS_ERROR_OK);
+    FSAEx_RawSchedulerDestroy(scheduler);
+    FSADelClient(client);
+}
+
+int main() {
+    RUN_TEST(TestBypassReadsSeeDirtyBlocks);
+    RUN_TEST(TestAsyncWriteInvalidatesCache);
+    RUN_TEST(TestCacheAndWriteBufferShareRanges);
+    RUN_TEST(TestSchedulerWithWriteBuffer);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// The tests are plain executables, the first failed check ends the test with a non zero exit code.
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                                               \
+    do {                                                                                                                             \
+        auto _a = (a);                                                                                                               \
+        auto _b = (b);                                                                                                               \
+        if (!(_a == _b)) {                                                                                                           \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, (long long) _a, (long long) _b); \
+            exit(1);                                                                                                                 \
+        }                                                                                                                            \
+    } while (0)
+
+#define RUN_TEST(fn)                          \
+    do {                                      \
+        fprintf(stderr, "[ RUN  ] %s\n", #fn); \
+        fn();                                 \
+        fprintf(stderr, "[  OK  ] %s\n", #fn); \
+    } while (0)
@@ -0,0 +1,77 @@
+// The custom mocha commands share one /dev/mcp handle between Mocha_InitLibrary and Mocha_DeInitLibrary.
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <cstring>
+#include <mocha/commands.h>
+#include <mocha/mocha.h>
+
+static void TestCommandsShareHandle() {
+    StubIosu_Reset();
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+    uint32_t opens  = StubIosu_GetMcpOpenCount();
+    uint32_t ioctls = StubIosu_GetMcpIoctlCount();
+
+    // One ioctl per command and no further IOS_Open.
+    char path[0x100];
+    CHECK_EQ(Mocha_GetEnvironmentPath(path, sizeof(path)), MOCHA_RESULT_SUCCESS);
+    CHECK(strcmp(path, "fs:/vol/external01/wiiu/environments/stub") == 0);
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_RPXHookCompleted(), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(Mocha_StartUSBLogging(false), MOCHA_RESULT_SUCCESS);
+    MochaRPXLoadInfo loadInfo = {};
+    strcpy(loadInfo.path, "wiiu/apps/test.rpx");
+    CHECK_EQ(Mocha_LoadRPXOnNextLaunch(&loadInfo), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpOpenCount(), opens);
+    CHECK_EQ(StubIosu_GetMcpIoctlCount(), ioctls + 5);
+
+    // The environment path is only queried once.
+    CHECK_EQ(Mocha_GetEnvironmentPath(path, sizeof(path)), MOCHA_RESULT_SUCCESS);
+    CHECK(strcmp(path, "fs:/vol/external01/wiiu/environments/stub") == 0);
+    CHECK_EQ(StubIosu_GetMcpIoctlCount(), ioctls + 5);
+
+    // So does the version check.
+    uint32_t version = 0;
+    CHECK_EQ(Mocha_CheckAPIVersion(&version), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(version, 3u);
+    CHECK_EQ(StubIosu_GetMcpOpenCount(), opens);
+    CHECK_EQ(StubIosu_GetMcpIoctlCount(), ioctls + 6);
+    Mocha_DeInitLibrary();
+
+    // Without the library only the version check works, with a handle of its own.
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_LIB_UNINITIALIZED);
+    CHECK_EQ(Mocha_CheckAPIVersion(&version), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpOpenCount(), opens + 1);
+}
+
+static void TestStaleHandle() {
+    StubIosu_Reset();
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_SUCCESS);
+
+    // Whether a command on a stale handle was executed is unknown, only queries are sent again.
+    StubIosu_InvalidateMcpHandles();
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_UNKNOWN_ERROR);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_START_MCP_THREAD), 0u);
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_START_MCP_THREAD), 1u);
+
+    StubIosu_InvalidateMcpHandles();
+    char path[0x100];
+    CHECK_EQ(Mocha_GetEnvironmentPath(path, sizeof(path)), MOCHA_RESULT_SUCCESS);
+    CHECK_EQ(StubIosu_GetMcpCommandCount(IPC_CUSTOM_COPY_ENVIRONMENT_PATH), 1u);
+    Mocha_DeInitLibrary();
+}
+
+static void TestUnpatchedIOSU() {
+    StubIosu_Reset();
+    // An unpatched IOSU rejects the custom commands, the library stays uninitialized.
+    StubIosu_SetMochaApiVersion(0);
+    CHECK_EQ(Mocha_InitLibrary(), MOCHA_RESULT_UNSUPPORTED_COMMAND);
+    CHECK_EQ(Mocha_StartMCPThread(), MOCHA_RESULT_LIB_UNINITIALIZED);
+}
+
+int main() {
+    RUN_TEST(TestCommandsShareHandle);
+    RUN_TEST(TestStaleHandle);
+    RUN_TEST(TestUnpatchedIOSU);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// The read-ahead window of a handle must never outlive the handle or hide newer data.
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <coreinit/filesystem_fsa.h>
+#include <cstring>
+#include <malloc.h>
+#include <mocha/fsa.h>
+
+#define SECTOR_SIZE    0x200
+#define DEVICE_SECTORS 256
+#define READ_SECTORS   8
+
+static void TestCloseWaitsForPrefetch() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    StubIosu_SetLatency(20000, 0);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawSetReadAhead(handle, 64 * SECTOR_SIZE), FS_ERROR_OK);
+
+    // Sequential reads, the last one leaves a prefetch in flight.
+    auto *buffer = (uint8_t *) memalign(0x40, READ_SECTORS * SECTOR_SIZE);
+    for (uint32_t i = 0; i < 2; i++) {
+        CHECK_EQ(FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, READ_SECTORS, i * READ_SECTORS, handle), FS_ERROR_OK);
+    }
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+
+    StubIosuStats stats;
+    StubIosu_GetStats(&stats);
+    CHECK(stats.asyncRequests > 0);
+    CHECK_EQ(stats.closesWithTransfersInFlight, 0u);
+
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestAsyncWriteInvalidatesWindow() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawSetReadAhead(handle, 64 * SECTOR_SIZE), FS_ERROR_OK);
+
+    auto *buffer = (uint8_t *) memalign(0x40, READ_SECTORS * SECTOR_SIZE);
+    for (uint32_t i = 0; i < 3; i++) {
+        CHECK_EQ(FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, READ_SECTORS, i * READ_SECTORS, handle), FS_ERROR_OK);
+    }
+
+    // The next sequential range is prefetched by now, overwrite it behind the back of the window.
+    auto *data = (uint8_t *) memalign(0x40, READ_SECTORS * SECTOR_SIZE);
+    memset(data, 0xA5, READ_SECTORS * SECTOR_SIZE);
+    CHECK_EQ(FSAEx_RawWriteAsyncEx(client, data, SECTOR_SIZE, READ_SECTORS, 3 * READ_SECTORS, handle, nullptr, nullptr), FS_ERROR_OK);
+    FSAExRawAsyncResult result;
+    CHECK_EQ(FSAEx_RawPollCompletion(handle, &result, true), FS_ERROR_OK);
+    CHECK_EQ(result.result, FS_ERROR_OK);
+
+    CHECK_EQ(FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, READ_SECTORS, 3 * READ_SECTORS, handle), FS_ERROR_OK);
+    CHECK(memcmp(buffer, data, READ_SECTORS * SECTOR_SIZE) == 0);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    free(data);
+    free(buffer);
+    FSADelClient(client);
+}
+
+static void TestStridedReadsArePrefetched() {
+    StubIosu_Reset();
+    auto *device = StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    for (uint32_t i = 0; i < DEVICE_SECTORS * SECTOR_SIZE; i++) {
+        device[i] = (uint8_t) (i / SECTOR_SIZE);
+    }
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+    CHECK_EQ(FSAEx_RawSetReadAhead(handle, 64 * SECTOR_SIZE), FS_ERROR_OK);
+
+    // Two sectors out of every six, the skipped sectors shrink the prefetch window instead of growing it.
+    auto *buffer = (uint8_t *) memalign(0x40, 2 * SECTOR_SIZE);
+    StubIosuStats before;
+    StubIosu_GetStats(&before);
+    for (uint32_t sector = 0; sector + 2 <= DEVICE_SECTORS; sector += 6) {
+        CHECK_EQ(FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, 2, sector, handle), FS_ERROR_OK);
+        CHECK_EQ(buffer[0], (uint8_t) sector);
+        CHECK_EQ(buffer[2 * SECTOR_SIZE - 1], (uint8_t) (sector + 1));
+    }
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+
+    StubIosuStats after;
+    StubIosu_GetStats(&after);
+    CHECK(after.asyncRequests - before.asyncRequests > 0);
+    CHECK(after.bytesRead - before.bytesRead < 2 * DEVICE_SECTORS * SECTOR_SIZE);
+
+    free(buffer);
+    FSADelClient(client);
+}
+
+int main() {
+    RUN_TEST(TestCloseWaitsForPrefetch);
+    RUN_TEST(TestAsyncWriteInvalidatesWindow);
+    RUN_TEST(TestStridedReadsArePrefetched);
+    return 0;
+}
@@ -0,0 +1,102 @@
+// The FSAShimBuffer pool must serve every request of a steady workload without allocating.
+#include "shim_pool.h"
+#include "stub_alloc.h"
+#include "stub_iosu.h"
+#include "test_common.h"
+#include <atomic>
+#include <coreinit/filesystem_fsa.h>
+#include <malloc.h>
+#include <mocha/fsa.h>
+#include <mocha/mocha.h>
+#include <thread>
+#include <vector>
+
+#define SECTOR_SIZE    0x200
+#define DEVICE_SECTORS 256
+#define THREAD_COUNT   4
+#define OPS_PER_THREAD 500
+#define SECTORS_PER_OP 8
+
+static void RunWorkload(int client, int32_t handle, uint32_t threadCount) {
+    std::atomic<uint32_t> failures{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t] {
+            auto *buffer = (uint8_t *) memalign(0x40, SECTORS_PER_OP * SECTOR_SIZE);
+            for (uint32_t i = 0; i < OPS_PER_THREAD; i++) {
+                uint64_t offset = (t * OPS_PER_THREAD + i) * SECTORS_PER_OP % DEVICE_SECTORS;
+                FSError res     = i % 2 ? FSAEx_RawWriteEx(client, buffer, SECTOR_SIZE, SECTORS_PER_OP, offset, handle)
+                                        : FSAEx_RawReadEx(client, buffer, SECTOR_SIZE, SECTORS_PER_OP, offset, handle);
+                if (res != FS_ERROR_OK) {
+                    failures++;
+                }
+            }
+            free(buffer);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(failures.load(), 0u);
+}
+
+static void TestSteadyStateHasNoMisses() {
+    StubIosu_Reset();
+    StubIosu_AddDevice("/dev/sdcard01", DEVICE_SECTORS * SECTOR_SIZE);
+    int client = FSAAddClient(nullptr);
+    int32_t handle;
+    CHECK_EQ(FSAEx_RawOpenEx(client, (char *) "/dev/sdcard01", &handle), FS_ERROR_OK);
+
+    // Warm up: one buffer per thread that can be in flight at the same time.
+    FSAShimBuffer *warm[THREAD_COUNT];
+    for (auto &shim : warm) {
+        shim = ShimPool_Acquire();
+        CHECK(shim != nullptr);
+    }
+    for (auto &shim : warm) {
+        ShimPool_Release(shim);
+    }
+
+    FSAEx_ResetShimPoolStats();
+    uint64_t memalignBefore = StubAlloc_GetMemalignCount();
+    // Single threaded, then with as many threads as buffers were warmed up.
+    RunWorkload(client, handle, 1);
+    RunWorkload(client, handle, THREAD_COUNT);
+    // The workload allocates one data buffer per thread itself.
+    uint64_t memalignCalls = StubAlloc_GetMemalignCount() - memalignBefore - (1 + THREAD_COUNT);
+
+    FSAExShimPoolStats stats;
+    FSAEx_GetShimPoolStats(&stats);
+    fprintf(stderr, "shim pool: %u hits, %u misses, %llu library memalign calls\n", stats.hits, stats.misses, (unsigned long long) memalignCalls);
+    CHECK_EQ(stats.misses, 0u);
+    CHECK_EQ(stats.hits, (uint32_t) (1 + THREAD_COUNT) * OPS_PER_THREAD);
+    CHECK_EQ(memalignCalls, 0u);
+
+    CHECK_EQ(FSAEx_RawCloseEx(client, handle), FS_ERROR_OK);
+    FSADelClient(client);
+}
+
+static void TestMissesAreCounted() {
+    FSAEx_ResetShimPoolStats();
+    uint64_t memalignBefore = StubAlloc_GetMemalignCount();
+    // More buffers than the pool holds, the ones that don't fit are freed again.
+    std::vector<FSAShimBuffer *> shims;
+    for (uint32_t i = 0; i < 32; i++) {
+        shims.push_back(ShimPool_Acquire());
+    }
+    for (auto *shim : shims) {
+        CHECK(((uintptr_t) shim & 0x3F) == 0);
+        ShimPool_Release(shim);
+    }
+    FSAExShimPoolStats stats;
+    FSAEx_GetShimPoolStats(&stats);
+    CHECK_EQ(stats.hits + stats.misses, 32u);
+    CHECK(stats.misses > 0);
+    CHECK_EQ(StubAlloc_GetMemalignCount() - memalignBefore, (uint64_t) stats.misses);
+}
+
+int main() {
+    RUN_TEST(TestSteadyStateHasNoMisses);
+    RUN_TEST(TestMissesAreCounted);
+    return 0;
+}